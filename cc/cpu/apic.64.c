@@ -28,6 +28,7 @@ uint8_t ioapic_count = 0;
 uint64_t lapic_addr = 0;
 int8_t apic_enabled = 0;
 uint32_t lapic_initial_timer_count = 0;
+uint32_t apic_timer_ap_mode = APIC_TIMER_PERIODIC; ///< timer mode of aps, one shot or tsc deadline after timer init
 uint64_t apic_ap_count = 0;
 boolean_t apic_x2apic = false;
 
@@ -322,6 +323,32 @@ int8_t apic_init_timer(void) {
 
     PRINTLOG(APIC, LOG_INFO, "delta is 0x%016llx", delta);
 
+    cpu_cpuid_regs_t query = {.eax = 0x1};
+    cpu_cpuid_regs_t answer = {0};
+
+    cpu_cpuid(query, &answer);
+
+    boolean_t tsc_deadline = (answer.ecx & (1 << 24)) != 0;
+
+    // tsc deadline needs invariant rate of rdtsc delta measured above, otherwise initial count is used
+    query.eax = 0x80000000;
+    answer = (cpu_cpuid_regs_t){0};
+    cpu_cpuid(query, &answer);
+
+    boolean_t tsc_invariant = false;
+
+    if(answer.eax >= 0x80000007) {
+        query.eax = 0x80000007;
+        answer = (cpu_cpuid_regs_t){0};
+        cpu_cpuid(query, &answer);
+
+        tsc_invariant = (answer.edx & (1 << 8)) != 0;
+    }
+
+    apic_timer_ap_mode = (tsc_deadline && tsc_invariant) ? APIC_TIMER_TSC_DEADLINE : APIC_TIMER_ONESHOT;
+
+    PRINTLOG(APIC, LOG_INFO, "aps use %s timer", apic_timer_ap_mode == APIC_TIMER_TSC_DEADLINE ? "tsc deadline" : "one shot");
+
 
     return 0;
 }
@@ -344,13 +371,46 @@ uint8_t apic_configure_lapic(void) {
     apic_write_lvt_lint1(APIC_ICR_DELIVERY_MODE_NMI);
 
     apic_write_timer_divide_configuration(0x3);
-    apic_write_timer_initial_value(lapic_initial_timer_count);
 
-    apic_write_timer_lvt(APIC_TIMER_PERIODIC | APIC_INTERRUPT_ENABLED | 0x20);
+    if(apic_timer_ap_mode == APIC_TIMER_PERIODIC) {
+        apic_write_timer_initial_value(lapic_initial_timer_count);
+    }
+
+    apic_write_timer_lvt(apic_timer_ap_mode | APIC_INTERRUPT_ENABLED | 0x20);
+
+    // first tick, then each interrupt arms the next event
+    apic_timer_arm(1);
 
     return 0;
 }
 
+boolean_t apic_timer_is_tickless(void) {
+    return apic_timer_ap_mode != APIC_TIMER_PERIODIC && apic_get_local_apic_id() != 0;
+}
+
+void apic_timer_arm(uint64_t ticks) {
+    if(!apic_timer_is_tickless()) {
+        return;
+    }
+
+    if(apic_timer_ap_mode == APIC_TIMER_TSC_DEADLINE) {
+        // lvt write should be visible before deadline msr write
+        asm volatile ("mfence" ::: "memory");
+
+        cpu_write_msr(APIC_MSR_TSC_DEADLINE, ticks ? rdtsc() + ticks * time_timer_rdtsc_delta : 0);
+
+        return;
+    }
+
+    uint64_t count = ticks * lapic_initial_timer_count;
+
+    if(count > 0xFFFFFFFF) {
+        count = 0xFFFFFFFF;
+    }
+
+    apic_write_timer_initial_value(count);
+}
+
 boolean_t apic_is_waiting_timer(void) {
     if(apic_enabled) {
         uint32_t current_lvt = apic_read_timer_lvt();
@@ -462,6 +462,15 @@ int8_t interrupt_int0D_general_protection_exception(interrupt_frame_ext_t* frame
 }
 
 int8_t interrupt_int0E_page_fault_exception(interrupt_frame_ext_t* frame){
+    uint64_t cr2 = cpu_read_cr2();
+
+    interrupt_errorcode_pagefault_t epf = { .bits = (uint32_t)frame->error_code };
+
+    // demand paged ranges get their frames at first access
+    if(!epf.fields.present && memory_paging_demand_handle_fault(cr2) == 0) {
+        return 0;
+    }
+
     // KERNEL_PANIC_DISABLE_LOCKS = true;
 
     uint32_t apic_id = apic_get_local_apic_id();
@@ -477,10 +486,6 @@ int8_t interrupt_int0E_page_fault_exception(interrupt_frame_ext_t* frame){
     PRINTLOG(KERNEL, LOG_FATAL, "page fault occured at 0x%x:0x%llx %s task 0x%llx", frame->return_cs, frame->return_rip, return_symbol_name, tid);
     PRINTLOG(KERNEL, LOG_FATAL, "return stack at 0x%x:0x%llx frm ptr 0x%p", frame->return_ss, frame->return_rsp, frame);
 
-    uint64_t cr2 = cpu_read_cr2();
-
-    interrupt_errorcode_pagefault_t epf = { .bits = (uint32_t)frame->error_code };
-
     PRINTLOG(KERNEL, LOG_FATAL, "page 0x%016llx P? %i W? %i U? %i I? %i", cr2, epf.fields.present, epf.fields.write, epf.fields.user, epf.fields.instruction_fetch);
 
     PRINTLOG(KERNEL, LOG_FATAL, "Cpu is halting.");
@@ -285,6 +285,10 @@ int32_t smp_ap_boot(uint8_t cpu_id) {
         cpu_hlt();
     }
 
+    if(memory_paging_tlb_ap_init() != 0) {
+        PRINTLOG(APIC, LOG_ERROR, "SMP: AP %i cannot join tlb shootdowns", cpu_id);
+    }
+
     PRINTLOG(APIC, LOG_INFO, "SMP: AP %i init done", cpu_id);
 
     cpu_sti();
@@ -15,14 +15,29 @@
 
 MODULE("turnstone.kernel.cpu.sync");
 
+/*! spin count of a lock waiter before it yields */
+#define SYNC_SPIN_COUNT    128
+/*! writer bit of reader writer lock state, other bits count readers */
+#define SYNC_RWLOCK_WRITER (1ULL << 63)
+
 typedef struct lock_t {
     memory_heap_t*    heap;
-    volatile uint64_t lock_value;
+    volatile uint32_t lock_value; ///< 1 while lock is held, future waiters sleep on it
     uint64_t          owner_task_id;
     uint64_t          owner_cpu_id;
     boolean_t         for_future;
+    boolean_t         interrupt_safe; ///< holder disables interrupts and waiters never yield
+    boolean_t         interrupts_enabled; ///< interrupt flag of holder of interrupt safe lock before acquiring
 }lock_t;
 
+_Static_assert(sizeof(lock_t) == SYNC_LOCK_SIZE, "lock_t size should be SYNC_LOCK_SIZE, heaps embed it");
+
+typedef struct rwlock_t {
+    memory_heap_t*    heap;
+    volatile uint64_t state; ///< writer bit and reader count
+    boolean_t         interrupts_enabled; ///< interrupt flag of writer before acquiring
+} rwlock_t;
+
 void video_text_print(const char* str);
 
 boolean_t KERNEL_PANIC_DISABLE_LOCKS = false;
@@ -79,6 +94,14 @@ lock_t* lock_create_with_heap_for_future(memory_heap_t* heap, boolean_t for_futu
     return lock;
 }
 
+void lock_set_interrupt_safe(lock_t* lock) {
+    if(lock == NULL || lock->for_future) {
+        return;
+    }
+
+    lock->interrupt_safe = true;
+}
+
 int8_t lock_destroy(lock_t* lock){
     if(lock == NULL) {
         return -1;
@@ -109,58 +132,434 @@ void lock_acquire(lock_t* lock) {
     }
 
 
+    boolean_t interrupts_enabled = false;
+
+    // holder cannot be interrupted at its cpu, so an interrupt handler never waits a holder which it preempted
+    if(lock->interrupt_safe) {
+        interrupts_enabled = cpu_cli();
+    }
+
     if(lock->lock_value && !lock->for_future && lock->owner_cpu_id == current_cpu_id && lock->owner_task_id == current_task_id) {
         return;
     }
 
-    while(bit_locked_set(&lock->lock_value, 0)) {
-#if 0
-        if(!lock->for_future) {
-            // lock_task_yield();
-            cpu_sti();
-            asm volatile ("pause" ::: "memory");
-        } else {
-            if(lock->owner_task_id == 0) { // when it is gpu sets future's owner task id 0
-                lock_task_yield();
-            } else {
-                cpu_sti();
-                asm volatile ("pause" ::: "memory");
-            }
+    uint64_t spin_count = 0;
+
+    // waiter tests before exchange, so lock line is not written while it is held
+    while(__atomic_load_n(&lock->lock_value, __ATOMIC_RELAXED) || __atomic_exchange_n(&lock->lock_value, 1, __ATOMIC_ACQUIRE)) {
+        // future completes after an io, so waiter sleeps until release wakes it
+        if(lock->for_future) {
+            futex_wait(&lock->lock_value, 1);
+
+            continue;
         }
-#else
+
         asm volatile ("pause" ::: "memory");
 
-        lock_task_yield();
-#endif
-    }
+        // holder may be descheduled, a waiter yields instead of spinning its slice away
+        // holder of an interrupt safe lock runs at another cpu and waiter may be an interrupt handler
+        if(++spin_count == SYNC_SPIN_COUNT) {
+            spin_count = 0;
 
-    asm volatile ("pause" ::: "memory");
+            if(!lock->interrupt_safe) {
+                lock_task_yield();
+            }
+        }
+    }
 
     if(!lock->for_future) {
         lock->owner_task_id = current_task_id;
     }
 
     lock->owner_cpu_id = current_cpu_id;
+    lock->interrupts_enabled = interrupts_enabled;
 }
 
 void lock_release(lock_t* lock) {
     if(lock) {
-        if(lock->for_future) {
-            // future_task_wait_toggler(lock->owner_task_id);
-        }
+        // waiter of future may destroy lock just after release, so lock is not read after it
+        boolean_t for_future = lock->for_future;
+        boolean_t interrupts_enabled = lock->interrupt_safe && lock->interrupts_enabled;
 
         lock->owner_task_id = 0;
         lock->owner_cpu_id = 0;
-        lock->lock_value = 0;
+        lock->interrupts_enabled = false;
+
+        __atomic_store_n(&lock->lock_value, 0, __ATOMIC_RELEASE);
+
+        if(for_future) {
+            futex_wake(&lock->lock_value, FUTEX_WAKE_ALL);
+        }
+
+        if(interrupts_enabled) {
+            cpu_sti();
+        }
+    }
+}
+
+void spinlock_acquire(spinlock_t* lock) {
+    boolean_t interrupts_enabled = cpu_cli();
+
+    uint32_t ticket = __atomic_fetch_add(&lock->next_ticket, 1, __ATOMIC_RELAXED);
+
+    while(true) {
+        uint32_t owner = __atomic_load_n(&lock->owner_ticket, __ATOMIC_ACQUIRE);
+
+        if(owner == ticket) {
+            break;
+        }
+
+        // back off proportional to queue position, so owner line is read less
+        for(uint32_t i = 0; i < ticket - owner; i++) {
+            asm volatile ("pause" ::: "memory");
+        }
+    }
+
+    lock->interrupts_enabled = interrupts_enabled;
+}
+
+void spinlock_release(spinlock_t* lock) {
+    boolean_t interrupts_enabled = lock->interrupts_enabled;
+
+    __atomic_store_n(&lock->owner_ticket, lock->owner_ticket + 1, __ATOMIC_RELEASE);
+
+    if(interrupts_enabled) {
+        cpu_sti();
+    }
+}
+
+rwlock_t* rwlock_create_with_heap(memory_heap_t* heap) {
+    heap = memory_get_heap(heap);
+    rwlock_t* lock = memory_malloc_ext(heap, sizeof(rwlock_t), 0x0);
+
+    if(lock == NULL) {
+        return NULL;
+    }
+
+    lock->heap = heap;
+
+    return lock;
+}
+
+int8_t rwlock_destroy(rwlock_t* lock) {
+    if(lock == NULL) {
+        return -1;
+    }
+
+    return memory_free_ext(lock->heap, lock);
+}
+
+void rwlock_read_acquire(rwlock_t* lock) {
+    if(lock == NULL || KERNEL_PANIC_DISABLE_LOCKS) {
+        return;
+    }
+
+    uint64_t state = __atomic_load_n(&lock->state, __ATOMIC_RELAXED);
+
+    // writer holds lock with interrupts disabled and never sleeps, so waiting it is short even at interrupt handlers
+    while(true) {
+        if(state & SYNC_RWLOCK_WRITER) {
+            asm volatile ("pause" ::: "memory");
+
+            state = __atomic_load_n(&lock->state, __ATOMIC_RELAXED);
+
+            continue;
+        }
+
+        if(__atomic_compare_exchange_n(&lock->state, &state, state + 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+}
+
+void rwlock_read_release(rwlock_t* lock) {
+    if(lock == NULL || KERNEL_PANIC_DISABLE_LOCKS) {
+        return;
+    }
+
+    __atomic_sub_fetch(&lock->state, 1, __ATOMIC_RELEASE);
+}
+
+void rwlock_write_acquire(rwlock_t* lock) {
+    if(lock == NULL || KERNEL_PANIC_DISABLE_LOCKS) {
+        return;
+    }
+
+    uint64_t spin_count = 0;
+
+    while(true) {
+        boolean_t interrupts_enabled = cpu_cli();
+        uint64_t free_state = 0;
+
+        if(__atomic_compare_exchange_n(&lock->state, &free_state, SYNC_RWLOCK_WRITER, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            lock->interrupts_enabled = interrupts_enabled;
+
+            return;
+        }
+
+        // readers may be preempted, so writer waits with interrupts enabled and yields to them
+        if(interrupts_enabled) {
+            cpu_sti();
+        }
+
         asm volatile ("pause" ::: "memory");
+
+        if(++spin_count == SYNC_SPIN_COUNT) {
+            spin_count = 0;
+            lock_task_yield();
+        }
     }
 }
 
+void rwlock_write_release(rwlock_t* lock) {
+    if(lock == NULL || KERNEL_PANIC_DISABLE_LOCKS) {
+        return;
+    }
+
+    boolean_t interrupts_enabled = lock->interrupts_enabled;
+
+    __atomic_store_n(&lock->state, 0, __ATOMIC_RELEASE);
+
+    if(interrupts_enabled) {
+        cpu_sti();
+    }
+}
+
+/*! futex bucket count, waiters are hashed by address */
+#define SYNC_FUTEX_BUCKET_COUNT 64
+
+/**
+ * @struct futex_bucket_t
+ * @brief waiters of futex addresses hashed to same bucket
+ */
+typedef struct futex_bucket_t {
+    spinlock_t lock; ///< bucket lock
+    task_t*    head; ///< first waiter
+    task_t*    tail; ///< last waiter, wakes are at wait order
+} futex_bucket_t; ///< short hand for struct
+
+/*! futex buckets, zero filled buckets are empty */
+static futex_bucket_t futex_buckets[SYNC_FUTEX_BUCKET_COUNT];
+
+/**
+ * @brief finds bucket of address
+ * @param[in] address futex address
+ * @return bucket
+ */
+static inline futex_bucket_t* futex_get_bucket(volatile uint32_t* address) {
+    uint64_t key = (uint64_t)address;
+
+    // addresses are at least 4 bytes aligned, fold upper bits into index
+    key = (key >> 2) ^ (key >> 12);
+
+    return &futex_buckets[key % SYNC_FUTEX_BUCKET_COUNT];
+}
+
+/**
+ * @brief unlinks task from its bucket, bucket should be locked
+ * @param[in] bucket bucket of task
+ * @param[in] task waiter
+ */
+static void futex_unlink(futex_bucket_t* bucket, task_t* task) {
+    if(task->futex_prev) {
+        task->futex_prev->futex_next = task->futex_next;
+    } else {
+        bucket->head = task->futex_next;
+    }
+
+    if(task->futex_next) {
+        task->futex_next->futex_prev = task->futex_prev;
+    } else {
+        bucket->tail = task->futex_prev;
+    }
+
+    task->futex_next = NULL;
+    task->futex_prev = NULL;
+    task->futex_address = NULL;
+}
+
+int8_t futex_wait(volatile uint32_t* address, uint32_t expected) {
+    if(address == NULL) {
+        return -1;
+    }
+
+    task_t* task = lock_get_current_task();
+
+    if(task == NULL) {
+        while(__atomic_load_n(address, __ATOMIC_ACQUIRE) == expected) {
+            asm volatile ("pause" ::: "memory");
+        }
+
+        return 0;
+    }
+
+    futex_bucket_t* bucket = futex_get_bucket(address);
+
+    spinlock_acquire(&bucket->lock);
+
+    // waker changes value before it takes bucket lock, so checking under lock cannot miss it
+    if(__atomic_load_n(address, __ATOMIC_ACQUIRE) != expected) {
+        spinlock_release(&bucket->lock);
+
+        return -1;
+    }
+
+    task->futex_address = address;
+    task->futex_next = NULL;
+    task->futex_prev = bucket->tail;
+
+    if(bucket->tail) {
+        bucket->tail->futex_next = task;
+    } else {
+        bucket->head = task;
+    }
+
+    bucket->tail = task;
+
+    __atomic_store_n(&task->state, TASK_STATE_FUTURE_WAITING, __ATOMIC_SEQ_CST);
+
+    spinlock_release(&bucket->lock);
+
+    // scheduler parks task, a wake before park makes task ready again
+    lock_task_yield();
+
+    spinlock_acquire(&bucket->lock);
+
+    // task is woken by another event or tasking is not started at this cpu
+    if(task->futex_address == address) {
+        futex_unlink(bucket, task);
+
+        task_state_t state = TASK_STATE_FUTURE_WAITING;
+        __atomic_compare_exchange_n(&task->state, &state, TASK_STATE_RUNNING, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    }
+
+    spinlock_release(&bucket->lock);
+
+    return 0;
+}
+
+uint64_t futex_wake(volatile uint32_t* address, uint64_t count) {
+    if(address == NULL || count == 0) {
+        return 0;
+    }
+
+    futex_bucket_t* bucket = futex_get_bucket(address);
+    uint64_t woken = 0;
+
+    spinlock_acquire(&bucket->lock);
+
+    task_t* task = bucket->head;
+
+    while(task && woken < count) {
+        task_t* next = task->futex_next;
+
+        if(task->futex_address == address) {
+            futex_unlink(bucket, task);
+            task_wake_task(task, TASK_STATE_SUSPENDED);
+            woken++;
+        }
+
+        task = next;
+    }
+
+    spinlock_release(&bucket->lock);
+
+    return woken;
+}
+
+void futex_remove_task(task_t* task) {
+    if(task == NULL) {
+        return;
+    }
+
+    volatile uint32_t* address = task->futex_address;
+
+    if(address == NULL) {
+        return;
+    }
+
+    futex_bucket_t* bucket = futex_get_bucket(address);
+
+    spinlock_acquire(&bucket->lock);
+
+    if(task->futex_address == address) {
+        futex_unlink(bucket, task);
+    }
+
+    spinlock_release(&bucket->lock);
+}
+
+typedef struct condvar_t {
+    memory_heap_t*    heap;
+    volatile uint32_t sequence; ///< changed by each signal, waiters sleep on it
+} condvar_t;
+
+condvar_t* condvar_create_with_heap(memory_heap_t* heap) {
+    heap = memory_get_heap(heap);
+    condvar_t* condvar = memory_malloc_ext(heap, sizeof(condvar_t), 0x0);
+
+    if(condvar == NULL) {
+        return NULL;
+    }
+
+    condvar->heap = heap;
+
+    return condvar;
+}
+
+int8_t condvar_destroy(condvar_t* condvar) {
+    if(condvar == NULL) {
+        return -1;
+    }
+
+    return memory_free_ext(condvar->heap, condvar);
+}
+
+int8_t condvar_wait(condvar_t* condvar, lock_t* lock) {
+    if(condvar == NULL || lock == NULL) {
+        return -1;
+    }
+
+    // sequence is read before releasing lock, a signal after release changes it and futex does not sleep
+    uint32_t sequence = __atomic_load_n(&condvar->sequence, __ATOMIC_ACQUIRE);
+
+    lock_release(lock);
+
+    futex_wait(&condvar->sequence, sequence);
+
+    lock_acquire(lock);
+
+    return 0;
+}
+
+int8_t condvar_signal(condvar_t* condvar) {
+    if(condvar == NULL) {
+        return -1;
+    }
+
+    __atomic_add_fetch(&condvar->sequence, 1, __ATOMIC_RELEASE);
+    futex_wake(&condvar->sequence, 1);
+
+    return 0;
+}
+
+int8_t condvar_broadcast(condvar_t* condvar) {
+    if(condvar == NULL) {
+        return -1;
+    }
+
+    __atomic_add_fetch(&condvar->sequence, 1, __ATOMIC_RELEASE);
+    futex_wake(&condvar->sequence, FUTEX_WAKE_ALL);
+
+    return 0;
+}
+
 typedef struct semaphore_t {
-    memory_heap_t* heap;
-    lock_t*        lock;
-    uint64_t       initial_count;
-    uint64_t       current_count;
+    memory_heap_t*    heap;
+    lock_t*           lock;
+    uint64_t          initial_count;
+    uint64_t          current_count;
+    volatile uint32_t sequence; ///< changed by each release, waiters sleep on it
 }semaphore_t;
 
 semaphore_t* semaphore_create_with_heap(memory_heap_t* heap, uint64_t count){
@@ -189,11 +588,7 @@ int8_t semaphore_acquire_with_count(semaphore_t* semaphore, uint64_t count){
         return -1;
     }
 
-    lock_acquire(semaphore->lock);
-
     if(semaphore->initial_count < count) {
-        lock_release(semaphore->lock);
-
         return -1;
     }
 
@@ -207,8 +602,12 @@ int8_t semaphore_acquire_with_count(semaphore_t* semaphore, uint64_t count){
             return 0;
         }
 
+        uint32_t sequence = __atomic_load_n(&semaphore->sequence, __ATOMIC_ACQUIRE);
+
         lock_release(semaphore->lock);
-        lock_task_yielder();
+
+        // sleeps until a release, a release after unlock changes sequence and futex does not sleep
+        futex_wait(&semaphore->sequence, sequence);
     }
 
     return 0;
@@ -228,8 +627,12 @@ int8_t semaphore_release_with_count(semaphore_t* semaphore, uint64_t count){
     }
 
     semaphore->current_count += count;
+    __atomic_add_fetch(&semaphore->sequence, 1, __ATOMIC_RELEASE);
 
     lock_release(semaphore->lock);
 
+    // waiters want different counts, all of them check again
+    futex_wake(&semaphore->sequence, FUTEX_WAKE_ALL);
+
     return 0;
 }
@@ -9,6 +9,7 @@
 #include <apic.h>
 #include <cpu.h>
 #include <cpu/syscall.h>
+#include <cpu/task.h>
 #include <cpu/smp.h>
 #include <logging.h>
 #include <memory.h>
@@ -75,12 +76,25 @@ int64_t syscall_function_hlt(uint64_t arg1, uint64_t arg2, uint64_t arg3, uint64
  */
 int64_t syscall_function_cli_and_hlt(uint64_t arg1, uint64_t arg2, uint64_t arg3, uint64_t arg4, uint64_t arg5, uint64_t arg6);
 
+/**
+ * @brief sets priority of a task system call handler.
+ * @param[in] arg1 task id, 0 for current task.
+ * @param[in] arg2 nice value between @ref TASK_NICE_MIN and @ref TASK_NICE_MAX.
+ * @param[in] arg3 Argument 3. (not used)
+ * @param[in] arg4 Argument 4. (not used)
+ * @param[in] arg5 Argument 5. (not used)
+ * @param[in] arg6 Argument 6. (not used)
+ * @return 0 on success, -1 on invalid task or nice value.
+ */
+int64_t syscall_function_set_priority(uint64_t arg1, uint64_t arg2, uint64_t arg3, uint64_t arg4, uint64_t arg5, uint64_t arg6);
+
 /**
  * @brief system call table.
  */
 const syscall_f SYSCALL_TABLE[] = {
     syscall_function_hlt,
     syscall_function_cli_and_hlt,
+    syscall_function_set_priority,
 };
 
 /*! system call table size */
@@ -242,3 +256,18 @@ int64_t syscall_function_cli_and_hlt(uint64_t arg1, uint64_t arg2, uint64_t arg3
                   "hlt\n");
     return 0;
 }
+
+int64_t syscall_function_set_priority(uint64_t arg1, uint64_t arg2, uint64_t arg3, uint64_t arg4, uint64_t arg5, uint64_t arg6) {
+    UNUSED(arg3);
+    UNUSED(arg4);
+    UNUSED(arg5);
+    UNUSED(arg6);
+
+    int64_t nice = (int64_t)arg2;
+
+    if(nice < TASK_NICE_MIN || nice > TASK_NICE_MAX) {
+        return -1;
+    }
+
+    return task_set_priority(arg1, (int8_t)nice);
+}
@@ -36,6 +36,9 @@ void video_text_print(const char_t* str);
 typedef task_t * (*memory_current_task_getter_f)(void);
 void memory_set_current_task_getter(memory_current_task_getter_f getter);
 
+typedef uint32_t (*memory_cpu_id_getter_f)(void);
+void memory_set_cpu_id_getter(memory_cpu_id_getter_f getter);
+
 typedef task_t * (*lock_current_task_getter_f)(void);
 extern lock_current_task_getter_f lock_get_current_task_getter;
 
@@ -62,14 +65,40 @@ volatile boolean_t task_tasking_initialized = false;
 memory_heap_t* task_map_heap = NULL;
 memory_heap_t** task_queue_and_cleanup_heaps = NULL;
 list_t** task_queues = NULL;
-list_t** task_sleep_queues; ///< task sleep lists
-list_t** task_wait_queues; ///< task wait lists
+/**
+ * @struct task_ready_queue_t
+ * @brief woken tasks of a cpu linked through tasks, so waking never allocates and it can be done under spin locks and at interrupt handlers
+ */
+typedef struct task_ready_queue_t {
+    spinlock_t lock; ///< queue lock
+    task_t*    head; ///< first woken task
+    task_t*    tail; ///< last woken task
+} task_ready_queue_t; ///< short hand for struct
+
+task_ready_queue_t* task_ready_queues = NULL; ///< woken tasks of cpus, popped before run queues
 list_t** task_cleanup_queues = NULL;
+volatile uint64_t* task_cpu_busy = NULL; ///< 1 if cpu runs a task other than its idle task
+volatile uint64_t* task_cpu_sleeping = NULL; ///< 1 if a tickless cpu runs its idle task, it needs a kick for new work
+volatile uint64_t* task_cpu_min_vruntimes = NULL; ///< vruntime of last task taken from run queue of cpu
 hashmap_t* task_map = NULL;
 uint32_t task_mxcsr_mask = 0;
 
 uint64_t task_max_tick_count_limit = 0;
+uint64_t task_min_granularity = 0;
+
+/*! weights of nice values from -20 to 19, a nice level changes cpu share about %10 */
+static const uint32_t task_nice_weights[TASK_NICE_MAX - TASK_NICE_MIN + 1] = {
+    88761, 71755, 56483, 46273, 36291,
+    29154, 23254, 18705, 14949, 11916,
+    9548,  7620,  6100,  4904,  3906,
+    3121,  2501,  1991,  1586,  1277,
+    1024,  820,   655,   526,   423,
+    335,   272,   215,   172,   137,
+    110,   87,    70,    56,    45,
+    36,    29,    23,    18,    15,
+};
 extern volatile uint64_t time_timer_rdtsc_delta;
+extern uint64_t memory_paging_tlb_cr3_noflush;
 
 extern int8_t kmain64(void);
 
@@ -88,19 +117,191 @@ extern volatile cpu_state_t __seg_gs * cpu_state;
 
 lock_t * task_find_next_task_lock = NULL;
 
-static int8_t task_sleep_queue_comparator(const void* item1, const void* item2) {
+static int8_t task_run_queue_comparator(const void* item1, const void* item2) {
     const task_t* t1 = (const task_t*)item1;
     const task_t* t2 = (const task_t*)item2;
 
-    if(t1->wake_tick < t2->wake_tick) {
+    if(t1->vruntime < t2->vruntime) {
+        return -1;
+    } else if(t1->vruntime > t2->vruntime) {
+        return 1;
+    }
+
+    if(t1->task_id < t2->task_id) {
         return -1;
-    } else if(t1->wake_tick > t2->wake_tick) {
+    } else if(t1->task_id > t2->task_id) {
         return 1;
     }
 
     return 0;
 }
 
+/**
+ * @brief returns weight of task's nice value
+ * @param[in] task task
+ * @return weight
+ */
+static inline uint64_t task_get_weight(const task_t* task) {
+    return task_nice_weights[task->nice - TASK_NICE_MIN];
+}
+
+/**
+ * @brief returns time slice of task, it is proportional to weight and bounded by min granularity and four default slices
+ * @param[in] task task
+ * @return slice in rdtsc ticks
+ */
+static uint64_t task_get_time_slice(const task_t* task) {
+    uint64_t slice = task_max_tick_count_limit * task_get_weight(task) / TASK_NICE_0_WEIGHT;
+
+    return MIN(MAX(slice, task_min_granularity), 4 * task_max_tick_count_limit);
+}
+
+/**
+ * @brief inserts task into run queue of cpu by vruntime, long sleepers get at most one slice of credit
+ * @param[in] cpu_id cpu id
+ * @param[in] task task
+ */
+static void task_enqueue(uint64_t cpu_id, task_t* task) {
+    uint64_t min_vruntime = task_cpu_min_vruntimes[cpu_id];
+
+    if(min_vruntime > task_max_tick_count_limit && task->vruntime < min_vruntime - task_max_tick_count_limit) {
+        task->vruntime = min_vruntime - task_max_tick_count_limit;
+    }
+
+    list_sortedlist_insert(task_queues[cpu_id], task);
+}
+
+/**
+ * @brief removes task with smallest vruntime from run queue of current cpu
+ * @return task or NULL if queue is empty
+ */
+static task_t* task_dequeue(void) {
+    task_t* task = (task_t*)list_delete_at_position(cpu_state->task_queue, 0);
+
+    if(task && task->vruntime > task_cpu_min_vruntimes[cpu_state->local_apic_id]) {
+        task_cpu_min_vruntimes[cpu_state->local_apic_id] = task->vruntime;
+    }
+
+    return task;
+}
+
+/**
+ * @brief appends task to a ready queue
+ * @param[in] queue ready queue
+ * @param[in] task woken task, it should not be at another queue
+ */
+static void task_ready_queue_push(task_ready_queue_t* queue, task_t* task) {
+    spinlock_acquire(&queue->lock);
+
+    task->ready_next = NULL;
+
+    if(queue->tail) {
+        queue->tail->ready_next = task;
+    } else {
+        queue->head = task;
+    }
+
+    queue->tail = task;
+
+    spinlock_release(&queue->lock);
+}
+
+/**
+ * @brief removes first task of a ready queue
+ * @param[in] queue ready queue
+ * @return task or NULL if queue is empty
+ */
+static task_t* task_ready_queue_pop(task_ready_queue_t* queue) {
+    if(__atomic_load_n(&queue->head, __ATOMIC_RELAXED) == NULL) {
+        return NULL;
+    }
+
+    spinlock_acquire(&queue->lock);
+
+    task_t* task = queue->head;
+
+    if(task) {
+        queue->head = task->ready_next;
+
+        if(queue->head == NULL) {
+            queue->tail = NULL;
+        }
+
+        task->ready_next = NULL;
+    }
+
+    spinlock_release(&queue->lock);
+
+    return task;
+}
+
+/**
+ * @brief pushes task to ready queue of its cpu and kicks that cpu if it is another one
+ * @param[in] task woken task
+ */
+static void task_make_ready(task_t* task) {
+    task_ready_queue_push(&task_ready_queues[task->cpu_id], task);
+
+    if(task->cpu_id != cpu_state->local_apic_id) {
+        apic_send_ipi(task->cpu_id, 0xFE, false);
+    }
+}
+
+/**
+ * @brief checks if task state needs a wake to become runnable
+ * @param[in] state task state
+ * @return true if task waits an event
+ */
+static inline boolean_t task_is_waiting(task_state_t state) {
+    return state == TASK_STATE_MESSAGE_WAITING || state == TASK_STATE_FUTURE_WAITING || state == TASK_STATE_SLEEPING;
+}
+
+/**
+ * @brief parks a switched out waiting task at no queue, waker moves it to ready queue
+ * @param[in] task waiting task
+ */
+static void task_park(task_t* task) {
+    // messages pushed before task started waiting
+    if(task->state == TASK_STATE_MESSAGE_WAITING && task->message_queues) {
+        for(uint64_t q_idx = 0; q_idx < list_size(task->message_queues); q_idx++) {
+            list_t* q = (list_t*)list_get_data_at_position(task->message_queues, q_idx);
+
+            if(list_size(q)) {
+                task_ready_queue_push(cpu_state->task_ready_queue, task);
+
+                return;
+            }
+        }
+    }
+
+    __atomic_store_n(&task->parked, true, __ATOMIC_SEQ_CST);
+
+    // a waker which changed state before parked is set did not see the task, one of us takes it back
+    if(!task_is_waiting(__atomic_load_n(&task->state, __ATOMIC_SEQ_CST)) &&
+       __atomic_exchange_n(&task->parked, false, __ATOMIC_SEQ_CST)) {
+        task_ready_queue_push(cpu_state->task_ready_queue, task);
+    }
+}
+
+void task_wake_task(task_t* task, task_state_t state) {
+    boolean_t interrupts_enabled = cpu_cli();
+
+    task_state_t old_state = __atomic_load_n(&task->state, __ATOMIC_SEQ_CST);
+
+    // a late wake does not bring an ended task back
+    while(old_state != TASK_STATE_ENDED &&
+          !__atomic_compare_exchange_n(&task->state, &old_state, state, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+    }
+
+    if(__atomic_exchange_n(&task->parked, false, __ATOMIC_SEQ_CST)) {
+        task_make_ready(task);
+    }
+
+    if(interrupts_enabled) {
+        cpu_sti();
+    }
+}
+
 task_t* task_get_current_task(void){
     if(!task_tasking_initialized) {
         return NULL;
@@ -117,6 +318,7 @@ int8_t task_init_tasking_ext(memory_heap_t* heap) {
     uint32_t apic_id = apic_get_local_apic_id();
 
     task_max_tick_count_limit = TASK_MAX_TICK_COUNT * time_timer_rdtsc_delta;
+    task_min_granularity = TASK_MIN_GRANULARITY_TICK_COUNT * time_timer_rdtsc_delta;
 
     frame_t* kernel_gs_frames = NULL;
 
@@ -199,9 +401,11 @@ int8_t task_init_tasking_ext(memory_heap_t* heap) {
 
     task_queue_and_cleanup_heaps = memory_malloc_ext(heap, sizeof(memory_heap_t*) * cpu_count, 0x0);
     task_queues = memory_malloc_ext(heap, sizeof(list_t*) * cpu_count, 0x0);
-    task_sleep_queues = memory_malloc_ext(heap, sizeof(list_t*) * cpu_count, 0x0);
-    task_wait_queues = memory_malloc_ext(heap, sizeof(list_t*) * cpu_count, 0x0);
+    task_ready_queues = memory_malloc_ext(heap, sizeof(task_ready_queue_t) * cpu_count, 0x0);
     task_cleanup_queues = memory_malloc_ext(heap, sizeof(list_t*) * cpu_count, 0x0);
+    task_cpu_busy = memory_malloc_ext(heap, sizeof(uint64_t) * cpu_count, 0x0);
+    task_cpu_sleeping = memory_malloc_ext(heap, sizeof(uint64_t) * cpu_count, 0x0);
+    task_cpu_min_vruntimes = memory_malloc_ext(heap, sizeof(uint64_t) * cpu_count, 0x0);
 
 
     for(uint32_t i = 0; i < cpu_count; i++) {
@@ -226,13 +430,21 @@ int8_t task_init_tasking_ext(memory_heap_t* heap) {
             return -1;
         }
 
+        if(memory_heap_register_range(task_related_heap, task_related_heap_va, task_related_heap_va + 0x1000 * FRAME_SIZE) != 0) {
+            PRINTLOG(TASKING, LOG_FATAL, "cannot register task related heap range");
+
+            return -1;
+        }
+
         PRINTLOG(TASKING, LOG_INFO, "cpu 0x%x task related heap 0x%p", i, task_related_heap);
 
         task_queue_and_cleanup_heaps[i] = task_related_heap;
-        task_queues[i] = list_create_queue_with_heap(task_related_heap);
-        task_sleep_queues[i] = list_create_sortedlist_with_heap(task_related_heap, &task_sleep_queue_comparator);
-        task_wait_queues[i] = list_create_queue_with_heap(task_related_heap);
+        task_queues[i] = list_create_sortedlist_with_heap(task_related_heap, &task_run_queue_comparator);
         task_cleanup_queues[i] = list_create_queue_with_heap(task_related_heap);
+
+        // queues are used by task switch and timer interrupt, their locks should not yield into scheduler
+        list_set_interrupt_safe(task_queues[i]);
+        list_set_interrupt_safe(task_cleanup_queues[i]);
     }
 
     {
@@ -257,6 +469,12 @@ int8_t task_init_tasking_ext(memory_heap_t* heap) {
             return -1;
         }
 
+        if(memory_heap_register_range(task_related_heap, task_related_heap_va, task_related_heap_va + 0x1000 * FRAME_SIZE) != 0) {
+            PRINTLOG(TASKING, LOG_FATAL, "cannot register task related heap range");
+
+            return -1;
+        }
+
         task_map_heap = task_related_heap;
 
         PRINTLOG(TASKING, LOG_INFO, "task map heap 0x%p", task_map_heap);
@@ -264,8 +482,7 @@ int8_t task_init_tasking_ext(memory_heap_t* heap) {
 
 
     current_cpu_state->task_queue = task_queues[0];
-    current_cpu_state->task_sleep_queue = task_sleep_queues[0];
-    current_cpu_state->task_wait_queue = task_wait_queues[0];
+    current_cpu_state->task_ready_queue = &task_ready_queues[0];
     current_cpu_state->task_cleanup_queue = task_cleanup_queues[0];
 
     interrupt_irq_set_handler(0xde, &task_task_switch_isr);
@@ -283,6 +500,8 @@ int8_t task_init_tasking_ext(memory_heap_t* heap) {
     kernel_task->heap_size = kernel->program_heap_size;
     kernel_task->task_id = cpu_count + 1;
     kernel_task->state = TASK_STATE_RUNNING;
+    kernel_task->attributes = TASK_ATTRIBUTE_PINNED;
+    kernel_task->on_cpu = true;
     kernel_task->entry_point = kmain64;
     kernel_task->page_table = memory_paging_get_table();
     kernel_task->registers = memory_malloc_ext(task_map_heap, sizeof(task_registers_t), 0x10);
@@ -360,6 +579,7 @@ int8_t task_init_tasking_ext(memory_heap_t* heap) {
     PRINTLOG(TASKING, LOG_INFO, "tasking system initialization ended, kernel task address 0x%p lapic id %d", kernel_task, apic_id);
 
     memory_set_current_task_getter(&task_get_current_task);
+    memory_set_cpu_id_getter(&apic_get_local_apic_id);
 
     lock_get_current_task_getter = &task_get_current_task;
     lock_task_yielder = &task_yield;
@@ -390,8 +610,7 @@ int8_t task_set_current_and_idle_task(void* entry_point, uint64_t stack_base, ui
     }
 
     cpu_state->task_queue = task_queues[apic_id];
-    cpu_state->task_sleep_queue = task_sleep_queues[apic_id];
-    cpu_state->task_wait_queue = task_wait_queues[apic_id];
+    cpu_state->task_ready_queue = &task_ready_queues[apic_id];
     cpu_state->task_cleanup_queue = task_cleanup_queues[apic_id];
 
     task_t* current_task = memory_malloc_ext(heap, sizeof(task_t), 0x0);
@@ -418,6 +637,8 @@ int8_t task_set_current_and_idle_task(void* entry_point, uint64_t stack_base, ui
     current_task->heap = heap;
     current_task->heap_size = kernel->program_heap_size;
     current_task->state = TASK_STATE_RUNNING;
+    current_task->attributes = TASK_ATTRIBUTE_PINNED;
+    current_task->on_cpu = true;
     current_task->entry_point = entry_point;
     current_task->page_table = memory_paging_get_table();
     current_task->registers = memory_malloc_ext(heap, sizeof(task_registers_t), 0x10);
@@ -486,6 +707,7 @@ __attribute__((naked, no_stack_protector)) void task_save_registers(task_registe
         "mov %%rax, %[rflags]\n"
         "popfq\n"
         "mov %%cr3, %%rax\n"
+        "or %[noflush], %%rax\n"
         "mov %%rax, %[cr3]\n"
         "pop %%rax\n"
         "mov %%rsp, %[rsp]\n"
@@ -509,7 +731,8 @@ __attribute__((naked, no_stack_protector)) void task_save_registers(task_registe
         [sse]    "m" (registers->sse),
         [rflags] "m" (registers->rflags),
         [rsp]    "m" (registers->rsp),
-        [cr3]     "m" (registers->cr3)
+        [cr3]     "m" (registers->cr3),
+        [noflush] "m" (memory_paging_tlb_cr3_noflush)
         );
 }
 
@@ -534,6 +757,7 @@ __attribute__((naked, no_stack_protector)) void task_load_registers(task_registe
         "push %%rax\n"
         "popfq\n"
         "mov %%cr3, %%rax\n"
+        "or %[noflush], %%rax\n"
         "cmp %[cr3], %%rax\n"
         "je 1f\n"
         "mov %[cr3], %%rax\n"
@@ -541,6 +765,11 @@ __attribute__((naked, no_stack_protector)) void task_load_registers(task_registe
         "1:\n"
         "mov %[rax],  %%rax\n"
         "mov %[rsp], %%rsp\n"
+        // old stack is not used anymore, previous task can be run by other cpus
+        "push %%rax\n"
+        "mov %%gs:%c[previous_task], %%rax\n"
+        "movb $0, %c[on_cpu](%%rax)\n"
+        "pop %%rax\n"
         "mov %[rdi], %%rdi\n"
         "retq\n"
         : :
@@ -562,7 +791,10 @@ __attribute__((naked, no_stack_protector)) void task_load_registers(task_registe
         [sse]     "m" (registers->sse),
         [rflags]  "m" (registers->rflags),
         [rsp]     "m" (registers->rsp),
-        [cr3]     "m" (registers->cr3)
+        [cr3]     "m" (registers->cr3),
+        [noflush] "m" (memory_paging_tlb_cr3_noflush),
+        [previous_task] "i" (offsetof_field(cpu_state_t, previous_task)),
+        [on_cpu]  "i" (offsetof_field(task_t, on_cpu))
         );
 }
 
@@ -571,6 +803,10 @@ static void task_cleanup_task(task_t* task) {
         return;
     }
 
+    // cancel returns after a sleep callback firing at another cpu, so task is not freed under it
+    time_timer_cancel(&task->sleep_timer);
+    futex_remove_task(task);
+
     if(task->vm) {
         hypervisor_vm_destroy(task->vm);
     }
@@ -580,40 +816,21 @@ static void task_cleanup_task(task_t* task) {
     hashmap_delete(task_map, (void*)task->task_id);
 
     uint64_t stack_va = (uint64_t)task->stack;
-    uint64_t stack_fa = MEMORY_PAGING_GET_FA_FOR_RESERVED_VA(stack_va);
-
-    uint64_t stack_size = task->stack_size;
-    uint64_t stack_frames_cnt = stack_size / FRAME_SIZE;
-
-    memory_memclean(task->stack, stack_size);
-
-    frame_t stack_frames = {stack_fa, stack_frames_cnt, FRAME_TYPE_USED, FRAME_ALLOCATION_TYPE_USED | FRAME_ALLOCATION_TYPE_BLOCK};
-
-    if(memory_paging_delete_va_for_frame_ext(task->page_table, stack_va, &stack_frames) != 0 ) {
-        PRINTLOG(TASKING, LOG_ERROR, "cannot remove pages for stack at va 0x%llx", stack_va);
-
-        cpu_hlt();
-    }
 
-    if(frame_get_allocator()->release_frame(frame_get_allocator(), &stack_frames) != 0) {
-        PRINTLOG(TASKING, LOG_ERROR, "cannot release stack with frames at 0x%llx with count 0x%llx", stack_fa, stack_frames_cnt);
+    if(memory_paging_demand_release(stack_va) != 0) {
+        PRINTLOG(TASKING, LOG_ERROR, "cannot release stack at va 0x%llx", stack_va);
 
         cpu_hlt();
     }
 
     if(task->heap != memory_get_default_heap() && task->heap != task_map_heap) {
         uint64_t heap_va = (uint64_t)task->heap;
-        uint64_t heap_fa = MEMORY_PAGING_GET_FA_FOR_RESERVED_VA(heap_va);
-
         uint64_t heap_size = task->heap_size;
-        uint64_t heap_frames_cnt = heap_size / FRAME_SIZE;
 
-        memory_memclean(task->heap, heap_size);
+        memory_heap_unregister_range(task->heap, heap_va, heap_va + heap_size);
 
-        frame_t heap_frames = {heap_fa, heap_frames_cnt, FRAME_TYPE_USED, FRAME_ALLOCATION_TYPE_USED | FRAME_ALLOCATION_TYPE_BLOCK};
-
-        if(memory_paging_delete_va_for_frame_ext(task->page_table, heap_va, &heap_frames) != 0 ) {
-            PRINTLOG(TASKING, LOG_ERROR, "cannot remove pages for heap at va 0x%llx", heap_va);
+        if(memory_paging_demand_release(heap_va) != 0) {
+            PRINTLOG(TASKING, LOG_ERROR, "cannot release heap at va 0x%llx", heap_va);
 
             if(task->page_table) {
                 PRINTLOG(TASKING, LOG_ERROR, "page table 0x%p", task->page_table->page_table);
@@ -621,12 +838,6 @@ static void task_cleanup_task(task_t* task) {
 
             cpu_hlt();
         }
-
-        if(frame_get_allocator()->release_frame(frame_get_allocator(), &heap_frames) != 0) {
-            PRINTLOG(TASKING, LOG_ERROR, "cannot release heap with frames at 0x%llx with count 0x%llx", stack_fa, heap_frames_cnt);
-
-            cpu_hlt();
-        }
     }
 
     memory_free_ext(task->creator_heap, task->registers);
@@ -642,61 +853,154 @@ void task_cleanup(void){
     lock_release(task_find_next_task_lock);
 }
 
-task_t* task_find_next_task(void) {
-    task_t* tmp_task = NULL;
+/**
+ * @brief returns load of cpu, waiting runnable tasks and running task except idle
+ * @param[in] cpu_id cpu id
+ * @return load
+ */
+static uint64_t task_get_cpu_load(uint64_t cpu_id) {
+    return list_size(task_queues[cpu_id]) + task_cpu_busy[cpu_id];
+}
 
-    if(list_size(cpu_state->task_sleep_queue)) {
-        task_t* t = (task_t*)list_get_data_at_position(cpu_state->task_sleep_queue, 0);
+/**
+ * @brief checks task can be moved to another cpu
+ * @param[in] task task at a run queue
+ * @return true if task is not pinned, not a vm, its stack is not used by a cpu and it has no pending tlb invalidations
+ */
+static boolean_t task_is_migratable(const task_t* task) {
+    if(task->on_cpu || task->vmcs_physical_address || (task->attributes & TASK_ATTRIBUTE_PINNED)) {
+        return false;
+    }
 
-        if(t->wake_tick < time_timer_get_tick_count()) {
-            tmp_task = (task_t*)list_delete_at_position(cpu_state->task_sleep_queue, 0);
-        }
+    // invalidations queued at its cpu's batch should be flushed by that cpu before task continues elsewhere
+    if(memory_paging_tlb_is_pending(task->cpu_id, task->tlb_generation)) {
+        return false;
     }
 
-    if(!tmp_task && list_size(cpu_state->task_wait_queue)) {
-        uint64_t found_index = -1;
-
-        for(uint64_t i = 0; i < list_size(cpu_state->task_wait_queue); i++) {
-            task_t* t = (task_t*)list_get_data_at_position(cpu_state->task_wait_queue, i);
-
-            if(t->state == TASK_STATE_FUTURE_WAITING) {
-                continue;
-            } else if(t->state == TASK_STATE_INTERRUPT_RECEIVED) {
-                found_index = i;
-                break;
-            } else if(t->state == TASK_STATE_MESSAGE_WAITING) {
-                if(t->message_queues) {
-                    for(uint64_t q_idx = 0; q_idx < list_size(t->message_queues); q_idx++) {
-                        list_t* q = (list_t*)list_get_data_at_position(t->message_queues, q_idx);
-
-                        if(list_size(q)) {
-                            found_index = i;
-                            break;
-                        }
-                    }
-                }
-
-            } else { // wait status cleared task
-                if(t->state != TASK_STATE_SUSPENDED) {
-                    video_text_print("task_find_next_task: task state is not suspended: 0x");
-                    char_t buf[16] = {0};
-                    utoh_with_buffer(buf, t->state);
-                    video_text_print(buf);
-                    video_text_print("\n");
-                }
-
-                found_index = i;
-                break;
-            }
+    return task->state == TASK_STATE_CREATED || task->state == TASK_STATE_STARTING || task->state == TASK_STATE_SUSPENDED;
+}
+
+/**
+ * @brief removes a task from tail of busiest cpu's run queue for current cpu, interrupts should be disabled
+ * @param[in] own_load load of current cpu
+ * @param[in] min_imbalance busiest cpu's load should exceed own load at least this value
+ * @return stolen task or NULL
+ */
+static task_t* task_steal_task(uint64_t own_load, uint64_t min_imbalance) {
+    uint64_t cpu_count = apic_get_ap_count() + 1;
+    uint64_t self = cpu_state->local_apic_id;
+    uint64_t busiest = self;
+    uint64_t busiest_load = 0;
+
+    for(uint64_t i = 0; i < cpu_count; i++) {
+        if(i == self || !list_size(task_queues[i])) {
+            continue;
         }
 
-        if(found_index != -1ULL) {
-            tmp_task = (task_t*)list_delete_at_position(cpu_state->task_wait_queue, found_index);
+        uint64_t load = task_get_cpu_load(i);
+
+        if(load > busiest_load) {
+            busiest_load = load;
+            busiest = i;
         }
     }
 
+    if(busiest == self || busiest_load < own_load + min_imbalance) {
+        return NULL;
+    }
+
+    // queue is sorted by vruntime, tail is the task which busiest cpu would run last, so its cache is coldest
+    task_t* task = (task_t*)list_delete_at_tail(task_queues[busiest]);
+
+    if(task == NULL) {
+        return NULL;
+    }
+
+    if(!task_is_migratable(task)) {
+        task_enqueue(busiest, task);
+
+        return NULL;
+    }
+
+    PRINTLOG(TASKING, LOG_TRACE, "task 0x%llx moved from cpu 0x%llx to cpu 0x%llx", task->task_id, busiest, self);
+
+    // vruntime is relative to run queue of cpu
+    uint64_t busiest_min_vruntime = task_cpu_min_vruntimes[busiest];
+    uint64_t lag = task->vruntime > busiest_min_vruntime ? task->vruntime - busiest_min_vruntime : 0;
+
+    task->vruntime = task_cpu_min_vruntimes[self] + lag;
+    task->cpu_id = self;
+
+    return task;
+}
+
+/**
+ * @brief wakes a tickless idle cpu for a task queued at a cpu, target cpu itself or a cpu which can steal it
+ * @param[in] cpu_id cpu whose run queue got a task
+ */
+static void task_kick_idle_cpu(uint64_t cpu_id) {
+    uint64_t self = cpu_state->local_apic_id;
+
+    if(cpu_id != self && __atomic_exchange_n(&task_cpu_sleeping[cpu_id], 0, __ATOMIC_ACQ_REL)) {
+        apic_send_ipi(cpu_id, 0xFE, false);
+
+        return;
+    }
+
+    uint64_t queue_size = list_size(task_queues[cpu_id]);
+
+    if(queue_size < 2) {
+        return;
+    }
+
+    // head runs next at its cpu, only tail is stolen. queue may shrink after its size is read, then tail is missing
+    const task_t* tail = list_get_data_at_position(task_queues[cpu_id], queue_size - 1);
+
+    if(tail == NULL || !task_is_migratable(tail)) {
+        return;
+    }
+
+    uint64_t cpu_count = apic_get_ap_count() + 1;
+
+    for(uint64_t i = 0; i < cpu_count; i++) {
+        if(i != cpu_id && i != self && __atomic_exchange_n(&task_cpu_sleeping[i], 0, __ATOMIC_ACQ_REL)) {
+            apic_send_ipi(i, 0xFE, false);
+
+            return;
+        }
+    }
+}
+
+void task_balance(void) {
+    if(!task_tasking_initialized || !cpu_state->tasking_enabled) {
+        return;
+    }
+
+    uint64_t tick = time_timer_get_tick_count();
+
+    if(tick - cpu_state->last_balance_tick < TASK_BALANCE_TICK_COUNT) {
+        return;
+    }
+
+    cpu_state->last_balance_tick = tick;
+
+    // idle cpus steal at task switch, here queued tasks are spread when all cpus are busy
+    task_t* task = task_steal_task(task_get_cpu_load(cpu_state->local_apic_id), 2);
+
+    if(task) {
+        task_enqueue(cpu_state->local_apic_id, task);
+    }
+}
+
+task_t* task_find_next_task(void) {
+    task_t* tmp_task = task_ready_queue_pop(cpu_state->task_ready_queue);
+
     if(!tmp_task && list_size(cpu_state->task_queue)) {
-        tmp_task = (task_t*)list_queue_pop(cpu_state->task_queue);
+        tmp_task = task_dequeue();
+    }
+
+    if(!tmp_task) {
+        tmp_task = task_steal_task(0, 1);
     }
 
     if(!tmp_task) {
@@ -735,15 +1039,37 @@ static __attribute__((noinline)) void task_task_switch_exit(void) {
 
 static char_t task_switch_task_id_buf[100] = {0};
 
+/**
+ * @brief checks running task still has time at its slice
+ * @param[in] task current task of cpu
+ * @param[in] current_tick rdtsc value
+ * @return true if task should continue
+ */
+static boolean_t task_is_in_time_slice(const task_t* task, uint64_t current_tick) {
+    return task != cpu_state->idle_task &&
+           task->state == TASK_STATE_RUNNING &&
+           (current_tick - task->last_tick_count) < task_get_time_slice(task) &&
+           current_tick > task->last_tick_count;
+}
+
+boolean_t task_is_time_slice_expired(void) {
+    task_t* current_task = cpu_state->current_task;
+
+    if(current_task == NULL || current_task == cpu_state->idle_task) {
+        return false;
+    }
+
+    return !task_is_in_time_slice(current_task, rdtsc());
+}
+
 __attribute__((no_stack_protector)) void task_switch_task(void) {
     task_t* current_task = cpu_state->current_task;
 
     uint64_t current_tick = rdtsc();
 
-    if(current_task != cpu_state->idle_task &&
-       current_task->state == TASK_STATE_RUNNING &&
-       (current_tick - current_task->last_tick_count) < task_max_tick_count_limit &&
-       current_tick > current_task->last_tick_count) {
+    if(task_is_in_time_slice(current_task, current_tick)) {
+
+        time_timer_wheel_program(TASK_MAX_TICK_COUNT);
 
         task_task_switch_exit();
 
@@ -767,19 +1093,29 @@ __attribute__((no_stack_protector)) void task_switch_task(void) {
     }
 
     if(current_task != cpu_state->idle_task) {
+        if(current_tick > current_task->last_tick_count) {
+            uint64_t delta = current_tick - current_task->last_tick_count;
+
+            current_task->run_time += delta;
+            current_task->vruntime += delta * TASK_NICE_0_WEIGHT / task_get_weight(current_task);
+        }
+
         switch(current_task->state) {
         case TASK_STATE_SUSPENDED:
         case TASK_STATE_STARTING:
-            list_queue_push(cpu_state->task_queue, current_task);
+            task_enqueue(cpu_state->local_apic_id, current_task);
+            task_kick_idle_cpu(cpu_state->local_apic_id);
             break;
         case TASK_STATE_ENDED:
             list_queue_push(cpu_state->task_cleanup_queue, current_task);
             break;
         case TASK_STATE_SLEEPING:
-            list_sortedlist_insert(cpu_state->task_sleep_queue, current_task);
+        case TASK_STATE_MESSAGE_WAITING:
+        case TASK_STATE_FUTURE_WAITING:
+            task_park(current_task);
             break;
         default:
-            list_queue_push(cpu_state->task_wait_queue, current_task);
+            task_ready_queue_push(cpu_state->task_ready_queue, current_task);
             break;
         }
     }
@@ -788,6 +1124,8 @@ __attribute__((no_stack_protector)) void task_switch_task(void) {
         task_cleanup();
     }
 
+    task_t* previous_task = current_task;
+
     current_task = task_find_next_task();
     current_task->last_tick_count = rdtsc();
     current_task->task_switch_count++;
@@ -803,6 +1141,12 @@ __attribute__((no_stack_protector)) void task_switch_task(void) {
 
     cpu_state->current_task = current_task;
 
+    // previous task stays on cpu until task_load_registers leaves its stack
+    current_task->on_cpu = true;
+    cpu_state->previous_task = previous_task != current_task ? previous_task : (task_t*)cpu_state->idle_task;
+    task_cpu_busy[cpu_state->local_apic_id] = current_task != cpu_state->idle_task;
+    task_cpu_sleeping[cpu_state->local_apic_id] = current_task == cpu_state->idle_task && apic_timer_is_tickless();
+
     if(current_task->vmcs_physical_address) {
         if(vmptrld(current_task->vmcs_physical_address) != 0) {
             utoh_with_buffer(task_switch_task_id_buf, current_task->task_id);
@@ -815,6 +1159,11 @@ __attribute__((no_stack_protector)) void task_switch_task(void) {
         vmx_write(VMX_HOST_GS_BASE, cpu_read_gs_base());
     }
 
+    memory_paging_tlb_mark_active(current_task->page_table);
+
+    // idle cpu sleeps until next timer or a kick, busy cpu also wakes at slice end
+    time_timer_wheel_program(current_task == cpu_state->idle_task ? 0 : TASK_MAX_TICK_COUNT);
+
     task_load_registers(current_task->registers);
 
     task_task_switch_exit();
@@ -874,22 +1223,15 @@ void task_kill_task(uint64_t task_id, boolean_t force) {
         }
     }
 
-    if(task->state == TASK_STATE_SLEEPING) {
-        list_list_delete(cpu_state->task_sleep_queue, task);
-        list_queue_push(cpu_state->task_queue, task);
-    } else if(task->state == TASK_STATE_FUTURE_WAITING ||
-              task->state == TASK_STATE_INTERRUPT_RECEIVED ||
-              task->state == TASK_STATE_MESSAGE_WAITING) {
-        list_list_delete(cpu_state->task_wait_queue, task);
-        list_queue_push(cpu_state->task_queue, task);
-    }
+    time_timer_cancel(&task->sleep_timer);
 
-    task->state = TASK_STATE_ENDED;
+    // a parked task is moved to ready queue of its cpu, which cleans it up
+    task_wake_task(task, TASK_STATE_ENDED);
 
     PRINTLOG(TASKING, LOG_INFO, "task 0x%llx will be ended", task->task_id);
 }
 
-uint64_t task_create_task(memory_heap_t* heap, uint64_t heap_size, uint64_t stack_size, void* entry_point, uint64_t args_cnt, void** args, const char_t* task_name) {
+uint64_t task_create_task_ext(memory_heap_t* heap, uint64_t heap_size, uint64_t stack_size, void* entry_point, uint64_t args_cnt, void** args, const char_t* task_name, uint64_t cpu_id) {
     heap = task_map_heap; // override heap
 
     task_t* new_task = memory_malloc_ext(heap, sizeof(task_t), 0x0);
@@ -909,29 +1251,23 @@ uint64_t task_create_task(memory_heap_t* heap, uint64_t heap_size, uint64_t stac
     }
 
 
-    frame_t* stack_frames;
-    uint64_t stack_frames_cnt = (stack_size + FRAME_SIZE - 1) / FRAME_SIZE;
-    stack_size = stack_frames_cnt * FRAME_SIZE;
-
-    if(frame_get_allocator()->allocate_frame_by_count(frame_get_allocator(), stack_frames_cnt, FRAME_ALLOCATION_TYPE_USED | FRAME_ALLOCATION_TYPE_BLOCK, &stack_frames, NULL) != 0) {
-        PRINTLOG(TASKING, LOG_ERROR, "cannot allocate stack with frame count 0x%llx", stack_frames_cnt);
-        memory_free_ext(heap, new_task);
-        memory_free_ext(heap, registers);
+    stack_size = (stack_size + FRAME_SIZE - 1) & ~(FRAME_SIZE - 1);
+    heap_size = (heap_size + FRAME_SIZE - 1) & ~(FRAME_SIZE - 1);
 
-        return -1;
+    // large heaps are rounded to 2M, heap ranges start at 2M boundaries and their chunks are faulted in with 2M pages
+    if(heap_size >= MEMORY_PAGING_PAGE_LENGTH_2M) {
+        heap_size = (heap_size + MEMORY_PAGING_PAGE_LENGTH_2M - 1) & ~(MEMORY_PAGING_PAGE_LENGTH_2M - 1);
     }
 
-    frame_t* heap_frames;
-    uint64_t heap_frames_cnt = (heap_size + FRAME_SIZE - 1) / FRAME_SIZE;
-    heap_size = heap_frames_cnt * FRAME_SIZE;
+    // only virtual ranges are reserved, heap frames are allocated by page fault handler at first access.
+    // stack is populated now because page faults push their frames to the faulting stack.
+    uint64_t stack_va = memory_paging_demand_reserve(stack_size, FRAME_SIZE, MEMORY_PAGING_PAGE_TYPE_NOEXEC);
 
-    if(frame_get_allocator()->allocate_frame_by_count(frame_get_allocator(), heap_frames_cnt, FRAME_ALLOCATION_TYPE_USED | FRAME_ALLOCATION_TYPE_BLOCK, &heap_frames, NULL) != 0) {
-        PRINTLOG(TASKING, LOG_ERROR, "cannot allocate heap with frame count 0x%llx", heap_frames_cnt);
+    if(stack_va == 0 || memory_paging_demand_populate(stack_va, stack_size) != 0) {
+        PRINTLOG(TASKING, LOG_ERROR, "cannot create stack with size 0x%llx", stack_size);
 
-        if(frame_get_allocator()->release_frame(frame_get_allocator(), stack_frames) != 0) {
-            PRINTLOG(TASKING, LOG_ERROR, "cannot release stack with frames at 0x%llx with count 0x%llx", stack_frames->frame_address, stack_frames->frame_count);
-
-            cpu_hlt();
+        if(stack_va) {
+            memory_paging_demand_release(stack_va);
         }
 
         memory_free_ext(heap, new_task);
@@ -940,30 +1276,25 @@ uint64_t task_create_task(memory_heap_t* heap, uint64_t heap_size, uint64_t stac
         return -1;
     }
 
-    uint64_t stack_va = MEMORY_PAGING_GET_VA_FOR_RESERVED_FA(stack_frames->frame_address);
-
-    if(memory_paging_add_va_for_frame(stack_va, stack_frames, MEMORY_PAGING_PAGE_TYPE_NOEXEC) != 0) {
-        PRINTLOG(TASKING, LOG_ERROR, "cannot add stack va 0x%llx for frame at 0x%llx with count 0x%llx", stack_va, stack_frames->frame_address, stack_frames->frame_count);
-
-        cpu_hlt();
-    }
-
-    memory_memclean((void*)stack_va, stack_size);
+    uint64_t heap_va = memory_paging_demand_reserve(heap_size, 0, MEMORY_PAGING_PAGE_TYPE_NOEXEC);
 
-    uint64_t heap_va = MEMORY_PAGING_GET_VA_FOR_RESERVED_FA(heap_frames->frame_address);
+    if(heap_va == 0) {
+        PRINTLOG(TASKING, LOG_ERROR, "cannot reserve heap with size 0x%llx", heap_size);
 
-    if(memory_paging_add_va_for_frame(heap_va, heap_frames, MEMORY_PAGING_PAGE_TYPE_NOEXEC) != 0) {
-        PRINTLOG(TASKING, LOG_ERROR, "cannot add heap va 0x%llx for frame at 0x%llx with count 0x%llx", heap_va, heap_frames->frame_address, heap_frames->frame_count);
+        memory_paging_demand_release(stack_va);
+        memory_free_ext(heap, new_task);
+        memory_free_ext(heap, registers);
 
-        cpu_hlt();
+        return -1;
     }
 
     memory_heap_t* task_heap = NULL;
 
+    // demand pages are cleaned while they are populated, heaps do not touch all pages at creation
     if(heap_size > (16 << 20)) {
-        task_heap = memory_create_heap_hash(heap_va, heap_va + heap_size);
+        task_heap = memory_create_heap_hash_ext(heap_va, heap_va + heap_size, true);
     } else {
-        task_heap = memory_create_heap_simple(heap_va, heap_va + heap_size);
+        task_heap = memory_create_heap_simple_ext(heap_va, heap_va + heap_size, true);
     }
 
 
@@ -973,6 +1304,10 @@ uint64_t task_create_task(memory_heap_t* heap, uint64_t heap_size, uint64_t stac
 
     task_heap->task_id = new_task_id;
 
+    if(memory_heap_register_range(task_heap, heap_va, heap_va + heap_size) != 0) {
+        PRINTLOG(TASKING, LOG_WARNING, "cannot register heap range of task 0x%llx, its frees fall back to heap search", new_task_id);
+    }
+
     new_task->heap = task_heap;
     new_task->heap_size = heap_size;
     new_task->task_id = new_task_id;
@@ -989,10 +1324,7 @@ uint64_t task_create_task(memory_heap_t* heap, uint64_t heap_size, uint64_t stac
 
     registers->rflags = 0x002;
 
-    uint64_t cr3_fa = (uint64_t)new_task->page_table->page_table;
-    cr3_fa = MEMORY_PAGING_GET_FA_FOR_RESERVED_VA(cr3_fa);
-
-    registers->cr3 = cr3_fa;
+    registers->cr3 = memory_paging_tlb_get_cr3(new_task->page_table);
 
     *(uint16_t*)&registers->sse[0] = 0x37F;
     *(uint32_t*)&registers->sse[24] = 0x1F80 & task_mxcsr_mask;
@@ -1020,23 +1352,31 @@ uint64_t task_create_task(memory_heap_t* heap, uint64_t heap_size, uint64_t stac
              new_task->task_name, new_task->task_id, new_task, registers->rsp, registers->rbp, new_task->heap, new_task->heap_size);
 
     uint64_t cpu_count = apic_get_ap_count() + 1;
-    size_t min_queue_size = -1;
-    list_t* min_queue = NULL;
 
-    for(uint64_t i = 0; i < cpu_count; i++) {
-        list_t* queue = task_queues[i];
+    if(cpu_id != TASK_CPU_ID_ANY && cpu_id < cpu_count) {
+        new_task->cpu_id = cpu_id;
+        new_task->attributes |= TASK_ATTRIBUTE_PINNED;
+    } else {
+        uint64_t min_load = -1ULL;
 
-        if(list_size(queue) < min_queue_size) {
-            min_queue_size = list_size(queue);
-            min_queue = queue;
-            new_task->cpu_id = i;
+        for(uint64_t i = 0; i < cpu_count; i++) {
+            uint64_t load = task_get_cpu_load(i);
+
+            if(load < min_load) {
+                min_load = load;
+                new_task->cpu_id = i;
+            }
         }
     }
 
+    // new task starts at minimum vruntime of cpu, so a task creating many tasks cannot starve others
+    new_task->vruntime = task_cpu_min_vruntimes[new_task->cpu_id];
+
     lock_acquire(task_find_next_task_lock);
     cpu_cli();
     hashmap_put(task_map, (void*)new_task->task_id, new_task);
-    list_stack_push(min_queue, new_task);
+    task_enqueue(new_task->cpu_id, new_task);
+    task_kick_idle_cpu(new_task->cpu_id);
     cpu_sti();
     lock_release(task_find_next_task_lock);
 
@@ -1158,10 +1498,7 @@ int8_t task_create_idle_task(void) {
 
     registers->rflags = 0x002;
 
-    uint64_t cr3_fa = (uint64_t)new_task->page_table->page_table;
-    cr3_fa = MEMORY_PAGING_GET_FA_FOR_RESERVED_VA(cr3_fa);
-
-    registers->cr3 = cr3_fa;
+    registers->cr3 = memory_paging_tlb_get_cr3(new_task->page_table);
 
     *(uint16_t*)&registers->sse[0] = 0x37F;
     *(uint32_t*)&registers->sse[24] = 0x1F80 & task_mxcsr_mask;
@@ -1239,8 +1576,13 @@ void task_remove_task_after_fault(uint64_t task_id) {
     current_task->task_switch_count++;
 
     cpu_state->current_task = current_task;
+    cpu_state->previous_task = current_task;
+    task_cpu_busy[cpu_state->local_apic_id] = false;
+    task_cpu_sleeping[cpu_state->local_apic_id] = apic_timer_is_tickless();
     current_task->state = TASK_STATE_RUNNING;
 
+    time_timer_wheel_program(0);
+
     task_load_registers(current_task->registers);
 
     cpu_sti();
@@ -46,12 +46,30 @@ uint64_t task_get_id(void) {
     return id;
 }
 
+/**
+ * @brief timer callback of sleeping task
+ * @param[in] data sleeping task
+ */
+static void task_sleep_timer_callback(void* data) {
+    task_t* task = (task_t*)data;
+
+    if(task->state == TASK_STATE_SLEEPING) {
+        task_wake_task(task, TASK_STATE_SUSPENDED);
+    }
+}
+
 void task_current_task_sleep(uint64_t wake_tick) {
     task_t* current_task = task_get_current_task();
 
     if(current_task) {
-        current_task->wake_tick = wake_tick;
         current_task->state = TASK_STATE_SLEEPING;
+
+        if(time_timer_add(&current_task->sleep_timer, wake_tick, &task_sleep_timer_callback, current_task) != 0) {
+            current_task->state = TASK_STATE_RUNNING;
+
+            return;
+        }
+
         task_yield();
     }
 }
@@ -60,7 +78,7 @@ void task_clear_message_waiting(uint64_t tid) {
     task_t* task = (task_t*)hashmap_get(task_map, (void*)tid);
 
     if(task) {
-        task->state = TASK_STATE_SUSPENDED;
+        task_wake_task(task, TASK_STATE_SUSPENDED);
     } else {
         PRINTLOG(TASKING, LOG_ERROR, "task not found 0x%llx", tid);
     }
@@ -68,15 +86,9 @@ void task_clear_message_waiting(uint64_t tid) {
 
 void task_set_interrupt_received(uint64_t tid) {
     task_t* task = (task_t*)hashmap_get(task_map, (void*)tid);
-    task_t* current_task = cpu_state->current_task;
 
     if(task) {
-        task->state = TASK_STATE_INTERRUPT_RECEIVED;
-
-        if(current_task->cpu_id != task->cpu_id) {
-            apic_send_ipi(task->cpu_id, 0xFE, false);
-        }
-
+        task_wake_task(task, TASK_STATE_INTERRUPT_RECEIVED);
     } else {
         video_text_print("int recv: task not found\n");
         PRINTLOG(TASKING, LOG_ERROR, "task not found 0x%llx", tid);
@@ -85,15 +97,9 @@ void task_set_interrupt_received(uint64_t tid) {
 
 void task_set_message_received(uint64_t tid) {
     task_t* task = (task_t*)hashmap_get(task_map, (void*)tid);
-    task_t* current_task = cpu_state->current_task;
 
     if(task) {
-        task->state = TASK_STATE_SUSPENDED;
-
-        if(current_task->cpu_id != task->cpu_id) {
-            apic_send_ipi(task->cpu_id, 0xFE, false);
-        }
-
+        task_wake_task(task, TASK_STATE_SUSPENDED);
     } else {
         video_text_print("msg recv: task not found\n");
         PRINTLOG(TASKING, LOG_ERROR, "task not found 0x%llx", tid);
@@ -108,6 +114,33 @@ void task_set_interruptible(void) {
     }
 }
 
+int8_t task_set_priority(uint64_t task_id, int8_t nice) {
+    if(nice < TASK_NICE_MIN || nice > TASK_NICE_MAX) {
+        return -1;
+    }
+
+    task_t* task = task_id ? (task_t*)hashmap_get(task_map, (void*)task_id) : task_get_current_task();
+
+    if(task == NULL) {
+        return -1;
+    }
+
+    // vruntime does not change, so task stays at its place if it is at a run queue
+    task->nice = nice;
+
+    return 0;
+}
+
+int8_t task_get_priority(uint64_t task_id) {
+    const task_t* task = task_id ? (task_t*)hashmap_get(task_map, (void*)task_id) : task_get_current_task();
+
+    if(task == NULL) {
+        return 0;
+    }
+
+    return task->nice;
+}
+
 void task_print_all(buffer_t* buffer) {
     iterator_t* it = hashmap_iterator_create(task_map);
 
@@ -131,13 +164,14 @@ void task_print_all(buffer_t* buffer) {
         buffer_printf(buffer,
                       "\ttask %s 0x%llx 0x%p on cpu 0x%llx switched 0x%llx\n"
                       "\t\tstack at 0x%llx-0x%llx heap at 0x%p[0x%llx] stack 0x%p[0x%llx]\n"
-                      "\t\tstate %d attributes 0x%x\n"
+                      "\t\tstate %d attributes 0x%x nice %d run time 0x%llx vruntime 0x%llx\n"
                       "\t\tmessage queues %lli messages %lli\n"
                       "\t\theap malloc 0x%llx free 0x%llx diff 0x%llx\n",
                       task->task_name, task->task_id, task, task->cpu_id, task->task_switch_count,
                       task->registers->rsp, task->registers->rbp, task->heap, task->heap_size,
                       task->stack, task->stack_size,
-                      task->state, task->attributes, list_size(task->message_queues), msgcount,
+                      task->state, task->attributes, task->nice, task->run_time, task->vruntime,
+                      list_size(task->message_queues), msgcount,
                       stat.malloc_count, stat.free_count, stat.malloc_count - stat.free_count
                       );
 
@@ -422,6 +456,10 @@ void task_toggle_wait_for_future(uint64_t tid) {
         video_text_print(task->state == TASK_STATE_FUTURE_WAITING ? "true" : "false");
         video_text_print("\n");
 
-        task->state = task->state == TASK_STATE_FUTURE_WAITING ? TASK_STATE_SUSPENDED : TASK_STATE_FUTURE_WAITING;
+        if(task->state == TASK_STATE_FUTURE_WAITING) {
+            task_wake_task(task, TASK_STATE_SUSPENDED);
+        } else {
+            task->state = TASK_STATE_FUTURE_WAITING;
+        }
     }
 }
@@ -128,7 +128,25 @@ int8_t time_timer_apic_isr(interrupt_frame_ext_t* frame) {
     }
 #endif
 
-    if(task_tasking_initialized && (time_timer_tick_count % TASK_MAX_TICK_COUNT) == 0) {
+    time_timer_wheel_run();
+
+    task_balance();
+
+    if(apic_id != 0 && apic_timer_is_tickless()) {
+        // one shot timer fires only at events, task switch arms the next one
+        if(task_tasking_initialized) {
+            task_task_switch_set_parameters(true, false);
+            task_switch_task();
+        } else {
+            apic_timer_arm(1);
+            apic_eoi();
+        }
+
+        return 0;
+    }
+
+    // weighted slices are checked at each tick, idle task switches at default slice boundaries
+    if(task_tasking_initialized && (task_is_time_slice_expired() || (time_timer_tick_count % TASK_MAX_TICK_COUNT) == 0)) {
         task_task_switch_set_parameters(true, false);
         task_switch_task();
     } else {
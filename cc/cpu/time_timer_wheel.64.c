@@ -0,0 +1,408 @@
+/**
+ * @file time_timer_wheel.64.c
+ * @brief per cpu hierarchical timer wheels
+ *
+ * each cpu has a wheel of four levels with 64 slots. level n slots are 64^n ticks wide, a timer is linked to the
+ * slot of the lowest level which covers its deadline, so adding and cancelling are O(1). when level 0 wraps, the
+ * current slot of next level is cascaded down. timers further than wheel span wait at last level and are
+ * cascaded again until their deadline fits. on tickless cpus one shot timer is armed for next expiry or cascade.
+ *
+ * This work is licensed under TURNSTONE OS Public License.
+ * Please read and understand latest version of Licence.
+ */
+
+#include <time/timer.h>
+#include <memory.h>
+#include <cpu.h>
+#include <cpu/sync.h>
+#include <apic.h>
+#include <logging.h>
+
+MODULE("turnstone.kernel.timer");
+
+/*! bit count of slot index of a level */
+#define TIME_TIMER_WHEEL_SLOT_BITS   6
+/*! slot count of a level */
+#define TIME_TIMER_WHEEL_SLOT_COUNT  (1ULL << TIME_TIMER_WHEEL_SLOT_BITS)
+/*! slot index mask */
+#define TIME_TIMER_WHEEL_SLOT_MASK   (TIME_TIMER_WHEEL_SLOT_COUNT - 1)
+/*! level count */
+#define TIME_TIMER_WHEEL_LEVEL_COUNT 4
+/*! largest tick distance a timer can be linked by its deadline */
+#define TIME_TIMER_WHEEL_MAX_DELTA   ((1ULL << (TIME_TIMER_WHEEL_SLOT_BITS * TIME_TIMER_WHEEL_LEVEL_COUNT)) - 1)
+
+/**
+ * @struct time_timer_wheel_t
+ * @brief timer wheel of a cpu
+ */
+struct time_timer_wheel_t {
+    spinlock_t        lock; ///< ticket lock, held with interrupts disabled
+    uint64_t          clock; ///< next tick to process
+    uint64_t          timer_count; ///< pending timer count
+    uint64_t          armed_tick; ///< tick which one shot timer of cpu is armed for, -1 if it is stopped
+    time_timer_t*     slots[TIME_TIMER_WHEEL_LEVEL_COUNT][TIME_TIMER_WHEEL_SLOT_COUNT]; ///< timer lists
+    time_timer_t*     expiring; ///< timers of processed slot which wait their callbacks, they stay pending
+};
+
+time_timer_wheel_t** time_timer_wheels = NULL; ///< wheels indexed by local apic id
+uint64_t time_timer_wheel_count = 0; ///< wheel count
+
+/**
+ * @brief returns wheel of current cpu
+ * @return wheel or NULL if wheels are not created
+ */
+static time_timer_wheel_t* time_timer_wheel_get_local(void) {
+    if(time_timer_wheels == NULL) {
+        return NULL;
+    }
+
+    uint64_t apic_id = apic_get_local_apic_id();
+
+    if(apic_id >= time_timer_wheel_count) {
+        return NULL;
+    }
+
+    return time_timer_wheels[apic_id];
+}
+
+/**
+ * @brief links timer to slot of its deadline, wheel should be locked
+ * @param[in] wheel wheel
+ * @param[in] timer timer
+ */
+static void time_timer_wheel_link(time_timer_wheel_t* wheel, time_timer_t* timer) {
+    uint64_t expires = timer->deadline;
+    uint64_t level = 0;
+
+    if(expires < wheel->clock) {
+        expires = wheel->clock;
+    } else if(expires - wheel->clock > TIME_TIMER_WHEEL_MAX_DELTA) {
+        expires = wheel->clock + TIME_TIMER_WHEEL_MAX_DELTA;
+    }
+
+    uint64_t delta = expires - wheel->clock;
+
+    while(level < TIME_TIMER_WHEEL_LEVEL_COUNT - 1 && delta >= (1ULL << (TIME_TIMER_WHEEL_SLOT_BITS * (level + 1)))) {
+        level++;
+    }
+
+    time_timer_t** slot = &wheel->slots[level][(expires >> (TIME_TIMER_WHEEL_SLOT_BITS * level)) & TIME_TIMER_WHEEL_SLOT_MASK];
+
+    timer->slot = slot;
+    timer->prev = NULL;
+    timer->next = *slot;
+
+    if(*slot) {
+        (*slot)->prev = timer;
+    }
+
+    *slot = timer;
+}
+
+/**
+ * @brief unlinks timer from its slot, wheel should be locked
+ * @param[in] timer timer
+ */
+static void time_timer_wheel_unlink(time_timer_t* timer) {
+    if(timer->prev) {
+        timer->prev->next = timer->next;
+    } else {
+        *timer->slot = timer->next;
+    }
+
+    if(timer->next) {
+        timer->next->prev = timer->prev;
+    }
+
+    timer->next = NULL;
+    timer->prev = NULL;
+    timer->slot = NULL;
+}
+
+/**
+ * @brief moves timers of a slot to lower levels, wheel should be locked
+ * @param[in] wheel wheel
+ * @param[in] level level of slot
+ * @return slot index, zero means next level should be cascaded too
+ */
+static uint64_t time_timer_wheel_cascade(time_timer_wheel_t* wheel, uint64_t level) {
+    uint64_t idx = (wheel->clock >> (TIME_TIMER_WHEEL_SLOT_BITS * level)) & TIME_TIMER_WHEEL_SLOT_MASK;
+
+    time_timer_t* timer = wheel->slots[level][idx];
+    wheel->slots[level][idx] = NULL;
+
+    while(timer) {
+        time_timer_t* next = timer->next;
+
+        time_timer_wheel_link(wheel, timer);
+
+        timer = next;
+    }
+
+    return idx;
+}
+
+/**
+ * @brief finds tick of next expiry or cascade, wheel should be locked
+ * @param[in] wheel wheel
+ * @return tick count or -1 if wheel is empty
+ */
+static uint64_t time_timer_wheel_next_event(const time_timer_wheel_t* wheel) {
+    if(wheel->timer_count == 0) {
+        return -1ULL;
+    }
+
+    for(uint64_t i = 0; i < TIME_TIMER_WHEEL_SLOT_COUNT; i++) {
+        uint64_t tick = wheel->clock + i;
+
+        if(wheel->slots[0][tick & TIME_TIMER_WHEEL_SLOT_MASK]) {
+            return tick;
+        }
+    }
+
+    // level slots are cascaded at start of their spans, current slot waits a full round
+    for(uint64_t level = 1; level < TIME_TIMER_WHEEL_LEVEL_COUNT; level++) {
+        uint64_t shift = TIME_TIMER_WHEEL_SLOT_BITS * level;
+        uint64_t block = wheel->clock >> shift;
+
+        for(uint64_t i = 1; i <= TIME_TIMER_WHEEL_SLOT_COUNT; i++) {
+            if(wheel->slots[level][(block + i) & TIME_TIMER_WHEEL_SLOT_MASK]) {
+                return (block + i) << shift;
+            }
+        }
+    }
+
+    return -1ULL;
+}
+
+/**
+ * @brief arms one shot timer for a tick, wheel should be locked
+ * @param[in] wheel wheel of current cpu
+ * @param[in] tick tick count or -1 for stopping timer
+ */
+static void time_timer_wheel_arm(time_timer_wheel_t* wheel, uint64_t tick) {
+    uint64_t now = time_timer_get_tick_count();
+
+    wheel->armed_tick = tick;
+
+    if(tick == -1ULL) {
+        apic_timer_arm(0);
+    } else {
+        apic_timer_arm(tick > now ? tick - now : 1);
+    }
+}
+
+int8_t time_timer_wheel_init(void) {
+    uint64_t cpu_count = apic_get_ap_count() + 1;
+
+    time_timer_wheel_t** wheels = memory_malloc(sizeof(time_timer_wheel_t*) * cpu_count);
+
+    if(wheels == NULL) {
+        PRINTLOG(TIMER, LOG_ERROR, "cannot allocate timer wheel list");
+
+        return -1;
+    }
+
+    uint64_t clock = time_timer_get_tick_count() + 1;
+
+    for(uint64_t i = 0; i < cpu_count; i++) {
+        wheels[i] = memory_malloc(sizeof(time_timer_wheel_t));
+
+        if(wheels[i] == NULL) {
+            PRINTLOG(TIMER, LOG_ERROR, "cannot allocate timer wheel of cpu 0x%llx", i);
+
+            for(uint64_t j = 0; j < i; j++) {
+                memory_free(wheels[j]);
+            }
+
+            memory_free(wheels);
+
+            return -1;
+        }
+
+        wheels[i]->clock = clock;
+        wheels[i]->armed_tick = -1ULL;
+    }
+
+    time_timer_wheel_count = cpu_count;
+    __atomic_store_n(&time_timer_wheels, wheels, __ATOMIC_RELEASE);
+
+    PRINTLOG(TIMER, LOG_INFO, "timer wheels created for 0x%llx cpus", cpu_count);
+
+    return 0;
+}
+
+/**
+ * @brief removes timer from its wheel if it is pending
+ * @param[in] timer timer
+ * @return 0 if timer is removed, -1 if it is not pending
+ */
+static int8_t time_timer_unlink_pending(time_timer_t* timer) {
+    time_timer_wheel_t* wheel = __atomic_load_n(&timer->wheel, __ATOMIC_ACQUIRE);
+
+    if(wheel == NULL) {
+        return -1;
+    }
+
+    int8_t res = -1;
+
+    spinlock_acquire(&wheel->lock);
+
+    // timer may be fired or moved while waiting lock
+    if(timer->wheel == wheel) {
+        time_timer_wheel_unlink(timer);
+        timer->wheel = NULL;
+        wheel->timer_count--;
+        res = 0;
+    }
+
+    spinlock_release(&wheel->lock);
+
+    return res;
+}
+
+int8_t time_timer_add(time_timer_t* timer, uint64_t deadline, time_timer_callback_f callback, void* data) {
+    if(timer == NULL || callback == NULL) {
+        return -1;
+    }
+
+    time_timer_wheel_t* wheel = time_timer_wheel_get_local();
+
+    if(wheel == NULL) {
+        return -1;
+    }
+
+    // firing timer is already unlinked and expiring ones are unlinked here, so add does not wait callbacks which may re-add their own timers
+    time_timer_unlink_pending(timer);
+
+    spinlock_acquire(&wheel->lock);
+
+    timer->deadline = deadline;
+    timer->callback = callback;
+    timer->data = data;
+
+    time_timer_wheel_link(wheel, timer);
+    timer->wheel = wheel;
+    wheel->timer_count++;
+
+    // a tickless cpu would sleep past the new deadline
+    if(deadline < wheel->armed_tick && apic_timer_is_tickless()) {
+        time_timer_wheel_arm(wheel, deadline);
+    }
+
+    spinlock_release(&wheel->lock);
+
+    return 0;
+}
+
+int8_t time_timer_cancel(time_timer_t* timer) {
+    if(timer == NULL) {
+        return -1;
+    }
+
+    int8_t res = time_timer_unlink_pending(timer);
+
+    uint64_t running_cpu = __atomic_load_n(&timer->running_cpu, __ATOMIC_ACQUIRE);
+
+    // callbacks run at timer interrupt, so at same cpu only timer's own callback can cancel it
+    if(running_cpu && running_cpu != apic_get_local_apic_id() + 1) {
+        while(__atomic_load_n(&timer->running_cpu, __ATOMIC_ACQUIRE)) {
+            asm volatile ("pause" ::: "memory");
+        }
+    }
+
+    return res;
+}
+
+void time_timer_wheel_run(void) {
+    time_timer_wheel_t* wheel = time_timer_wheel_get_local();
+
+    if(wheel == NULL) {
+        return;
+    }
+
+    uint64_t now = time_timer_get_tick_count();
+    uint64_t running_cpu = apic_get_local_apic_id() + 1;
+
+    spinlock_acquire(&wheel->lock);
+
+    while(wheel->clock <= now) {
+        if(wheel->timer_count == 0) {
+            // nothing to cascade or fire, skip idle ticks at once
+            wheel->clock = now + 1;
+
+            break;
+        }
+
+        uint64_t idx = wheel->clock & TIME_TIMER_WHEEL_SLOT_MASK;
+
+        if(idx == 0) {
+            for(uint64_t level = 1; level < TIME_TIMER_WHEEL_LEVEL_COUNT; level++) {
+                if(time_timer_wheel_cascade(wheel, level) != 0) {
+                    break;
+                }
+            }
+        }
+
+        // expired timers stay linked to wheel while callbacks run without lock, so add and cancel unlink them under lock
+        wheel->expiring = wheel->slots[0][idx];
+        wheel->slots[0][idx] = NULL;
+
+        for(time_timer_t* timer = wheel->expiring; timer; timer = timer->next) {
+            timer->slot = &wheel->expiring;
+        }
+
+        // callbacks re-adding with past deadlines go to next tick
+        wheel->clock++;
+
+        while(wheel->expiring) {
+            time_timer_t* timer = wheel->expiring;
+
+            time_timer_wheel_unlink(timer);
+            wheel->timer_count--;
+
+            // a cancel which sees timer is not pending should see it is firing
+            __atomic_store_n(&timer->running_cpu, running_cpu, __ATOMIC_RELAXED);
+            __atomic_store_n(&timer->wheel, NULL, __ATOMIC_RELEASE);
+
+            spinlock_release(&wheel->lock);
+
+            timer->callback(timer->data);
+
+            // timer may be freed by a waiting cancel just after this store
+            __atomic_store_n(&timer->running_cpu, 0, __ATOMIC_RELEASE);
+
+            spinlock_acquire(&wheel->lock);
+        }
+    }
+
+    spinlock_release(&wheel->lock);
+}
+
+void time_timer_wheel_program(uint64_t max_ticks) {
+    if(!apic_timer_is_tickless()) {
+        return;
+    }
+
+    time_timer_wheel_t* wheel = time_timer_wheel_get_local();
+
+    if(wheel == NULL) {
+        return;
+    }
+
+    spinlock_acquire(&wheel->lock);
+
+    uint64_t tick = time_timer_wheel_next_event(wheel);
+
+    if(max_ticks) {
+        uint64_t limit = time_timer_get_tick_count() + max_ticks;
+
+        if(tick > limit) {
+            tick = limit;
+        }
+    }
+
+    time_timer_wheel_arm(wheel, tick);
+
+    spinlock_release(&wheel->lock);
+}
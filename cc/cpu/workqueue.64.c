@@ -0,0 +1,185 @@
+/**
+ * @file workqueue.64.c
+ * @brief per cpu lock free work queues drained by pinned worker tasks
+ *
+ * This work is licensed under TURNSTONE OS Public License.
+ * Please read and understand latest version of Licence.
+ */
+
+#include <cpu/workqueue.h>
+#include <cpu/task.h>
+#include <memory.h>
+#include <apic.h>
+#include <logging.h>
+
+MODULE("turnstone.kernel.cpu.task");
+
+/**
+ * @struct workqueue_t
+ * @brief work queue of a cpu
+ */
+typedef struct workqueue_t {
+    workqueue_work_t* volatile head; ///< last queued work, works are linked to older ones
+    uint64_t                   task_id; ///< worker task id, it is woken when queue becomes non empty
+} workqueue_t; ///< short hand for struct
+
+/*! work queues indexed by local apic id, published after all workers are created */
+static workqueue_t* workqueues = NULL;
+/*! work queue count */
+static uint64_t workqueue_count = 0;
+
+/**
+ * @brief worker task, runs works of its cpu at batches
+ * @param[in] args_cnt argument count
+ * @param[in] args arguments, worker is pinned so it finds its queue by cpu
+ * @return never returns
+ */
+static int32_t workqueue_worker(uint64_t args_cnt, void** args) {
+    UNUSED(args_cnt);
+    UNUSED(args);
+
+    task_set_interruptible();
+
+    task_t* self = task_get_current_task();
+    workqueue_t* wq = NULL;
+
+    while(true) {
+        // interrupt handlers wake worker without locks, a wake after this point makes it ready again so it is not lost
+        task_set_message_waiting();
+
+        if(wq == NULL) {
+            workqueue_t* wqs = __atomic_load_n(&workqueues, __ATOMIC_ACQUIRE);
+
+            if(wqs) {
+                wq = &wqs[apic_get_local_apic_id()];
+            }
+        }
+
+        workqueue_work_t* works = NULL;
+
+        if(wq) {
+            works = __atomic_exchange_n(&wq->head, NULL, __ATOMIC_ACQUIRE);
+        }
+
+        if(works == NULL) {
+            task_yield();
+
+            continue;
+        }
+
+        task_state_t waiting = TASK_STATE_MESSAGE_WAITING;
+        __atomic_compare_exchange_n(&self->state, &waiting, TASK_STATE_RUNNING, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+
+        workqueue_work_t* batch = NULL;
+
+        // queue is a stack, reverse it for running works at schedule order
+        while(works) {
+            workqueue_work_t* next = works->next;
+            works->next = batch;
+            batch = works;
+            works = next;
+        }
+
+        while(batch) {
+            workqueue_work_t* work = batch;
+            batch = work->next;
+
+            work->next = NULL;
+
+            // work scheduled while its callback runs is queued again
+            __atomic_store_n(&work->pending, false, __ATOMIC_RELEASE);
+
+            work->callback(work->data);
+        }
+    }
+
+    return 0;
+}
+
+int8_t workqueue_init(void) {
+    uint64_t cpu_count = apic_get_ap_count() + 1;
+
+    workqueue_t* wqs = memory_malloc(sizeof(workqueue_t) * cpu_count);
+
+    if(wqs == NULL) {
+        PRINTLOG(TASKING, LOG_ERROR, "cannot allocate work queues");
+
+        return -1;
+    }
+
+    for(uint64_t i = 0; i < cpu_count; i++) {
+        wqs[i].task_id = task_create_task_ext(NULL, 1 << 20, 64 << 10, &workqueue_worker, 0, NULL, "kworker", i);
+
+        if(wqs[i].task_id == -1ULL) {
+            PRINTLOG(TASKING, LOG_ERROR, "cannot create worker of cpu 0x%llx", i);
+
+            // queues are not published, so created workers never touch them
+            for(uint64_t j = 0; j < i; j++) {
+                task_kill_task(wqs[j].task_id, false);
+            }
+
+            memory_free(wqs);
+
+            return -1;
+        }
+
+        // deferred works are interrupt bottom halves, they run before other tasks
+        task_set_priority(wqs[i].task_id, TASK_NICE_MIN);
+    }
+
+    workqueue_count = cpu_count;
+    __atomic_store_n(&workqueues, wqs, __ATOMIC_RELEASE);
+
+    // workers which started before publishing sleep until they find their queues
+    for(uint64_t i = 0; i < cpu_count; i++) {
+        task_set_interrupt_received(wqs[i].task_id);
+    }
+
+    PRINTLOG(TASKING, LOG_INFO, "work queues created for 0x%llx cpus", cpu_count);
+
+    return 0;
+}
+
+void workqueue_work_init(workqueue_work_t* work, workqueue_work_f callback, void* data) {
+    if(work == NULL) {
+        return;
+    }
+
+    work->next = NULL;
+    work->callback = callback;
+    work->data = data;
+    work->pending = false;
+}
+
+int8_t workqueue_schedule(workqueue_work_t* work) {
+    if(work == NULL || work->callback == NULL) {
+        return -1;
+    }
+
+    workqueue_t* wqs = __atomic_load_n(&workqueues, __ATOMIC_ACQUIRE);
+    uint32_t apic_id = apic_get_local_apic_id();
+
+    if(wqs == NULL || apic_id >= workqueue_count) {
+        return -1;
+    }
+
+    if(__atomic_exchange_n(&work->pending, true, __ATOMIC_ACQ_REL)) {
+        return 0;
+    }
+
+    workqueue_t* wq = &wqs[apic_id];
+    workqueue_work_t* head = __atomic_load_n(&wq->head, __ATOMIC_RELAXED);
+
+    // only worker removes works and it takes whole queue, so push has no aba problem
+    do {
+        work->next = head;
+    } while(!__atomic_compare_exchange_n(&wq->head, &head, work, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    // worker sleeps only when queue is empty, later works find it awake
+    // interrupt received wake takes only spin locks, so it is safe at interrupt handlers
+    if(head == NULL) {
+        task_set_interrupt_received(wq->task_id);
+    }
+
+    return 0;
+}
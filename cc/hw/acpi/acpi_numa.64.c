@@ -0,0 +1,175 @@
+/**
+ * @file acpi_numa.64.c
+ * @brief acpi srat and slit parsers for numa topology
+ *
+ * This work is licensed under TURNSTONE OS Public License.
+ * Please read and understand latest version of Licence.
+ */
+#include <acpi.h>
+#include <memory.h>
+#include <memory/frame.h>
+#include <logging.h>
+
+MODULE("turnstone.kernel.hw.acpi");
+
+/*! distance of a node to itself */
+#define ACPI_NUMA_LOCAL_DISTANCE  10
+/*! distance between nodes when slit is missing */
+#define ACPI_NUMA_REMOTE_DISTANCE 20
+
+/**
+ * @brief returns dense node index of proximity domain, adds domain if it is new
+ * @param[in] domains proximity domains of nodes
+ * @param[in,out] topology topology whose node count is updated
+ * @param[in] domain proximity domain
+ * @return node index or @ref FRAME_NUMA_NODE_UNKNOWN if there are too many nodes
+ */
+static uint64_t acpi_numa_get_node(uint32_t* domains, frame_numa_topology_t* topology, uint32_t domain) {
+    for(uint64_t i = 0; i < topology->node_count; i++) {
+        if(domains[i] == domain) {
+            return i;
+        }
+    }
+
+    if(topology->node_count == FRAME_NUMA_MAX_NODE_COUNT) {
+        PRINTLOG(ACPI, LOG_WARNING, "too many proximity domains, domain 0x%x is ignored", domain);
+
+        return FRAME_NUMA_NODE_UNKNOWN;
+    }
+
+    domains[topology->node_count] = domain;
+
+    return topology->node_count++;
+}
+
+/**
+ * @brief sets node of cpu
+ * @param[in,out] topology numa topology
+ * @param[in] apic_id local apic id of cpu
+ * @param[in] node node index
+ */
+static void acpi_numa_set_cpu_node(frame_numa_topology_t* topology, uint32_t apic_id, uint64_t node) {
+    if(node == FRAME_NUMA_NODE_UNKNOWN || apic_id >= FRAME_NUMA_MAX_CPU_COUNT) {
+        return;
+    }
+
+    topology->cpu_nodes[apic_id] = node;
+
+    PRINTLOG(ACPI, LOG_DEBUG, "cpu 0x%x is at numa node 0x%llx", apic_id, node);
+}
+
+int8_t acpi_numa_setup(acpi_xrsdp_descriptor_t* desc) {
+    acpi_table_srat_t* srat = (acpi_table_srat_t*)acpi_get_table(desc, "SRAT");
+
+    if(srat == NULL) {
+        PRINTLOG(ACPI, LOG_INFO, "srat not found, memory is at single node");
+
+        return 0;
+    }
+
+    frame_numa_topology_t topology = {0};
+    uint32_t domains[FRAME_NUMA_MAX_NODE_COUNT] = {0};
+
+    memory_memset(topology.cpu_nodes, FRAME_NUMA_NODE_UNKNOWN, sizeof(topology.cpu_nodes));
+
+    uint8_t* data = srat->entries;
+    uint8_t* data_end = (uint8_t*)srat + srat->header.length;
+
+    while(data + sizeof(struct srat_info_t) <= data_end) {
+        acpi_table_srat_entry_t* e = (acpi_table_srat_entry_t*)data;
+
+        if(e->info.length == 0) {
+            PRINTLOG(ACPI, LOG_ERROR, "srat entry with zero length");
+
+            return -1;
+        }
+
+        data += e->info.length;
+
+        if(e->info.type == ACPI_SRAT_ENTRY_TYPE_PROCESSOR_LOCAL_APIC_AFFINITY) {
+            if(!(e->processor_local_apic_affinity.flags & ACPI_SRAT_ENTRY_FLAG_ENABLED)) {
+                continue;
+            }
+
+            uint32_t domain = e->processor_local_apic_affinity.proximity_domain_low |
+                              (e->processor_local_apic_affinity.proximity_domain_high[0] << 8) |
+                              (e->processor_local_apic_affinity.proximity_domain_high[1] << 16) |
+                              (e->processor_local_apic_affinity.proximity_domain_high[2] << 24);
+
+            acpi_numa_set_cpu_node(&topology, e->processor_local_apic_affinity.apic_id, acpi_numa_get_node(domains, &topology, domain));
+        } else if(e->info.type == ACPI_SRAT_ENTRY_TYPE_PROCESSOR_LOCAL_X2APIC_AFFINITY) {
+            if(!(e->processor_local_x2apic_affinity.flags & ACPI_SRAT_ENTRY_FLAG_ENABLED)) {
+                continue;
+            }
+
+            uint64_t node = acpi_numa_get_node(domains, &topology, e->processor_local_x2apic_affinity.proximity_domain);
+
+            acpi_numa_set_cpu_node(&topology, e->processor_local_x2apic_affinity.x2apic_id, node);
+        } else if(e->info.type == ACPI_SRAT_ENTRY_TYPE_MEMORY_AFFINITY) {
+            if(!(e->memory_affinity.flags & ACPI_SRAT_ENTRY_FLAG_ENABLED) || e->memory_affinity.length_in_bytes < FRAME_SIZE) {
+                continue;
+            }
+
+            uint64_t node = acpi_numa_get_node(domains, &topology, e->memory_affinity.proximity_domain);
+
+            if(node == FRAME_NUMA_NODE_UNKNOWN) {
+                continue;
+            }
+
+            if(topology.range_count == FRAME_NUMA_MAX_RANGE_COUNT) {
+                PRINTLOG(ACPI, LOG_WARNING, "too many memory affinity ranges, range at 0x%llx is ignored", e->memory_affinity.base_address);
+
+                continue;
+            }
+
+            frame_numa_range_t* r = &topology.ranges[topology.range_count++];
+
+            // partial frames at edges are left outside of node
+            r->frame_address = (e->memory_affinity.base_address + FRAME_SIZE - 1) & ~(uint64_t)(FRAME_SIZE - 1);
+            r->frame_count = (e->memory_affinity.base_address + e->memory_affinity.length_in_bytes - r->frame_address) / FRAME_SIZE;
+            r->node = node;
+
+            PRINTLOG(ACPI, LOG_DEBUG, "memory 0x%llx-0x%llx is at numa node 0x%llx",
+                     r->frame_address, r->frame_address + r->frame_count * FRAME_SIZE, node);
+        }
+    }
+
+    if(topology.node_count < 2) {
+        PRINTLOG(ACPI, LOG_INFO, "srat has single proximity domain, memory is at single node");
+
+        return 0;
+    }
+
+    for(uint64_t i = 0; i < topology.node_count; i++) {
+        for(uint64_t j = 0; j < topology.node_count; j++) {
+            topology.distances[i][j] = i == j ? ACPI_NUMA_LOCAL_DISTANCE : ACPI_NUMA_REMOTE_DISTANCE;
+        }
+    }
+
+    acpi_table_slit_t* slit = (acpi_table_slit_t*)acpi_get_table(desc, "SLIT");
+
+    if(slit == NULL) {
+        PRINTLOG(ACPI, LOG_INFO, "slit not found, remote nodes have same distance");
+    } else {
+        uint64_t locality_count = slit->locality_count;
+
+        if(sizeof(acpi_table_slit_t) + locality_count * locality_count > slit->header.length) {
+            PRINTLOG(ACPI, LOG_ERROR, "slit is truncated");
+        } else {
+            // slit is indexed by proximity domains
+            for(uint64_t i = 0; i < topology.node_count; i++) {
+                for(uint64_t j = 0; j < topology.node_count; j++) {
+                    if(domains[i] < locality_count && domains[j] < locality_count) {
+                        topology.distances[i][j] = slit->distances[domains[i] * locality_count + domains[j]];
+                    }
+                }
+            }
+        }
+    }
+
+    PRINTLOG(ACPI, LOG_INFO, "numa topology has 0x%llx nodes and 0x%llx memory ranges", topology.node_count, topology.range_count);
+
+    frame_allocator_t* fa = frame_get_allocator();
+
+    return fa->set_numa_topology(fa, &topology);
+}
@@ -20,6 +20,11 @@
 
 MODULE("turnstone.kernel.hw.drivers.ahci");
 
+/*! prdt entry count of each command table, set by port rebase */
+#define AHCI_PRDT_ENTRY_COUNT 64
+/*! maximum byte count of a prdt entry */
+#define AHCI_PRDT_ENTRY_MAX_SIZE (4 << 20)
+
 void video_text_print(const char* str);
 
 list_t* sata_ports = NULL;
@@ -762,6 +767,70 @@ int8_t ahci_identify(uint64_t disk_id) {
     return 0;
 }
 
+/**
+ * @brief fills prdt entries of buffer, each page is translated and physically contiguous pages share an entry
+ * @param[in] cmd_table command table, its entries are cleaned
+ * @param[in] buffer buffer, demand paged buffers are populated
+ * @param[in] size buffer size
+ * @return entry count, -1 on error
+ */
+static int32_t ahci_fill_prdt(ahci_hba_prdt_t* cmd_table, const uint8_t* buffer, uint32_t size) {
+    uint64_t va = (uint64_t)buffer;
+
+    if(memory_paging_demand_populate_for_dma(va, size) != 0) {
+        PRINTLOG(AHCI, LOG_ERROR, "cannot populate buffer 0x%p", buffer);
+
+        return -1;
+    }
+
+    memory_memclean(cmd_table->prdt_entry, sizeof(ahci_hba_prdt_entry_t) * AHCI_PRDT_ENTRY_COUNT);
+
+    int32_t entry_count = 0;
+    uint64_t entry_end = 0;
+    uint32_t entry_size = 0;
+
+    while(size) {
+        uint32_t chunk = FRAME_SIZE - (va % FRAME_SIZE);
+
+        if(chunk > size) {
+            chunk = size;
+        }
+
+        uint64_t pa = 0;
+
+        if(memory_paging_get_physical_address(va, &pa) != 0) {
+            PRINTLOG(AHCI, LOG_ERROR, "cannot get buffer physical address 0x%llx", va);
+
+            return -1;
+        }
+
+        if(entry_count && pa == entry_end && entry_size + chunk <= AHCI_PRDT_ENTRY_MAX_SIZE) {
+            entry_size += chunk;
+        } else {
+            if(entry_count == AHCI_PRDT_ENTRY_COUNT) {
+                PRINTLOG(AHCI, LOG_ERROR, "buffer 0x%p needs more than 0x%x prdt entries", buffer, AHCI_PRDT_ENTRY_COUNT);
+
+                return -1;
+            }
+
+            entry_count++;
+            entry_size = chunk;
+            cmd_table->prdt_entry[entry_count - 1].data_base_address = pa;
+        }
+
+        cmd_table->prdt_entry[entry_count - 1].data_byte_count = entry_size - 1;
+
+        PRINTLOG(AHCI, LOG_TRACE, "prdt entry %i data base address 0x%llx data byte count 0x%x", entry_count - 1,
+                 cmd_table->prdt_entry[entry_count - 1].data_base_address, cmd_table->prdt_entry[entry_count - 1].data_byte_count);
+
+        entry_end = pa + chunk;
+        va += chunk;
+        size -= chunk;
+    }
+
+    return entry_count;
+}
+
 future_t* ahci_read(uint64_t disk_id, uint64_t lba, uint32_t size, uint8_t* buffer) {
     ahci_sata_disk_t* disk = (ahci_sata_disk_t*)list_get_data_at_position(sata_ports, disk_id);
 
@@ -790,53 +859,27 @@ future_t* ahci_read(uint64_t disk_id, uint64_t lba, uint32_t size, uint8_t* buff
         return NULL;
     }
 
-    uint32_t prdt_length = size / (4 << 20);
-
-    if(size % (4 << 20) != 0) {
-        prdt_length++;
-    }
-
-    if(prdt_length > 64) {
-        PRINTLOG(AHCI, LOG_FATAL, "cannot read more than 0x%llx at on", 65536 * disk->logical_sector_size);
-
-        return NULL;
-    }
-
-    PRINTLOG(AHCI, LOG_TRACE, "size 0x%x sector count 0x%x prdt length 0x%x", size, sector_count, prdt_length);
+    PRINTLOG(AHCI, LOG_TRACE, "size 0x%x sector count 0x%x", size, sector_count);
 
     ahci_hba_cmd_header_t* cmd_hdr = (ahci_hba_cmd_header_t*)MEMORY_PAGING_GET_VA_FOR_RESERVED_FA(port->command_list_base_address);
     cmd_hdr += slot;
 
     cmd_hdr->command_fis_length = sizeof(ahci_fis_reg_h2d_t) / sizeof(uint32_t);
     cmd_hdr->write_direction = 0;
-    cmd_hdr->prdt_length = prdt_length;
     cmd_hdr->clear_busy = 1;
 
     ahci_hba_prdt_t* cmd_table = (ahci_hba_prdt_t*)MEMORY_PAGING_GET_VA_FOR_RESERVED_FA(cmd_hdr->prdt_base_address);
-    memory_memclean(cmd_table, sizeof(ahci_hba_prdt_t) + (sizeof(ahci_hba_prdt_entry_t) * (  cmd_hdr->prdt_length - 1)));
 
-    uint64_t buffer_phy_addr = 0;
+    // buffer pages may not be physically contiguous, for example demand paged task heaps
+    int32_t prdt_length = ahci_fill_prdt(cmd_table, buffer, size);
 
-    if(memory_paging_get_physical_address((uint64_t)buffer, &buffer_phy_addr) != 0) {
-        PRINTLOG(AHCI, LOG_ERROR, "cannot get read buffer physical address 0x%p", buffer);
+    if(prdt_length == -1) {
+        PRINTLOG(AHCI, LOG_ERROR, "cannot build prdt of %s buffer 0x%p", "read", buffer);
 
         return NULL;
     }
 
-    PRINTLOG(AHCI, LOG_TRACE, "buffer 0x%p physical address 0x%llx", buffer, buffer_phy_addr);
-
-
-    uint32_t tmp_size = size;
-
-    for(uint32_t i = 0; i < cmd_hdr->prdt_length; i++) {
-        cmd_table->prdt_entry[i].data_base_address = buffer_phy_addr;
-        cmd_table->prdt_entry[i].data_byte_count = (tmp_size > (4 << 20)) ? (4 << 20) - 1 : tmp_size - 1;
-
-        PRINTLOG(AHCI, LOG_TRACE, "prdt entry %i data base address 0x%llx data byte count 0x%x", i, cmd_table->prdt_entry[i].data_base_address, cmd_table->prdt_entry[i].data_byte_count);
-
-        tmp_size -= (4 << 20);
-        buffer_phy_addr += (4 << 20);
-    }
+    cmd_hdr->prdt_length = prdt_length;
 
     ahci_fis_reg_h2d_t* fis = (ahci_fis_reg_h2d_t*)MEMORY_PAGING_GET_VA_FOR_RESERVED_FA(&cmd_table->command_fis);
     memory_memclean(fis, sizeof(ahci_fis_reg_h2d_t));
@@ -919,18 +962,6 @@ future_t* ahci_write(uint64_t disk_id, uint64_t lba, uint32_t size, uint8_t* buf
         return NULL;
     }
 
-    uint32_t prdt_length = size / (4 << 20);
-
-    if(size % (4 << 20) != 0) {
-        prdt_length++;
-    }
-
-    if(prdt_length > 64) {
-        PRINTLOG(AHCI, LOG_FATAL, "cannot write more than 0x%llx at on", 65536 * disk->logical_sector_size);
-
-        return NULL;
-    }
-
     PRINTLOG(AHCI, LOG_TRACE, "write to port 0x%p at lba 0x%llx with size 0x%x from buffer 0x%p slot %i", port, lba, size, buffer, slot);
 
     ahci_hba_cmd_header_t* cmd_hdr = (ahci_hba_cmd_header_t*)MEMORY_PAGING_GET_VA_FOR_RESERVED_FA(port->command_list_base_address);
@@ -938,29 +969,20 @@ future_t* ahci_write(uint64_t disk_id, uint64_t lba, uint32_t size, uint8_t* buf
 
     cmd_hdr->command_fis_length = sizeof(ahci_fis_reg_h2d_t) / sizeof(uint32_t);
     cmd_hdr->write_direction = 1;
-    cmd_hdr->prdt_length = prdt_length;
     cmd_hdr->clear_busy = 1;
 
     ahci_hba_prdt_t* cmd_table = (ahci_hba_prdt_t*)MEMORY_PAGING_GET_VA_FOR_RESERVED_FA(cmd_hdr->prdt_base_address);
-    memory_memclean(cmd_table, sizeof(ahci_hba_prdt_t) + (sizeof(ahci_hba_prdt_entry_t) * (  cmd_hdr->prdt_length - 1)));
 
-    uint64_t buffer_phy_addr = 0;
+    // buffer pages may not be physically contiguous, for example demand paged task heaps
+    int32_t prdt_length = ahci_fill_prdt(cmd_table, buffer, size);
 
-    if(memory_paging_get_physical_address((uint64_t)buffer, &buffer_phy_addr) != 0) {
-        PRINTLOG(AHCI, LOG_ERROR, "cannot get read buffer physical address 0x%p", buffer);
+    if(prdt_length == -1) {
+        PRINTLOG(AHCI, LOG_ERROR, "cannot build prdt of %s buffer 0x%p", "write", buffer);
 
         return NULL;
     }
 
-    uint32_t tmp_size = size;
-
-    for(uint32_t i = 0; i < cmd_hdr->prdt_length; i++) {
-        cmd_table->prdt_entry[i].data_base_address = buffer_phy_addr;
-        cmd_table->prdt_entry[i].data_byte_count = (tmp_size > (4 << 20)) ? (4 << 20) - 1 : tmp_size - 1;
-
-        tmp_size -= (4 << 20);
-        buffer_phy_addr += (4 << 20);
-    }
+    cmd_hdr->prdt_length = prdt_length;
 
     ahci_fis_reg_h2d_t* fis = (ahci_fis_reg_h2d_t*)MEMORY_PAGING_GET_VA_FOR_RESERVED_FA(&cmd_table->command_fis);
     memory_memclean(fis, sizeof(ahci_fis_reg_h2d_t));
@@ -1126,7 +1148,7 @@ void ahci_port_rebase(ahci_hba_port_t* port, uint64_t offset, int8_t nr_cmd_slot
     ahci_hba_cmd_header_t* cmd_hdr = (ahci_hba_cmd_header_t*)MEMORY_PAGING_GET_VA_FOR_RESERVED_FA(port->command_list_base_address);
 
     for(uint8_t i = 0; i < nr_cmd_slots; i++) {
-        cmd_hdr[i].prdt_length = 64;
+        cmd_hdr[i].prdt_length = AHCI_PRDT_ENTRY_COUNT;
         cmd_hdr[i].prdt_base_address = offset;
 
         uint64_t size = sizeof(ahci_hba_prdt_t) + (sizeof(ahci_hba_prdt_entry_t) * (  cmd_hdr[i].prdt_length - 1));
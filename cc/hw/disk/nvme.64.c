@@ -48,17 +48,12 @@ const nvme_disk_t* nvme_get_disk_by_id(uint64_t disk_id) {
     return hashmap_get(nvme_disks, (void*)disk_id);
 }
 
-int8_t nvme_isr(interrupt_frame_ext_t* frame) {
-    uint8_t intnum = frame->interrupt_number;
-    intnum -= 0x20;
-
-    nvme_disk_t* nvme_disk = (nvme_disk_t*)hashmap_get(nvme_disk_isr_map, (void*)(uint64_t)intnum);
-
-    if(nvme_disk == NULL) {
-        apic_eoi();
-
-        return 0;
-    }
+/**
+ * @brief releases locks of completed io commands
+ * @param[in] data nvme disk
+ */
+static void nvme_process_completions(void* data) {
+    nvme_disk_t* nvme_disk = (nvme_disk_t*)data;
 
     // uint32_t status_code = nvme_disk->io_completion_queue[nvme_disk->io_c_queue_head].status_code;
     // uint32_t status_type = nvme_disk->io_completion_queue[nvme_disk->io_c_queue_head].status_type;
@@ -76,6 +71,8 @@ int8_t nvme_isr(interrupt_frame_ext_t* frame) {
 
         if(nvme_disk->current_phase != phase) {
             // TODO: handle error phase
+            // entry is not posted yet, its interrupt schedules completions again
+            break;
         } else {
             lock_t* lock = (lock_t*)hashmap_get(nvme_disk->command_lock_map, (void*)(uint64_t)cid);
             hashmap_delete(nvme_disk->command_lock_map, (void*)(uint64_t)cid);
@@ -97,6 +94,24 @@ int8_t nvme_isr(interrupt_frame_ext_t* frame) {
             }
         }
     }
+}
+
+int8_t nvme_isr(interrupt_frame_ext_t* frame) {
+    uint8_t intnum = frame->interrupt_number;
+    intnum -= 0x20;
+
+    nvme_disk_t* nvme_disk = (nvme_disk_t*)hashmap_get(nvme_disk_isr_map, (void*)(uint64_t)intnum);
+
+    if(nvme_disk == NULL) {
+        apic_eoi();
+
+        return 0;
+    }
+
+    // completions of a burst are handled at once by worker, before work queues they are handled here
+    if(workqueue_schedule(&nvme_disk->completion_work) != 0) {
+        nvme_process_completions(nvme_disk);
+    }
 
     pci_msix_clear_pending_bit(nvme_disk->pci_device, nvme_disk->msix_capability, 1);
     apic_eoi();
@@ -433,6 +448,8 @@ int8_t nvme_init(memory_heap_t* heap, list_t* nvme_pci_devices) {
 
         PRINTLOG(NVME, LOG_TRACE, "creating io cq");
 
+        workqueue_work_init(&nvme_disk->completion_work, nvme_process_completions, nvme_disk);
+
         nvme_disk->io_queue_isr = pci_msix_set_isr(pci_nvme,  msix_cap, 1, nvme_isr);
         hashmap_put(nvme_disk_isr_map, (void*)nvme_disk->io_queue_isr, nvme_disk);
 
@@ -659,6 +676,13 @@ future_t* nvme_read_write(uint64_t disk_id, uint64_t lba, uint32_t size, uint8_t
         return NULL;
     }
 
+    // demand paged buffers are populated page by page, so their frames are not contiguous
+    if(memory_paging_demand_populate_for_dma(buffer_va, size) != 0) {
+        PRINTLOG(NVME, LOG_ERROR, "cannot %s: buffer pages cannot be populated", write?"write":"read");
+
+        return NULL;
+    }
+
     uint64_t buffer_fa = 0;
 
     if(memory_paging_get_physical_address(buffer_va, &buffer_fa) != 0) {
@@ -667,6 +691,14 @@ future_t* nvme_read_write(uint64_t disk_id, uint64_t lba, uint32_t size, uint8_t
         return NULL;
     }
 
+    uint64_t prp2_fa = 0;
+
+    if(fa_cnt >= 2 && memory_paging_get_physical_address(buffer_va + 0x1000, &prp2_fa) != 0) {
+        PRINTLOG(NVME, LOG_ERROR, "cannot %s: buffer physical address not found", write?"write":"read");
+
+        return NULL;
+    }
+
     uint16_t cid = nvme_disk->next_cid++;
 
     if(cid == 0) {
@@ -682,14 +714,21 @@ future_t* nvme_read_write(uint64_t disk_id, uint64_t lba, uint32_t size, uint8_t
     uint64_t prp2 = 0;
 
     if(fa_cnt == 2) {
-        prp2 = prp1 + 0x1000;
+        prp2 = prp2_fa;
     } else if(fa_cnt > 2) {
         prp2 = nvme_disk->prp_frame_fa + iosqt * 0x1000;
         uint64_t* prp2_list = (uint64_t*)MEMORY_PAGING_GET_VA_FOR_RESERVED_FA(prp2);
         memory_memclean(prp2_list, 0x1000);
 
-        for(uint64_t i = 0; i < fa_cnt - 1; i++) {
-            prp2_list[i] = prp1 + (i + 1) * 0x1000;
+        prp2_list[0] = prp2_fa;
+
+        for(uint64_t i = 1; i < fa_cnt - 1; i++) {
+            if(memory_paging_get_physical_address(buffer_va + (i + 1) * 0x1000, &prp2_list[i]) != 0) {
+                PRINTLOG(NVME, LOG_ERROR, "cannot %s: buffer physical address not found", write?"write":"read");
+
+                return NULL;
+            }
+
             PRINTLOG(NVME, LOG_TRACE, "prp2: %llx va %llx", prp2_list[i], buffer_va + (i + 1) * 0x1000);
         }
     }
@@ -27,6 +27,8 @@ MODULE("turnstone.kernel.hw.network.e1000");
 
 list_t* e1000_net_devs = NULL;
 
+extern uint64_t network_rx_task_id;
+
 uint16_t network_e1000_eeprom_read(network_e1000_dev_t* dev, uint8_t addr);
 uint16_t network_e1000_phy_read(network_e1000_dev_t* dev, int regaddr);
 void     network_e1000_rx_enable(network_e1000_dev_t* dev);
@@ -38,6 +40,8 @@ int8_t   network_e1000_process_tx(void);
 void     network_e1000_phy_write(network_e1000_dev_t* dev, int regaddr, uint16_t data);
 
 
+uint64_t network_e1000_tx_task_id = 0;
+
 int8_t network_e1000_process_tx(void) {
 
     for(uint64_t dev_idx = 0; dev_idx < list_size(e1000_net_devs); dev_idx++) {
@@ -311,6 +315,10 @@ void network_e1000_rx_poll(const network_e1000_dev_t* dev) {
             memory_memcopy(pkt, packet->packet_data, pktlen);
 
             list_queue_push(network_received_packets, packet);
+
+            if(network_rx_task_id) {
+                task_set_message_received(network_rx_task_id);
+            }
         }
 
         // update RX counts and the tail pointer
@@ -325,10 +333,28 @@ void network_e1000_rx_poll(const network_e1000_dev_t* dev) {
 }
 #pragma GCC diagnostic pop
 
+/**
+ * @brief polls rx ring at work queue
+ * @param[in] data e1000 device
+ */
+static void network_e1000_rx_work(void* data) {
+    network_e1000_rx_poll((const network_e1000_dev_t*)data);
+}
+
+/**
+ * @brief defers rx poll to work queue, polls at interrupt handler before work queues
+ * @param[in] dev e1000 device
+ */
+static void network_e1000_rx_defer(network_e1000_dev_t* dev) {
+    if(workqueue_schedule(&dev->rx_work) != 0) {
+        network_e1000_rx_poll(dev);
+    }
+}
+
 int8_t network_e1000_rx_isr(interrupt_frame_ext_t* frame)  {
     uint8_t intnum = frame->interrupt_number;
 
-    const network_e1000_dev_t* dev = list_get_data_at_position(e1000_net_devs, 0);
+    network_e1000_dev_t* dev = (network_e1000_dev_t*)list_get_data_at_position(e1000_net_devs, 0);
 
     // read the pending interrupt status
     uint32_t icr = dev->mmio->isr_status;
@@ -357,13 +383,13 @@ int8_t network_e1000_rx_isr(interrupt_frame_ext_t* frame)  {
             }
         }
 
-        network_e1000_rx_poll(dev);
+        network_e1000_rx_defer(dev);
     }
 
     // packet is pending
     if( icr & (1 << 7) ) {
         icr &= ~(1 << 7);
-        network_e1000_rx_poll(dev);
+        network_e1000_rx_defer(dev);
     }
 
     if(icr & 0x8000) {
@@ -511,6 +537,8 @@ int8_t network_e1000_init(const pci_dev_t* pci_netdev) {
     network_e1000_rx_init(dev);
     network_e1000_tx_init(dev);
 
+    workqueue_work_init(&dev->rx_work, network_e1000_rx_work, dev);
+
     uint8_t isrnum = dev->irq_base;
     interrupt_irq_set_handler(isrnum, &network_e1000_rx_isr);
     // apic_ioapic_setup_irq(isrnum, APIC_IOAPIC_TRIGGER_MODE_LEVEL);
@@ -522,7 +550,7 @@ int8_t network_e1000_init(const pci_dev_t* pci_netdev) {
 
     network_e1000_rx_enable(dev);
 
-    task_create_task(NULL, 64 << 10, 1 << 20, &network_e1000_process_tx, 0, NULL, "e1000 tx");
+    network_e1000_tx_task_id = task_create_task(NULL, 64 << 10, 1 << 20, &network_e1000_process_tx, 0, NULL, "e1000 tx");
 
     list_list_insert(e1000_net_devs, dev);
 
@@ -225,6 +225,7 @@ void hypervisor_ipc_send_timer_interrupt(hypervisor_vm_t* vm) {
     }
 
     list_queue_push(mq, (void*)&hypervisor_ipc_message_timer_int);
+    task_set_message_received(vm->task_id);
 }
 
 const hypervisor_ipc_message_t hypervisor_ipc_message_close = {
@@ -240,6 +241,7 @@ int8_t hypervisor_ipc_send_close(uint64_t vm_id) {
     }
 
     list_queue_push(vm_mq, (void*)&hypervisor_ipc_message_close);
+    task_set_message_received(vm_id);
 
     return 0;
 }
@@ -143,6 +143,16 @@ const char_t* backtrace_get_symbol_name_by_rip(uint64_t rip) {
     return symbol_name;
 }
 
+const char_t* backtrace_get_module_name_by_rip(uint64_t rip) {
+    const linker_global_offset_table_entry_t* got_entry = backtrace_get_symbol_entry(rip);
+
+    if(!got_entry) {
+        return NULL;
+    }
+
+    return linker_get_module_name_at_memory(got_entry->module_id);
+}
+
 void backtrace_print_location_by_rip(uint64_t rip) {
     const linker_global_offset_table_entry_t* got_entry = backtrace_get_symbol_entry(rip);
 
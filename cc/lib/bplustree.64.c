@@ -62,6 +62,38 @@ typedef struct bplustree_iterator_internal_t {
     index_key_comparator_f           comparator; ///< key comparator
 } bplustree_iterator_internal_t; ///< short hand for struct
 
+/*! slab cache of tree nodes, only trees at default heap use it */
+memory_cache_t* bplustree_node_cache = NULL;
+
+/**
+ * @brief allocates tree node from slab cache or heap
+ * @param[in] heap tree's heap
+ * @return node
+ */
+static bplustree_node_internal_t* bplustree_node_alloc(memory_heap_t* heap) {
+    memory_cache_t* cache = memory_cache_get_for_heap(&bplustree_node_cache, heap, "bplustree nodes", sizeof(bplustree_node_internal_t), 0, NULL);
+
+    if(cache) {
+        return memory_cache_alloc(cache);
+    }
+
+    return memory_malloc_ext(heap, sizeof(bplustree_node_internal_t), 0x0);
+}
+
+/**
+ * @brief frees tree node allocated by bplustree_node_alloc
+ * @param[in] heap tree's heap
+ * @param[in] node node
+ * @return 0 on success
+ */
+static int8_t bplustree_node_free(memory_heap_t* heap, const bplustree_node_internal_t* node) {
+    if(bplustree_node_cache && memory_cache_get_heap(bplustree_node_cache) == heap) {
+        return memory_cache_free(bplustree_node_cache, (void*)node);
+    }
+
+    return memory_free_ext(heap, (void*)node);
+}
+
 /*! b+ tree insert implementation. see also index_t insert method*/
 int8_t bplustree_insert(index_t* idx, const void* key, const void* data, void** removed_data);
 /*! b+ tree delete implementation. see also index_t delete method*/
@@ -242,7 +274,7 @@ int8_t bplustree_destroy_index(index_t* idx){
                         list_delete_at_position(tmp_node->childs, 0);
                     }
 
-                    memory_free_ext(idx->heap, (void*)node);
+                    bplustree_node_free(idx->heap, node);
                     node = tmp_node;
                 }
             } else {
@@ -270,7 +302,7 @@ int8_t bplustree_destroy_index(index_t* idx){
                     list_delete_at_position(tmp_node->childs, 0);
                 }
 
-                memory_free_ext(idx->heap, (void*)node);
+                bplustree_node_free(idx->heap, node);
                 node = tmp_node;
             }
         }
@@ -284,7 +316,7 @@ int8_t bplustree_destroy_index(index_t* idx){
 
 bplustree_node_internal_t* bplustree_split_node(index_t* idx, bplustree_node_internal_t* node, void** ptr_par_key) {
     bplustree_internal_t* tree = (bplustree_internal_t*)idx->metadata;
-    bplustree_node_internal_t* new_node = memory_malloc_ext(idx->heap, sizeof(bplustree_node_internal_t), 0x0);
+    bplustree_node_internal_t* new_node = bplustree_node_alloc(idx->heap);
 
     if(new_node == NULL) {
         return NULL;
@@ -324,7 +356,7 @@ bplustree_node_internal_t* bplustree_split_node(index_t* idx, bplustree_node_int
                         void* cloned_key = NULL;
 
                         if(tree->key_cloner(idx->heap, cur, &cloned_key) != 0) {
-                            memory_free_ext(idx->heap, new_node);
+                            bplustree_node_free(idx->heap, new_node);
 
                             return NULL;
                         }
@@ -394,7 +426,7 @@ int8_t bplustree_insert(index_t* idx, const void* key, const void* data, void**
 
     bplustree_internal_t* tree = (bplustree_internal_t*)idx->metadata;
     if(tree->root == NULL) {
-        tree->root = memory_malloc_ext(idx->heap, sizeof(bplustree_node_internal_t), 0x0);
+        tree->root = bplustree_node_alloc(idx->heap);
 
         if(tree->root == NULL) {
             return -1;
@@ -404,7 +436,7 @@ int8_t bplustree_insert(index_t* idx, const void* key, const void* data, void**
         tree->root->keys = list_create_sortedlist_with_heap(idx->heap, idx->comparator);
 
         if(tree->root->keys == NULL) {
-            memory_free_ext(idx->heap, tree->root);
+            bplustree_node_free(idx->heap, tree->root);
 
             return -1;
         }
@@ -414,7 +446,7 @@ int8_t bplustree_insert(index_t* idx, const void* key, const void* data, void**
 
             if(tree->key_cloner(idx->heap, key, &cloned_key) != 0) {
                 memory_free_ext(idx->heap, tree->root->keys);
-                memory_free_ext(idx->heap, tree->root);
+                bplustree_node_free(idx->heap, tree->root);
 
                 return -1;
             }
@@ -429,7 +461,7 @@ int8_t bplustree_insert(index_t* idx, const void* key, const void* data, void**
 
         if(tree->root->datas == NULL) {
             memory_free_ext(idx->heap, tree->root->keys);
-            memory_free_ext(idx->heap, tree->root);
+            bplustree_node_free(idx->heap, tree->root);
 
             return -1;
         }
@@ -444,7 +476,7 @@ int8_t bplustree_insert(index_t* idx, const void* key, const void* data, void**
             if(!bucket) {
                 memory_free_ext(idx->heap, tree->root->keys);
                 memory_free_ext(idx->heap, tree->root->datas);
-                memory_free_ext(idx->heap, tree->root);
+                bplustree_node_free(idx->heap, tree->root);
 
                 return -1;
             }
@@ -544,10 +576,10 @@ int8_t bplustree_insert(index_t* idx, const void* key, const void* data, void**
                     }
 
                     if(node->parent == NULL) { // root node
-                        node->parent = memory_malloc_ext(idx->heap, sizeof(bplustree_node_internal_t), 0x0);
+                        node->parent = bplustree_node_alloc(idx->heap);
 
                         if(node->parent == NULL) {
-                            memory_free_ext(idx->heap, new_node);
+                            bplustree_node_free(idx->heap, new_node);
 
                             return -1;
                         }
@@ -556,8 +588,8 @@ int8_t bplustree_insert(index_t* idx, const void* key, const void* data, void**
                         node->parent->keys = list_create_sortedlist_with_heap(idx->heap, idx->comparator);
 
                         if(node->parent->keys == NULL) {
-                            memory_free_ext(idx->heap, new_node);
-                            memory_free_ext(idx->heap, node->parent);
+                            bplustree_node_free(idx->heap, new_node);
+                            bplustree_node_free(idx->heap, node->parent);
                             node->parent = NULL;
 
                             return -1;
@@ -567,9 +599,9 @@ int8_t bplustree_insert(index_t* idx, const void* key, const void* data, void**
                         node->parent->childs = list_create_list_with_heap(idx->heap);
 
                         if(node->parent->keys == NULL) {
-                            memory_free_ext(idx->heap, (void*)new_node);
+                            bplustree_node_free(idx->heap, new_node);
                             memory_free_ext(idx->heap, node->parent->keys);
-                            memory_free_ext(idx->heap, (void*)node->parent);
+                            bplustree_node_free(idx->heap, node->parent);
                             node->parent = NULL;
 
                             return -1;
@@ -709,13 +741,13 @@ int8_t bplustree_toss_root(index_t* idx) {
                     list_destroy(right_child->childs);
                 }
 
-                memory_free_ext(idx->heap, (void*)right_child);
+                bplustree_node_free(idx->heap, right_child);
 
             }
 
             list_destroy_with_type(root->keys, destroy_type, tree->key_destroyer);
             list_destroy(root->childs);
-            memory_free_ext(idx->heap, (void*)root);
+            bplustree_node_free(idx->heap, root);
 
             left_child->next = NULL;
             left_child->parent = NULL;
@@ -1084,7 +1116,7 @@ int8_t bplustree_delete(index_t* idx, const void* key, void** deleted_data){
                         list_destroy(src->childs);
                     }
 
-                    memory_free_ext(idx->heap, (void*)src);
+                    bplustree_node_free(idx->heap, src);
                 } else {
                     // borrow
 
@@ -1158,7 +1190,7 @@ int8_t bplustree_delete(index_t* idx, const void* key, void** deleted_data){
         if(list_size(tree->root->keys) == 0) {
             list_destroy_with_type(tree->root->keys, destroy_type, tree->key_destroyer);
             list_destroy(tree->root->datas);
-            memory_free_ext(idx->heap, (void*)tree->root);
+            bplustree_node_free(idx->heap, tree->root);
             tree->root = NULL;
         }
     } else {
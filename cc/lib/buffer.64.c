@@ -26,6 +26,7 @@ typedef struct buffer_t {
     boolean_t      readonly;
     uint64_t       mark_position;
     uint8_t*       data;
+    boolean_t      interrupt_safe; ///< buffer is appended at interrupt handlers, it does not grow
 }buffer_t;
 
 buffer_t buffer_tmp_buffer_for_printf = {
@@ -99,6 +100,17 @@ buffer_t* buffer_encapsulate(uint8_t* data, uint64_t length) {
     return buffer;
 }
 
+boolean_t buffer_set_interrupt_safe(buffer_t* buffer) {
+    if(!buffer) {
+        return false;
+    }
+
+    lock_set_interrupt_safe(buffer->lock);
+    buffer->interrupt_safe = true;
+
+    return true;
+}
+
 boolean_t buffer_set_readonly(buffer_t* buffer, boolean_t ro) {
     if(!buffer) {
         return false;
@@ -184,6 +196,11 @@ static boolean_t buffer_resize_if_need(buffer_t* buffer, uint64_t length) {
     }
 
     if(buffer->capacity != new_cap) {
+        // lock is held with interrupts disabled, appends which do not fit are dropped until reader takes data
+        if(buffer->interrupt_safe) {
+            return false;
+        }
+
         uint8_t* tmp_data = memory_malloc_ext(buffer->heap, new_cap, 0);
 
         if(tmp_data == NULL) {
@@ -307,7 +324,23 @@ uint8_t* buffer_get_all_bytes(buffer_t* buffer, uint64_t* length) {
 }
 
 uint8_t* buffer_get_all_bytes_and_reset(buffer_t* buffer, uint64_t* length) {
-    lock_acquire(buffer->lock);
+    // capacity changes only under lock, new data is allocated before it and it is retried if buffer grows meanwhile
+    uint8_t* new_data = NULL;
+    uint64_t new_capacity = 0;
+
+    while(true) {
+        new_capacity = buffer->capacity;
+        new_data = memory_malloc_ext(buffer->heap, new_capacity, 0);
+
+        lock_acquire(buffer->lock);
+
+        if(new_capacity == buffer->capacity) {
+            break;
+        }
+
+        lock_release(buffer->lock);
+        memory_free_ext(buffer->heap, new_data);
+    }
 
     uint8_t* res = buffer->data;
 
@@ -315,7 +348,7 @@ uint8_t* buffer_get_all_bytes_and_reset(buffer_t* buffer, uint64_t* length) {
         *length = buffer->length;
     }
 
-    buffer->data = memory_malloc_ext(buffer->heap, buffer->capacity, 0);
+    buffer->data = new_data;
     buffer->length = 0;
     buffer->position = 0;
 
@@ -555,6 +588,30 @@ uint8_t* buffer_get_view_at_position(const buffer_t* buffer, uint64_t position,
     return buffer->data + position;
 }
 
+uint8_t* buffer_reserve(buffer_t* buffer, uint64_t length) {
+    if(!buffer) {
+        return NULL;
+    }
+
+    if(buffer->readonly) {
+        return NULL;
+    }
+
+    lock_acquire(buffer->lock);
+
+    if(!buffer_resize_if_need(buffer, length)) {
+        lock_release(buffer->lock);
+
+        return NULL;
+    }
+
+    uint8_t* res = buffer->data + buffer->position;
+
+    lock_release(buffer->lock);
+
+    return res;
+}
+
 
 int64_t buffer_printf(buffer_t* buffer, const char_t* fmt, ...) {
     va_list args;
@@ -118,6 +118,82 @@ static inline int8_t cache_move_to_head(cache_t* cache, boolean_t mru, cache_ite
     return 0;
 }
 
+/**
+ * @brief removes tail item of a list and destroys it, lock should be held
+ * @param[in] cache cache
+ * @param[in] mru item is removed from mru list, else lru list
+ * @return removed item's size by policy, 0 if list is empty
+ */
+static uint64_t cache_evict_tail(cache_t* cache, boolean_t mru) {
+    cache_item_t* ci = mru ? cache->mru_list_tail : cache->lru_list_tail;
+
+    if(!ci) {
+        return 0;
+    }
+
+    cache_delete_item(cache, mru, ci);
+
+    if(mru) {
+        hashmap_delete(cache->mru_map, ci->key);
+        cache->mru_size -= ci->size;
+    } else {
+        hashmap_delete(cache->lru_map, ci->key);
+        cache->lru_size -= ci->size;
+    }
+
+    // count policy does not know item sizes, only item records are accounted
+    uint64_t freed = cache->config.policy == CACHE_POLICY_SIZE ? ci->size : sizeof(cache_item_t);
+
+    cache->config.item_key_destroyer(ci->key, ci->item);
+
+    memory_free(ci);
+
+    return freed;
+}
+
+uint64_t cache_shrink(cache_t* cache, uint64_t target) {
+    if(!cache) {
+        return 0;
+    }
+
+    lock_acquire(cache->lock);
+
+    // count policy items have unknown sizes, so at most half of them are evicted at once
+    uint64_t max_count = -1ULL;
+
+    if(cache->config.policy == CACHE_POLICY_COUNT) {
+        max_count = (cache->mru_size + cache->lru_size + 1) / 2;
+    }
+
+    uint64_t freed = 0;
+    uint64_t count = 0;
+
+    // lru items are evicted first, mru items only if it is not enough
+    while(freed < target && count < max_count && cache->lru_list_tail) {
+        freed += cache_evict_tail(cache, false);
+        count++;
+    }
+
+    while(freed < target && count < max_count && cache->mru_list_tail) {
+        freed += cache_evict_tail(cache, true);
+        count++;
+    }
+
+    lock_release(cache->lock);
+
+    return freed;
+}
+
+/**
+ * @brief shrinker callback of caches
+ * @param[in] context cache
+ * @param[in] target requested byte count
+ * @return released byte count
+ */
+static uint64_t cache_shrinker(void* context, uint64_t target) {
+    return cache_shrink((cache_t*)context, target);
+}
+
 cache_t* cache_new (cache_config_t * config) {
     if(!config) {
         return NULL;
@@ -144,6 +220,10 @@ cache_t* cache_new (cache_config_t * config) {
 
     cache->lock = lock_create();
 
+    if(memory_shrinker_register("cache", cache_shrinker, cache) != 0) {
+        PRINTLOG(KERNEL, LOG_WARNING, "cache 0x%p is not shrinkable", cache);
+    }
+
     return cache;
 }
 
@@ -152,6 +232,9 @@ boolean_t cache_destroy (cache_t * cache) {
         return true;
     }
 
+    // shrinker may be running, it should finish before items are destroyed
+    memory_shrinker_unregister(cache_shrinker, cache);
+
     cache_item_t* ci;
 
     ci = cache->mru_list_head;
@@ -245,7 +328,13 @@ boolean_t cache_put(cache_t * cache, const void* key, const void* item, uint64_t
     ci->key = key;
     ci->size = size;
 
-    return cache_put_ci(cache, ci);
+    lock_acquire(cache->lock);
+
+    boolean_t res = cache_put_ci(cache, ci);
+
+    lock_release(cache->lock);
+
+    return res;
 }
 #pragma GCC diagnostic pop
 
@@ -254,25 +343,31 @@ const void* cache_get(cache_t* cache, const void* key) {
         return NULL;
     }
 
+    lock_acquire(cache->lock);
+
+    const void* item = NULL;
+
     cache_item_t* ci = (cache_item_t*)hashmap_get(cache->mru_map, key);
 
     if(ci) {
         cache_move_to_head(cache, true, ci);
 
-        return ci->item;
-    }
-
-    ci = (cache_item_t*)hashmap_get(cache->lru_map, key);
+        item = ci->item;
+    } else {
+        ci = (cache_item_t*)hashmap_get(cache->lru_map, key);
 
-    if(ci) {
-        cache_delete_item(cache, false, ci);
-        hashmap_delete(cache->lru_map, ci->key);
-        cache->lru_size -= ci->size;
+        if(ci) {
+            cache_delete_item(cache, false, ci);
+            hashmap_delete(cache->lru_map, ci->key);
+            cache->lru_size -= ci->size;
 
-        cache_put_ci(cache, ci);
+            item = ci->item;
 
-        return ci->item;
+            cache_put_ci(cache, ci);
+        }
     }
 
-    return NULL;
+    lock_release(cache->lock);
+
+    return item;
 }
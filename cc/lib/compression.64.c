@@ -10,6 +10,7 @@
 #include <compression.h>
 #include <deflate.h>
 #include <zpack.h>
+#include <lz4.h>
 
 MODULE("turnstone.lib");
 
@@ -39,6 +40,12 @@ const compression_t zpack_compression = {
     .unpack = zpack_unpack,
 };
 
+const compression_t lz4_compression = {
+    .type = COMPRESSION_TYPE_LZ4,
+    .pack = lz4_pack,
+    .unpack = lz4_unpack,
+};
+
 const compression_t* compression_get(compression_type_t type) {
     switch(type) {
     case COMPRESSION_TYPE_NONE:
@@ -47,6 +54,8 @@ const compression_t* compression_get(compression_type_t type) {
         return &deflate_compression;
     case COMPRESSION_TYPE_ZPACK:
         return &zpack_compression;
+    case COMPRESSION_TYPE_LZ4:
+        return &lz4_compression;
     default:
         return NULL;
     }
@@ -11,6 +11,12 @@
 #include <quicksort.h>
 #include <logging.h>
 
+#if ___KERNELBUILD == 1
+#include <cpu/task.h>
+#include <apic.h>
+#include <future.h>
+#endif
+
 MODULE("turnstone.lib");
 
 #define DEFLATE_MAX_MATCH (258)
@@ -18,9 +24,12 @@ MODULE("turnstone.lib");
 #define DEFLATE_WINDOW_SIZE 32768
 #define DEFLATE_HASHTABLE_SIZE 15
 #define DEFLATE_HASHTABLE_MUL 2654435761U
-#define DEFLATE_HASHTABLE_PREV_SIZE 32765
 #define DEFLATE_NO_POS (-1)
 #define DEFLATE_MAX_BLOCK_SIZE 65535
+#define DEFLATE_PARALLEL_CHUNK_SIZE (4 * DEFLATE_MAX_BLOCK_SIZE)
+#define DEFLATE_PARALLEL_MIN_SIZE (2 * DEFLATE_PARALLEL_CHUNK_SIZE)
+#define DEFLATE_PARALLEL_WORKER_HEAP_SIZE (8 << 20)
+#define DEFLATE_PARALLEL_WORKER_STACK_SIZE (256 << 10)
 
 
 typedef struct deflate_match_t {
@@ -28,22 +37,51 @@ typedef struct deflate_match_t {
     int64_t best_pos;
 } deflate_match_t;
 
+/**
+ * @struct deflate_hashtable_t
+ * @brief hash chains, head holds latest position of a hash and prev links each position of window to
+ * previous position with same hash
+ */
 typedef struct deflate_hashtable_t {
-    int64_t prev[DEFLATE_HASHTABLE_PREV_SIZE];
-    int64_t head[1ULL << DEFLATE_HASHTABLE_SIZE];
+    int32_t prev[DEFLATE_WINDOW_SIZE]; ///< previous positions, indexed by position modulo window size
+    int32_t head[1ULL << DEFLATE_HASHTABLE_SIZE]; ///< latest positions of hashes
 } deflate_hashtable_t;
 
+/**
+ * @struct deflate_level_config_t
+ * @brief match finder parameters of a compression level
+ */
+typedef struct deflate_level_config_t {
+    uint16_t  good_length; ///< remaining chain is cut to a quarter once best match reaches this length
+    uint16_t  lazy_length; ///< lazy levels try next position for shorter matches, other levels index match interior up to this length
+    uint16_t  nice_length; ///< search stops once best match reaches this length
+    uint16_t  max_chain; ///< chain entries visited per search
+    boolean_t lazy; ///< lazy match evaluation
+} deflate_level_config_t;
+
+/*! match finder parameters of levels, values follow zlib's configuration table */
+static const deflate_level_config_t deflate_level_configs[DEFLATE_LEVEL_MAX + 1] = {
+    {0, 0, 0, 0, false}, // stored blocks only
+    {4, 4, 8, 4, false},
+    {4, 5, 16, 8, false},
+    {4, 6, 32, 32, false},
+    {4, 4, 16, 16, true},
+    {8, 16, 32, 32, true},
+    {8, 16, 128, 128, true},
+    {8, 32, 128, 256, true},
+    {32, 128, 258, 1024, true},
+    {32, 258, 258, 4096, true},
+};
+
+/*! unaligned 64 bit type */
+typedef uint64_t __attribute__((aligned(1), may_alias)) deflate_unaligned_uint64_t;
+
 typedef struct bit_buffer_t {
     buffer_t* buffer;
     uint8_t   byte;
     uint8_t   bit_count;
 } bit_buffer_t;
 
-typedef struct huffman_decode_table_t {
-    uint16_t counts[16];
-    uint16_t symbols[288];
-} huffman_decode_table_t;
-
 typedef struct huffman_encode_table_t {
     uint16_t codes[288];
     uint8_t  lengths[288];
@@ -109,41 +147,6 @@ const huffman_encode_table_t huffman_encode_distance_fixed = {
     },
 };
 
-const huffman_decode_table_t huffman_decode_fixed_lengths = {
-    {
-        0, 0, 0, 0, 0, 0, 0, 24, 152, 112, 0, 0, 0, 0, 0, 0,
-    },
-    {
-        256, 257, 258, 259, 260, 261, 262, 263, 264, 265, 266, 267, 268, 269, 270, 271,
-        272, 273, 274, 275, 276, 277, 278, 279, 0, 1, 2, 3, 4, 5, 6, 7,
-        8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23,
-        24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39,
-        40, 41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, 52, 53, 54, 55,
-        56, 57, 58, 59, 60, 61, 62, 63, 64, 65, 66, 67, 68, 69, 70, 71,
-        72, 73, 74, 75, 76, 77, 78, 79, 80, 81, 82, 83, 84, 85, 86, 87,
-        88, 89, 90, 91, 92, 93, 94, 95, 96, 97, 98, 99, 100, 101, 102, 103,
-        104, 105, 106, 107, 108, 109, 110, 111, 112, 113, 114, 115, 116, 117, 118, 119,
-        120, 121, 122, 123, 124, 125, 126, 127, 128, 129, 130, 131, 132, 133, 134, 135,
-        136, 137, 138, 139, 140, 141, 142, 143, 280, 281, 282, 283, 284, 285, 286, 287,
-        144, 145, 146, 147, 148, 149, 150, 151, 152, 153, 154, 155, 156, 157, 158, 159,
-        160, 161, 162, 163, 164, 165, 166, 167, 168, 169, 170, 171, 172, 173, 174, 175,
-        176, 177, 178, 179, 180, 181, 182, 183, 184, 185, 186, 187, 188, 189, 190, 191,
-        192, 193, 194, 195, 196, 197, 198, 199, 200, 201, 202, 203, 204, 205, 206, 207,
-        208, 209, 210, 211, 212, 213, 214, 215, 216, 217, 218, 219, 220, 221, 222, 223,
-        224, 225, 226, 227, 228, 229, 230, 231, 232, 233, 234, 235, 236, 237, 238, 239,
-        240, 241, 242, 243, 244, 245, 246, 247, 248, 249, 250, 251, 252, 253, 254, 255,
-    }
-};
-
-const huffman_decode_table_t huffman_decode_fixed_distances = {
-    {
-        0, 0, 0, 0, 0, 30, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-    },
-    {
-        0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-    }
-};
-
 const uint16_t huffman_length_base[] = {
     3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258,
 };
@@ -214,10 +217,6 @@ const uint8_t huffman_code_lengths[] = {
     16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15,
 };
 
-int8_t deflate_inflate_uncompressed_block(bit_buffer_t* bit_buffer, buffer_t* out);
-int8_t deflate_inflate_block(bit_buffer_t* bit_buffer, buffer_t* out, huffman_decode_table_t* lengths, huffman_decode_table_t* distances);
-int8_t huffman_decode_table_decode(bit_buffer_t* bit_buffer, huffman_decode_table_t* huffman_lengths, huffman_decode_table_t* huffman_distances);
-
 static inline int64_t bit_buffer_get(bit_buffer_t* bit_buffer, uint8_t bit_count) {
     int64_t result = 0;
 
@@ -281,355 +280,149 @@ static inline int8_t bit_buffer_push(bit_buffer_t* bit_buffer) {
     return 0;
 }
 
-static inline void bitbuffer_discard(bit_buffer_t* bit_buffer) {
-    bit_buffer->bit_count = 0;
-    bit_buffer->byte = 0;
-}
-
-static inline int16_t bit_buffer_get_16le(bit_buffer_t* bit_buffer) {
-    int16_t result = buffer_get_byte(bit_buffer->buffer);
-
-    result |= buffer_get_byte(bit_buffer->buffer) << 8;
-
-    return result;
-}
-
-int8_t deflate_inflate_uncompressed_block(bit_buffer_t* bit_buffer, buffer_t* out) {
-    bitbuffer_discard(bit_buffer); // Align to byte boundary
-
-    uint16_t len = bit_buffer_get_16le(bit_buffer);
-    uint16_t nlen = bit_buffer_get_16le(bit_buffer);
-
-    if (len != (~nlen & 0xFFFF)) {
-        return -1;
-    }
-
-    uint8_t* data = buffer_get_bytes(bit_buffer->buffer, len);
-
-    buffer_append_bytes(out, data, len);
-
-    memory_free(data);
-
-    return 0;
-}
-
-static int32_t huffman_decode(bit_buffer_t* bit_buffer, huffman_decode_table_t* huffman_decode_table, int32_t max_symbol) {
-    int32_t count = 0, cur = 0;
-
-    for (int32_t i = 1; cur >= 0; i++) {
-        int64_t bit = bit_buffer_get(bit_buffer, 1);
-
-        if (bit < 0) {
-            return -1;
-        }
-
-        cur = (cur << 1) | bit;
-        count += huffman_decode_table->counts[i];
-        cur -= huffman_decode_table->counts[i];
-    }
-
-    if (count + cur < 0 || count + cur > max_symbol) {
-        PRINTLOG(COMPRESSION, LOG_ERROR, "invalid huffman symbol index %i %i", count, cur);
-
-        return -1;
-    }
-
-    return huffman_decode_table->symbols[count + cur];
+static inline uint32_t deflate_hash4(uint32_t data) {
+    return (data * DEFLATE_HASHTABLE_MUL) >> (32 - DEFLATE_HASHTABLE_SIZE);
 }
 
-int8_t deflate_inflate_block(bit_buffer_t* bit_buffer, buffer_t* out, huffman_decode_table_t* lengths, huffman_decode_table_t* distances) {
-    while(true) {
-        int32_t symbol = huffman_decode(bit_buffer, lengths, 288);
-
-        if(symbol < 0) {
-            PRINTLOG(COMPRESSION, LOG_ERROR, "corruption before %lli %i", buffer_get_position(bit_buffer->buffer), bit_buffer->bit_count);
-
-            return -1;
-        }
-
-        if(symbol < 256) {
-            buffer_append_byte(out, symbol);
-        } else if(symbol == 256) {
-            break;
-        } else {
-            symbol -= 257;
-
-            int32_t length = bit_buffer_get(bit_buffer, huffman_length_extra_bits[symbol]) + huffman_length_base[symbol];
-
-            if(length < 0) {
-                PRINTLOG(COMPRESSION, LOG_ERROR, "corruption before %lli %i", buffer_get_position(bit_buffer->buffer), bit_buffer->bit_count);
-
-                return -1;
-            }
-
-            int32_t distance_symbol = huffman_decode(bit_buffer, distances, 30);
-
-            if(distance_symbol < 0) {
-                PRINTLOG(COMPRESSION, LOG_ERROR, "corruption before %lli %i", buffer_get_position(bit_buffer->buffer), bit_buffer->bit_count);
-
-                return -1;
-            }
-
-            int32_t distance = bit_buffer_get(bit_buffer, huffman_distance_extra_bits[distance_symbol]) + huffman_distance_base[distance_symbol];
-
-            if(distance < 0) {
-                PRINTLOG(COMPRESSION, LOG_ERROR, "corruption before %lli %i", buffer_get_position(bit_buffer->buffer), bit_buffer->bit_count);
-
-                return -1;
-            }
-
-            uint64_t current_position = buffer_get_position(out);
-            current_position -= distance;
-
-            for (int32_t i = 0; i < length; i++) {
-                buffer_append_byte(out, buffer_peek_byte_at_position(out, current_position++));
-            }
-
-        }
-    }
-
-    return 0;
+/**
+ * @brief hashes minimum match bytes at position
+ * @param[in] p position
+ * @return hash value
+ */
+static inline uint32_t deflate_hash3(const uint8_t* p) {
+    return deflate_hash4(p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16));
 }
 
-static inline int8_t huffman_decode_table_build(uint8_t* lengths, size_t size, struct huffman_decode_table_t* out, uint32_t max_length) {
-
-    uint16_t offsets[16];
-    uint32_t count = 0;
-
-    for(uint32_t i = 0; i < 16; i++) {
-        out->counts[i] = 0;
-    }
-
-    for(uint32_t i = 0; i < size; ++i) {
-        if(lengths[i] > max_length) {
-            return -1;
-        }
-
-        out->counts[lengths[i]]++;
-    }
-
-    out->counts[0] = 0;
-
-    for (uint32_t i = 0; i < 16; ++i) {
-        offsets[i] = count;
-        count += out->counts[i];
-    }
-
-    for (uint32_t i = 0; i < size; ++i) {
-        if (lengths[i]) {
-            out->symbols[offsets[lengths[i]]++] = i;
-        }
-    }
+/**
+ * @brief inserts position to head of its hash chain
+ * @param[in] data input
+ * @param[in] pos position, at least minimum match bytes should follow it
+ * @param[in] ht hashtable
+ */
+static inline void deflate_hash_insert(const uint8_t* data, int32_t pos, deflate_hashtable_t* ht) {
+    uint32_t h = deflate_hash3(data + pos);
 
-    return 0;
+    ht->prev[pos & (DEFLATE_WINDOW_SIZE - 1)] = ht->head[h];
+    ht->head[h] = pos;
 }
 
+/**
+ * @brief counts common bytes of two sequences 8 bytes per step, first difference is found with xor and ctz
+ * @param[in] a first sequence
+ * @param[in] b second sequence
+ * @param[in] max_len comparison limit
+ * @return common byte count
+ */
+static inline int64_t deflate_match_length(const uint8_t* a, const uint8_t* b, int64_t max_len) {
+    int64_t len = 0;
 
-int8_t huffman_decode_table_decode(bit_buffer_t* bit_buffer, huffman_decode_table_t* huffman_lengths, huffman_decode_table_t* huffman_distances) {
-    memory_memclean(huffman_lengths, sizeof(huffman_decode_table_t));
-    memory_memclean(huffman_distances, sizeof(huffman_decode_table_t));
-
-    uint8_t lengths[320] = {0};
-
-    int32_t bit = 0;
-
-    bit = bit_buffer_get(bit_buffer, 5);
-
-    if(bit < 0) {
-        return -1;
-    }
-
-    uint32_t literals  = 257 + bit;
-
-    bit = bit_buffer_get(bit_buffer, 5);
-
-    if(bit < 0) {
-        return -1;
-    }
-
-    uint32_t distances = 1 + bit;
-
-    bit = bit_buffer_get(bit_buffer, 4);
-
-    if(bit < 0) {
-        return -1;
-    }
-
-    uint32_t clengths  = 4 + bit;
-
-    for (uint32_t i = 0; i < clengths; i++) {
-        bit = bit_buffer_get(bit_buffer, 3);
-
-        if(bit < 0) {
-            return -1;
-        }
-
-        lengths[huffman_code_lengths[i]] = bit;
-    }
-
-    huffman_decode_table_t codes = {0};
-
-    if(huffman_decode_table_build(lengths, 19, &codes, 7) < 0) {
-        return -1;
-    }
-
-    uint32_t count = 0;
-
-    while (count < literals + distances) {
-        int32_t symbol = huffman_decode(bit_buffer, &codes, 19);
-
-        if(count == 0 && symbol == 16) {
-            return -1;
-        }
-
-        if (symbol < 0) {
-            return -1;
-        }else if (symbol < 16) {
-            lengths[count++] = symbol;
-        } else if (symbol < 19) {
-            int32_t rep = 0, length;
-
-            if (symbol == 16) {
-                rep = lengths[count - 1];
-
-                bit = bit_buffer_get(bit_buffer, 2);
-
-                if(bit < 0) {
-                    return -1;
-                }
-
-                length = bit + 3;
-            } else if (symbol == 17) {
-                bit = bit_buffer_get(bit_buffer, 3);
-
-                if(bit < 0) {
-                    return -1;
-                }
-
-                length = bit + 3;
-            } else if (symbol == 18) {
-                bit = bit_buffer_get(bit_buffer, 7);
-
-                if(bit < 0) {
-                    return -1;
-                }
-
-                length = bit + 11;
-            }
-
-            do {
-                lengths[count++] = rep;
-                length--;
-            } while (length);
+    while(len + 8 <= max_len) {
+        uint64_t diff = *(const deflate_unaligned_uint64_t*)(a + len) ^ *(const deflate_unaligned_uint64_t*)(b + len);
 
-        } else {
-            return -1;
+        if(diff) {
+            return len + (__builtin_ctzll(diff) >> 3);
         }
-    }
 
-    if(huffman_decode_table_build(lengths, literals, huffman_lengths, 15) < 0) {
-        return -1;
+        len += 8;
     }
 
-    if(huffman_decode_table_build(lengths + literals, distances, huffman_distances, 15) < 0) {
-        return -1;
+    while(len < max_len && a[len] == b[len]) {
+        len++;
     }
 
-    return 0;
-}
-
-static inline uint32_t deflate_hash4(uint32_t data) {
-    return (data * DEFLATE_HASHTABLE_MUL) >> (32 - DEFLATE_HASHTABLE_SIZE);
-}
-
-static inline void deflate_hash_insert(int64_t pos, uint32_t h, deflate_hashtable_t* ht) {
-    ht->prev[pos % DEFLATE_WINDOW_SIZE] = ht->head[h];
-    ht->head[h] = pos;
+    return len;
 }
 
-static deflate_match_t deflate_find_bestmatch (buffer_t* in, int64_t in_len, int64_t in_p, deflate_hashtable_t* ht) {
+/**
+ * @brief walks hash chain of position and returns longest match, position itself is not inserted
+ * @param[in] data input
+ * @param[in] in_len input length
+ * @param[in] in_p position
+ * @param[in] ht hashtable
+ * @param[in] config level parameters
+ * @return best match, best_pos is DEFLATE_NO_POS if there is no match
+ */
+static deflate_match_t deflate_find_bestmatch(const uint8_t* data, int64_t in_len, int64_t in_p, const deflate_hashtable_t* ht, const deflate_level_config_t* config) {
     int64_t max_match = MIN(in_len - in_p, DEFLATE_MAX_MATCH);
-    int64_t start = in_p - DEFLATE_WINDOW_SIZE;
 
-    if(start < 0) {
-        start = 0;
+    if(max_match < DEFLATE_MIN_MATCH) {
+        return (deflate_match_t){.best_size = 0, .best_pos = DEFLATE_NO_POS};
     }
 
-    uint32_t hash = buffer_peek_ints(in, DEFLATE_MIN_MATCH);
-    hash = deflate_hash4(hash);
+    int64_t start = MAX(0, in_p - DEFLATE_WINDOW_SIZE);
+    int64_t nice_length = MIN(config->nice_length, max_match);
+    const uint8_t* cur = data + in_p;
 
     int64_t best_size = 0;
-    int64_t best_pos = -1;
-    int64_t i = ht->head[hash];
-    int64_t max_match_step = 4096;
-
-    while(i != DEFLATE_NO_POS && max_match_step > 0) {
-        if(i < start) {
-            break;
-        }
+    int64_t best_pos = DEFLATE_NO_POS;
+    int64_t i = ht->head[deflate_hash3(cur)];
+    uint32_t chain = config->max_chain;
+    boolean_t chain_cut = false;
 
-        if(best_size >= 32) {
-            max_match_step >>= 2;
-        }
-
-        max_match_step--;
+    while(i != DEFLATE_NO_POS && i >= start && chain > 0) {
+        chain--;
 
-        int64_t j = 0;
-        boolean_t not_matched = false;
+        const uint8_t* cand = data + i;
 
-        for(; j < best_size && j < max_match; j++) {
-            if(buffer_peek_byte_at_position(in, i + j) != buffer_peek_byte_at_position(in, in_p + j)) {
-                not_matched = true;
-
-                break;
-            }
-        }
+        // a candidate can be longer than best match only if it also matches at best match's end
+        if(cand[best_size] == cur[best_size] && cand[0] == cur[0]) {
+            int64_t len = deflate_match_length(cand, cur, max_match);
 
-        if(not_matched) {
-            i = ht->prev[i % DEFLATE_HASHTABLE_PREV_SIZE];
+            if(len > best_size) {
+                best_size = len;
+                best_pos = i;
 
-            continue;
-        }
+                if(len >= nice_length) {
+                    break;
+                }
 
-        for(; j < max_match; j++) {
-            if(buffer_peek_byte_at_position(in, i + j) != buffer_peek_byte_at_position(in, in_p + j)) {
-                break;
+                if(!chain_cut && len >= config->good_length) {
+                    chain >>= 2;
+                    chain_cut = true;
+                }
             }
         }
 
-        if(j >= DEFLATE_MIN_MATCH && j > best_size) {
-            best_size = j;
-            best_pos = i;
-        }
-
-        if(j == max_match) {
-            break;
-        }
-
-        int64_t prev_i = ht->prev[i % DEFLATE_HASHTABLE_PREV_SIZE];
+        int64_t prev_i = ht->prev[i & (DEFLATE_WINDOW_SIZE - 1)];
 
-        if(prev_i == i) {
+        // chains only go backwards, anything else is a slot reused by a newer position
+        if(prev_i >= i) {
             break;
         }
 
         i = prev_i;
     }
 
-    deflate_hash_insert(in_p, hash, ht);
+    if(best_size < DEFLATE_MIN_MATCH) {
+        return (deflate_match_t){.best_size = 0, .best_pos = DEFLATE_NO_POS};
+    }
 
     return (deflate_match_t){.best_size = best_size, .best_pos = best_pos};
 }
 
-static buffer_t* deflate_deflate_lz77(buffer_t* in_block, huffman_encode_freq_t* freqs) {
+static buffer_t* deflate_deflate_lz77(buffer_t* in_block, huffman_encode_freq_t* freqs, const deflate_level_config_t* config) {
+    int64_t history_len = buffer_get_position(in_block);
+    int64_t in_len = buffer_get_length(in_block);
+    const uint8_t* data = buffer_get_view_at_position(in_block, 0, in_len);
+
+    if(data == NULL) {
+        return NULL;
+    }
+
     deflate_hashtable_t* ht = memory_malloc(sizeof(deflate_hashtable_t));
 
     if(ht == NULL) {
         return NULL;
     }
 
-    memory_memset(ht->head, DEFLATE_NO_POS, sizeof(ht->head));
+    memory_memset(ht->head, 0xFF, sizeof(ht->head));
+
+    // bytes before position are history of previous blocks, index them so matches can reach back
+    for(int64_t p = MAX(0, history_len - DEFLATE_WINDOW_SIZE); p < history_len; p++) {
+        deflate_hash_insert(data, p, ht);
+    }
 
-    buffer_t* out_block = buffer_new_with_capacity(NULL, buffer_get_length(in_block) * 2);
+    buffer_t* out_block = buffer_new_with_capacity(NULL, (in_len - history_len) * 2);
 
     if(out_block == NULL) {
         memory_free(ht);
@@ -637,14 +430,29 @@ static buffer_t* deflate_deflate_lz77(buffer_t* in_block, huffman_encode_freq_t*
         return NULL;
     }
 
-    int64_t in_len = buffer_get_length(in_block);
+    int64_t in_p = history_len;
+    deflate_match_t next_dpm = {.best_size = 0, .best_pos = DEFLATE_NO_POS};
+    boolean_t has_next_dpm = false;
+
+    while(in_p < in_len) {
+        deflate_match_t dpm = has_next_dpm ? next_dpm : deflate_find_bestmatch(data, in_len, in_p, ht, config);
+        has_next_dpm = false;
+
+        if(in_p + DEFLATE_MIN_MATCH <= in_len) {
+            deflate_hash_insert(data, in_p, ht);
+        }
 
-    while(buffer_remaining(in_block)) {
-        int64_t in_p = (int64_t)buffer_get_position(in_block);
+        // lazy evaluation: a short match is deferred if next position has a longer one
+        if(dpm.best_pos != DEFLATE_NO_POS && config->lazy && dpm.best_size < config->lazy_length) {
+            next_dpm = deflate_find_bestmatch(data, in_len, in_p + 1, ht, config);
 
-        deflate_match_t dpm = deflate_find_bestmatch(in_block, in_len, in_p, ht);
+            if(next_dpm.best_size > dpm.best_size) {
+                has_next_dpm = true;
+                dpm.best_pos = DEFLATE_NO_POS;
+            }
+        }
 
-        if(dpm.best_pos != DEFLATE_NO_POS && dpm.best_size >= DEFLATE_MIN_MATCH) {
+        if(dpm.best_pos != DEFLATE_NO_POS) {
             uint16_t marker = 0xFFFF;
 
             int64_t distance = in_p - dpm.best_pos;
@@ -669,14 +477,16 @@ static buffer_t* deflate_deflate_lz77(buffer_t* in_block, huffman_encode_freq_t*
 
             freqs->extra_bits_count += huffman_length_extra_bits[length_idx] + huffman_distance_extra_bits[dist_idx];
 
-            if(!buffer_seek(in_block, dpm.best_size, BUFFER_SEEK_DIRECTION_CURRENT)) {
-                memory_free(ht);
-                buffer_destroy(out_block);
-
-                return NULL;
+            // fast levels skip indexing inside long matches
+            if(config->lazy || dpm.best_size <= config->lazy_length) {
+                for(int64_t p = in_p + 1; p < in_p + dpm.best_size && p + DEFLATE_MIN_MATCH <= in_len; p++) {
+                    deflate_hash_insert(data, p, ht);
+                }
             }
+
+            in_p += dpm.best_size;
         } else {
-            int16_t symbol = buffer_get_byte(in_block);
+            int16_t symbol = data[in_p++];
 
             freqs->literal_freqs[symbol]++;
 
@@ -693,8 +503,7 @@ static buffer_t* deflate_deflate_lz77(buffer_t* in_block, huffman_encode_freq_t*
     return out_block;
 }
 
-static int8_t deflate_deflate_no_compress(buffer_t* in_block, bit_buffer_t* bit_buffer, boolean_t is_last_block) {
-    int64_t in_len = buffer_get_length(in_block);
+static int8_t deflate_deflate_no_compress(uint8_t* block, int64_t in_len, bit_buffer_t* bit_buffer, boolean_t is_last_block) {
 
     if(in_len > DEFLATE_MAX_BLOCK_SIZE) {
         return -1;
@@ -728,13 +537,13 @@ static int8_t deflate_deflate_no_compress(buffer_t* in_block, bit_buffer_t* bit_
         return -1;
     }
 
-    in_len = ~in_len & 0xFFFF;
+    int64_t in_nlen = ~in_len & 0xFFFF;
 
-    if(!buffer_append_bytes(bit_buffer->buffer, (uint8_t*)&in_len, 2)) {
+    if(!buffer_append_bytes(bit_buffer->buffer, (uint8_t*)&in_nlen, 2)) {
         return -1;
     }
 
-    if(!buffer_append_buffer(bit_buffer->buffer, in_block)) {
+    if(!buffer_append_bytes(bit_buffer->buffer, block, in_len)) {
         return -1;
     }
 
@@ -1405,234 +1214,1799 @@ exit_error:
 }
 
 
-int8_t deflate_deflate (buffer_t * in, buffer_t* out) {
-    bit_buffer_t bit_buffer = {
-        .buffer = out,
-        .byte = 0,
-        .bit_count = 0
-    };
+/**
+ * @brief compresses a block choosing stored, fixed or dynamic encoding by output size
+ * @param[in] data history bytes followed by block bytes
+ * @param[in] history_len history length, matches may refer to at most last 32 KiB of it
+ * @param[in] block_len block length
+ * @param[in] bit_buffer output bit buffer
+ * @param[in] is_last_block sets final block flag and flushes last partial byte
+ * @param[in] level compression level, level 0 emits stored blocks
+ * @return 0 on success
+ */
+static int8_t deflate_deflate_compress_block(uint8_t* data, int64_t history_len, int64_t block_len, bit_buffer_t* bit_buffer, boolean_t is_last_block, uint8_t level) {
+    int8_t ret = 0;
 
-    while(buffer_remaining(in)) {
-        int64_t in_rem = buffer_remaining(in);
-        int64_t in_pos = buffer_get_position(in);
+    if(block_len == 0) {
+        // empty fixed block with only end of block symbol
+        ret = bit_buffer_put(bit_buffer, 1, is_last_block?1:0);
 
-        int64_t block_len = MIN(in_rem, DEFLATE_MAX_BLOCK_SIZE);
+        if(ret == 0) {
+            ret = bit_buffer_put(bit_buffer, 2, 1);
+        }
 
-        uint8_t* block = buffer_get_view_at_position(in, in_pos, block_len);
+        if(ret == 0) {
+            ret = bit_buffer_put(bit_buffer, huffman_encode_fixed.lengths[256], huffman_encode_fixed.codes[256]);
+        }
 
-        if(!buffer_seek(in, block_len, BUFFER_SEEK_DIRECTION_CURRENT)) {
-            return -1;
+        if(ret == 0 && is_last_block) {
+            ret = bit_buffer_push(bit_buffer);
         }
 
-        boolean_t is_last_block = buffer_remaining(in) == 0;
+        return ret;
+    }
 
-        buffer_t* in_block = buffer_encapsulate(block, block_len);
+    if(level == DEFLATE_LEVEL_STORE) {
+        ret = deflate_deflate_no_compress(data + history_len, block_len, bit_buffer, is_last_block);
 
-        if(!in_block) {
-            return -1;
+        if(ret == 0 && is_last_block) {
+            ret = bit_buffer_push(bit_buffer);
         }
 
-        huffman_encode_freq_t* freqs = memory_malloc(sizeof(huffman_encode_freq_t));
+        return ret;
+    }
 
-        if(!freqs) {
-            buffer_destroy(in_block);
+    buffer_t* in_block = buffer_encapsulate(data, history_len + block_len);
 
-            return -1;
-        }
+    if(!in_block) {
+        return -1;
+    }
 
-        buffer_t* lz77_block = deflate_deflate_lz77(in_block, freqs);
+    if(!buffer_seek(in_block, history_len, BUFFER_SEEK_DIRECTION_START)) {
+        buffer_destroy(in_block);
 
-        if(!lz77_block) {
-            buffer_destroy(in_block);
-            memory_free(freqs);
+        return -1;
+    }
 
-            return -1;
-        }
+    huffman_encode_freq_t* freqs = memory_malloc(sizeof(huffman_encode_freq_t));
 
-        huffman_encode_table_t* dyn_symbols = NULL;
-        huffman_encode_table_t* dyn_distances = NULL;
-        int64_t dyn_header_len = 0;
+    if(!freqs) {
+        buffer_destroy(in_block);
 
-        bit_buffer_t* dyn_header = huffman_encode_build_tables_and_code(freqs, &dyn_symbols, &dyn_distances, &dyn_header_len);
+        return -1;
+    }
 
-        if(!dyn_header || !dyn_symbols || !dyn_distances) {
-            if(dyn_header) {
-                buffer_destroy(dyn_header->buffer);
-            }
+    buffer_t* lz77_block = deflate_deflate_lz77(in_block, freqs, &deflate_level_configs[level]);
 
-            memory_free(dyn_header);
-            memory_free(dyn_symbols);
-            memory_free(dyn_distances);
-            buffer_destroy(in_block);
-            buffer_destroy(lz77_block);
-            memory_free(freqs);
+    if(!lz77_block) {
+        buffer_destroy(in_block);
+        memory_free(freqs);
 
-            return -1;
-        }
+        return -1;
+    }
 
+    huffman_encode_table_t* dyn_symbols = NULL;
+    huffman_encode_table_t* dyn_distances = NULL;
+    int64_t dyn_header_len = 0;
 
-        uint64_t nocompress_len = 0;
+    bit_buffer_t* dyn_header = huffman_encode_build_tables_and_code(freqs, &dyn_symbols, &dyn_distances, &dyn_header_len);
 
-        if(bit_buffer.bit_count <= 5) {
-            nocompress_len = 8 - bit_buffer.bit_count;
-        } else {
-            nocompress_len = 16 - bit_buffer.bit_count;
+    if(!dyn_header || !dyn_symbols || !dyn_distances) {
+        if(dyn_header) {
+            buffer_destroy(dyn_header->buffer);
         }
 
-        nocompress_len += 16 + 16 + buffer_get_length(in_block) * 8;
+        memory_free(dyn_header);
+        memory_free(dyn_symbols);
+        memory_free(dyn_distances);
+        buffer_destroy(in_block);
+        buffer_destroy(lz77_block);
+        memory_free(freqs);
 
-        uint64_t fixedcompress_len = deflate_deflate_calculate_out_size(freqs, &huffman_encode_fixed, &huffman_encode_distance_fixed);
-        uint64_t dyncompress_len = deflate_deflate_calculate_out_size(freqs, dyn_symbols, dyn_distances) + dyn_header_len;
+        return -1;
+    }
 
-        int8_t ret = 0;
 
-        if(nocompress_len < fixedcompress_len) {
-            ret = deflate_deflate_no_compress(in_block, &bit_buffer, is_last_block);
-        } else if(fixedcompress_len < dyncompress_len) {
-            if(is_last_block) {
-                ret = bit_buffer_put(&bit_buffer, 1, 1);
-            } else {
-                ret = bit_buffer_put(&bit_buffer, 1, 0);
+    uint64_t nocompress_len = 0;
+
+    if(bit_buffer->bit_count <= 5) {
+        nocompress_len = 8 - bit_buffer->bit_count;
+    } else {
+        nocompress_len = 16 - bit_buffer->bit_count;
+    }
+
+    nocompress_len += 16 + 16 + block_len * 8;
+
+    uint64_t fixedcompress_len = deflate_deflate_calculate_out_size(freqs, &huffman_encode_fixed, &huffman_encode_distance_fixed);
+    uint64_t dyncompress_len = deflate_deflate_calculate_out_size(freqs, dyn_symbols, dyn_distances) + dyn_header_len;
+
+    if(nocompress_len < fixedcompress_len) {
+        ret = deflate_deflate_no_compress(data + history_len, block_len, bit_buffer, is_last_block);
+    } else if(fixedcompress_len < dyncompress_len) {
+        if(is_last_block) {
+            ret = bit_buffer_put(bit_buffer, 1, 1);
+        } else {
+            ret = bit_buffer_put(bit_buffer, 1, 0);
+        }
+
+        if(ret < 0) {
+            goto end_block_op;
+        }
+
+        ret = bit_buffer_put(bit_buffer, 2, 1);
+
+        if(ret < 0) {
+            goto end_block_op;
+        }
+
+        ret = deflate_deflate_block(lz77_block, bit_buffer, &huffman_encode_fixed, &huffman_encode_distance_fixed);
+    } else {
+        if(is_last_block) {
+            ret = bit_buffer_put(bit_buffer, 1, 1);
+        } else {
+            ret = bit_buffer_put(bit_buffer, 1, 0);
+        }
+
+        if(ret < 0) {
+            goto end_block_op;
+        }
+
+        ret = bit_buffer_put(bit_buffer, 2, 2);
+
+        if(ret < 0) {
+            goto end_block_op;
+        }
+
+        for(int32_t i = 0; i < dyn_header_len; i++) {
+            int8_t dyn_header_bit = bit_buffer_get(dyn_header, 1);
+            ret = bit_buffer_put(bit_buffer, 1, dyn_header_bit);
+
+            if(ret < 0) {
+                goto end_block_op;
+            }
+        }
+
+        ret = deflate_deflate_block(lz77_block, bit_buffer, dyn_symbols, dyn_distances);
+    }
+
+    if(ret == 0 && is_last_block) {
+        ret = bit_buffer_push(bit_buffer);
+    }
+
+end_block_op:
+    memory_free(freqs);
+    buffer_destroy(in_block);
+    buffer_destroy(lz77_block);
+    buffer_destroy(dyn_header->buffer);
+    memory_free(dyn_header);
+    memory_free(dyn_symbols);
+    memory_free(dyn_distances);
+
+    if(ret != 0) {
+        PRINTLOG(COMPRESSION, LOG_ERROR, "Failed to deflate block");
+    }
+
+    return ret;
+}
+
+/**
+ * @brief ends a non final chunk with an empty stored block, so output is byte aligned and
+ * independently compressed chunks can be concatenated
+ * @param[in] bit_buffer output bit buffer
+ * @return 0 on success
+ */
+static int8_t deflate_deflate_sync_flush(bit_buffer_t* bit_buffer) {
+    if(bit_buffer_put(bit_buffer, 3, 0) != 0 || bit_buffer_push(bit_buffer) != 0) {
+        return -1;
+    }
+
+    uint32_t len_nlen = 0xFFFF0000;
+
+    if(!buffer_append_bytes(bit_buffer->buffer, (uint8_t*)&len_nlen, sizeof(len_nlen))) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief compresses a chunk as consecutive blocks
+ * @param[in] data priming history followed by chunk bytes
+ * @param[in] history_len priming history length
+ * @param[in] chunk_len chunk length
+ * @param[in] bit_buffer output bit buffer
+ * @param[in] is_last_chunk last block is marked final, otherwise chunk ends with a sync flush
+ * @param[in] level compression level
+ * @return 0 on success
+ */
+static int8_t deflate_deflate_chunk(uint8_t* data, int64_t history_len, int64_t chunk_len, bit_buffer_t* bit_buffer, boolean_t is_last_chunk, uint8_t level) {
+    int64_t pos = 0;
+
+    do {
+        int64_t block_len = MIN(chunk_len - pos, DEFLATE_MAX_BLOCK_SIZE);
+        int64_t block_history_len = MIN(history_len + pos, DEFLATE_WINDOW_SIZE);
+        boolean_t is_last_block = is_last_chunk && pos + block_len == chunk_len;
+
+        int8_t ret = deflate_deflate_compress_block(data + history_len + pos - block_history_len, block_history_len, block_len, bit_buffer, is_last_block, level);
+
+        if(ret != 0) {
+            return ret;
+        }
+
+        pos += block_len;
+    } while(pos < chunk_len);
+
+    if(!is_last_chunk) {
+        return deflate_deflate_sync_flush(bit_buffer);
+    }
+
+    return 0;
+}
+
+/**
+ * @struct deflate_parallel_job_t
+ * @brief a chunk of parallel deflate
+ */
+typedef struct deflate_parallel_job_t {
+    uint8_t*  data; ///< priming history followed by chunk
+    int64_t   history_len; ///< priming history length
+    int64_t   chunk_len; ///< chunk length
+    boolean_t is_last_chunk; ///< chunk ends the stream
+    uint8_t   level; ///< compression level
+    buffer_t* out; ///< compressed chunk, allocated by caller so it outlives worker's heap
+    int8_t    result; ///< compression result
+#if ___KERNELBUILD == 1
+    future_t* future; ///< completion of worker task, NULL when job runs inline
+    void**    args; ///< worker task arguments
+#endif
+} deflate_parallel_job_t;
+
+/**
+ * @brief compresses a job's chunk
+ * @param[in] job job
+ * @return 0 on success
+ */
+static int8_t deflate_deflate_parallel_job(deflate_parallel_job_t* job) {
+    bit_buffer_t bit_buffer = {
+        .buffer = job->out,
+        .byte = 0,
+        .bit_count = 0
+    };
+
+    return deflate_deflate_chunk(job->data, job->history_len, job->chunk_len, &bit_buffer, job->is_last_chunk, job->level);
+}
+
+#if ___KERNELBUILD == 1
+/**
+ * @brief worker task entry point, compresses a job and releases its future lock
+ * @param[in] args_cnt argument count
+ * @param[in] args job and future lock
+ * @return 0 on success
+ */
+static int32_t deflate_deflate_parallel_worker(uint64_t args_cnt, void** args) {
+    if(args_cnt != 2) {
+        return -1;
+    }
+
+    deflate_parallel_job_t* job = args[0];
+    lock_t* lock = args[1];
+
+    job->result = deflate_deflate_parallel_job(job);
+
+    lock_release(lock);
+
+    return 0;
+}
+#endif
+
+/**
+ * @brief starts a job on a worker task, runs it inline when workers are not available
+ * @param[in] job job
+ * @param[in] use_worker try to start a worker task
+ */
+static void deflate_deflate_parallel_start(deflate_parallel_job_t* job, boolean_t use_worker) {
+#if ___KERNELBUILD == 1
+    if(use_worker) {
+        lock_t* lock = lock_create_for_future(task_get_id());
+        job->args = memory_malloc(sizeof(void*) * 2);
+
+        if(lock && job->args) {
+            job->args[0] = job;
+            job->args[1] = lock;
+            job->future = future_create(lock);
+        }
+
+        if(job->future && task_create_task(NULL, DEFLATE_PARALLEL_WORKER_HEAP_SIZE, DEFLATE_PARALLEL_WORKER_STACK_SIZE,
+                                           deflate_deflate_parallel_worker, 2, job->args, "deflate worker") != -1ULL) {
+            return;
+        }
+
+        PRINTLOG(COMPRESSION, LOG_WARNING, "cannot start deflate worker, compressing chunk inline");
+
+        // future lock is created held for the worker, nobody else releases it
+        if(job->future) {
+            lock_release(lock);
+            future_get_data_and_destroy(job->future);
+            job->future = NULL;
+        } else {
+            lock_destroy(lock);
+        }
+
+        memory_free(job->args);
+        job->args = NULL;
+    }
+#else
+    UNUSED(use_worker);
+#endif
+
+    job->result = deflate_deflate_parallel_job(job);
+}
+
+/**
+ * @brief waits a job started by deflate_deflate_parallel_start
+ * @param[in] job job
+ */
+static void deflate_deflate_parallel_wait(deflate_parallel_job_t* job) {
+#if ___KERNELBUILD == 1
+    if(job->future) {
+        future_get_data_and_destroy(job->future);
+        memory_free(job->args);
+        job->future = NULL;
+        job->args = NULL;
+    }
+#else
+    UNUSED(job);
+#endif
+}
+
+/**
+ * @brief returns how many chunks can be compressed at the same time
+ * @return cpu count when tasking is running, otherwise 1
+ */
+static uint64_t deflate_deflate_parallel_max_workers(void) {
+#if ___KERNELBUILD == 1
+    if(task_get_current_task()) {
+        return apic_get_ap_count() + 1;
+    }
+#endif
+
+    return 1;
+}
+
+int8_t deflate_deflate_parallel(buffer_t* in, buffer_t* out, uint64_t worker_count, uint8_t level) {
+    if(level > DEFLATE_LEVEL_MAX) {
+        PRINTLOG(COMPRESSION, LOG_ERROR, "invalid deflate level %i", level);
+
+        return -1;
+    }
+
+    int64_t in_len = buffer_remaining(in);
+
+    if(in_len == 0) {
+        return 0;
+    }
+
+    uint64_t max_workers = deflate_deflate_parallel_max_workers();
+
+    if(worker_count == 0 || worker_count > max_workers) {
+        worker_count = max_workers;
+    }
+
+    int64_t in_pos = buffer_get_position(in);
+    int64_t history_len = MIN(in_pos, DEFLATE_WINDOW_SIZE);
+
+    uint8_t* data = buffer_get_view_at_position(in, in_pos - history_len, history_len + in_len);
+
+    if(!data) {
+        return -1;
+    }
+
+    data += history_len;
+
+    uint64_t chunk_count = (in_len + DEFLATE_PARALLEL_CHUNK_SIZE - 1) / DEFLATE_PARALLEL_CHUNK_SIZE;
+
+    deflate_parallel_job_t* jobs = memory_malloc(sizeof(deflate_parallel_job_t) * chunk_count);
+
+    if(!jobs) {
+        return -1;
+    }
+
+    for(uint64_t i = 0; i < chunk_count; i++) {
+        int64_t chunk_start = i * DEFLATE_PARALLEL_CHUNK_SIZE;
+
+        // each chunk is primed with last 32 KiB before it, so matches do not suffer from the split
+        jobs[i].history_len = MIN(history_len + chunk_start, DEFLATE_WINDOW_SIZE);
+        jobs[i].data = data + chunk_start - jobs[i].history_len;
+        jobs[i].chunk_len = MIN(in_len - chunk_start, DEFLATE_PARALLEL_CHUNK_SIZE);
+        jobs[i].is_last_chunk = i == chunk_count - 1;
+        jobs[i].level = level;
+    }
+
+    int8_t ret = 0;
+
+    for(uint64_t wave = 0; wave < chunk_count && ret == 0; wave += worker_count) {
+        uint64_t wave_end = MIN(wave + worker_count, chunk_count);
+
+        for(uint64_t i = wave; i < wave_end; i++) {
+            jobs[i].out = buffer_new_with_capacity(NULL, jobs[i].chunk_len + 1024);
+
+            if(!jobs[i].out) {
+                wave_end = i;
+                ret = -1;
+
+                break;
             }
+        }
+
+        // caller compresses first chunk of the wave while workers compress the others
+        for(uint64_t i = wave + 1; i < wave_end; i++) {
+            deflate_deflate_parallel_start(&jobs[i], true);
+        }
+
+        if(wave < wave_end) {
+            deflate_deflate_parallel_start(&jobs[wave], false);
+        }
+
+        for(uint64_t i = wave; i < wave_end; i++) {
+            deflate_deflate_parallel_wait(&jobs[i]);
+
+            if(ret == 0 && (jobs[i].result != 0 || !buffer_append_buffer(out, jobs[i].out))) {
+                PRINTLOG(COMPRESSION, LOG_ERROR, "Failed to deflate chunk 0x%llx", i);
+
+                ret = -1;
+            }
+
+            buffer_destroy(jobs[i].out);
+        }
+    }
+
+    memory_free(jobs);
+
+    if(ret == 0 && !buffer_seek(in, in_len, BUFFER_SEEK_DIRECTION_CURRENT)) {
+        ret = -1;
+    }
+
+    return ret;
+}
+
+int8_t deflate_deflate (buffer_t * in, buffer_t* out) {
+    return deflate_deflate_with_level(in, out, DEFLATE_LEVEL_DEFAULT);
+}
+
+int8_t deflate_deflate_with_level(buffer_t* in, buffer_t* out, uint8_t level) {
+    if(level > DEFLATE_LEVEL_MAX) {
+        PRINTLOG(COMPRESSION, LOG_ERROR, "invalid deflate level %i", level);
+
+        return -1;
+    }
+
+    int64_t in_len = buffer_remaining(in);
+
+    if(in_len == 0) {
+        return 0;
+    }
+
+    if(in_len >= DEFLATE_PARALLEL_MIN_SIZE && deflate_deflate_parallel_max_workers() > 1) {
+        return deflate_deflate_parallel(in, out, 0, level);
+    }
+
+    bit_buffer_t bit_buffer = {
+        .buffer = out,
+        .byte = 0,
+        .bit_count = 0
+    };
+
+    int64_t in_pos = buffer_get_position(in);
+    int64_t history_len = MIN(in_pos, DEFLATE_WINDOW_SIZE);
+
+    uint8_t* data = buffer_get_view_at_position(in, in_pos - history_len, history_len + in_len);
+
+    if(!data) {
+        return -1;
+    }
+
+    int8_t ret = deflate_deflate_chunk(data, history_len, in_len, &bit_buffer, true, level);
+
+    if(ret == 0 && !buffer_seek(in, in_len, BUFFER_SEEK_DIRECTION_CURRENT)) {
+        ret = -1;
+    }
+
+    return ret;
+}
+
+/**
+ * @struct deflate_deflate_state_t
+ * @brief streaming compressor state, input is gathered into a block after 32 KiB history
+ */
+typedef struct deflate_deflate_state_t {
+    uint8_t      window[DEFLATE_WINDOW_SIZE + DEFLATE_MAX_BLOCK_SIZE]; ///< history followed by current block
+    int64_t      history_len; ///< history length at window
+    int64_t      block_len; ///< gathered bytes of current block
+    bit_buffer_t bit_buffer; ///< compressed output, complete bytes wait at buffer until drained
+    uint64_t     drained; ///< drained bytes of bit buffer's buffer
+    uint8_t      level; ///< compression level
+    boolean_t    finished; ///< last block is compressed
+} deflate_deflate_state_t;
+
+/**
+ * @brief copies compressed bytes to caller window and resets output buffer when it is empty
+ * @param[in] ds compressor state
+ * @param[out] out output window
+ * @param[in] out_len output window size
+ * @param[in,out] out_written bytes written to output window
+ * @return true if all compressed bytes are drained
+ */
+static boolean_t deflate_deflate_stream_drain(deflate_deflate_state_t* ds, uint8_t* out, uint64_t out_len, uint64_t* out_written) {
+    buffer_t* buf = ds->bit_buffer.buffer;
+    uint64_t pending = buffer_get_length(buf) - ds->drained;
+    uint64_t len = MIN(pending, out_len - *out_written);
+
+    if(len) {
+        memory_memcopy(buffer_get_view_at_position(buf, ds->drained, len), out + *out_written, len);
+        ds->drained += len;
+        *out_written += len;
+    }
+
+    if(ds->drained == buffer_get_length(buf)) {
+        buffer_reset(buf);
+        ds->drained = 0;
+
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * @brief compresses gathered block and slides last 32 KiB into history
+ * @param[in] ds compressor state
+ * @param[in] is_last_block final block flag
+ * @return 0 on success
+ */
+static int8_t deflate_deflate_stream_block(deflate_deflate_state_t* ds, boolean_t is_last_block) {
+    if(deflate_deflate_compress_block(ds->window, ds->history_len, ds->block_len, &ds->bit_buffer, is_last_block, ds->level) != 0) {
+        return -1;
+    }
+
+    int64_t total = ds->history_len + ds->block_len;
+    int64_t keep = MIN(total, DEFLATE_WINDOW_SIZE);
+
+    if(keep != total) {
+        memory_memcopy(ds->window + total - keep, ds->window, keep);
+    }
+
+    ds->history_len = keep;
+    ds->block_len = 0;
+
+    return 0;
+}
+
+/*! root bits of literal/length decode table */
+#define DEFLATE_INFLATE_LITLEN_TABLE_BITS 10
+/*! root bits of distance decode table */
+#define DEFLATE_INFLATE_DIST_TABLE_BITS 8
+/*! root bits of code length decode table, code lengths are at most 7 bits so it is single level */
+#define DEFLATE_INFLATE_CODELEN_TABLE_BITS 7
+/*! literal/length decode table size with subtables */
+#define DEFLATE_INFLATE_LITLEN_TABLE_SIZE 2048
+/*! distance decode table size with subtables */
+#define DEFLATE_INFLATE_DIST_TABLE_SIZE 1024
+/*! code length decode table size */
+#define DEFLATE_INFLATE_CODELEN_TABLE_SIZE 128
+/*! fast path needs this many input bytes for a 64 bit refill */
+#define DEFLATE_INFLATE_FAST_IN_SLACK 8
+/*! fast path needs room for longest match plus wild copy overrun */
+#define DEFLATE_INFLATE_FAST_OUT_SLACK (DEFLATE_MAX_MATCH + 16)
+/*! minimum output reservation when output buffer has no spare capacity */
+#define DEFLATE_INFLATE_MIN_RESERVE 0x10000
+
+/*! decode table entry: symbol is not valid at this position */
+#define DEFLATE_INFLATE_ENTRY_INVALID  0x80000000U
+/*! decode table entry: value is subtable index, extra is subtable bits */
+#define DEFLATE_INFLATE_ENTRY_SUBTABLE 0x40000000U
+/*! decode table entry: value is a literal byte */
+#define DEFLATE_INFLATE_ENTRY_LITERAL  0x20000000U
+/*! decode table entry: end of block */
+#define DEFLATE_INFLATE_ENTRY_EOB      0x10000000U
+
+/*! builds a decode table entry: flags, 16 bit value (literal or base), extra bit count and code length */
+#define DEFLATE_INFLATE_ENTRY(f, v, e, l) ((f) | ((uint32_t)(v) << 12) | ((uint32_t)(e) << 8) | (uint32_t)(l))
+/*! code length of entry, bits consumed before extra bits */
+#define DEFLATE_INFLATE_ENTRY_LENGTH(e) ((e) & 0x1F)
+/*! extra bit count of entry */
+#define DEFLATE_INFLATE_ENTRY_EXTRA(e) (((e) >> 8) & 0xF)
+/*! value of entry */
+#define DEFLATE_INFLATE_ENTRY_VALUE(e) (((e) >> 12) & 0xFFFF)
+
+/*! stream mode sliding window: 32 KiB history and 64 KiB of new output */
+#define DEFLATE_INFLATE_STREAM_WINDOW_SIZE (3 * DEFLATE_WINDOW_SIZE)
+
+/*! bits needed to decode a length/distance pair with extra bits */
+#define DEFLATE_INFLATE_SYMBOL_PAIR_BITS 48
+
+/**
+ * @enum deflate_inflate_step_t
+ * @brief inflate resume points, decoding is suspended only at these steps
+ */
+typedef enum deflate_inflate_step_t {
+    DEFLATE_INFLATE_STEP_HEADER, ///< next block header
+    DEFLATE_INFLATE_STEP_STORED_HEADER, ///< stored block length
+    DEFLATE_INFLATE_STEP_STORED_COPY, ///< stored block data
+    DEFLATE_INFLATE_STEP_DYNAMIC_COUNTS, ///< dynamic block code counts
+    DEFLATE_INFLATE_STEP_DYNAMIC_CODE_LENGTHS, ///< code length code lengths
+    DEFLATE_INFLATE_STEP_DYNAMIC_LENGTHS, ///< literal/length and distance code lengths
+    DEFLATE_INFLATE_STEP_BLOCK, ///< huffman coded data
+    DEFLATE_INFLATE_STEP_DONE, ///< last block is decoded
+    DEFLATE_INFLATE_STEP_ERROR, ///< stream is corrupted
+} deflate_inflate_step_t;
+
+/**
+ * @struct deflate_inflate_state_t
+ * @brief inflate state, input bits are kept at a 64 bit reservoir.
+ * at one shot mode output is written in place to output buffer, at stream mode output is written
+ * to a sliding window and flushed to caller's output window.
+ */
+typedef struct deflate_inflate_state_t {
+    const uint8_t*         in_start; ///< input start of current call
+    const uint8_t*         in; ///< next input byte to load into reservoir
+    const uint8_t*         in_end; ///< input end
+    uint64_t               bitbuf; ///< bit reservoir, lsb first
+    uint32_t               bitcount; ///< valid bits at reservoir
+    uint32_t               overread; ///< zero bytes loaded after input end
+    boolean_t              final; ///< no more input will come, input end is padded with zeros
+    boolean_t              last_block; ///< current block is the last one
+    deflate_inflate_step_t step; ///< resume point
+    uint32_t               literals; ///< dynamic block literal/length code count
+    uint32_t               distances; ///< dynamic block distance code count
+    uint32_t               clengths; ///< dynamic block code length code count
+    uint32_t               count; ///< decoded code lengths at dynamic header
+    uint32_t               stored_left; ///< remaining bytes of stored block
+    buffer_t*              out; ///< output buffer at one shot mode, NULL at stream mode
+    uint8_t*               out_base; ///< output start, back references can reach here
+    uint8_t*               out_cur; ///< start of uncommitted (one shot) or unflushed (stream) output
+    uint8_t*               op; ///< output pointer
+    uint8_t*               oend; ///< end of reserved output
+    uint8_t*               window; ///< stream mode sliding window
+    uint8_t*               user_out; ///< stream mode caller output window position
+    uint8_t*               user_out_end; ///< stream mode caller output window end
+    uint8_t                lengths[320]; ///< code lengths of dynamic header
+    uint32_t               litlen_table[DEFLATE_INFLATE_LITLEN_TABLE_SIZE]; ///< literal/length decode table
+    uint32_t               dist_table[DEFLATE_INFLATE_DIST_TABLE_SIZE]; ///< distance decode table
+    uint32_t               codelen_table[DEFLATE_INFLATE_CODELEN_TABLE_SIZE]; ///< code length decode table
+} deflate_inflate_state_t;
+
+/**
+ * @brief refills bit reservoir to at least 56 bits, 8 bytes at a time when input allows.
+ * near input end of final input zero bytes are loaded and counted at overread.
+ * @param[in] s inflate state
+ */
+static inline void deflate_inflate_refill(deflate_inflate_state_t* s) {
+    if(s->in_end - s->in >= 8) {
+        s->bitbuf |= *(const deflate_unaligned_uint64_t*)s->in << s->bitcount;
+        s->in += (63 - s->bitcount) >> 3;
+        s->bitcount |= 56;
+
+        return;
+    }
+
+    while(s->bitcount <= 56) {
+        if(s->in < s->in_end) {
+            s->bitbuf |= (uint64_t)*s->in << s->bitcount;
+            s->in++;
+        } else if(s->final) {
+            s->overread++;
+        } else {
+            break;
+        }
+
+        s->bitcount += 8;
+    }
+}
+
+/**
+ * @brief checks if a step needing count bits can run. when input is not final and it is short,
+ * remaining input is moved into reservoir and step should be retried with more input.
+ * @param[in] s inflate state
+ * @param[in] count needed bits, at most 56
+ * @return true if step can run
+ */
+static inline boolean_t deflate_inflate_need(deflate_inflate_state_t* s, uint32_t count) {
+    if(s->final || s->bitcount + 8 * (uint64_t)(s->in_end - s->in) >= count) {
+        return true;
+    }
+
+    while(s->in < s->in_end) {
+        s->bitbuf |= (uint64_t)*s->in << s->bitcount;
+        s->in++;
+        s->bitcount += 8;
+    }
+
+    return false;
+}
+
+/**
+ * @brief checks if consumed bits are all from real input
+ * @param[in] s inflate state
+ * @return true if no zero padding is consumed
+ */
+static inline boolean_t deflate_inflate_input_valid(deflate_inflate_state_t* s) {
+    return s->bitcount >= s->overread * 8;
+}
+
+/**
+ * @brief reads up to 32 bits from reservoir
+ * @param[in] s inflate state
+ * @param[in] count bit count
+ * @return bits
+ */
+static inline uint32_t deflate_inflate_bits(deflate_inflate_state_t* s, uint32_t count) {
+    if(s->bitcount < count) {
+        deflate_inflate_refill(s);
+    }
+
+    uint32_t res = s->bitbuf & ((1ULL << count) - 1);
+
+    s->bitbuf >>= count;
+    s->bitcount -= count;
+
+    return res;
+}
+
+/**
+ * @brief gives whole unused reservoir bytes of current call back to input and empties reservoir
+ * @param[in] s inflate state
+ */
+static inline void deflate_inflate_release_input(deflate_inflate_state_t* s) {
+    uint64_t unused = (s->bitcount >> 3) - s->overread;
+
+    s->in -= MIN(unused, (uint64_t)(s->in - s->in_start));
+    s->bitbuf = 0;
+    s->bitcount = 0;
+    s->overread = 0;
+}
+
+/**
+ * @brief looks up a symbol from a two level decode table
+ * @param[in] table decode table
+ * @param[in] root_bits root table bits
+ * @param[in] bitbuf bit reservoir
+ * @return table entry
+ */
+static inline uint32_t deflate_inflate_lookup(const uint32_t* table, uint32_t root_bits, uint64_t bitbuf) {
+    uint32_t entry = table[bitbuf & ((1U << root_bits) - 1)];
+
+    if(entry & DEFLATE_INFLATE_ENTRY_SUBTABLE) {
+        uint32_t sub_bits = DEFLATE_INFLATE_ENTRY_EXTRA(entry);
+
+        entry = table[DEFLATE_INFLATE_ENTRY_VALUE(entry) + ((bitbuf >> root_bits) & ((1U << sub_bits) - 1))];
+    }
+
+    return entry;
+}
+
+/**
+ * @brief consumes an entry's code and extra bits and returns its value plus extra bits
+ * @param[in] s inflate state
+ * @param[in] entry table entry
+ * @return decoded value
+ */
+static inline uint32_t deflate_inflate_consume(deflate_inflate_state_t* s, uint32_t entry) {
+    uint32_t len = DEFLATE_INFLATE_ENTRY_LENGTH(entry);
+    uint32_t extra = DEFLATE_INFLATE_ENTRY_EXTRA(entry);
+
+    s->bitbuf >>= len;
+
+    uint32_t value = DEFLATE_INFLATE_ENTRY_VALUE(entry) + (s->bitbuf & ((1U << extra) - 1));
+
+    s->bitbuf >>= extra;
+    s->bitcount -= len + extra;
+
+    return value;
+}
+
+static uint32_t deflate_inflate_litlen_entry(uint32_t symbol) {
+    if(symbol < 256) {
+        return DEFLATE_INFLATE_ENTRY(DEFLATE_INFLATE_ENTRY_LITERAL, symbol, 0, 0);
+    }
+
+    if(symbol == 256) {
+        return DEFLATE_INFLATE_ENTRY(DEFLATE_INFLATE_ENTRY_EOB, 0, 0, 0);
+    }
+
+    if(symbol < 286) {
+        return DEFLATE_INFLATE_ENTRY(0, huffman_length_base[symbol - 257], huffman_length_extra_bits[symbol - 257], 0);
+    }
+
+    return DEFLATE_INFLATE_ENTRY_INVALID;
+}
+
+static uint32_t deflate_inflate_dist_entry(uint32_t symbol) {
+    if(symbol < 30) {
+        return DEFLATE_INFLATE_ENTRY(0, huffman_distance_base[symbol], huffman_distance_extra_bits[symbol], 0);
+    }
+
+    return DEFLATE_INFLATE_ENTRY_INVALID;
+}
+
+static uint32_t deflate_inflate_codelen_entry(uint32_t symbol) {
+    return DEFLATE_INFLATE_ENTRY(DEFLATE_INFLATE_ENTRY_LITERAL, symbol, 0, 0);
+}
+
+/**
+ * @brief builds a multi level decode table from canonical code lengths.
+ * codes not longer than root bits are replicated at root table, longer codes go to subtables
+ * sized by the remaining code space of their prefix. entries with zero length are invalid.
+ * @param[in] lengths code lengths of symbols
+ * @param[in] count symbol count
+ * @param[in] symbol_entry builds value/extra/flags part of a symbol's entry
+ * @param[in] root_bits root table bits
+ * @param[out] table decode table
+ * @param[in] table_size decode table capacity
+ * @return 0 on success
+ */
+static int8_t deflate_inflate_build_table(const uint8_t* lengths, uint32_t count, uint32_t (*symbol_entry)(uint32_t),
+                                          uint32_t root_bits, uint32_t* table, uint32_t table_size) {
+    uint16_t counts[16] = {0};
+    uint16_t offsets[16] = {0};
+    uint16_t sorted[320] = {0};
+
+    memory_memclean(table, table_size * sizeof(uint32_t));
+
+    for(uint32_t i = 0; i < count; i++) {
+        if(lengths[i] > 15) {
+            return -1;
+        }
+
+        counts[lengths[i]]++;
+    }
+
+    counts[0] = 0;
+
+    uint32_t max = 15;
+
+    while(max > 0 && counts[max] == 0) {
+        max--;
+    }
+
+    if(max == 0) {
+        return 0; // no codes, every lookup is invalid
+    }
+
+    uint32_t min = 1;
+
+    while(counts[min] == 0) {
+        min++;
+    }
+
+    int32_t left = 1;
+
+    for(uint32_t len = 1; len < 16; len++) {
+        left <<= 1;
+        left -= counts[len];
+
+        if(left < 0) {
+            PRINTLOG(COMPRESSION, LOG_ERROR, "over subscribed huffman code");
+
+            return -1;
+        }
+    }
+
+    for(uint32_t len = 1; len < 15; len++) {
+        offsets[len + 1] = offsets[len] + counts[len];
+    }
+
+    for(uint32_t i = 0; i < count; i++) {
+        if(lengths[i]) {
+            sorted[offsets[lengths[i]]++] = i;
+        }
+    }
+
+    uint32_t huff = 0; // bit reversed code of current symbol
+    uint32_t sym = 0;
+    uint32_t len = min;
+    uint32_t curr = root_bits;
+    uint32_t drop = 0;
+    int64_t low = -1;
+    uint32_t used = 1U << root_bits;
+    uint32_t mask = used - 1;
+    uint32_t next = 0;
+
+    if(used > table_size) {
+        return -1;
+    }
+
+    while(true) {
+        uint32_t here = symbol_entry(sorted[sym]) | len;
+        uint32_t incr = 1U << (len - drop);
+        uint32_t fill = 1U << curr;
+
+        do {
+            fill -= incr;
+            table[next + (huff >> drop) + fill] = here;
+        } while(fill != 0);
+
+        incr = 1U << (len - 1);
+
+        while(huff & incr) {
+            incr >>= 1;
+        }
+
+        if(incr != 0) {
+            huff &= incr - 1;
+            huff += incr;
+        } else {
+            huff = 0;
+        }
+
+        sym++;
+
+        if(--counts[len] == 0) {
+            if(len == max) {
+                break;
+            }
+
+            len = lengths[sorted[sym]];
+        }
+
+        if(len > root_bits && (int64_t)(huff & mask) != low) {
+            if(drop == 0) {
+                drop = root_bits;
+            }
+
+            next += 1U << curr;
+
+            curr = len - drop;
+            left = 1 << curr;
+
+            while(curr + drop < max) {
+                left -= counts[curr + drop];
+
+                if(left <= 0) {
+                    break;
+                }
+
+                curr++;
+                left <<= 1;
+            }
+
+            used += 1U << curr;
+
+            if(used > table_size) {
+                PRINTLOG(COMPRESSION, LOG_ERROR, "huffman decode table overflow");
+
+                return -1;
+            }
+
+            low = huff & mask;
+            table[low] = DEFLATE_INFLATE_ENTRY(DEFLATE_INFLATE_ENTRY_SUBTABLE, next, curr, root_bits);
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief commits written output and reserves at least need bytes more
+ * @param[in] s inflate state
+ * @param[in] need minimum bytes to reserve
+ * @return 0 on success
+ */
+static int8_t deflate_inflate_reserve(deflate_inflate_state_t* s, uint64_t need) {
+    if(s->op != s->out_cur && !buffer_seek(s->out, s->op - s->out_cur, BUFFER_SEEK_DIRECTION_CURRENT)) {
+        return -1;
+    }
+
+    uint64_t reserve = buffer_get_length(s->out);
+
+    reserve = MAX(reserve, need);
+    reserve = MAX(reserve, DEFLATE_INFLATE_MIN_RESERVE);
+
+    uint8_t* cur = buffer_reserve(s->out, reserve);
+
+    if(!cur) {
+        PRINTLOG(COMPRESSION, LOG_ERROR, "cannot reserve output");
+
+        return -1;
+    }
+
+    s->out_base = cur - buffer_get_position(s->out);
+    s->out_cur = cur;
+    s->op = cur;
+    s->oend = cur + reserve;
+
+    return 0;
+}
+
+/**
+ * @brief copies 8 bytes with a single unaligned move
+ * @param[in] dst destination
+ * @param[in] src source
+ */
+static inline void deflate_inflate_copy8(uint8_t* dst, const uint8_t* src) {
+    *(deflate_unaligned_uint64_t*)dst = *(const deflate_unaligned_uint64_t*)src;
+}
+
+/**
+ * @brief copies a match, may write up to 15 bytes after match end
+ * @param[in] op output pointer
+ * @param[in] distance match distance
+ * @param[in] length match length
+ */
+static inline void deflate_inflate_copy_match_fast(uint8_t* op, uint32_t distance, uint32_t length) {
+    const uint8_t* src = op - distance;
+    uint8_t* end = op + length;
+
+    if(distance >= 16) {
+        do {
+            deflate_inflate_copy8(op, src);
+            deflate_inflate_copy8(op + 8, src + 8);
+            op += 16;
+            src += 16;
+        } while(op < end);
+    } else if(distance >= 8) {
+        do {
+            deflate_inflate_copy8(op, src);
+            op += 8;
+            src += 8;
+        } while(op < end);
+    } else {
+        while(op < end) {
+            *op++ = *src++;
+        }
+    }
+}
+
+/**
+ * @brief copies unflushed window bytes to caller's output window
+ * @param[in] s inflate state
+ */
+static void deflate_inflate_flush(deflate_inflate_state_t* s) {
+    uint64_t len = MIN((uint64_t)(s->op - s->out_cur), (uint64_t)(s->user_out_end - s->user_out));
+
+    memory_memcopy(s->out_cur, s->user_out, len);
+
+    s->out_cur += len;
+    s->user_out += len;
+}
+
+/**
+ * @brief makes room for at least need bytes of output.
+ * one shot mode grows output buffer, stream mode flushes window and slides last 32 KiB to window start.
+ * @param[in] s inflate state
+ * @param[in] need needed bytes, at most DEFLATE_INFLATE_FAST_OUT_SLACK at stream mode
+ * @return 0 on success, 1 if caller's output window is full, -1 on error
+ */
+static int8_t deflate_inflate_make_room(deflate_inflate_state_t* s, uint64_t need) {
+    if(s->out) {
+        return (uint64_t)(s->oend - s->op) >= need ? 0 : deflate_inflate_reserve(s, need);
+    }
+
+    deflate_inflate_flush(s);
+
+    if((uint64_t)(s->oend - s->op) >= need) {
+        return 0;
+    }
+
+    if(s->out_cur != s->op) {
+        return 1;
+    }
+
+    uint64_t keep = MIN((uint64_t)(s->op - s->window), DEFLATE_WINDOW_SIZE);
+
+    memory_memcopy(s->op - keep, s->window, keep);
+
+    s->op = s->window + keep;
+    s->out_cur = s->op;
+
+    return 0;
+}
+
+/**
+ * @brief decodes stored block length
+ * @param[in] s inflate state
+ * @return DEFLATE_STREAM_OK if more input is needed, DEFLATE_STREAM_END when step is done
+ */
+static deflate_stream_status_t deflate_inflate_stored_header(deflate_inflate_state_t* s) {
+    uint32_t align = s->bitcount & 7;
+
+    if(!deflate_inflate_need(s, align + 32)) {
+        return DEFLATE_STREAM_OK;
+    }
+
+    deflate_inflate_bits(s, align); // Align to byte boundary
+
+    uint16_t len = deflate_inflate_bits(s, 16);
+    uint16_t nlen = deflate_inflate_bits(s, 16);
+
+    if(!deflate_inflate_input_valid(s)) {
+        PRINTLOG(COMPRESSION, LOG_ERROR, "unexpected end of input stream");
+
+        return DEFLATE_STREAM_ERROR;
+    }
+
+    if (len != (~nlen & 0xFFFF)) {
+        PRINTLOG(COMPRESSION, LOG_ERROR, "stored block length mismatch");
+
+        return DEFLATE_STREAM_ERROR;
+    }
+
+    s->stored_left = len;
+    s->step = DEFLATE_INFLATE_STEP_STORED_COPY;
+
+    return DEFLATE_STREAM_END;
+}
+
+/**
+ * @brief copies stored block data, first from reservoir then from input
+ * @param[in] s inflate state
+ * @return DEFLATE_STREAM_OK if more input is needed, DEFLATE_STREAM_OUTPUT_FULL if output is full, DEFLATE_STREAM_END when step is done
+ */
+static deflate_stream_status_t deflate_inflate_stored_copy(deflate_inflate_state_t* s) {
+    while(s->stored_left) {
+        int8_t room = deflate_inflate_make_room(s, 1);
+
+        if(room < 0) {
+            return DEFLATE_STREAM_ERROR;
+        }
+
+        if(room > 0) {
+            return DEFLATE_STREAM_OUTPUT_FULL;
+        }
+
+        if(s->bitcount >= 8) {
+            *s->op++ = deflate_inflate_bits(s, 8);
+            s->stored_left--;
+
+            continue;
+        }
+
+        if(!deflate_inflate_input_valid(s)) {
+            break;
+        }
+
+        // reservoir is empty, drop stale bits of look ahead bytes which are copied directly
+        s->bitbuf = 0;
+
+        uint64_t len = MIN((uint64_t)s->stored_left, (uint64_t)(s->oend - s->op));
+
+        len = MIN(len, (uint64_t)(s->in_end - s->in));
+
+        if(len == 0) {
+            if(s->final) {
+                break;
+            }
+
+            return DEFLATE_STREAM_OK;
+        }
+
+        memory_memcopy(s->in, s->op, len);
+
+        s->in += len;
+        s->op += len;
+        s->stored_left -= len;
+    }
+
+    if(s->stored_left || !deflate_inflate_input_valid(s)) {
+        PRINTLOG(COMPRESSION, LOG_ERROR, "unexpected end of input stream");
+
+        return DEFLATE_STREAM_ERROR;
+    }
+
+    s->step = DEFLATE_INFLATE_STEP_HEADER;
+
+    return DEFLATE_STREAM_END;
+}
+
+/**
+ * @brief decodes dynamic huffman tables of a block, resumable at each code length
+ * @param[in] s inflate state
+ * @return DEFLATE_STREAM_OK if more input is needed, DEFLATE_STREAM_END when step is done
+ */
+static deflate_stream_status_t deflate_inflate_dynamic_tables(deflate_inflate_state_t* s) {
+    if(s->step == DEFLATE_INFLATE_STEP_DYNAMIC_COUNTS) {
+        if(!deflate_inflate_need(s, 14)) {
+            return DEFLATE_STREAM_OK;
+        }
+
+        s->literals  = 257 + deflate_inflate_bits(s, 5);
+        s->distances = 1 + deflate_inflate_bits(s, 5);
+        s->clengths  = 4 + deflate_inflate_bits(s, 4);
+
+        if(s->literals > 286 || s->distances > 30) {
+            PRINTLOG(COMPRESSION, LOG_ERROR, "invalid huffman table sizes %i %i", s->literals, s->distances);
+
+            return DEFLATE_STREAM_ERROR;
+        }
+
+        memory_memclean(s->lengths, sizeof(s->lengths));
+        s->count = 0;
+        s->step = DEFLATE_INFLATE_STEP_DYNAMIC_CODE_LENGTHS;
+    }
+
+    if(s->step == DEFLATE_INFLATE_STEP_DYNAMIC_CODE_LENGTHS) {
+        while(s->count < s->clengths) {
+            if(!deflate_inflate_need(s, 3)) {
+                return DEFLATE_STREAM_OK;
+            }
+
+            s->lengths[huffman_code_lengths[s->count++]] = deflate_inflate_bits(s, 3);
+        }
+
+        if(deflate_inflate_build_table(s->lengths, 19, deflate_inflate_codelen_entry, DEFLATE_INFLATE_CODELEN_TABLE_BITS,
+                                       s->codelen_table, DEFLATE_INFLATE_CODELEN_TABLE_SIZE) != 0) {
+            return DEFLATE_STREAM_ERROR;
+        }
+
+        memory_memclean(s->lengths, sizeof(s->lengths));
+        s->count = 0;
+        s->step = DEFLATE_INFLATE_STEP_DYNAMIC_LENGTHS;
+    }
+
+    uint32_t total = s->literals + s->distances;
+
+    while (s->count < total) {
+        if(!deflate_inflate_need(s, 14)) {
+            return DEFLATE_STREAM_OK;
+        }
+
+        if(s->bitcount < 14) {
+            deflate_inflate_refill(s);
+        }
+
+        uint32_t entry = s->codelen_table[s->bitbuf & ((1U << DEFLATE_INFLATE_CODELEN_TABLE_BITS) - 1)];
+
+        if(DEFLATE_INFLATE_ENTRY_LENGTH(entry) == 0) {
+            PRINTLOG(COMPRESSION, LOG_ERROR, "invalid code length code");
+
+            return DEFLATE_STREAM_ERROR;
+        }
 
-            if(ret < 0) {
-                goto end_block_op;
-            }
+        uint32_t symbol = deflate_inflate_consume(s, entry);
+        uint32_t rep = 0;
+        uint32_t length = 0;
 
-            ret = bit_buffer_put(&bit_buffer, 2, 1);
+        if (symbol < 16) {
+            s->lengths[s->count++] = symbol;
 
-            if(ret < 0) {
-                goto end_block_op;
+            continue;
+        } else if (symbol == 16) {
+            if(s->count == 0) {
+                return DEFLATE_STREAM_ERROR;
             }
 
-            ret = deflate_deflate_block(lz77_block, &bit_buffer, &huffman_encode_fixed, &huffman_encode_distance_fixed);
+            rep = s->lengths[s->count - 1];
+            length = deflate_inflate_bits(s, 2) + 3;
+        } else if (symbol == 17) {
+            length = deflate_inflate_bits(s, 3) + 3;
         } else {
-            if(is_last_block) {
-                ret = bit_buffer_put(&bit_buffer, 1, 1);
-            } else {
-                ret = bit_buffer_put(&bit_buffer, 1, 0);
+            length = deflate_inflate_bits(s, 7) + 11;
+        }
+
+        if(s->count + length > total) {
+            return DEFLATE_STREAM_ERROR;
+        }
+
+        while(length--) {
+            s->lengths[s->count++] = rep;
+        }
+    }
+
+    if(!deflate_inflate_input_valid(s)) {
+        PRINTLOG(COMPRESSION, LOG_ERROR, "unexpected end of input stream");
+
+        return DEFLATE_STREAM_ERROR;
+    }
+
+    if(s->lengths[256] == 0) {
+        return DEFLATE_STREAM_ERROR;
+    }
+
+    if(deflate_inflate_build_table(s->lengths, s->literals, deflate_inflate_litlen_entry, DEFLATE_INFLATE_LITLEN_TABLE_BITS,
+                                   s->litlen_table, DEFLATE_INFLATE_LITLEN_TABLE_SIZE) != 0) {
+        return DEFLATE_STREAM_ERROR;
+    }
+
+    if(deflate_inflate_build_table(s->lengths + s->literals, s->distances, deflate_inflate_dist_entry, DEFLATE_INFLATE_DIST_TABLE_BITS,
+                                   s->dist_table, DEFLATE_INFLATE_DIST_TABLE_SIZE) != 0) {
+        return DEFLATE_STREAM_ERROR;
+    }
+
+    s->step = DEFLATE_INFLATE_STEP_BLOCK;
+
+    return DEFLATE_STREAM_END;
+}
+
+/**
+ * @brief builds fixed huffman tables
+ * @param[in] s inflate state
+ * @return 0 on success
+ */
+static int8_t deflate_inflate_fixed_tables(deflate_inflate_state_t* s) {
+    uint8_t lengths[288 + 32];
+
+    for(uint32_t i = 0; i < 288; i++) {
+        lengths[i] = huffman_encode_fixed.lengths[i];
+    }
+
+    for(uint32_t i = 0; i < 32; i++) {
+        lengths[288 + i] = 5;
+    }
+
+    if(deflate_inflate_build_table(lengths, 288, deflate_inflate_litlen_entry, DEFLATE_INFLATE_LITLEN_TABLE_BITS,
+                                   s->litlen_table, DEFLATE_INFLATE_LITLEN_TABLE_SIZE) != 0) {
+        return -1;
+    }
+
+    return deflate_inflate_build_table(lengths + 288, 32, deflate_inflate_dist_entry, DEFLATE_INFLATE_DIST_TABLE_BITS,
+                                       s->dist_table, DEFLATE_INFLATE_DIST_TABLE_SIZE);
+}
+
+/**
+ * @brief decodes a huffman coded block, resumable at each symbol.
+ * while enough input and output slack remain a fast loop decodes a whole length/distance pair
+ * after a single 64 bit refill and copies matches with wide moves. near the ends it falls back
+ * to exact copies and waits for a symbol pair worth of input before each symbol.
+ * @param[in] s inflate state
+ * @return DEFLATE_STREAM_OK if more input is needed, DEFLATE_STREAM_OUTPUT_FULL if output is full, DEFLATE_STREAM_END at end of block
+ */
+static deflate_stream_status_t deflate_inflate_block(deflate_inflate_state_t* s) {
+    const uint32_t* litlen_table = s->litlen_table;
+    const uint32_t* dist_table = s->dist_table;
+
+    while(true) {
+        if(s->oend - s->op < DEFLATE_INFLATE_FAST_OUT_SLACK) {
+            int8_t room = deflate_inflate_make_room(s, DEFLATE_INFLATE_FAST_OUT_SLACK);
+
+            if(room < 0) {
+                return DEFLATE_STREAM_ERROR;
             }
 
-            if(ret < 0) {
-                goto end_block_op;
+            if(room > 0 && s->oend - s->op < DEFLATE_MAX_MATCH) {
+                return DEFLATE_STREAM_OUTPUT_FULL;
             }
+        }
 
-            ret = bit_buffer_put(&bit_buffer, 2, 2);
+        boolean_t fast = s->in_end - s->in >= DEFLATE_INFLATE_FAST_IN_SLACK && s->oend - s->op >= DEFLATE_INFLATE_FAST_OUT_SLACK;
 
-            if(ret < 0) {
-                goto end_block_op;
+        if(!fast && !deflate_inflate_need(s, DEFLATE_INFLATE_SYMBOL_PAIR_BITS)) {
+            return DEFLATE_STREAM_OK;
+        }
+
+        deflate_inflate_refill(s);
+
+        uint32_t entry = deflate_inflate_lookup(litlen_table, DEFLATE_INFLATE_LITLEN_TABLE_BITS, s->bitbuf);
+
+        if(DEFLATE_INFLATE_ENTRY_LENGTH(entry) == 0 || (entry & DEFLATE_INFLATE_ENTRY_INVALID)) {
+            PRINTLOG(COMPRESSION, LOG_ERROR, "invalid literal/length code");
+
+            return DEFLATE_STREAM_ERROR;
+        }
+
+        uint32_t value = deflate_inflate_consume(s, entry);
+
+        if(entry & DEFLATE_INFLATE_ENTRY_LITERAL) {
+            *s->op++ = value;
+
+            if(!fast && !deflate_inflate_input_valid(s)) {
+                break;
             }
 
-            for(int32_t i = 0; i < dyn_header_len; i++) {
-                int8_t dyn_header_bit = bit_buffer_get(dyn_header, 1);
-                ret = bit_buffer_put(&bit_buffer, 1, dyn_header_bit);
+            continue;
+        }
 
-                if(ret < 0) {
-                    goto end_block_op;
-                }
+        if(entry & DEFLATE_INFLATE_ENTRY_EOB) {
+            if(!deflate_inflate_input_valid(s)) {
+                break;
             }
 
-            ret = deflate_deflate_block(lz77_block, &bit_buffer, dyn_symbols, dyn_distances);
+            s->step = DEFLATE_INFLATE_STEP_HEADER;
+
+            return DEFLATE_STREAM_END;
         }
 
-        if(is_last_block) {
-            bit_buffer_push(&bit_buffer);
+        uint32_t length = value;
+
+        entry = deflate_inflate_lookup(dist_table, DEFLATE_INFLATE_DIST_TABLE_BITS, s->bitbuf);
+
+        if(DEFLATE_INFLATE_ENTRY_LENGTH(entry) == 0 || (entry & DEFLATE_INFLATE_ENTRY_INVALID)) {
+            PRINTLOG(COMPRESSION, LOG_ERROR, "invalid distance code");
+
+            return DEFLATE_STREAM_ERROR;
         }
 
-end_block_op:
-        memory_free(freqs);
-        buffer_destroy(in_block);
-        buffer_destroy(lz77_block);
-        buffer_destroy(dyn_header->buffer);
-        memory_free(dyn_header);
-        memory_free(dyn_symbols);
-        memory_free(dyn_distances);
+        uint32_t distance = deflate_inflate_consume(s, entry);
 
-        if(ret != 0) {
-            PRINTLOG(COMPRESSION, LOG_ERROR, "Failed to deflate block");
+        if(!fast && !deflate_inflate_input_valid(s)) {
+            break;
+        }
 
-            return ret;
+        if(distance > (uint64_t)(s->op - s->out_base)) {
+            PRINTLOG(COMPRESSION, LOG_ERROR, "distance too far back %i", distance);
+
+            return DEFLATE_STREAM_ERROR;
+        }
+
+        if(fast) {
+            deflate_inflate_copy_match_fast(s->op, distance, length);
+            s->op += length;
+
+            continue;
+        }
+
+        const uint8_t* src = s->op - distance;
+
+        for(uint32_t i = 0; i < length; i++) {
+            *s->op++ = *src++;
         }
     }
 
-    return 0;
-}
+    PRINTLOG(COMPRESSION, LOG_ERROR, "unexpected end of input stream");
 
-int8_t deflate_inflate(buffer_t* in, buffer_t* out) {
-    bit_buffer_t bit_buffer = {
-        .buffer = in,
-        .byte = 0,
-        .bit_count = 0
-    };
+    return DEFLATE_STREAM_ERROR;
+}
 
-    int8_t ret = 0;
-    int64_t bit;
+/**
+ * @brief runs inflate steps until input is consumed, output is full or stream ends
+ * @param[in] s inflate state
+ * @return stream status
+ */
+static deflate_stream_status_t deflate_inflate_run(deflate_inflate_state_t* s) {
+    deflate_stream_status_t ret = DEFLATE_STREAM_END;
 
-    while(true) {
-        bit = bit_buffer_get(&bit_buffer, 1);
+    while(ret == DEFLATE_STREAM_END) {
+        switch(s->step) {
+        case DEFLATE_INFLATE_STEP_HEADER:
+            if(s->last_block) {
+                deflate_inflate_release_input(s);
+                s->step = DEFLATE_INFLATE_STEP_DONE;
 
-        if(bit == -1) {
-            return -1;
-        }
+                break;
+            }
 
-        boolean_t last = bit == 1;
+            if(!deflate_inflate_need(s, 3)) {
+                ret = DEFLATE_STREAM_OK;
 
-        bit = bit_buffer_get(&bit_buffer, 2);
+                break;
+            }
 
-        if(bit == -1) {
-            PRINTLOG(COMPRESSION, LOG_ERROR, "Failed to read block type");
+            s->last_block = deflate_inflate_bits(s, 1) == 1;
 
-            return -1;
-        }
+            uint8_t type = deflate_inflate_bits(s, 2);
 
-        uint8_t type = bit;
+            if(!deflate_inflate_input_valid(s)) {
+                PRINTLOG(COMPRESSION, LOG_ERROR, "Failed to read block type");
 
-        huffman_decode_table_t lengths = {0};
-        memory_memcopy(&huffman_decode_fixed_lengths, &lengths, sizeof(huffman_decode_table_t));
-        huffman_decode_table_t distances = {0};
-        memory_memcopy(&huffman_decode_fixed_distances, &distances, sizeof(huffman_decode_table_t));
+                ret = DEFLATE_STREAM_ERROR;
+            } else if(type == 0) {
+                s->step = DEFLATE_INFLATE_STEP_STORED_HEADER;
+            } else if(type == 1) {
+                if(deflate_inflate_fixed_tables(s) != 0) {
+                    ret = DEFLATE_STREAM_ERROR;
+                }
 
-        switch(type) {
-        case 0:
-            ret = deflate_inflate_uncompressed_block(&bit_buffer, out);
+                s->step = DEFLATE_INFLATE_STEP_BLOCK;
+            } else if(type == 2) {
+                s->step = DEFLATE_INFLATE_STEP_DYNAMIC_COUNTS;
+            } else {
+                PRINTLOG(COMPRESSION, LOG_ERROR, "Reserved block type");
 
-            if(ret != 0) {
-                PRINTLOG(COMPRESSION, LOG_ERROR, "Failed to decode uncompressed block");
+                ret = DEFLATE_STREAM_ERROR;
             }
 
             break;
-        case 2:
-            if(huffman_decode_table_decode(&bit_buffer, &lengths, &distances) != 0) {
-                PRINTLOG(COMPRESSION, LOG_ERROR, "Failed to decode huffman table");
+        case DEFLATE_INFLATE_STEP_STORED_HEADER:
+            ret = deflate_inflate_stored_header(s);
+            break;
+        case DEFLATE_INFLATE_STEP_STORED_COPY:
+            ret = deflate_inflate_stored_copy(s);
+            break;
+        case DEFLATE_INFLATE_STEP_DYNAMIC_COUNTS:
+        case DEFLATE_INFLATE_STEP_DYNAMIC_CODE_LENGTHS:
+        case DEFLATE_INFLATE_STEP_DYNAMIC_LENGTHS:
+            ret = deflate_inflate_dynamic_tables(s);
 
-                return -1;
+            if(ret == DEFLATE_STREAM_ERROR) {
+                PRINTLOG(COMPRESSION, LOG_ERROR, "Failed to decode huffman table");
             }
 
-            nobreak;
-        case 1:
-            ret = deflate_inflate_block(&bit_buffer, out, &lengths, &distances);
+            break;
+        case DEFLATE_INFLATE_STEP_BLOCK:
+            ret = deflate_inflate_block(s);
 
-            if(ret != 0) {
+            if(ret == DEFLATE_STREAM_ERROR) {
                 PRINTLOG(COMPRESSION, LOG_ERROR, "Failed to decode block");
             }
 
             break;
-        case 3:
-            PRINTLOG(COMPRESSION, LOG_ERROR, "Reserved block type");
+        case DEFLATE_INFLATE_STEP_DONE:
+            if(!s->out) {
+                deflate_inflate_flush(s);
+            }
 
-            return -1;
+            return s->out_cur == s->op || s->out ? DEFLATE_STREAM_END : DEFLATE_STREAM_OUTPUT_FULL;
+        case DEFLATE_INFLATE_STEP_ERROR:
+            return DEFLATE_STREAM_ERROR;
         }
+    }
 
-        if (ret != 0) {
-            return ret;
+    if(ret == DEFLATE_STREAM_ERROR) {
+        s->step = DEFLATE_INFLATE_STEP_ERROR;
+
+        return ret;
+    }
+
+    if(!s->out) {
+        deflate_inflate_flush(s);
+
+        if(s->out_cur != s->op) {
+            ret = DEFLATE_STREAM_OUTPUT_FULL;
         }
+    }
 
-        if (last) {
-            break;
+    return ret;
+}
+
+int8_t deflate_inflate(buffer_t* in, buffer_t* out) {
+    deflate_inflate_state_t* s = memory_malloc(sizeof(deflate_inflate_state_t));
+
+    if(!s) {
+        return -1;
+    }
+
+    uint64_t in_len = buffer_remaining(in);
+    const uint8_t* in_start = buffer_get_view(in, in_len);
+
+    if(!in_start && in_len) {
+        memory_free(s);
+
+        return -1;
+    }
+
+    s->in_start = in_start;
+    s->in = in_start;
+    s->in_end = in_start + in_len;
+    s->final = true;
+    s->out = out;
+
+    uint64_t out_spare = buffer_get_capacity(out) - buffer_get_position(out);
+
+    if(deflate_inflate_reserve(s, out_spare) != 0) {
+        memory_free(s);
+
+        return -1;
+    }
+
+    int8_t ret = 0;
+
+    if(deflate_inflate_run(s) != DEFLATE_STREAM_END) {
+        ret = -1;
+    } else if(!buffer_seek(out, s->op - s->out_cur, BUFFER_SEEK_DIRECTION_CURRENT) ||
+              !buffer_seek(in, s->in - in_start, BUFFER_SEEK_DIRECTION_CURRENT)) {
+        ret = -1;
+    }
+
+    memory_free(s);
+
+    return ret;
+}
+
+/**
+ * @struct deflate_stream_t
+ * @brief streaming context, only one of the states is set
+ */
+struct deflate_stream_t {
+    deflate_deflate_state_t* deflate; ///< compressor state
+    deflate_inflate_state_t* inflate; ///< decompressor state
+};
+
+deflate_stream_t* deflate_deflate_stream_init(void) {
+    return deflate_deflate_stream_init_with_level(DEFLATE_LEVEL_DEFAULT);
+}
+
+deflate_stream_t* deflate_deflate_stream_init_with_level(uint8_t level) {
+    if(level > DEFLATE_LEVEL_MAX) {
+        PRINTLOG(COMPRESSION, LOG_ERROR, "invalid deflate level %i", level);
+
+        return NULL;
+    }
+
+    deflate_stream_t* stream = memory_malloc(sizeof(deflate_stream_t));
+
+    if(!stream) {
+        return NULL;
+    }
+
+    stream->deflate = memory_malloc(sizeof(deflate_deflate_state_t));
+
+    if(!stream->deflate) {
+        memory_free(stream);
+
+        return NULL;
+    }
+
+    stream->deflate->bit_buffer.buffer = buffer_new_with_capacity(NULL, DEFLATE_MAX_BLOCK_SIZE + 1024);
+
+    if(!stream->deflate->bit_buffer.buffer) {
+        memory_free(stream->deflate);
+        memory_free(stream);
+
+        return NULL;
+    }
+
+    stream->deflate->level = level;
+
+    return stream;
+}
+
+deflate_stream_status_t deflate_deflate_stream_feed(deflate_stream_t* stream, buffer_t* in, uint8_t* out, uint64_t out_len, uint64_t* out_written) {
+    if(!stream || !stream->deflate || !out_written || stream->deflate->finished) {
+        return DEFLATE_STREAM_ERROR;
+    }
+
+    deflate_deflate_state_t* ds = stream->deflate;
+
+    *out_written = 0;
+
+    while(true) {
+        if(!deflate_deflate_stream_drain(ds, out, out_len, out_written)) {
+            return DEFLATE_STREAM_OUTPUT_FULL;
+        }
+
+        uint64_t in_rem = buffer_remaining(in);
+
+        if(in_rem == 0) {
+            return DEFLATE_STREAM_OK;
+        }
+
+        // full block is compressed only when more input comes, so finish can mark it as last
+        if(ds->block_len == DEFLATE_MAX_BLOCK_SIZE && deflate_deflate_stream_block(ds, false) != 0) {
+            return DEFLATE_STREAM_ERROR;
+        }
+
+        uint64_t len = MIN(in_rem, (uint64_t)(DEFLATE_MAX_BLOCK_SIZE - ds->block_len));
+
+        if(!buffer_write_slice_into(in, buffer_get_position(in), len, ds->window + ds->history_len + ds->block_len) ||
+           !buffer_seek(in, len, BUFFER_SEEK_DIRECTION_CURRENT)) {
+            return DEFLATE_STREAM_ERROR;
         }
+
+        ds->block_len += len;
     }
+}
 
-    return 0;
+deflate_stream_status_t deflate_deflate_stream_finish(deflate_stream_t* stream, uint8_t* out, uint64_t out_len, uint64_t* out_written) {
+    if(!stream || !stream->deflate || !out_written) {
+        return DEFLATE_STREAM_ERROR;
+    }
+
+    deflate_deflate_state_t* ds = stream->deflate;
+
+    *out_written = 0;
+
+    if(!ds->finished) {
+        if(!deflate_deflate_stream_drain(ds, out, out_len, out_written)) {
+            return DEFLATE_STREAM_OUTPUT_FULL;
+        }
+
+        if(deflate_deflate_stream_block(ds, true) != 0) {
+            return DEFLATE_STREAM_ERROR;
+        }
+
+        ds->finished = true;
+    }
+
+    return deflate_deflate_stream_drain(ds, out, out_len, out_written) ? DEFLATE_STREAM_END : DEFLATE_STREAM_OUTPUT_FULL;
+}
+
+deflate_stream_t* deflate_inflate_stream_init(void) {
+    deflate_stream_t* stream = memory_malloc(sizeof(deflate_stream_t));
+
+    if(!stream) {
+        return NULL;
+    }
+
+    deflate_inflate_state_t* s = memory_malloc(sizeof(deflate_inflate_state_t));
+
+    if(!s) {
+        memory_free(stream);
+
+        return NULL;
+    }
+
+    s->window = memory_malloc(DEFLATE_INFLATE_STREAM_WINDOW_SIZE);
+
+    if(!s->window) {
+        memory_free(s);
+        memory_free(stream);
+
+        return NULL;
+    }
+
+    s->out_base = s->window;
+    s->out_cur = s->window;
+    s->op = s->window;
+    s->oend = s->window + DEFLATE_INFLATE_STREAM_WINDOW_SIZE;
+
+    stream->inflate = s;
+
+    return stream;
 }
 
+/**
+ * @brief runs inflate on input buffer's remaining bytes and caller's output window
+ * @param[in] s inflate state
+ * @param[in] in input buffer, may be NULL at finish
+ * @param[out] out output window
+ * @param[in] out_len output window size
+ * @param[out] out_written bytes written to output window
+ * @return stream status
+ */
+static deflate_stream_status_t deflate_inflate_stream_run(deflate_inflate_state_t* s, buffer_t* in, uint8_t* out, uint64_t out_len, uint64_t* out_written) {
+    uint64_t in_len = in ? buffer_remaining(in) : 0;
+    const uint8_t* in_start = in_len ? buffer_get_view(in, in_len) : NULL;
+
+    if(!in_start && in_len) {
+        return DEFLATE_STREAM_ERROR;
+    }
+
+    s->in_start = in_start;
+    s->in = in_start;
+    s->in_end = in_start + in_len;
+    s->user_out = out;
+    s->user_out_end = out + out_len;
+
+    deflate_stream_status_t ret = deflate_inflate_run(s);
+
+    *out_written = s->user_out - out;
+
+    if(in && !buffer_seek(in, s->in - in_start, BUFFER_SEEK_DIRECTION_CURRENT)) {
+        return DEFLATE_STREAM_ERROR;
+    }
+
+    return ret;
+}
+
+deflate_stream_status_t deflate_inflate_stream_feed(deflate_stream_t* stream, buffer_t* in, uint8_t* out, uint64_t out_len, uint64_t* out_written) {
+    if(!stream || !stream->inflate || !out_written) {
+        return DEFLATE_STREAM_ERROR;
+    }
+
+    *out_written = 0;
+
+    if(stream->inflate->final) {
+        return DEFLATE_STREAM_ERROR;
+    }
 
+    return deflate_inflate_stream_run(stream->inflate, in, out, out_len, out_written);
+}
+
+deflate_stream_status_t deflate_inflate_stream_finish(deflate_stream_t* stream, uint8_t* out, uint64_t out_len, uint64_t* out_written) {
+    if(!stream || !stream->inflate || !out_written) {
+        return DEFLATE_STREAM_ERROR;
+    }
+
+    *out_written = 0;
+    stream->inflate->final = true;
+
+    return deflate_inflate_stream_run(stream->inflate, NULL, out, out_len, out_written);
+}
+
+int8_t deflate_stream_destroy(deflate_stream_t* stream) {
+    if(!stream) {
+        return 0;
+    }
+
+    if(stream->deflate) {
+        buffer_destroy(stream->deflate->bit_buffer.buffer);
+        memory_free(stream->deflate);
+    }
+
+    if(stream->inflate) {
+        memory_free(stream->inflate->window);
+        memory_free(stream->inflate);
+    }
+
+    memory_free(stream);
+
+    return 0;
+}
@@ -47,9 +47,47 @@ struct hashmap_t {
     hashmap_key_generator_f  hkg; ///< key generator
     hashmap_key_comparator_f hkc; ///< key comparator
     hashmap_segment_t*       segments; ///< segments
-    lock_t*                  lock; ///< lock
+    rwlock_t*                lock; ///< lock, gets are readers
 }; ///< hashmap
 
+/*! slab cache of hashmaps, only hashmaps at default heap use it */
+memory_cache_t* hashmap_cache = NULL;
+/*! slab cache of hashmap segments, only hashmaps at default heap use it */
+memory_cache_t* hashmap_segment_cache = NULL;
+
+/**
+ * @brief allocates fixed size hashmap object from slab cache or heap
+ * @param[in] heap hashmap's heap
+ * @param[in] cache_slot cache of object type
+ * @param[in] name cache name
+ * @param[in] size object size
+ * @return object
+ */
+static void* hashmap_object_alloc(memory_heap_t* heap, memory_cache_t** cache_slot, const char_t* name, uint64_t size) {
+    memory_cache_t* cache = memory_cache_get_for_heap(cache_slot, heap, name, size, 0, NULL);
+
+    if(cache) {
+        return memory_cache_alloc(cache);
+    }
+
+    return memory_malloc_ext(heap, size, 0);
+}
+
+/**
+ * @brief frees object allocated by hashmap_object_alloc
+ * @param[in] heap hashmap's heap
+ * @param[in] cache cache of object type
+ * @param[in] object object
+ * @return 0 on success
+ */
+static int8_t hashmap_object_free(memory_heap_t* heap, memory_cache_t* cache, void* object) {
+    if(cache && memory_cache_get_heap(cache) == heap) {
+        return memory_cache_free(cache, object);
+    }
+
+    return memory_free_ext(heap, object);
+}
+
 /**
  * @brief default key generator
  * @param[in] key key
@@ -119,7 +157,7 @@ hashmap_t*  hashmap_new_with_hkg_with_hkc(memory_heap_t* heap, uint64_t capacity
 
     heap = memory_get_heap(heap);
 
-    hashmap_t* hm = memory_malloc_ext(heap, sizeof(hashmap_t), 0);
+    hashmap_t* hm = hashmap_object_alloc(heap, &hashmap_cache, "hashmaps", sizeof(hashmap_t));
 
     if(!hm) {
         return NULL;
@@ -127,7 +165,7 @@ hashmap_t*  hashmap_new_with_hkg_with_hkc(memory_heap_t* heap, uint64_t capacity
 
     hm->heap = heap;
 
-    hm->lock = lock_create_with_heap(heap);
+    hm->lock = rwlock_create_with_heap(heap);
 
     hm->total_capacity = capacity;
     hm->segment_capacity = capacity;
@@ -135,10 +173,11 @@ hashmap_t*  hashmap_new_with_hkg_with_hkc(memory_heap_t* heap, uint64_t capacity
     hm->hkg = hkg?hkg:hashmap_default_kg;
     hm->hkc = hkc?hkc:hashmap_default_kc;
 
-    hm->segments = memory_malloc_ext(heap, sizeof(hashmap_segment_t), 0);
+    hm->segments = hashmap_object_alloc(heap, &hashmap_segment_cache, "hashmap segments", sizeof(hashmap_segment_t));
 
     if(!hm->segments) {
-        memory_free_ext(heap, hm);
+        rwlock_destroy(hm->lock);
+        hashmap_object_free(heap, hashmap_cache, hm);
 
         return NULL;
     }
@@ -146,8 +185,9 @@ hashmap_t*  hashmap_new_with_hkg_with_hkc(memory_heap_t* heap, uint64_t capacity
     hm->segments->items = memory_malloc_ext(heap, sizeof(hashmap_item_t) * hm->segment_capacity, 0);
 
     if(!hm->segments->items) {
-        memory_free_ext(heap, hm->segments);
-        memory_free_ext(heap, hm);
+        hashmap_object_free(heap, hashmap_segment_cache, hm->segments);
+        rwlock_destroy(hm->lock);
+        hashmap_object_free(heap, hashmap_cache, hm);
 
         return NULL;
     }
@@ -172,13 +212,13 @@ boolean_t   hashmap_destroy(hashmap_t* hm) {
         hashmap_segment_t* t_seg = seg->next;
 
         memory_free_ext(heap, seg->items);
-        memory_free_ext(heap, seg);
+        hashmap_object_free(heap, hashmap_segment_cache, seg);
 
         seg = t_seg;
     }
 
-    lock_destroy(hm->lock);
-    memory_free_ext(heap, hm);
+    rwlock_destroy(hm->lock);
+    hashmap_object_free(heap, hashmap_cache, hm);
 
     return NULL;
 }
@@ -186,111 +226,160 @@ boolean_t   hashmap_destroy(hashmap_t* hm) {
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wanalyzer-malloc-leak"
 /**
- * @brief get next new segment
+ * @brief allocates an empty segment which is not linked to hashmap
  * @param[in] hm hashmap
- * @param[in] seg segment
- * @return next new segment
+ * @return segment
  */
-static hashmap_segment_t* hashmap_segment_next_new(hashmap_t* hm, hashmap_segment_t* seg) {
-    while(seg->next) {
-        seg = seg->next;
+static hashmap_segment_t* hashmap_segment_alloc(hashmap_t* hm) {
+    hashmap_segment_t* seg = hashmap_object_alloc(hm->heap, &hashmap_segment_cache, "hashmap segments", sizeof(hashmap_segment_t));
+
+    if(!seg) {
+        return NULL;
     }
 
-    seg->next = memory_malloc_ext(hm->heap, sizeof(hashmap_segment_t), 0);
+    seg->items = memory_malloc_ext(hm->heap, sizeof(hashmap_item_t) * hm->segment_capacity, 0);
+
+    if(!seg->items) {
+        hashmap_object_free(hm->heap, hashmap_segment_cache, seg);
 
-    if(!seg->next) {
         return NULL;
     }
 
-    seg->next->items = memory_malloc_ext(hm->heap, sizeof(hashmap_item_t) * hm->segment_capacity, 0);
+    return seg;
+}
+#pragma GCC diagnostic pop
 
-    if(!seg->next->items) {
-        memory_free_ext(hm->heap, seg->next);
+/**
+ * @brief frees a segment which is not linked to hashmap
+ * @param[in] hm hashmap
+ * @param[in] seg segment
+ */
+static void hashmap_segment_free(hashmap_t* hm, hashmap_segment_t* seg) {
+    memory_free_ext(hm->heap, seg->items);
+    hashmap_object_free(hm->heap, hashmap_segment_cache, seg);
+}
 
-        return NULL;
+/**
+ * @brief links spare segment to end of hashmap, write lock should be held
+ * @param[in] hm hashmap
+ * @param[in] seg segment
+ * @param[in] spare preallocated segment
+ * @return next new segment
+ */
+static hashmap_segment_t* hashmap_segment_next_new(hashmap_t* hm, hashmap_segment_t* seg, hashmap_segment_t* spare) {
+    while(seg->next) {
+        seg = seg->next;
     }
 
-    hm->total_capacity += hm->segment_capacity;
+    seg->next = spare;
 
-    seg = seg->next;
+    hm->total_capacity += hm->segment_capacity;
 
-    return seg;
+    return spare;
 }
-#pragma GCC diagnostic pop
 
 const void* hashmap_put(hashmap_t* hm, const void* key, const void* item) {
     if(!hm) {
         return NULL;
     }
 
-    lock_acquire(hm->lock);
+    // allocation may yield, so writer which holds lock with interrupts disabled never allocates
+    hashmap_segment_t* spare = NULL;
 
-    uint64_t h_key = hm->hkg(key) % hm->segment_capacity;
+    while(true) {
+        rwlock_write_acquire(hm->lock);
 
-    hashmap_segment_t* seg = hm->segments;
+        uint64_t h_key = hm->hkg(key) % hm->segment_capacity;
 
-    while(true) {
-        if(seg->items[h_key].exists) {
-            if(hm->hkc(key, seg->items[h_key].key) == 0) {
-                const void* old_item = seg->items[h_key].value;
+        hashmap_segment_t* seg = hm->segments;
 
-                seg->items[h_key].key = key;
-                seg->items[h_key].value = item;
-                seg->items[h_key].exists = true;
+        while(true) {
+            if(seg->items[h_key].exists) {
+                if(hm->hkc(key, seg->items[h_key].key) == 0) {
+                    const void* old_item = seg->items[h_key].value;
 
-                lock_release(hm->lock);
+                    seg->items[h_key].key = key;
+                    seg->items[h_key].value = item;
+                    seg->items[h_key].exists = true;
 
-                return old_item;
-            }
+                    rwlock_write_release(hm->lock);
 
-            uint64_t t_h_key = (h_key + 1) % hm->segment_capacity;
+                    if(spare) {
+                        hashmap_segment_free(hm, spare);
+                    }
 
-            if(seg->items[t_h_key].exists) {
-                if(hm->hkc(key, seg->items[t_h_key].key) == 0) {
-                    const void* old_item = seg->items[t_h_key].value;
+                    return old_item;
+                }
 
-                    seg->items[t_h_key].key = key;
-                    seg->items[t_h_key].value = item;
-                    seg->items[t_h_key].exists = true;
+                uint64_t t_h_key = (h_key + 1) % hm->segment_capacity;
 
-                    lock_release(hm->lock);
+                if(seg->items[t_h_key].exists) {
+                    if(hm->hkc(key, seg->items[t_h_key].key) == 0) {
+                        const void* old_item = seg->items[t_h_key].value;
 
-                    return old_item;
+                        seg->items[t_h_key].key = key;
+                        seg->items[t_h_key].value = item;
+                        seg->items[t_h_key].exists = true;
+
+                        rwlock_write_release(hm->lock);
+
+                        if(spare) {
+                            hashmap_segment_free(hm, spare);
+                        }
+
+                        return old_item;
+                    }
+                } else {
+                    h_key = t_h_key;
+
+                    break;
                 }
-            } else {
-                h_key = t_h_key;
 
-                break;
-            }
+                if(seg->next) {
+                    seg = seg->next;
+                } else {
+                    if(!spare) {
+                        // allocate without lock and search again, another writer may change segments meanwhile
+                        seg = NULL;
 
-            if(seg->next) {
-                seg = seg->next;
-            } else {
-                seg = hashmap_segment_next_new(hm, seg);
+                        break;
+                    }
 
-                if(!seg) {
-                    lock_release(hm->lock);
+                    seg = hashmap_segment_next_new(hm, seg, spare);
+                    spare = NULL;
 
-                    return NULL;
+                    break;
                 }
 
+            } else {
                 break;
             }
+        }
 
-        } else {
-            break;
+        if(seg) {
+            seg->items[h_key].key = key;
+            seg->items[h_key].value = item;
+            seg->items[h_key].exists = true;
+            seg->size++;
+            hm->total_size++;
+
+            rwlock_write_release(hm->lock);
+
+            if(spare) {
+                hashmap_segment_free(hm, spare);
+            }
+
+            return NULL;
         }
-    }
 
-    seg->items[h_key].key = key;
-    seg->items[h_key].value = item;
-    seg->items[h_key].exists = true;
-    seg->size++;
-    hm->total_size++;
+        rwlock_write_release(hm->lock);
 
-    lock_release(hm->lock);
+        spare = hashmap_segment_alloc(hm);
 
-    return NULL;
+        if(!spare) {
+            return NULL;
+        }
+    }
 }
 
 const void* hashmap_get_key(hashmap_t* hm, const void* key) {
@@ -300,19 +389,29 @@ const void* hashmap_get_key(hashmap_t* hm, const void* key) {
 
     const uint64_t h_key = hm->hkg(key) % hm->segment_capacity;
 
+    rwlock_read_acquire(hm->lock);
+
     hashmap_segment_t* seg = hm->segments;
 
     while(seg) {
         if(seg->items[h_key].exists) {
             if(hm->hkc(key, seg->items[h_key].key) == 0) {
-                return seg->items[h_key].key;
+                const void* res = seg->items[h_key].key;
+
+                rwlock_read_release(hm->lock);
+
+                return res;
             }
 
             uint64_t t_h_key = (h_key + 1) % hm->segment_capacity;
 
             if(seg->items[t_h_key].exists) {
                 if(hm->hkc(key, seg->items[t_h_key].key) == 0) {
-                    return seg->items[t_h_key].key;
+                    const void* res = seg->items[t_h_key].key;
+
+                    rwlock_read_release(hm->lock);
+
+                    return res;
                 }
             }
         }
@@ -320,6 +419,8 @@ const void* hashmap_get_key(hashmap_t* hm, const void* key) {
         seg = seg->next;
     }
 
+    rwlock_read_release(hm->lock);
+
     return NULL;
 }
 
@@ -330,11 +431,15 @@ boolean_t hashmap_exists(hashmap_t* hm, const void* key) {
 
     const uint64_t h_key = hm->hkg(key) % hm->segment_capacity;
 
+    rwlock_read_acquire(hm->lock);
+
     hashmap_segment_t* seg = hm->segments;
 
     while(seg) {
         if(seg->items[h_key].exists) {
             if(hm->hkc(key, seg->items[h_key].key) == 0) {
+                rwlock_read_release(hm->lock);
+
                 return true;
             }
 
@@ -342,6 +447,8 @@ boolean_t hashmap_exists(hashmap_t* hm, const void* key) {
 
             if(seg->items[t_h_key].exists) {
                 if(hm->hkc(key, seg->items[t_h_key].key) == 0) {
+                    rwlock_read_release(hm->lock);
+
                     return true;
                 }
             }
@@ -350,6 +457,8 @@ boolean_t hashmap_exists(hashmap_t* hm, const void* key) {
         seg = seg->next;
     }
 
+    rwlock_read_release(hm->lock);
+
     return false;
 }
 
@@ -361,19 +470,29 @@ const void* hashmap_get(hashmap_t* hm, const void* key) {
 
     const uint64_t h_key = hm->hkg(key) % hm->segment_capacity;
 
+    rwlock_read_acquire(hm->lock);
+
     hashmap_segment_t* seg = hm->segments;
 
     while(seg) {
         if(seg->items[h_key].exists) {
             if(hm->hkc(key, seg->items[h_key].key) == 0) {
-                return seg->items[h_key].value;
+                const void* res = seg->items[h_key].value;
+
+                rwlock_read_release(hm->lock);
+
+                return res;
             }
 
             uint64_t t_h_key = (h_key + 1) % hm->segment_capacity;
 
             if(seg->items[t_h_key].exists) {
                 if(hm->hkc(key, seg->items[t_h_key].key) == 0) {
-                    return seg->items[t_h_key].value;
+                    const void* res = seg->items[t_h_key].value;
+
+                    rwlock_read_release(hm->lock);
+
+                    return res;
                 }
             }
         }
@@ -381,6 +500,8 @@ const void* hashmap_get(hashmap_t* hm, const void* key) {
         seg = seg->next;
     }
 
+    rwlock_read_release(hm->lock);
+
     return NULL;
 }
 
@@ -389,7 +510,7 @@ boolean_t hashmap_delete(hashmap_t* hm, const void* key) {
         return false;
     }
 
-    lock_acquire(hm->lock);
+    rwlock_write_acquire(hm->lock);
 
     const uint64_t h_key = hm->hkg(key) % hm->segment_capacity;
 
@@ -404,7 +525,7 @@ boolean_t hashmap_delete(hashmap_t* hm, const void* key) {
                 seg->size--;
                 hm->total_size--;
 
-                lock_release(hm->lock);
+                rwlock_write_release(hm->lock);
 
                 return true;
             }
@@ -419,7 +540,7 @@ boolean_t hashmap_delete(hashmap_t* hm, const void* key) {
                     seg->size--;
                     hm->total_size--;
 
-                    lock_release(hm->lock);
+                    rwlock_write_release(hm->lock);
 
                     return true;
                 }
@@ -429,7 +550,7 @@ boolean_t hashmap_delete(hashmap_t* hm, const void* key) {
         seg = seg->next;
     }
 
-    lock_release(hm->lock);
+    rwlock_write_release(hm->lock);
 
     return true;
 }
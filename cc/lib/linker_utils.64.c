@@ -135,3 +135,20 @@ void linker_print_module_info_at_memory(uint64_t module_id) {
     }
 
 }
+
+const char_t* linker_get_module_name_at_memory(uint64_t module_id) {
+    if(!linker_modules_at_memory) {
+        return NULL;
+    }
+
+    program_header_t* program_header = (program_header_t*)SYSTEM_INFO->program_header_virtual_start;
+    const char_t* symbol_names = (const char_t*)program_header->symbol_table_virtual_address;
+
+    const linker_metadata_at_memory_t* module_or_section = hashmap_get(linker_modules_at_memory, (void*)module_id);
+
+    if(!module_or_section || !symbol_names) {
+        return NULL;
+    }
+
+    return symbol_names + module_or_section->module.module_name_offset;
+}
@@ -66,6 +66,16 @@ memory_heap_t* list_get_heap(list_t* list) {
     return list->heap;
 }
 
+int8_t list_set_interrupt_safe(list_t* list) {
+    if(list == NULL) {
+        return -1;
+    }
+
+    lock_set_interrupt_safe(list->lock);
+
+    return 0;
+}
+
 list_data_comparator_f list_set_comparator(list_t* list, list_data_comparator_f comparator){
     if(list == NULL) {
         return NULL;
@@ -56,6 +56,38 @@ typedef struct linkedlist_iterator_internal_t {
     size_t       current_position;
 } linkedlist_iterator_internal_t; ///<short hand for struct
 
+/*! slab cache of list items, only lists at default heap use it */
+memory_cache_t* linkedlist_item_cache = NULL;
+
+/**
+ * @brief allocates list item from slab cache or list's heap
+ * @param[in] list owner list
+ * @return list item
+ */
+static list_item_t* linkedlist_item_alloc(list_t* list) {
+    memory_cache_t* cache = memory_cache_get_for_heap(&linkedlist_item_cache, list->heap, "list items", sizeof(list_item_t), 0, NULL);
+
+    if(cache) {
+        return memory_cache_alloc(cache);
+    }
+
+    return memory_malloc_ext(list->heap, sizeof(list_item_t), 0x0);
+}
+
+/**
+ * @brief frees list item allocated by linkedlist_item_alloc
+ * @param[in] heap list's heap
+ * @param[in] item list item
+ * @return 0 on success
+ */
+static int8_t linkedlist_item_free(memory_heap_t* heap, list_item_t* item) {
+    if(linkedlist_item_cache && memory_cache_get_heap(linkedlist_item_cache) == heap) {
+        return memory_cache_free(linkedlist_item_cache, item);
+    }
+
+    return memory_free_ext(heap, item);
+}
+
 
 list_t* linkedlist_create_with_type(memory_heap_t* heap, list_type_t type,
                                     list_data_comparator_f comparator, indexer_t indexer);
@@ -155,7 +187,7 @@ uint8_t linkedlist_destroy_with_type(list_t* list, list_destroy_type_t type, lis
         }
 
         list_item_t* n_li = item->next;
-        memory_free_ext(heap, item);
+        linkedlist_item_free(heap, item);
         item = n_li;
     }
 
@@ -173,19 +205,19 @@ size_t linkedlist_insert_at(list_t* list, const void* data, list_insert_delete_a
         return -1ULL;
     }
 
-    lock_acquire(list->lock);
-
-    size_t result = 0;
-    list_item_t* item = memory_malloc_ext(list->heap, sizeof(list_item_t), 0x0);
+    // item is allocated and freed without lock, so an interrupt safe list never allocates with interrupts disabled
+    list_item_t* item = linkedlist_item_alloc(list);
 
     if(item == NULL) {
-        lock_release(list->lock);
-
         return -1ULL;
     }
 
     item->data = data;
 
+    lock_acquire(list->lock);
+
+    size_t result = 0;
+
     if(list->head == NULL) { // if head is null insert both head and tail and return
         list->head = item;
         list->tail = item;
@@ -354,8 +386,8 @@ size_t linkedlist_insert_at(list_t* list, const void* data, list_insert_delete_a
             list->middle_position++;
         }
     } else {
-        memory_free_ext(list->heap, item);
         lock_release(list->lock);
+        linkedlist_item_free(list->heap, item);
 
         return -1ULL;
     }
@@ -397,6 +429,7 @@ const void* linkedlist_delete_at(list_t* list, const void* data, list_insert_del
     lock_acquire(list->lock);
 
     const void* result = NULL;
+    list_item_t* deleted_item = NULL;
 
     if(where == LIST_DELETE_AT_HEAD) {
         list_item_t* item = list->head;
@@ -415,7 +448,7 @@ const void* linkedlist_delete_at(list_t* list, const void* data, list_insert_del
         }
 
         result = item->data;
-        memory_free_ext(list->heap, item);
+        deleted_item = item;
         list->item_count--;
 
         list->balance++;
@@ -453,7 +486,7 @@ const void* linkedlist_delete_at(list_t* list, const void* data, list_insert_del
         }
 
         result = item->data;
-        memory_free_ext(list->heap, item);
+        deleted_item = item;
         list->item_count--;
 
         list->balance--;
@@ -485,6 +518,8 @@ const void* linkedlist_delete_at(list_t* list, const void* data, list_insert_del
             pk_iter->destroy(pk_iter);
 
             if(result == NULL) {
+                lock_release(list->lock);
+
                 return NULL;
             }
 
@@ -521,7 +556,7 @@ const void* linkedlist_delete_at(list_t* list, const void* data, list_insert_del
             // TODO: check error.
             indexer_delete(list->indexer, item);
             result = item->data;
-            memory_free_ext(list->heap, item);
+            deleted_item = item;
             list->item_count--;
 
         } else {
@@ -626,11 +661,15 @@ const void* linkedlist_delete_at(list_t* list, const void* data, list_insert_del
 
         result = cur->data;
         list->item_count--;
-        memory_free_ext(list->heap, cur);
+        deleted_item = cur;
     }
 
     lock_release(list->lock);
 
+    if(deleted_item) {
+        linkedlist_item_free(list->heap, deleted_item);
+    }
+
     return result;
 }
 
@@ -1101,7 +1140,7 @@ const void* linkedlist_iterator_delete_item(iterator_t* iterator){
     iter->current = next;
     iter->current_deleted = 1;
     iter->list->item_count--;
-    memory_free_ext(iter->list->heap, current);
+    linkedlist_item_free(iter->list->heap, current);
 
     if(iter->list->type == LIST_TYPE_INDEXEDLIST) {
         // TODO: check error
@@ -0,0 +1,466 @@
+/**
+ * @file lz4.64.c
+ * @brief LZ4 block compression algorithm implementation.
+ *
+ * This work is licensed under TURNSTONE OS Public License.
+ * Please read and understand latest version of Licence.
+ */
+
+#include <lz4.h>
+#include <utils.h>
+#include <logging.h>
+
+/*! module name */
+MODULE("turnstone.lib");
+
+/*! minimum match length */
+#define LZ4_MIN_MATCH 4
+
+/*! maximum match distance, offsets are 16 bit */
+#define LZ4_MAX_DISTANCE 65535
+
+/*! last bytes of input are always literals */
+#define LZ4_LAST_LITERALS 5
+
+/*! last match should start before input end minus this limit */
+#define LZ4_MF_LIMIT 12
+
+/*! inputs shorter than this are emitted as literals */
+#define LZ4_MIN_LENGTH (LZ4_MF_LIMIT + 1)
+
+/*! wild copy step and output slack */
+#define LZ4_WILDCOPY_LENGTH 16
+
+/*! a compressed byte expands at most to this many bytes, a 255 length byte adds 255 bytes of match */
+#define LZ4_MAX_EXPANSION 255
+
+/*! hashtable size 2^12 */
+#define LZ4_HASHTABLE_SIZE 12
+
+/*! hash4 multiplier */
+#define LZ4_HASHTABLE_MUL 2654435761U
+
+/*! search step is increased after each 2^LZ4_SKIP_TRIGGER failed probes */
+#define LZ4_SKIP_TRIGGER 6
+
+/*! size of unpacked size header */
+#define LZ4_HEADER_SIZE sizeof(uint64_t)
+
+/*! unaligned 16 bit type */
+typedef uint16_t __attribute__((aligned(1), may_alias)) lz4_unaligned_uint16_t;
+/*! unaligned 32 bit type */
+typedef uint32_t __attribute__((aligned(1), may_alias)) lz4_unaligned_uint32_t;
+/*! unaligned 64 bit type */
+typedef uint64_t __attribute__((aligned(1), may_alias)) lz4_unaligned_uint64_t;
+
+/**
+ * @brief hash function
+ * @param[in] data data to hash
+ * @return hash value
+ */
+static inline uint32_t lz4_hash4(uint32_t data) {
+    return (data * LZ4_HASHTABLE_MUL) >> (32 - LZ4_HASHTABLE_SIZE);
+}
+
+/**
+ * @brief reads unaligned 32 bit value
+ * @param[in] p pointer
+ * @return value
+ */
+static inline uint32_t lz4_read32(const uint8_t* p) {
+    return *(const lz4_unaligned_uint32_t*)p;
+}
+
+/**
+ * @brief reads unaligned 64 bit value
+ * @param[in] p pointer
+ * @return value
+ */
+static inline uint64_t lz4_read64(const uint8_t* p) {
+    return *(const lz4_unaligned_uint64_t*)p;
+}
+
+/**
+ * @brief copies 8 bytes with a single unaligned move
+ * @param[in] dst destination
+ * @param[in] src source
+ */
+static inline void lz4_copy8(uint8_t* dst, const uint8_t* src) {
+    *(lz4_unaligned_uint64_t*)dst = *(const lz4_unaligned_uint64_t*)src;
+}
+
+/**
+ * @brief copies 16 bytes per step until dst reaches dst_end, may write up to 15 bytes after dst_end.
+ * src and dst may overlap if src is at least 16 bytes behind dst.
+ * @param[in] dst destination
+ * @param[in] src source
+ * @param[in] dst_end destination end
+ */
+static inline void lz4_wildcopy16(uint8_t* dst, const uint8_t* src, const uint8_t* dst_end) {
+    do {
+        lz4_copy8(dst, src);
+        lz4_copy8(dst + 8, src + 8);
+        dst += 16;
+        src += 16;
+    } while(dst < dst_end);
+}
+
+/**
+ * @brief copies exactly len bytes, used when wild copy would read past source end
+ * @param[in] dst destination
+ * @param[in] src source
+ * @param[in] len length
+ */
+static inline void lz4_copy(uint8_t* dst, const uint8_t* src, uint64_t len) {
+    while(len >= 8) {
+        lz4_copy8(dst, src);
+        dst += 8;
+        src += 8;
+        len -= 8;
+    }
+
+    while(len--) {
+        *dst++ = *src++;
+    }
+}
+
+/**
+ * @brief counts common bytes of two sequences 8 bytes per step
+ * @param[in] in current position
+ * @param[in] match match position, should be before in
+ * @param[in] in_limit end of comparable area
+ * @return common byte count
+ */
+static inline uint64_t lz4_count(const uint8_t* in, const uint8_t* match, const uint8_t* in_limit) {
+    const uint8_t* start = in;
+
+    while(in + 8 <= in_limit) {
+        uint64_t diff = lz4_read64(in) ^ lz4_read64(match);
+
+        if(diff) {
+            return (in - start) + (__builtin_ctzll(diff) >> 3);
+        }
+
+        in += 8;
+        match += 8;
+    }
+
+    while(in < in_limit && *in == *match) {
+        in++;
+        match++;
+    }
+
+    return in - start;
+}
+
+/**
+ * @brief writes length extension bytes of a token
+ * @param[in] op output pointer
+ * @param[in] len length minus 15
+ * @return new output pointer
+ */
+static inline uint8_t* lz4_write_length(uint8_t* op, uint64_t len) {
+    while(len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+
+    *op++ = len;
+
+    return op;
+}
+
+/**
+ * @brief emits literal only sequence
+ * @param[in] op output pointer
+ * @param[in] literals literal start
+ * @param[in] lit_len literal count
+ * @return new output pointer
+ */
+static uint8_t* lz4_write_last_literals(uint8_t* op, const uint8_t* literals, uint64_t lit_len) {
+    if(lit_len >= 15) {
+        *op++ = 15 << 4;
+        op = lz4_write_length(op, lit_len - 15);
+    } else {
+        *op++ = lit_len << 4;
+    }
+
+    lz4_copy(op, literals, lit_len);
+
+    return op + lit_len;
+}
+
+int8_t lz4_pack(buffer_t* in, buffer_t* out) {
+    uint64_t in_len = buffer_remaining(in);
+
+    if(in_len > 0xFFFFFFFFULL) {
+        PRINTLOG(COMPRESSION, LOG_ERROR, "lz4 input too large 0x%llx", in_len);
+
+        return -1;
+    }
+
+    const uint8_t* src = buffer_get_view(in, in_len);
+
+    if(!src && in_len) {
+        return -1;
+    }
+
+    uint64_t bound = LZ4_HEADER_SIZE + in_len + in_len / 255 + LZ4_WILDCOPY_LENGTH;
+
+    uint8_t* dst = buffer_reserve(out, bound);
+
+    if(!dst) {
+        return -1;
+    }
+
+    *(lz4_unaligned_uint64_t*)dst = in_len;
+
+    uint8_t* op = dst + LZ4_HEADER_SIZE;
+
+    if(in_len < LZ4_MIN_LENGTH) {
+        op = lz4_write_last_literals(op, src, in_len);
+
+        goto commit;
+    }
+
+    uint32_t* ht = memory_malloc(sizeof(uint32_t) << LZ4_HASHTABLE_SIZE);
+
+    if(!ht) {
+        return -1;
+    }
+
+    const uint8_t* mflimit = src + in_len - LZ4_MF_LIMIT;
+    const uint8_t* matchlimit = src + in_len - LZ4_LAST_LITERALS;
+    const uint8_t* anchor = src;
+    const uint8_t* ip = src;
+
+    ht[lz4_hash4(lz4_read32(ip))] = 0;
+    ip++;
+
+    while(true) {
+        const uint8_t* ref = NULL;
+        uint32_t step = 1;
+        uint32_t search_count = 1 << LZ4_SKIP_TRIGGER;
+
+        while(true) {
+            if(ip > mflimit) {
+                goto last_literals;
+            }
+
+            uint32_t h = lz4_hash4(lz4_read32(ip));
+            ref = src + ht[h];
+            ht[h] = ip - src;
+
+            if(ip - ref <= LZ4_MAX_DISTANCE && lz4_read32(ref) == lz4_read32(ip)) {
+                break;
+            }
+
+            ip += step;
+            step = search_count++ >> LZ4_SKIP_TRIGGER;
+        }
+
+        while(ip > anchor && ref > src && ip[-1] == ref[-1]) {
+            ip--;
+            ref--;
+        }
+
+        uint64_t lit_len = ip - anchor;
+        uint8_t* token = op++;
+
+        if(lit_len >= 15) {
+            *token = 15 << 4;
+            op = lz4_write_length(op, lit_len - 15);
+        } else {
+            *token = lit_len << 4;
+        }
+
+        lz4_copy(op, anchor, lit_len);
+        op += lit_len;
+
+        *(lz4_unaligned_uint16_t*)op = ip - ref;
+        op += 2;
+
+        uint64_t match_len = LZ4_MIN_MATCH + lz4_count(ip + LZ4_MIN_MATCH, ref + LZ4_MIN_MATCH, matchlimit);
+
+        if(match_len - LZ4_MIN_MATCH >= 15) {
+            *token |= 15;
+            op = lz4_write_length(op, match_len - LZ4_MIN_MATCH - 15);
+        } else {
+            *token |= match_len - LZ4_MIN_MATCH;
+        }
+
+        ip += match_len;
+        anchor = ip;
+
+        if(ip > mflimit) {
+            break;
+        }
+
+        ht[lz4_hash4(lz4_read32(ip - 2))] = ip - 2 - src;
+    }
+
+last_literals:
+    op = lz4_write_last_literals(op, anchor, src + in_len - anchor);
+
+    memory_free(ht);
+
+commit:
+    if(!buffer_seek(in, in_len, BUFFER_SEEK_DIRECTION_CURRENT)) {
+        return -1;
+    }
+
+    if(!buffer_seek(out, op - dst, BUFFER_SEEK_DIRECTION_CURRENT)) {
+        return -1;
+    }
+
+    return 0;
+}
+
+int8_t lz4_unpack(buffer_t* in, buffer_t* out) {
+    uint64_t in_len = buffer_remaining(in);
+
+    if(in_len < LZ4_HEADER_SIZE + 1) {
+        PRINTLOG(COMPRESSION, LOG_ERROR, "lz4 input too short");
+
+        return -1;
+    }
+
+    const uint8_t* src = buffer_get_view(in, in_len);
+
+    if(!src) {
+        return -1;
+    }
+
+    uint64_t out_len = *(const lz4_unaligned_uint64_t*)src;
+
+    // header is untrusted, a length which input cannot produce would overflow reserve and end pointer
+    if(out_len > (in_len - LZ4_HEADER_SIZE) * LZ4_MAX_EXPANSION) {
+        PRINTLOG(COMPRESSION, LOG_ERROR, "lz4 output length 0x%llx is too large for input length 0x%llx", out_len, in_len);
+
+        return -1;
+    }
+
+    uint8_t* dst = buffer_reserve(out, out_len + LZ4_WILDCOPY_LENGTH);
+
+    if(!dst) {
+        return -1;
+    }
+
+    const uint8_t* ip = src + LZ4_HEADER_SIZE;
+    const uint8_t* iend = src + in_len;
+    uint8_t* op = dst;
+    uint8_t* oend = dst + out_len;
+
+    while(true) {
+        if(ip >= iend) {
+            goto corrupted;
+        }
+
+        uint8_t token = *ip++;
+        uint64_t lit_len = token >> 4;
+
+        if(lit_len == 15) {
+            uint8_t b;
+
+            do {
+                if(ip >= iend) {
+                    goto corrupted;
+                }
+
+                b = *ip++;
+                lit_len += b;
+            } while(b == 255);
+        }
+
+        if(lit_len > (uint64_t)(iend - ip) || lit_len > (uint64_t)(oend - op)) {
+            goto corrupted;
+        }
+
+        if(lit_len) {
+            if(ip + lit_len + LZ4_WILDCOPY_LENGTH <= iend) {
+                lz4_wildcopy16(op, ip, op + lit_len);
+            } else {
+                lz4_copy(op, ip, lit_len);
+            }
+        }
+
+        op += lit_len;
+        ip += lit_len;
+
+        if(ip == iend) {
+            break;
+        }
+
+        if(iend - ip < 2) {
+            goto corrupted;
+        }
+
+        uint64_t offset = *(const lz4_unaligned_uint16_t*)ip;
+        ip += 2;
+
+        if(offset == 0 || offset > (uint64_t)(op - dst)) {
+            goto corrupted;
+        }
+
+        uint64_t match_len = token & 15;
+
+        if(match_len == 15) {
+            uint8_t b;
+
+            do {
+                if(ip >= iend) {
+                    goto corrupted;
+                }
+
+                b = *ip++;
+                match_len += b;
+            } while(b == 255);
+        }
+
+        match_len += LZ4_MIN_MATCH;
+
+        if(match_len > (uint64_t)(oend - op)) {
+            goto corrupted;
+        }
+
+        const uint8_t* match = op - offset;
+        uint8_t* match_end = op + match_len;
+
+        if(offset >= 16) {
+            lz4_wildcopy16(op, match, match_end);
+        } else if(offset >= 8) {
+            uint8_t* cop = op;
+
+            do {
+                lz4_copy8(cop, match);
+                cop += 8;
+                match += 8;
+            } while(cop < match_end);
+        } else {
+            for(uint8_t* cop = op; cop < match_end; cop++) {
+                *cop = *match++;
+            }
+        }
+
+        op = match_end;
+    }
+
+    if(op != oend) {
+        goto corrupted;
+    }
+
+    if(!buffer_seek(in, in_len, BUFFER_SEEK_DIRECTION_CURRENT)) {
+        return -1;
+    }
+
+    if(!buffer_seek(out, out_len, BUFFER_SEEK_DIRECTION_CURRENT)) {
+        return -1;
+    }
+
+    return 0;
+
+corrupted:
+    PRINTLOG(COMPRESSION, LOG_ERROR, "lz4 stream corrupted at 0x%llx", (uint64_t)(ip - src));
+
+    return -1;
+}
@@ -223,7 +223,11 @@ uint8_t* network_dhcpv4_process_packet(network_dhcpv4_t* recv_dhcpv4_packet, voi
 
         res->packet_data = packet_data;
 
-        list_queue_push(ni->return_queue, res);
+        if(network_transmit_packet_push(ni->return_queue, res) != 0) {
+            PRINTLOG(NETWORK, LOG_ERROR, "cannot queue dhcp packet");
+            memory_free_ext(list_get_heap(ni->return_queue), packet_data);
+            memory_free_ext(list_get_heap(ni->return_queue), res);
+        }
 
         PRINTLOG(NETWORK, LOG_TRACE, "dhcp request is send");
     } else if(type == NETWORK_DHCPV4_OPCODE_ACK) {
@@ -30,6 +30,10 @@ int8_t spool_init(size_t spool_size, uint64_t spool_start) {
         return -1;
     }
 
+    if(memory_heap_register_range(spool_heap, spool_start, spool_start + spool_size) != 0) {
+        return -1;
+    }
+
     spool_list = list_create_queue_with_heap(spool_heap);
 
     if(spool_list == NULL) {
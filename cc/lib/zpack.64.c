@@ -27,7 +27,7 @@ MODULE("turnstone.lib");
 /*! hash4 multiplier */
 #define ZPACK_HASHTABLE_MUL 2654435761U
 
-/*! hashtable previous size, backward item count */
+/*! hashtable previous size, backward item count, power of two above window size */
 #define ZPACK_HASHTABLE_PREV_SIZE 16384
 
 /*! no position */
@@ -51,6 +51,37 @@ typedef struct zpack_hashtable_t {
     int64_t head[1ULL << ZPACK_HASHTABLE_SIZE]; ///< hashtable heads
 } zpack_hashtable_t; ///< hashtable structure
 
+/**
+ * @struct zpack_level_config_t
+ * @brief match finder parameters of a compression level
+ */
+typedef struct zpack_level_config_t {
+    uint16_t  good_length; ///< remaining chain is cut to a quarter once best match reaches this length
+    uint16_t  lazy_length; ///< lazy levels try next position for shorter matches, other levels index match interior up to this length
+    uint16_t  nice_length; ///< search stops once best match reaches this length
+    uint16_t  max_chain; ///< chain entries visited per search
+    boolean_t lazy; ///< lazy match evaluation
+} zpack_level_config_t; ///< level parameters
+
+/*! match finder parameters of levels, level 0 is not used */
+static const zpack_level_config_t zpack_level_configs[ZPACK_LEVEL_MAX + 1] = {
+    {0, 0, 0, 0, false},
+    {4, 4, 8, 4, false},
+    {4, 5, 16, 8, false},
+    {4, 6, 32, 32, false},
+    {4, 4, 16, 16, true},
+    {8, 16, 32, 32, true},
+    {8, 16, 128, 128, true},
+    {8, 32, 128, 256, true},
+    {32, 128, ZPACK_MAX_MATCH, 1024, true},
+    {32, ZPACK_MAX_MATCH, ZPACK_MAX_MATCH, 4096, true},
+};
+
+/*! unaligned 32 bit type */
+typedef uint32_t __attribute__((aligned(1), may_alias)) zpack_unaligned_uint32_t;
+/*! unaligned 64 bit type */
+typedef uint64_t __attribute__((aligned(1), may_alias)) zpack_unaligned_uint64_t;
+
 /**
  * @brief hash function
  * @param[in] data data to hash
@@ -62,114 +93,167 @@ static inline uint32_t zpack_hash4(uint32_t data) {
 
 /**
  * @brief insert position to hashtable
- * @param[in] pos position
- * @param[in] h hash value
+ * @param[in] data input
+ * @param[in] pos position, at least minimum match bytes should follow it
  * @param[in] ht hashtable
  */
-static inline void zpack_hash_insert(int64_t pos, uint32_t h, zpack_hashtable_t* ht) {
-    ht->prev[pos % ZPACK_WINDOW_SIZE] = ht->head[h];
+static inline void zpack_hash_insert(const uint8_t* data, int64_t pos, zpack_hashtable_t* ht) {
+    uint32_t h = zpack_hash4(*(const zpack_unaligned_uint32_t*)(data + pos));
+
+    ht->prev[pos & (ZPACK_HASHTABLE_PREV_SIZE - 1)] = ht->head[h];
     ht->head[h] = pos;
 }
 
 /**
- * @brief find best match
- * @param[in] in input buffer
+ * @brief counts common bytes of two sequences 8 bytes per step, first difference is found with xor and ctz
+ * @param[in] a first sequence
+ * @param[in] b second sequence
+ * @param[in] max_len comparison limit
+ * @return common byte count
+ */
+static inline int64_t zpack_match_length(const uint8_t* a, const uint8_t* b, int64_t max_len) {
+    int64_t len = 0;
+
+    while(len + 8 <= max_len) {
+        uint64_t diff = *(const zpack_unaligned_uint64_t*)(a + len) ^ *(const zpack_unaligned_uint64_t*)(b + len);
+
+        if(diff) {
+            return len + (__builtin_ctzll(diff) >> 3);
+        }
+
+        len += 8;
+    }
+
+    while(len < max_len && a[len] == b[len]) {
+        len++;
+    }
+
+    return len;
+}
+
+/**
+ * @brief find best match by walking hash chain of position, position itself is not inserted
+ * @param[in] data input
  * @param[in] in_len input buffer length
  * @param[in] in_p input buffer position
  * @param[in] ht hashtable
+ * @param[in] config level parameters
  * @return best match
  */
-static zpack_match_t zpack_find_bestmatch (buffer_t* in, int64_t in_len, int64_t in_p, zpack_hashtable_t* ht) {
+static zpack_match_t zpack_find_bestmatch (const uint8_t* data, int64_t in_len, int64_t in_p, const zpack_hashtable_t* ht, const zpack_level_config_t* config) {
     int64_t max_match = MIN(in_len - in_p, ZPACK_MAX_MATCH);
-    int64_t start = in_p - ZPACK_WINDOW_SIZE;
 
-    if(start < 0) {
-        start = 0;
+    if(max_match < ZPACK_MIN_MATCH) {
+        return (zpack_match_t){.best_size = 0, .best_pos = ZPACK_NO_POS};
     }
 
-    uint32_t hash = buffer_peek_ints(in, ZPACK_MIN_MATCH);
-    hash = zpack_hash4(hash);
+    int64_t start = MAX(0, in_p - ZPACK_WINDOW_SIZE);
+    int64_t nice_length = MIN(config->nice_length, max_match);
+    const uint8_t* cur = data + in_p;
 
     int64_t best_size = 0;
-    int64_t best_pos = -1;
-    int64_t i = ht->head[hash];
-    int64_t max_match_step = 4096;
-
-    while(i != ZPACK_NO_POS && max_match_step > 0) {
-        if(i < start) {
-            break;
-        }
-
-        if(best_size >= 32) {
-            max_match_step >>= 2;
-        }
-
-        max_match_step--;
+    int64_t best_pos = ZPACK_NO_POS;
+    int64_t i = ht->head[zpack_hash4(*(const zpack_unaligned_uint32_t*)cur)];
+    uint32_t chain = config->max_chain;
+    boolean_t chain_cut = false;
 
-        int64_t j = 0;
-        boolean_t not_matched = false;
+    while(i != ZPACK_NO_POS && i >= start && chain > 0) {
+        chain--;
 
-        for(; j < best_size && j < max_match; j++) {
-            if(buffer_peek_byte_at_position(in, i + j) != buffer_peek_byte_at_position(in, in_p + j)) {
-                not_matched = true;
+        const uint8_t* cand = data + i;
 
-                break;
-            }
-        }
+        // a candidate can be longer than best match only if it also matches at best match's end
+        if(cand[best_size] == cur[best_size] && cand[0] == cur[0]) {
+            int64_t len = zpack_match_length(cand, cur, max_match);
 
-        if(not_matched) {
-            i = ht->prev[i % ZPACK_HASHTABLE_PREV_SIZE];
+            if(len > best_size) {
+                best_size = len;
+                best_pos = i;
 
-            continue;
-        }
+                if(len >= nice_length) {
+                    break;
+                }
 
-        for(; j < max_match; j++) {
-            if(buffer_peek_byte_at_position(in, i + j) != buffer_peek_byte_at_position(in, in_p + j)) {
-                break;
+                if(!chain_cut && len >= config->good_length) {
+                    chain >>= 2;
+                    chain_cut = true;
+                }
             }
         }
 
-        if(j >= ZPACK_MIN_MATCH && j > best_size) {
-            best_size = j;
-            best_pos = i;
-        }
+        int64_t prev_i = ht->prev[i & (ZPACK_HASHTABLE_PREV_SIZE - 1)];
 
-        if(j == max_match) {
-            break;
-        }
-
-        int64_t prev_i = ht->prev[i % ZPACK_HASHTABLE_PREV_SIZE];
-
-        if(prev_i == i) {
+        // chains only go backwards, anything else is a slot reused by a newer position
+        if(prev_i >= i) {
             break;
         }
 
         i = prev_i;
     }
 
-    zpack_hash_insert(in_p, hash, ht);
+    if(best_size < ZPACK_MIN_MATCH) {
+        return (zpack_match_t){.best_size = 0, .best_pos = ZPACK_NO_POS};
+    }
 
     return (zpack_match_t){.best_size = best_size, .best_pos = best_pos};
 }
 
 int8_t zpack_pack (buffer_t* in, buffer_t* out) {
+    return zpack_pack_with_level(in, out, ZPACK_LEVEL_DEFAULT);
+}
+
+int8_t zpack_pack_with_level(buffer_t* in, buffer_t* out, uint8_t level) {
+    if(level < ZPACK_LEVEL_MIN || level > ZPACK_LEVEL_MAX) {
+        return -1;
+    }
+
+    const zpack_level_config_t* config = &zpack_level_configs[level];
+
+    int64_t in_len = buffer_get_length(in);
+    int64_t in_p = (int64_t)buffer_get_position(in);
+
+    if(in_p == in_len) {
+        return 0;
+    }
+
+    const uint8_t* data = buffer_get_view_at_position(in, 0, in_len);
+
+    if(!data) {
+        return -1;
+    }
+
     zpack_hashtable_t* ht = memory_malloc(sizeof(zpack_hashtable_t));
 
     if(!ht) {
-        return 0;
+        return -1;
     }
 
     memory_memset(ht->head, 0xFF, sizeof(ht->head));
 
     buffer_t* individuals = buffer_new_with_capacity(NULL, 257);
-    int64_t in_len = buffer_get_length(in);
 
-    while (buffer_remaining(in)) {
-        int64_t in_p = (int64_t)buffer_get_position(in);
+    zpack_match_t next_zpm = {.best_size = 0, .best_pos = ZPACK_NO_POS};
+    boolean_t has_next_zpm = false;
+
+    while (in_p < in_len) {
+        zpack_match_t zpm = has_next_zpm ? next_zpm : zpack_find_bestmatch(data, in_len, in_p, ht, config);
+        has_next_zpm = false;
+
+        if(in_p + ZPACK_MIN_MATCH <= in_len) {
+            zpack_hash_insert(data, in_p, ht);
+        }
 
-        zpack_match_t zpm = zpack_find_bestmatch(in, in_len, in_p, ht);
+        // lazy evaluation: a short match is deferred if next position has a longer one
+        if(zpm.best_pos != ZPACK_NO_POS && config->lazy && zpm.best_size < config->lazy_length) {
+            next_zpm = zpack_find_bestmatch(data, in_len, in_p + 1, ht, config);
 
-        if(zpm.best_pos != -1 && zpm.best_size > 3) {
+            if(next_zpm.best_size > zpm.best_size) {
+                has_next_zpm = true;
+                zpm.best_pos = ZPACK_NO_POS;
+            }
+        }
+
+        if(zpm.best_pos != ZPACK_NO_POS) {
             /* copy */
             if (buffer_get_length(individuals)) {
                 out = buffer_append_byte(out, (buffer_get_length(individuals) - 1) | 0xC0);
@@ -181,13 +265,15 @@ int8_t zpack_pack (buffer_t* in, buffer_t* out) {
 
             int32_t offset = in_p - zpm.best_pos;
 
-            if(!buffer_seek(in, zpm.best_size, BUFFER_SEEK_DIRECTION_CURRENT)) {
-                buffer_destroy(individuals);
-                memory_free(ht);
-
-                return -1;
+            // fast levels skip indexing inside long matches
+            if(config->lazy || zpm.best_size <= config->lazy_length) {
+                for(int64_t p = in_p + 1; p < in_p + zpm.best_size && p + ZPACK_MIN_MATCH <= in_len; p++) {
+                    zpack_hash_insert(data, p, ht);
+                }
             }
 
+            in_p += zpm.best_size;
+
             zpm.best_size -= 4;
 
             out = buffer_append_byte(out, zpm.best_size);
@@ -201,7 +287,7 @@ int8_t zpack_pack (buffer_t* in, buffer_t* out) {
 
         } else {
             /* individual bytes */
-            individuals = buffer_append_byte(individuals, buffer_get_byte(in));
+            individuals = buffer_append_byte(individuals, data[in_p++]);
 
             if (buffer_get_length(individuals) == 0x40) {
                 out = buffer_append_byte(out, (buffer_get_length(individuals) - 1) | 0xC0);
@@ -224,6 +310,10 @@ int8_t zpack_pack (buffer_t* in, buffer_t* out) {
     buffer_destroy(individuals);
     memory_free(ht);
 
+    if(!buffer_seek(in, in_len, BUFFER_SEEK_DIRECTION_START)) {
+        return -1;
+    }
+
     return 0;
 }
 
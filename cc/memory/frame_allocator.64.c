@@ -2,6 +2,12 @@
  * @file frame_allocator.64.c
  * @brief Physical Frame allocator implementation for 64-bit systems.
  *
+ * free memory is managed by a binary buddy system over the efi memory map. each order has a bitmap
+ * of free blocks, blocks are split while allocating and coalesced with their buddies while releasing,
+ * so allocations and releases do not allocate memory. plain used frames are tracked with a page
+ * bitmap, reserved frames still live at an address ordered tree because of their attributes. each cpu
+ * keeps a short cache of single frames for page sized allocations.
+ *
  * This work is licensed under TURNSTONE OS Public License.
  * Please read and understand latest version of Licence.
  */
@@ -17,20 +23,50 @@
 #include <memory/paging.h>
 #include <stdbufs.h>
 #include <logging.h>
+#include <utils.h>
 
 MODULE("turnstone.kernel.memory.frame");
 
+/*! max buddy order, blocks of max order are 1 GiB */
+#define FRAME_ALLOCATOR_MAX_ORDER       18
+/*! max cpu count of per cpu frame caches */
+#define FRAME_ALLOCATOR_MAX_CPU_COUNT   256
+/*! frame count of a per cpu cache */
+#define FRAME_ALLOCATOR_CPU_CACHE_SIZE  32
+/*! frame count moved between buddy and per cpu cache at once */
+#define FRAME_ALLOCATOR_CPU_CACHE_BATCH 16
+/*! memory pressure is notified when free frames are below total / divisor */
+#define FRAME_ALLOCATOR_LOW_WATERMARK_DIVISOR  32
+/*! shrinkers are asked to free until free frames reach total / divisor */
+#define FRAME_ALLOCATOR_HIGH_WATERMARK_DIVISOR 16
+
+typedef struct frame_allocator_cpu_cache_t {
+    uint64_t count; ///< cached frame count
+    uint64_t frames[FRAME_ALLOCATOR_CPU_CACHE_SIZE]; ///< cached free frame addresses
+} frame_allocator_cpu_cache_t;
+
+typedef struct frame_allocator_numa_t {
+    frame_numa_topology_t topology; ///< copy of numa topology
+    uint8_t               fallbacks[FRAME_NUMA_MAX_NODE_COUNT][FRAME_NUMA_MAX_NODE_COUNT]; ///< nodes sorted by distance for each node
+    uint64_t              free_frame_counts[FRAME_NUMA_MAX_NODE_COUNT]; ///< free pages of nodes at buddy
+} frame_allocator_numa_t;
+
 typedef struct frame_allocator_context_t {
-    memory_heap_t* heap;
-    list_t*        free_frames_sorted_by_size;
-    list_t*        acpi_frames;
-    index_t*       free_frames_by_address;
-    index_t*       allocated_frames_by_address;
-    index_t*       reserved_frames_by_address;
-    lock_t*        lock;
-    uint64_t       total_frame_count;
-    uint64_t       free_frame_count;
-    uint64_t       allocated_frame_count;
+    memory_heap_t*               heap;
+    list_t*                      acpi_frames;
+    index_t*                     allocated_frames_by_address; ///< only used frames with attributes, plain used frames are at used map
+    index_t*                     reserved_frames_by_address;
+    lock_t*                      lock;
+    uint64_t                     total_frame_count;
+    uint64_t                     free_frame_count;
+    uint64_t                     allocated_frame_count;
+    uint64_t                     page_count; ///< page count managed by buddy, starts at address 0
+    uint64_t*                    free_maps[FRAME_ALLOCATOR_MAX_ORDER + 1]; ///< free block bitmaps of orders
+    uint64_t                     free_block_counts[FRAME_ALLOCATOR_MAX_ORDER + 1]; ///< free block counts of orders
+    uint64_t                     free_map_hints[FRAME_ALLOCATOR_MAX_ORDER + 1]; ///< first word of free maps which may have a free block
+    uint64_t*                    used_map; ///< plain used pages
+    frame_allocator_cpu_cache_t* cpu_caches;
+    frame_allocator_numa_t*      numa; ///< numa topology, null if memory is at single node
 } frame_allocator_context_t;
 
 
@@ -47,6 +83,9 @@ frame_type_t fa_get_fa_type(efi_memory_type_t efi_m_type);
 uint64_t     fa_get_total_frame_count(frame_allocator_t* self);
 uint64_t     fa_get_free_frame_count(frame_allocator_t* self);
 uint64_t     fa_get_allocated_frame_count(frame_allocator_t* self);
+int8_t       fa_set_numa_topology(frame_allocator_t* self, const frame_numa_topology_t* topology);
+uint64_t     fa_get_node_count(frame_allocator_t* self);
+uint64_t     fa_get_node_free_frame_count(frame_allocator_t* self, uint64_t node);
 
 int8_t frame_allocator_cmp_by_size(const void* data1, const void* data2){
     frame_t* f1 = (frame_t*)data1;
@@ -99,7 +138,7 @@ uint64_t fa_get_free_frame_count(frame_allocator_t* self) {
 
     frame_allocator_context_t* ctx = (frame_allocator_context_t*)self->context;
 
-    return ctx->free_frame_count;
+    return __atomic_load_n(&ctx->free_frame_count, __ATOMIC_RELAXED);
 }
 
 uint64_t fa_get_allocated_frame_count(frame_allocator_t* self) {
@@ -109,351 +148,1002 @@ uint64_t fa_get_allocated_frame_count(frame_allocator_t* self) {
 
     frame_allocator_context_t* ctx = (frame_allocator_context_t*)self->context;
 
-    return ctx->allocated_frame_count;
+    return __atomic_load_n(&ctx->allocated_frame_count, __ATOMIC_RELAXED);
 }
 
-int8_t fa_reserve_system_frames(frame_allocator_t* self, frame_t* f){
-    frame_allocator_context_t* ctx = (frame_allocator_context_t*)self->context;
+/**
+ * @brief moves frame count between free and allocated counters, per cpu caches update them without lock
+ * @param[in] ctx allocator context
+ * @param[in] count frame count moved from free to allocated, negative for releases
+ */
+static void frame_allocator_account(frame_allocator_context_t* ctx, int64_t count) {
+    __atomic_add_fetch(&ctx->allocated_frame_count, count, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&ctx->free_frame_count, count, __ATOMIC_RELAXED);
+}
 
-    lock_acquire(ctx->lock);
+/**
+ * @brief notifies memory pressure when free frames are below low watermark, lock should not be held
+ * @param[in] ctx allocator context
+ * @param[in] failed_count frame count of failed allocation, 0 after successful ones
+ */
+static void frame_allocator_check_watermark(frame_allocator_context_t* ctx, uint64_t failed_count) {
+    uint64_t free_count = __atomic_load_n(&ctx->free_frame_count, __ATOMIC_RELAXED);
+    uint64_t low = ctx->total_frame_count / FRAME_ALLOCATOR_LOW_WATERMARK_DIVISOR;
 
-    uint64_t rem_frm_cnt = f->frame_count;
-    uint64_t rem_frm_start = f->frame_address;
+    if(!failed_count && free_count >= low) {
+        return;
+    }
 
+    // shrinkers are asked to refill until high watermark
+    uint64_t high = ctx->total_frame_count / FRAME_ALLOCATOR_HIGH_WATERMARK_DIVISOR;
+    uint64_t target = failed_count + (high > free_count ? high - free_count : 0);
 
+    memory_pressure_notify(target * FRAME_SIZE);
+}
 
-    while(rem_frm_cnt) {
+/**
+ * @brief zeros frames through a temporary mapping, lock should be held
+ * @param[in] frame_address first frame
+ * @param[in] frame_count frame count
+ */
+static void frame_allocator_clean_frames(uint64_t frame_address, uint64_t frame_count) {
+    for(uint64_t i = 0; i < frame_count; i++) {
+        memory_paging_add_page(0x1000, frame_address + i * FRAME_SIZE, MEMORY_PAGING_PAGE_TYPE_4K);
+        memory_memclean((void*)(0x1000), FRAME_SIZE);
+        // mapping is only used by current cpu under lock, a shootdown would wait other cpus with lock held
+        memory_paging_delete_page_local(0x1000, NULL);
+    }
+}
 
-        frame_t search_frm = {rem_frm_start, 1, 0, 0};
+static inline boolean_t frame_allocator_map_test(const uint64_t* map, uint64_t idx) {
+    return (map[idx >> 6] >> (idx & 63)) & 1;
+}
 
-        frame_t* frm = (frame_t*)ctx->reserved_frames_by_address->find(ctx->reserved_frames_by_address, &search_frm);
+/**
+ * @brief returns node of page
+ * @param[in] numa numa topology
+ * @param[in] page page
+ * @return node or @ref FRAME_NUMA_NODE_UNKNOWN if page is not at any node range
+ */
+static uint64_t frame_allocator_numa_node_of_page(const frame_allocator_numa_t* numa, uint64_t page) {
+    for(uint64_t i = 0; i < numa->topology.range_count; i++) {
+        const frame_numa_range_t* r = &numa->topology.ranges[i];
+        uint64_t start = r->frame_address / FRAME_SIZE;
 
-        if(frm == NULL) {
-            break;
+        if(page >= start && page < start + r->frame_count) {
+            return r->node;
         }
+    }
 
-        if(frm->frame_address <= rem_frm_start && rem_frm_cnt <= frm->frame_count) {
-            lock_release(ctx->lock);
-            PRINTLOG(FRAMEALLOCATOR, LOG_TRACE, "frame inside reserved area");
+    return FRAME_NUMA_NODE_UNKNOWN;
+}
 
-            return 0;
+/**
+ * @brief checks block does not cross a node range boundary, so a block always belongs to one node
+ * @param[in] numa numa topology
+ * @param[in] order block order
+ * @param[in] idx block index at order
+ * @return true if block is inside one range or outside of all ranges
+ */
+static boolean_t frame_allocator_numa_block_fits(const frame_allocator_numa_t* numa, uint64_t order, uint64_t idx) {
+    uint64_t start = idx << order;
+    uint64_t end = start + (1ULL << order);
+
+    for(uint64_t i = 0; i < numa->topology.range_count; i++) {
+        const frame_numa_range_t* r = &numa->topology.ranges[i];
+        uint64_t r_start = r->frame_address / FRAME_SIZE;
+        uint64_t r_end = r_start + r->frame_count;
+
+        if((r_start > start && r_start < end) || (r_end > start && r_end < end)) {
+            return false;
         }
+    }
 
-        uint64_t frm_alloc_cnt = (rem_frm_start - frm->frame_address) / FRAME_SIZE;
-        frm_alloc_cnt = frm->frame_count - frm_alloc_cnt;
+    return true;
+}
 
-        rem_frm_start += frm_alloc_cnt * FRAME_SIZE;
-        rem_frm_cnt -= frm_alloc_cnt;
+/**
+ * @brief returns node of current cpu
+ * @param[in] ctx allocator context
+ * @return node or @ref FRAME_NUMA_NODE_UNKNOWN
+ */
+static uint64_t frame_allocator_numa_get_cpu_node(frame_allocator_context_t* ctx) {
+    uint64_t cpu_id = 0;
+
+    if(!ctx->numa || !memory_get_cpu_id(&cpu_id) || cpu_id >= FRAME_NUMA_MAX_CPU_COUNT) {
+        return FRAME_NUMA_NODE_UNKNOWN;
     }
 
+    return ctx->numa->topology.cpu_nodes[cpu_id];
+}
 
-    while(rem_frm_cnt) {
-        PRINTLOG(FRAMEALLOCATOR, LOG_TRACE, "remaining frame start 0x%llx count 0x%llx", rem_frm_start, rem_frm_cnt);
+/**
+ * @brief marks free block of order, lock should be held
+ * @param[in] ctx allocator context
+ * @param[in] order block order
+ * @param[in] idx block index at order
+ */
+static void frame_allocator_buddy_set(frame_allocator_context_t* ctx, uint64_t order, uint64_t idx) {
+    ctx->free_maps[order][idx >> 6] |= 1ULL << (idx & 63);
+    ctx->free_block_counts[order]++;
 
-        frame_t search_frm = {rem_frm_start, 1, 0, 0};
+    if(ctx->numa) {
+        uint64_t node = frame_allocator_numa_node_of_page(ctx->numa, idx << order);
 
-        frame_t* frm = (frame_t*)ctx->free_frames_by_address->find(ctx->free_frames_by_address, &search_frm);
+        if(node != FRAME_NUMA_NODE_UNKNOWN) {
+            ctx->numa->free_frame_counts[node] += 1ULL << order;
+        }
+    }
 
-        if(frm == NULL) {
-            frame_t* new_r_frm = memory_malloc_ext(ctx->heap, sizeof(frame_t), 0);
+    if((idx >> 6) < ctx->free_map_hints[order]) {
+        ctx->free_map_hints[order] = idx >> 6;
+    }
+}
 
-            if(new_r_frm == NULL) {
-                PRINTLOG(FRAMEALLOCATOR, LOG_FATAL, "no free memory. Halting...");
-                cpu_hlt();
+/**
+ * @brief unmarks free block of order, lock should be held
+ * @param[in] ctx allocator context
+ * @param[in] order block order
+ * @param[in] idx block index at order
+ */
+static void frame_allocator_buddy_clear(frame_allocator_context_t* ctx, uint64_t order, uint64_t idx) {
+    ctx->free_maps[order][idx >> 6] &= ~(1ULL << (idx & 63));
+    ctx->free_block_counts[order]--;
+
+    if(ctx->numa) {
+        uint64_t node = frame_allocator_numa_node_of_page(ctx->numa, idx << order);
+
+        if(node != FRAME_NUMA_NODE_UNKNOWN) {
+            ctx->numa->free_frame_counts[node] -= 1ULL << order;
+        }
+    }
+}
+
+/**
+ * @brief returns block count of order, blocks partially outside of managed pages are not counted
+ * @param[in] ctx allocator context
+ * @param[in] order block order
+ * @return block count
+ */
+static inline uint64_t frame_allocator_buddy_block_count(frame_allocator_context_t* ctx, uint64_t order) {
+    return ctx->page_count >> order;
+}
+
+/**
+ * @brief releases a block and coalesces it with its free buddies, blocks of different nodes are not coalesced, lock should be held
+ * @param[in] ctx allocator context
+ * @param[in] order block order
+ * @param[in] idx block index at order
+ */
+static void frame_allocator_buddy_free_block(frame_allocator_context_t* ctx, uint64_t order, uint64_t idx) {
+    while(order < FRAME_ALLOCATOR_MAX_ORDER &&
+          (idx ^ 1) < frame_allocator_buddy_block_count(ctx, order) &&
+          frame_allocator_map_test(ctx->free_maps[order], idx ^ 1) &&
+          (!ctx->numa || frame_allocator_numa_block_fits(ctx->numa, order + 1, idx >> 1))) {
+        frame_allocator_buddy_clear(ctx, order, idx ^ 1);
+        idx >>= 1;
+        order++;
+    }
+
+    frame_allocator_buddy_set(ctx, order, idx);
+}
+
+/**
+ * @brief returns largest order of aligned block starting at page and ending before end
+ * @param[in] page block start page
+ * @param[in] end range end page
+ * @return order
+ */
+static uint64_t frame_allocator_buddy_fit_order(uint64_t page, uint64_t end) {
+    uint64_t order = page ? (uint64_t)__builtin_ctzll(page) : FRAME_ALLOCATOR_MAX_ORDER;
+
+    order = MIN(order, FRAME_ALLOCATOR_MAX_ORDER);
+
+    while(page + (1ULL << order) > end) {
+        order--;
+    }
+
+    return order;
+}
+
+/**
+ * @brief releases pages to buddy, pages outside of buddy are ignored, lock should be held
+ * @param[in] ctx allocator context
+ * @param[in] frame_address first frame
+ * @param[in] frame_count frame count
+ */
+static void frame_allocator_buddy_free_range(frame_allocator_context_t* ctx, uint64_t frame_address, uint64_t frame_count) {
+    uint64_t page = frame_address / FRAME_SIZE;
+    uint64_t end = MIN(page + frame_count, ctx->page_count);
+
+    while(page < end) {
+        uint64_t order = frame_allocator_buddy_fit_order(page, end);
+
+        while(ctx->numa && order && !frame_allocator_numa_block_fits(ctx->numa, order, page >> order)) {
+            order--;
+        }
+
+        frame_allocator_buddy_free_block(ctx, order, page >> order);
+
+        page += 1ULL << order;
+    }
+}
+
+/**
+ * @brief finds lowest free block of order inside index range, lock should be held
+ * @param[in] ctx allocator context
+ * @param[in] order block order
+ * @param[in] start first block index
+ * @param[in] limit block index limit
+ * @param[out] idx found block index
+ * @return true if found
+ */
+static boolean_t frame_allocator_buddy_find(frame_allocator_context_t* ctx, uint64_t order, uint64_t start, uint64_t limit, uint64_t* idx) {
+    if(!ctx->free_block_counts[order] || start >= limit) {
+        return false;
+    }
+
+    uint64_t word_count = (frame_allocator_buddy_block_count(ctx, order) + 63) / 64;
+    uint64_t* map = ctx->free_maps[order];
+
+    word_count = MIN(word_count, (limit + 63) / 64);
+
+    for(uint64_t w = MAX(ctx->free_map_hints[order], start >> 6); w < word_count; w++) {
+        uint64_t bits = map[w];
+
+        if(!bits) {
+            if(w == ctx->free_map_hints[order]) {
+                ctx->free_map_hints[order] = w + 1;
             }
 
-            new_r_frm->frame_address = rem_frm_start;
-            new_r_frm->frame_count = rem_frm_cnt;
-            new_r_frm->type = FRAME_TYPE_RESERVED;
-            ctx->reserved_frames_by_address->insert(ctx->reserved_frames_by_address, new_r_frm, new_r_frm, NULL);
+            continue;
+        }
 
-            PRINTLOG(FRAMEALLOCATOR, LOG_TRACE, "no used frame found, inserted into reserveds, frame start 0x%llx count 0x%llx", rem_frm_start, rem_frm_cnt);
+        if(w == (start >> 6)) {
+            bits &= ~0ULL << (start & 63);
+
+            if(!bits) {
+                continue;
+            }
+        }
+
+        uint64_t found = w * 64 + __builtin_ctzll(bits);
+
+        if(found >= limit) {
+            return false;
+        }
+
+        *idx = found;
+
+        return true;
+    }
 
+    return false;
+}
+
+/**
+ * @brief allocates a block of order, splits larger blocks if needed, lock should be held
+ * @param[in] ctx allocator context
+ * @param[in] order block order
+ * @param[in] start_page block should start at or after start page
+ * @param[in] limit_page block should end before limit page
+ * @param[out] page first page of block
+ * @return 0 on success
+ */
+static int8_t frame_allocator_buddy_alloc_block(frame_allocator_context_t* ctx, uint64_t order, uint64_t start_page, uint64_t limit_page, uint64_t* page) {
+    for(uint64_t o = order; o <= FRAME_ALLOCATOR_MAX_ORDER; o++) {
+        uint64_t idx = 0;
+        uint64_t start = (start_page + (1ULL << o) - 1) >> o;
+
+        if(!frame_allocator_buddy_find(ctx, o, start, limit_page >> o, &idx)) {
+            continue;
+        }
+
+        frame_allocator_buddy_clear(ctx, o, idx);
+
+        while(o > order) {
+            o--;
+            idx <<= 1;
+            frame_allocator_buddy_set(ctx, o, idx + 1);
+        }
+
+        *page = idx << order;
+
+        return 0;
+    }
+
+    return -1;
+}
+
+/**
+ * @brief allocates continuous pages, tail of rounded block returns to buddy, lock should be held
+ * @param[in] ctx allocator context
+ * @param[in] count page count
+ * @param[in] start_page pages should start at or after start page
+ * @param[in] limit_page pages should end before limit page
+ * @param[out] page first page
+ * @return 0 on success
+ */
+static int8_t frame_allocator_buddy_alloc(frame_allocator_context_t* ctx, uint64_t count, uint64_t start_page, uint64_t limit_page, uint64_t* page) {
+    uint64_t max_block = 1ULL << FRAME_ALLOCATOR_MAX_ORDER;
+
+    if(count <= max_block) {
+        uint64_t order = 0;
+
+        while((1ULL << order) < count) {
+            order++;
+        }
+
+        if(frame_allocator_buddy_alloc_block(ctx, order, start_page, limit_page, page) != 0) {
+            return -1;
+        }
+
+        frame_allocator_buddy_free_range(ctx, (*page + count) * FRAME_SIZE, (1ULL << order) - count);
+
+        return 0;
+    }
+
+    // larger requests need a run of free max order blocks
+    uint64_t need = (count + max_block - 1) / max_block;
+    uint64_t limit = MIN(frame_allocator_buddy_block_count(ctx, FRAME_ALLOCATOR_MAX_ORDER), limit_page >> FRAME_ALLOCATOR_MAX_ORDER);
+    uint64_t* map = ctx->free_maps[FRAME_ALLOCATOR_MAX_ORDER];
+    uint64_t run = 0;
+
+    for(uint64_t idx = (start_page + max_block - 1) / max_block; idx < limit; idx++) {
+        run = frame_allocator_map_test(map, idx) ? run + 1 : 0;
+
+        if(run == need) {
+            uint64_t first = idx + 1 - need;
+
+            for(uint64_t i = first; i <= idx; i++) {
+                frame_allocator_buddy_clear(ctx, FRAME_ALLOCATOR_MAX_ORDER, i);
+            }
+
+            *page = first * max_block;
+
+            frame_allocator_buddy_free_range(ctx, (*page + count) * FRAME_SIZE, need * max_block - count);
+
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * @brief allocates continuous pages from node of current cpu, falls back to other nodes by distance and then to any page, lock should be held
+ * @param[in] ctx allocator context
+ * @param[in] count page count
+ * @param[in] limit_page pages should end before limit page
+ * @param[out] page first page
+ * @return 0 on success
+ */
+static int8_t frame_allocator_buddy_alloc_preferred(frame_allocator_context_t* ctx, uint64_t count, uint64_t limit_page, uint64_t* page) {
+    frame_allocator_numa_t* numa = ctx->numa;
+    uint64_t node = frame_allocator_numa_get_cpu_node(ctx);
+
+    if(numa && node != FRAME_NUMA_NODE_UNKNOWN) {
+        for(uint64_t i = 0; i < numa->topology.node_count; i++) {
+            uint64_t n = numa->fallbacks[node][i];
+
+            // exhausted nodes are skipped without scanning their bitmaps
+            if(numa->free_frame_counts[n] < count) {
+                continue;
+            }
+
+            for(uint64_t r = 0; r < numa->topology.range_count; r++) {
+                const frame_numa_range_t* range = &numa->topology.ranges[r];
+
+                if(range->node != n) {
+                    continue;
+                }
+
+                uint64_t start = range->frame_address / FRAME_SIZE;
+                uint64_t end = MIN(start + range->frame_count, limit_page);
+
+                if(start < end && frame_allocator_buddy_alloc(ctx, count, start, end, page) == 0) {
+                    return 0;
+                }
+            }
+        }
+    }
+
+    // memory outside of srat ranges or blocks requiring pages of several nodes
+    return frame_allocator_buddy_alloc(ctx, count, 0, limit_page, page);
+}
+
+/**
+ * @brief checks block is free, itself or a larger block containing it should be free or all its parts, lock should be held
+ * @param[in] ctx allocator context
+ * @param[in] order block order
+ * @param[in] idx block index at order
+ * @return true if all pages of block are free
+ */
+static boolean_t frame_allocator_buddy_is_free(frame_allocator_context_t* ctx, uint64_t order, uint64_t idx) {
+    for(uint64_t o = order; o <= FRAME_ALLOCATOR_MAX_ORDER; o++) {
+        uint64_t o_idx = idx >> (o - order);
+
+        if(o_idx >= frame_allocator_buddy_block_count(ctx, o)) {
+            break;
+        }
+
+        if(frame_allocator_map_test(ctx->free_maps[o], o_idx)) {
+            return true;
+        }
+    }
+
+    if(order == 0) {
+        return false;
+    }
+
+    return frame_allocator_buddy_is_free(ctx, order - 1, idx << 1) && frame_allocator_buddy_is_free(ctx, order - 1, (idx << 1) + 1);
+}
+
+/**
+ * @brief removes a free block from buddy, splits containing block if needed, lock should be held
+ * @param[in] ctx allocator context
+ * @param[in] order block order
+ * @param[in] idx block index at order
+ */
+static void frame_allocator_buddy_claim(frame_allocator_context_t* ctx, uint64_t order, uint64_t idx) {
+    for(uint64_t o = order; o <= FRAME_ALLOCATOR_MAX_ORDER; o++) {
+        uint64_t o_idx = idx >> (o - order);
+
+        if(o_idx >= frame_allocator_buddy_block_count(ctx, o)) {
             break;
         }
 
-        PRINTLOG(FRAMEALLOCATOR, LOG_TRACE, "area inside free frames, frame start 0x%llx count 0x%llx", rem_frm_start, rem_frm_cnt);
+        if(frame_allocator_map_test(ctx->free_maps[o], o_idx)) {
+            frame_allocator_buddy_clear(ctx, o, o_idx);
 
-        uint64_t frm_alloc_cnt = (rem_frm_start - frm->frame_address) / FRAME_SIZE;
-        frm_alloc_cnt = frm->frame_count - frm_alloc_cnt;
+            // other halves on the way down stay free
+            while(o > order) {
+                o--;
+                frame_allocator_buddy_set(ctx, o, (idx >> (o - order)) ^ 1);
+            }
+
+            return;
+        }
+    }
+
+    if(order == 0) {
+        return;
+    }
+
+    frame_allocator_buddy_claim(ctx, order - 1, idx << 1);
+    frame_allocator_buddy_claim(ctx, order - 1, (idx << 1) + 1);
+}
+
+/**
+ * @brief checks or claims all pages of range, lock should be held
+ * @param[in] ctx allocator context
+ * @param[in] frame_address first frame
+ * @param[in] frame_count frame count
+ * @param[in] claim if false only checks
+ * @return true if all pages are free
+ */
+static boolean_t frame_allocator_buddy_range(frame_allocator_context_t* ctx, uint64_t frame_address, uint64_t frame_count, boolean_t claim) {
+    uint64_t page = frame_address / FRAME_SIZE;
+    uint64_t end = page + frame_count;
 
-        frame_t new_frm = {rem_frm_start, 0, FRAME_TYPE_RESERVED, 0};
+    if(end > ctx->page_count || page >= end) {
+        return false;
+    }
+
+    while(page < end) {
+        uint64_t order = frame_allocator_buddy_fit_order(page, end);
+
+        if(claim) {
+            frame_allocator_buddy_claim(ctx, order, page >> order);
+        } else if(!frame_allocator_buddy_is_free(ctx, order, page >> order)) {
+            return false;
+        }
+
+        page += 1ULL << order;
+    }
+
+    return true;
+}
+
+/**
+ * @brief sets or clears used bits of pages
+ * @param[in] ctx allocator context
+ * @param[in] frame_address first frame
+ * @param[in] frame_count frame count
+ * @param[in] used new state
+ */
+static void frame_allocator_mark_used(frame_allocator_context_t* ctx, uint64_t frame_address, uint64_t frame_count, boolean_t used) {
+    uint64_t page = frame_address / FRAME_SIZE;
+    uint64_t end = MIN(page + frame_count, ctx->page_count);
 
-        if(frm_alloc_cnt < rem_frm_cnt) {
-            new_frm.frame_count = frm_alloc_cnt;
-            rem_frm_cnt -= frm_alloc_cnt;
-            rem_frm_start += frm_alloc_cnt * FRAME_SIZE;
+    while(page < end) {
+        uint64_t bits = MIN(64 - (page & 63), end - page);
+        uint64_t mask = (bits == 64 ? ~0ULL : ((1ULL << bits) - 1)) << (page & 63);
+
+        if(used) {
+            __atomic_fetch_or(&ctx->used_map[page >> 6], mask, __ATOMIC_RELAXED);
         } else {
-            new_frm.frame_count = rem_frm_cnt;
-            rem_frm_cnt = 0;
+            __atomic_fetch_and(&ctx->used_map[page >> 6], ~mask, __ATOMIC_RELAXED);
         }
 
-        self->allocate_frame(self, &new_frm);
+        page += bits;
     }
+}
 
-    lock_release(ctx->lock);
+/**
+ * @brief checks all pages of range are plain used frames
+ * @param[in] ctx allocator context
+ * @param[in] frame_address first frame
+ * @param[in] frame_count frame count
+ * @return true if all pages are used
+ */
+static boolean_t frame_allocator_is_used(frame_allocator_context_t* ctx, uint64_t frame_address, uint64_t frame_count) {
+    uint64_t page = frame_address / FRAME_SIZE;
+    uint64_t end = page + frame_count;
 
+    if(end > ctx->page_count || page >= end) {
+        return false;
+    }
 
-    return 0;
+    for(; page < end; page++) {
+        if(!frame_allocator_map_test(ctx->used_map, page)) {
+            return false;
+        }
+    }
+
+    return true;
 }
 
+/**
+ * @brief returns current cpu's frame cache, interrupts should be disabled
+ * @param[in] ctx allocator context
+ * @return cache or NULL before cpu ids are known
+ */
+static frame_allocator_cpu_cache_t* frame_allocator_get_cpu_cache(frame_allocator_context_t* ctx) {
+    uint64_t cpu_id = 0;
 
-int8_t fa_allocate_frame_by_count(frame_allocator_t* self, uint64_t count, frame_allocation_type_t fa_type, frame_t** fs, uint64_t* alloc_list_size) {
-    frame_allocator_context_t* ctx = (frame_allocator_context_t*)self->context;
+    if(!ctx->cpu_caches || !memory_get_cpu_id(&cpu_id) || cpu_id >= FRAME_ALLOCATOR_MAX_CPU_COUNT) {
+        return NULL;
+    }
 
+    return &ctx->cpu_caches[cpu_id];
+}
 
-    lock_acquire(ctx->lock);
+/**
+ * @brief allocates a single frame from current cpu's cache, refills cache from buddy in batches
+ * @param[in] ctx allocator context
+ * @param[out] frame_address allocated frame
+ * @return 0 on success, -1 if caller should use buddy
+ */
+static int8_t frame_allocator_cpu_cache_pop(frame_allocator_context_t* ctx, uint64_t* frame_address) {
+    boolean_t interrupts_enabled = cpu_cli();
+    frame_allocator_cpu_cache_t* cache = frame_allocator_get_cpu_cache(ctx);
 
-    if(fa_type & FRAME_ALLOCATION_TYPE_RELAX) {
+    if(!cache) {
+        if(interrupts_enabled) {
+            cpu_sti();
+        }
 
-    } else if(fa_type & FRAME_ALLOCATION_TYPE_BLOCK) {
-        iterator_t* iter = list_iterator_create(ctx->free_frames_sorted_by_size);
+        return -1;
+    }
 
-        if(iter == NULL) {
-            lock_release(ctx->lock);
-            PRINTLOG(FRAMEALLOCATOR, LOG_ERROR, "cannot list free frames");
+    if(cache->count) {
+        *frame_address = cache->frames[--cache->count];
 
-            return -1;
+        if(interrupts_enabled) {
+            cpu_sti();
         }
 
-        frame_t* tmp_frm = NULL;
+        return 0;
+    }
 
-        while(iter->end_of_iterator(iter) != 0) {
-            frame_t* item = (frame_t*)iter->get_item(iter);
+    if(interrupts_enabled) {
+        cpu_sti();
+    }
 
-            if(item->frame_count >= count) {
-                if(fa_type & FRAME_ALLOCATION_TYPE_UNDER_4G) {
-                    if(item->frame_address + count * FRAME_SIZE >= 0x100000000) {
-                        iter->next(iter);
+    uint64_t batch[FRAME_ALLOCATOR_CPU_CACHE_BATCH];
+    uint64_t batch_count = 0;
 
-                        continue;
-                    }
-                }
+    lock_acquire(ctx->lock);
 
-                if(count % 0x200 == 0) {
-                    if(item->frame_address % MEMORY_PAGING_PAGE_LENGTH_2M == 0) { // fast hit
-                        iter->delete_item(iter);
-                        ctx->free_frames_by_address->delete(ctx->free_frames_by_address, item, NULL);
-                        tmp_frm = item;
+    while(batch_count < FRAME_ALLOCATOR_CPU_CACHE_BATCH) {
+        uint64_t page = 0;
 
-                        break;
-                    } else {
-                        // we need check fit with alignment
-                        uint64_t begin_rem = item->frame_address % MEMORY_PAGING_PAGE_LENGTH_2M;
-                        uint64_t begin_rem_f_cnt = begin_rem / FRAME_SIZE;
+        if(frame_allocator_buddy_alloc_preferred(ctx, 1, ctx->page_count, &page) != 0) {
+            break;
+        }
 
-                        if(item->frame_count >= count + begin_rem_f_cnt) {
-                            iter->delete_item(iter);
-                            ctx->free_frames_by_address->delete(ctx->free_frames_by_address, item, NULL);
+        batch[batch_count++] = page * FRAME_SIZE;
+    }
 
-                            // we found, but we need to re-insert begining to free frames
-                            frame_t* new_begin_frm = memory_malloc_ext(ctx->heap, sizeof(frame_t), 0);
+    lock_release(ctx->lock);
 
-                            if(new_begin_frm == NULL) {
-                                PRINTLOG(FRAMEALLOCATOR, LOG_FATAL, "no free memory. Halting...");
-                                cpu_hlt();
-                            }
+    if(!batch_count) {
+        return -1;
+    }
 
-                            new_begin_frm->frame_address = item->frame_address;
-                            new_begin_frm->frame_count = begin_rem_f_cnt;
+    *frame_address = batch[--batch_count];
 
-                            list_sortedlist_insert(ctx->free_frames_sorted_by_size, new_begin_frm);
-                            ctx->free_frames_by_address->insert(ctx->free_frames_by_address, new_begin_frm, new_begin_frm, NULL);
+    interrupts_enabled = cpu_cli();
+    cache = frame_allocator_get_cpu_cache(ctx);
 
-                            item->frame_address += begin_rem_f_cnt * FRAME_SIZE;
-                            item->frame_count -= begin_rem_f_cnt;
+    // task may be moved to another cpu while refilling, remaining frames go to cache of new cpu
+    while(cache && batch_count && cache->count < FRAME_ALLOCATOR_CPU_CACHE_SIZE) {
+        cache->frames[cache->count++] = batch[--batch_count];
+    }
 
-                            tmp_frm = item;
+    if(interrupts_enabled) {
+        cpu_sti();
+    }
 
-                            break;
-                        }
+    if(batch_count) {
+        lock_acquire(ctx->lock);
 
+        while(batch_count) {
+            frame_allocator_buddy_free_range(ctx, batch[--batch_count], 1);
+        }
 
-                    }
+        lock_release(ctx->lock);
+    }
 
-                } else {
-                    iter->delete_item(iter);
-                    ctx->free_frames_by_address->delete(ctx->free_frames_by_address, item, NULL);
-                    tmp_frm = item;
+    return 0;
+}
 
-                    break;
-                }
+/**
+ * @brief puts a clean single frame to current cpu's cache, flushes half of a full cache to buddy
+ * @param[in] ctx allocator context
+ * @param[in] frame_address frame to release
+ */
+static void frame_allocator_cpu_cache_push(frame_allocator_context_t* ctx, uint64_t frame_address) {
+    uint64_t batch[FRAME_ALLOCATOR_CPU_CACHE_BATCH + 1];
+    uint64_t batch_count = 0;
+
+    boolean_t interrupts_enabled = cpu_cli();
+    frame_allocator_cpu_cache_t* cache = frame_allocator_get_cpu_cache(ctx);
+
+    if(!cache) {
+        batch[batch_count++] = frame_address;
+    } else {
+        if(cache->count == FRAME_ALLOCATOR_CPU_CACHE_SIZE) {
+            while(batch_count < FRAME_ALLOCATOR_CPU_CACHE_BATCH) {
+                batch[batch_count++] = cache->frames[--cache->count];
             }
+        }
+
+        cache->frames[cache->count++] = frame_address;
+    }
+
+    if(interrupts_enabled) {
+        cpu_sti();
+    }
+
+    if(batch_count) {
+        lock_acquire(ctx->lock);
 
-            iter = iter->next(iter);
+        while(batch_count) {
+            frame_allocator_buddy_free_range(ctx, batch[--batch_count], 1);
         }
 
-        iter->destroy(iter);
+        lock_release(ctx->lock);
+    }
+}
 
-        if(tmp_frm == NULL) {
-            lock_release(ctx->lock);
-            PRINTLOG(FRAMEALLOCATOR, LOG_ERROR, "cannot find free frames with count 0x%llx", count);
+/**
+ * @brief splits free blocks which contain given page boundary inside, lock should be held
+ * @param[in] ctx allocator context
+ * @param[in] edge boundary page
+ */
+static void frame_allocator_numa_split_at(frame_allocator_context_t* ctx, uint64_t edge) {
+    for(uint64_t o = FRAME_ALLOCATOR_MAX_ORDER; o > 0; o--) {
+        uint64_t idx = edge >> o;
+
+        if(!(edge & ((1ULL << o) - 1)) || idx >= frame_allocator_buddy_block_count(ctx, o) ||
+           !frame_allocator_map_test(ctx->free_maps[o], idx)) {
+            continue;
+        }
+
+        // the half containing the edge is checked at next order
+        frame_allocator_buddy_clear(ctx, o, idx);
+        frame_allocator_buddy_set(ctx, o - 1, idx << 1);
+        frame_allocator_buddy_set(ctx, o - 1, (idx << 1) + 1);
+    }
+}
+
+int8_t fa_set_numa_topology(frame_allocator_t* self, const frame_numa_topology_t* topology) {
+    if(self == NULL || topology == NULL || topology->node_count == 0 ||
+       topology->node_count > FRAME_NUMA_MAX_NODE_COUNT || topology->range_count > FRAME_NUMA_MAX_RANGE_COUNT) {
+        return -1;
+    }
+
+    for(uint64_t i = 0; i < topology->range_count; i++) {
+        if(topology->ranges[i].node >= topology->node_count) {
+            PRINTLOG(FRAMEALLOCATOR, LOG_ERROR, "numa range 0x%llx has unknown node 0x%llx", i, topology->ranges[i].node);
 
             return -1;
         }
+    }
+
+    frame_allocator_context_t* ctx = (frame_allocator_context_t*)self->context;
+
+    frame_allocator_numa_t* numa = memory_malloc_ext(ctx->heap, sizeof(frame_allocator_numa_t), 0);
+
+    if(numa == NULL) {
+        return -1;
+    }
+
+    memory_memcopy(topology, &numa->topology, sizeof(frame_numa_topology_t));
+
+    // nodes are sorted by distance, node itself is first at ties
+    for(uint64_t n = 0; n < topology->node_count; n++) {
+        const uint8_t* distances = topology->distances[n];
+        uint8_t* fallbacks = numa->fallbacks[n];
 
-        if(alloc_list_size) {
-            *alloc_list_size = 1;
+        fallbacks[0] = n;
+
+        for(uint64_t i = 0, count = 1; i < topology->node_count; i++) {
+            if(i == n) {
+                continue;
+            }
+
+            uint64_t j = count++;
+
+            while(j > 1 && distances[fallbacks[j - 1]] > distances[i]) {
+                fallbacks[j] = fallbacks[j - 1];
+                j--;
+            }
+
+            fallbacks[j] = i;
         }
+    }
+
+    lock_acquire(ctx->lock);
+
+    if(ctx->numa) {
+        lock_release(ctx->lock);
+        memory_free_ext(ctx->heap, numa);
+
+        PRINTLOG(FRAMEALLOCATOR, LOG_ERROR, "numa topology is already set");
+
+        return -1;
+    }
+
+    // after splitting every free block belongs to one node, free_block coalescing keeps it so
+    for(uint64_t i = 0; i < topology->range_count; i++) {
+        uint64_t start = topology->ranges[i].frame_address / FRAME_SIZE;
+
+        frame_allocator_numa_split_at(ctx, start);
+        frame_allocator_numa_split_at(ctx, start + topology->ranges[i].frame_count);
+    }
+
+    for(uint64_t o = 0; o <= FRAME_ALLOCATOR_MAX_ORDER; o++) {
+        uint64_t word_count = (frame_allocator_buddy_block_count(ctx, o) + 63) / 64;
+
+        for(uint64_t w = 0; w < word_count; w++) {
+            uint64_t bits = ctx->free_maps[o][w];
 
-        frame_t* new_frm = memory_malloc_ext(ctx->heap, sizeof(frame_t), 0);
+            while(bits) {
+                uint64_t idx = w * 64 + __builtin_ctzll(bits);
+                uint64_t node = frame_allocator_numa_node_of_page(numa, idx << o);
 
-        if(new_frm == NULL) {
-            PRINTLOG(FRAMEALLOCATOR, LOG_FATAL, "no free memory. Halting...");
-            cpu_hlt();
+                if(node != FRAME_NUMA_NODE_UNKNOWN) {
+                    numa->free_frame_counts[node] += 1ULL << o;
+                }
+
+                bits &= bits - 1;
+            }
         }
+    }
 
-        uint64_t rem_frms = tmp_frm->frame_count - count;
+    ctx->numa = numa;
 
-        new_frm->frame_address = tmp_frm->frame_address;
-        new_frm->frame_count = count;
-        new_frm->frame_attributes = tmp_frm->frame_attributes;
+    lock_release(ctx->lock);
+
+    for(uint64_t n = 0; n < topology->node_count; n++) {
+        PRINTLOG(FRAMEALLOCATOR, LOG_INFO, "numa node 0x%llx has 0x%llx free frames", n, numa->free_frame_counts[n]);
+    }
 
-        ctx->allocated_frame_count += count;
-        ctx->free_frame_count -= count;
+    return 0;
+}
+
+uint64_t fa_get_node_count(frame_allocator_t* self) {
+    if(self == NULL) {
+        return 0;
+    }
+
+    frame_allocator_context_t* ctx = (frame_allocator_context_t*)self->context;
+
+    return ctx->numa ? ctx->numa->topology.node_count : 1;
+}
+
+uint64_t fa_get_node_free_frame_count(frame_allocator_t* self, uint64_t node) {
+    if(self == NULL) {
+        return 0;
+    }
+
+    frame_allocator_context_t* ctx = (frame_allocator_context_t*)self->context;
+
+    if(!ctx->numa) {
+        return node == 0 ? fa_get_free_frame_count(self) : 0;
+    }
+
+    if(node >= ctx->numa->topology.node_count) {
+        return 0;
+    }
+
+    return __atomic_load_n(&ctx->numa->free_frame_counts[node], __ATOMIC_RELAXED);
+}
+
+int8_t fa_reserve_system_frames(frame_allocator_t* self, frame_t* f){
+    frame_allocator_context_t* ctx = (frame_allocator_context_t*)self->context;
+
+    lock_acquire(ctx->lock);
+
+    uint64_t rem_frm_cnt = f->frame_count;
+    uint64_t rem_frm_start = f->frame_address;
+
+
+
+    while(rem_frm_cnt) {
+
+        frame_t search_frm = {rem_frm_start, 1, 0, 0};
+
+        frame_t* frm = (frame_t*)ctx->reserved_frames_by_address->find(ctx->reserved_frames_by_address, &search_frm);
 
-        if(fa_type & FRAME_ALLOCATION_TYPE_OLD_RESERVED) {
-            new_frm->frame_attributes |= FRAME_ATTRIBUTE_OLD_RESERVED;
+        if(frm == NULL) {
+            break;
         }
 
-        *fs = new_frm;
+        if(frm->frame_address <= rem_frm_start && rem_frm_cnt <= frm->frame_count) {
+            lock_release(ctx->lock);
+            PRINTLOG(FRAMEALLOCATOR, LOG_TRACE, "frame inside reserved area");
 
-        if(fa_type & FRAME_ALLOCATION_TYPE_RESERVED) {
-            new_frm->type = FRAME_TYPE_RESERVED;
-            ctx->reserved_frames_by_address->insert(ctx->reserved_frames_by_address, new_frm, new_frm, NULL);
-        } else {
-            new_frm->type = FRAME_TYPE_USED;
-            ctx->allocated_frames_by_address->insert(ctx->allocated_frames_by_address, new_frm, new_frm, NULL);
+            return 0;
         }
 
+        uint64_t frm_alloc_cnt = (rem_frm_start - frm->frame_address) / FRAME_SIZE;
+        frm_alloc_cnt = frm->frame_count - frm_alloc_cnt;
+
+        rem_frm_start += frm_alloc_cnt * FRAME_SIZE;
+        rem_frm_cnt -= frm_alloc_cnt;
+    }
+
 
-        if(rem_frms) {
-            frame_t* free_rem_frm = memory_malloc_ext(ctx->heap, sizeof(frame_t), 0);
+    while(rem_frm_cnt) {
+        PRINTLOG(FRAMEALLOCATOR, LOG_TRACE, "remaining frame start 0x%llx count 0x%llx", rem_frm_start, rem_frm_cnt);
+
+        uint64_t free_cnt = 0;
+
+        while(free_cnt < rem_frm_cnt && frame_allocator_buddy_range(ctx, rem_frm_start + free_cnt * FRAME_SIZE, 1, false)) {
+            free_cnt++;
+        }
 
-            if(free_rem_frm == NULL) {
+        if(free_cnt == 0) {
+            frame_t* new_r_frm = memory_malloc_ext(ctx->heap, sizeof(frame_t), 0);
+
+            if(new_r_frm == NULL) {
                 PRINTLOG(FRAMEALLOCATOR, LOG_FATAL, "no free memory. Halting...");
                 cpu_hlt();
             }
 
-            free_rem_frm->frame_address = tmp_frm->frame_address + count * FRAME_SIZE;
-            free_rem_frm->frame_count = rem_frms;
-            free_rem_frm->type = FRAME_TYPE_FREE;
-            free_rem_frm->frame_attributes = tmp_frm->frame_attributes;
+            new_r_frm->frame_address = rem_frm_start;
+            new_r_frm->frame_count = rem_frm_cnt;
+            new_r_frm->type = FRAME_TYPE_RESERVED;
+            ctx->reserved_frames_by_address->insert(ctx->reserved_frames_by_address, new_r_frm, new_r_frm, NULL);
+
+            PRINTLOG(FRAMEALLOCATOR, LOG_TRACE, "no used frame found, inserted into reserveds, frame start 0x%llx count 0x%llx", rem_frm_start, rem_frm_cnt);
 
-            ctx->free_frames_by_address->insert(ctx->free_frames_by_address, free_rem_frm, free_rem_frm, NULL);
-            list_sortedlist_insert(ctx->free_frames_sorted_by_size, free_rem_frm);
+            break;
         }
 
-        memory_free_ext(ctx->heap, tmp_frm);
+        PRINTLOG(FRAMEALLOCATOR, LOG_TRACE, "area inside free frames, frame start 0x%llx count 0x%llx", rem_frm_start, free_cnt);
 
-        lock_release(ctx->lock);
+        frame_t new_frm = {rem_frm_start, free_cnt, FRAME_TYPE_RESERVED, 0};
 
-        return 0;
-    } else {
-        lock_release(ctx->lock);
-        PRINTLOG(FRAMEALLOCATOR, LOG_ERROR, "unknown alloctation type for frames 0x%x", fa_type);
+        rem_frm_cnt -= free_cnt;
+        rem_frm_start += free_cnt * FRAME_SIZE;
 
-        return -1;
+        self->allocate_frame(self, &new_frm);
     }
 
     lock_release(ctx->lock);
 
-    PRINTLOG(FRAMEALLOCATOR, LOG_ERROR, "Should never hit");
 
-    return -1;
+    return 0;
 }
 
-int8_t fa_allocate_frame(frame_allocator_t* self, frame_t* f) {
-    if(self == NULL) {
+
+int8_t fa_allocate_frame_by_count(frame_allocator_t* self, uint64_t count, frame_allocation_type_t fa_type, frame_t** fs, uint64_t* alloc_list_size) {
+    frame_allocator_context_t* ctx = (frame_allocator_context_t*)self->context;
+
+    if((fa_type & FRAME_ALLOCATION_TYPE_RELAX) || !(fa_type & FRAME_ALLOCATION_TYPE_BLOCK) || count == 0) {
+        PRINTLOG(FRAMEALLOCATOR, LOG_ERROR, "unknown alloctation type for frames 0x%x", fa_type);
+
         return -1;
     }
 
-    frame_allocator_context_t* ctx = self->context;
+    frame_t* new_frm = memory_malloc_ext(ctx->heap, sizeof(frame_t), 0);
 
-    lock_acquire(ctx->lock);
+    if(new_frm == NULL) {
+        PRINTLOG(FRAMEALLOCATOR, LOG_FATAL, "no free memory. Halting...");
+        cpu_hlt();
+    }
 
-    frame_t* frm = (frame_t*)ctx->free_frames_by_address->find(ctx->free_frames_by_address, f);
+    new_frm->frame_count = count;
 
-    if(frm == NULL) {
-        lock_release(ctx->lock);
-        PRINTLOG(FRAMEALLOCATOR, LOG_ERROR, "frame not found 0x%llx 0x%llx", f->frame_address, f->frame_count);
+    boolean_t plain_used = !(fa_type & (FRAME_ALLOCATION_TYPE_RESERVED | FRAME_ALLOCATION_TYPE_OLD_RESERVED));
 
-        return -1;
+    if(alloc_list_size) {
+        *alloc_list_size = 1;
     }
 
-    uint64_t rem_frms = frm->frame_count;
+    // single used frames come from cpu caches without allocator lock
+    if(count == 1 && plain_used && !(fa_type & FRAME_ALLOCATION_TYPE_UNDER_4G) &&
+       frame_allocator_cpu_cache_pop(ctx, &new_frm->frame_address) == 0) {
+        new_frm->type = FRAME_TYPE_USED;
+        frame_allocator_mark_used(ctx, new_frm->frame_address, 1, true);
+        frame_allocator_account(ctx, 1);
 
-    list_sortedlist_delete(ctx->free_frames_sorted_by_size, frm);
-    ctx->free_frames_by_address->delete(ctx->free_frames_by_address, frm, NULL);
+        *fs = new_frm;
 
-    if(frm->frame_address < f->frame_address) {
-        frame_t* new_frm = memory_malloc_ext(ctx->heap, sizeof(frame_t), 0);
+        frame_allocator_check_watermark(ctx, 0);
 
-        if(new_frm == NULL) {
-            lock_release(ctx->lock);
-            return -1;
-        }
+        return 0;
+    }
 
-        new_frm->frame_address = frm->frame_address;
-        new_frm->frame_count = (f->frame_address - frm->frame_address) / FRAME_SIZE;
-        new_frm->type = FRAME_TYPE_FREE;
-        new_frm->frame_attributes = frm->frame_attributes;
+    lock_acquire(ctx->lock);
 
-        list_sortedlist_insert(ctx->free_frames_sorted_by_size, new_frm);
-        ctx->free_frames_by_address->insert(ctx->free_frames_by_address, new_frm, new_frm, NULL);
+    uint64_t limit_page = ctx->page_count;
 
-        rem_frms -= new_frm->frame_count;
+    if(fa_type & FRAME_ALLOCATION_TYPE_UNDER_4G) {
+        limit_page = MIN(limit_page, 0x100000000ULL / FRAME_SIZE);
     }
 
-    rem_frms -= f->frame_count;
+    uint64_t page = 0;
 
-    if(rem_frms) {
-        frame_t* new_frm = memory_malloc_ext(ctx->heap, sizeof(frame_t), 0);
+    if(frame_allocator_buddy_alloc_preferred(ctx, count, limit_page, &page) != 0) {
+        lock_release(ctx->lock);
+        memory_free_ext(ctx->heap, new_frm);
 
-        if(new_frm == NULL) {
-            lock_release(ctx->lock);
+        if(fa_type & FRAME_ALLOCATION_TYPE_OPPORTUNISTIC) {
             return -1;
         }
 
-        new_frm->frame_address = f->frame_address + f->frame_count * FRAME_SIZE;
-        new_frm->frame_count = rem_frms;
-        new_frm->type = FRAME_TYPE_FREE;
-        new_frm->frame_attributes = frm->frame_attributes;
+        PRINTLOG(FRAMEALLOCATOR, LOG_ERROR, "cannot find free frames with count 0x%llx", count);
+
+        frame_allocator_check_watermark(ctx, count);
 
-        list_sortedlist_insert(ctx->free_frames_sorted_by_size, new_frm);
-        ctx->free_frames_by_address->insert(ctx->free_frames_by_address, new_frm, new_frm, NULL);
+        return -1;
     }
 
+    new_frm->frame_address = page * FRAME_SIZE;
 
-    frame_t* new_frm = memory_malloc_ext(ctx->heap, sizeof(frame_t), 0);
+    frame_allocator_account(ctx, count);
 
-    if(new_frm == NULL) {
-        lock_release(ctx->lock);
-        return -1;
+    if(fa_type & FRAME_ALLOCATION_TYPE_OLD_RESERVED) {
+        new_frm->frame_attributes |= FRAME_ATTRIBUTE_OLD_RESERVED;
     }
 
-    new_frm->frame_address = f->frame_address;
-    new_frm->frame_count = f->frame_count;
-    new_frm->type = f->type != FRAME_TYPE_FREE?f->type:FRAME_TYPE_USED;
-    new_frm->frame_attributes = f->frame_attributes?f->frame_attributes:frm->frame_attributes;
-
-    ctx->allocated_frame_count += new_frm->frame_count;
-    ctx->free_frame_count -= new_frm->frame_count;
+    *fs = new_frm;
 
-    if(new_frm->type == FRAME_TYPE_USED) {
+    if(fa_type & FRAME_ALLOCATION_TYPE_RESERVED) {
+        new_frm->type = FRAME_TYPE_RESERVED;
+        ctx->reserved_frames_by_address->insert(ctx->reserved_frames_by_address, new_frm, new_frm, NULL);
+    } else if(!plain_used) {
+        new_frm->type = FRAME_TYPE_USED;
         ctx->allocated_frames_by_address->insert(ctx->allocated_frames_by_address, new_frm, new_frm, NULL);
     } else {
-        ctx->reserved_frames_by_address->insert(ctx->reserved_frames_by_address, new_frm, new_frm, NULL);
+        new_frm->type = FRAME_TYPE_USED;
+        frame_allocator_mark_used(ctx, new_frm->frame_address, count, true);
     }
 
-    memory_free_ext(ctx->heap, frm);
-
     lock_release(ctx->lock);
 
+    frame_allocator_check_watermark(ctx, 0);
+
     return 0;
 }
 
-int8_t fa_release_frame(frame_allocator_t* self, frame_t* f) {
+int8_t fa_allocate_frame(frame_allocator_t* self, frame_t* f) {
     if(self == NULL) {
         return -1;
     }
@@ -462,239 +1152,177 @@ int8_t fa_release_frame(frame_allocator_t* self, frame_t* f) {
 
     lock_acquire(ctx->lock);
 
-    const frame_t* tmp_frame = ctx->allocated_frames_by_address->find(ctx->allocated_frames_by_address, f);
-
-    if(tmp_frame) {
-
-        ctx->allocated_frames_by_address->delete(ctx->allocated_frames_by_address, tmp_frame, NULL);
-
-        uint64_t rem_frms = tmp_frame->frame_count - f->frame_count;
-
-        if(tmp_frame->frame_address < f->frame_address) {
-            uint64_t prev_frm_count = (f->frame_address - tmp_frame->frame_address) / FRAME_SIZE;
-
-            frame_t* prev_frm = memory_malloc_ext(ctx->heap, sizeof(frame_t), 0);
-
-            if(prev_frm == NULL) {
-                lock_release(ctx->lock);
-                return -1;
-            }
-            prev_frm->frame_address = tmp_frame->frame_address;
-            prev_frm->frame_count = prev_frm_count;
-            prev_frm->type = FRAME_TYPE_USED;
-            prev_frm->frame_attributes = tmp_frame->frame_attributes;
-
-            ctx->allocated_frames_by_address->insert(ctx->allocated_frames_by_address, prev_frm, prev_frm, NULL);
-
-            rem_frms -= prev_frm_count;
-        }
-
-        if(rem_frms) {
-            frame_t* next_frm = memory_malloc_ext(ctx->heap, sizeof(frame_t), 0);
-
-            if(next_frm == NULL) {
-                lock_release(ctx->lock);
-                return -1;
-            }
-            next_frm->frame_address = f->frame_address + f->frame_count * FRAME_SIZE;
-            next_frm->frame_count = rem_frms;
-            next_frm->type = FRAME_TYPE_USED;
-            next_frm->frame_attributes = tmp_frame->frame_attributes;
-
-            ctx->allocated_frames_by_address->insert(ctx->allocated_frames_by_address, next_frm, next_frm, NULL);
-        }
-
-        frame_t* new_frm = memory_malloc_ext(ctx->heap, sizeof(frame_t), 0);
-
-        if(new_frm == NULL) {
-            lock_release(ctx->lock);
-            return -1;
-        }
-
-        new_frm->frame_address = f->frame_address;
-        new_frm->frame_count = f->frame_count;
-        new_frm->type = FRAME_TYPE_FREE;
-        new_frm->frame_attributes = tmp_frame->frame_attributes;
-
-        ctx->allocated_frame_count -= new_frm->frame_count;
-        ctx->free_frame_count += new_frm->frame_count;
+    if(!frame_allocator_buddy_range(ctx, f->frame_address, f->frame_count, false)) {
+        lock_release(ctx->lock);
+        PRINTLOG(FRAMEALLOCATOR, LOG_ERROR, "frame not found 0x%llx 0x%llx", f->frame_address, f->frame_count);
 
-        for(uint64_t i = 0; i < f->frame_count; i++) {
-            memory_paging_add_page(0x1000, f->frame_address + i * FRAME_SIZE, MEMORY_PAGING_PAGE_TYPE_4K);
-            memory_memclean((void*)(0x1000), FRAME_SIZE);
-            memory_paging_delete_page(0x1000, NULL);
-        }
+        return -1;
+    }
 
-        ctx->free_frames_by_address->insert(ctx->free_frames_by_address, new_frm, new_frm, NULL);
-        list_sortedlist_insert(ctx->free_frames_sorted_by_size, new_frm);
+    frame_type_t type = f->type != FRAME_TYPE_FREE?f->type:FRAME_TYPE_USED;
 
-        memory_free_ext(ctx->heap, (void*)tmp_frame);
+    if(type == FRAME_TYPE_USED && !f->frame_attributes) {
+        frame_allocator_buddy_range(ctx, f->frame_address, f->frame_count, true);
+        frame_allocator_mark_used(ctx, f->frame_address, f->frame_count, true);
+        frame_allocator_account(ctx, f->frame_count);
 
         lock_release(ctx->lock);
 
         return 0;
     }
 
-    tmp_frame = ctx->reserved_frames_by_address->find(ctx->reserved_frames_by_address, f);
+    frame_t* new_frm = memory_malloc_ext(ctx->heap, sizeof(frame_t), 0);
 
-    if(tmp_frame) {
-        ctx->reserved_frames_by_address->delete(ctx->reserved_frames_by_address, tmp_frame, NULL);
+    if(new_frm == NULL) {
+        lock_release(ctx->lock);
+        return -1;
+    }
 
-        uint64_t rem_frms = tmp_frame->frame_count - f->frame_count;
+    frame_allocator_buddy_range(ctx, f->frame_address, f->frame_count, true);
 
-        if(tmp_frame->frame_address < f->frame_address) {
-            uint64_t prev_frm_count = (f->frame_address - tmp_frame->frame_address) / FRAME_SIZE;
+    new_frm->frame_address = f->frame_address;
+    new_frm->frame_count = f->frame_count;
+    new_frm->type = type;
+    new_frm->frame_attributes = f->frame_attributes;
 
-            frame_t* prev_frm = memory_malloc_ext(ctx->heap, sizeof(frame_t), 0);
+    frame_allocator_account(ctx, new_frm->frame_count);
 
-            if(prev_frm == NULL) {
-                lock_release(ctx->lock);
-                return -1;
-            }
+    if(new_frm->type == FRAME_TYPE_USED) {
+        ctx->allocated_frames_by_address->insert(ctx->allocated_frames_by_address, new_frm, new_frm, NULL);
+    } else {
+        ctx->reserved_frames_by_address->insert(ctx->reserved_frames_by_address, new_frm, new_frm, NULL);
+    }
 
-            prev_frm->frame_address = tmp_frame->frame_address;
-            prev_frm->frame_count = prev_frm_count;
-            prev_frm->type = FRAME_TYPE_USED;
-            prev_frm->frame_attributes = tmp_frame->frame_attributes;
+    lock_release(ctx->lock);
 
-            ctx->reserved_frames_by_address->insert(ctx->reserved_frames_by_address, prev_frm, prev_frm, NULL);
+    return 0;
+}
 
-            rem_frms -= prev_frm_count;
-        }
+/**
+ * @brief releases part of a frame record of tree, remaining parts are inserted back, lock should be held
+ * @param[in] ctx allocator context
+ * @param[in] tree tree of record
+ * @param[in] tmp_frame record
+ * @param[in] f released part
+ * @return 0 on success
+ */
+static int8_t frame_allocator_release_tree_frame(frame_allocator_context_t* ctx, index_t* tree, const frame_t* tmp_frame, frame_t* f) {
+    tree->delete(tree, tmp_frame, NULL);
 
-        if(rem_frms) {
-            frame_t* next_frm = memory_malloc_ext(ctx->heap, sizeof(frame_t), 0);
+    uint64_t rem_frms = tmp_frame->frame_count - f->frame_count;
 
-            if(next_frm == NULL) {
-                lock_release(ctx->lock);
-                return -1;
-            }
+    if(tmp_frame->frame_address < f->frame_address) {
+        uint64_t prev_frm_count = (f->frame_address - tmp_frame->frame_address) / FRAME_SIZE;
 
-            next_frm->frame_address = f->frame_address + f->frame_count * FRAME_SIZE;
-            next_frm->frame_count = rem_frms;
-            next_frm->type = FRAME_TYPE_USED;
-            next_frm->frame_attributes = tmp_frame->frame_attributes;
+        frame_t* prev_frm = memory_malloc_ext(ctx->heap, sizeof(frame_t), 0);
 
-            ctx->reserved_frames_by_address->insert(ctx->reserved_frames_by_address, next_frm, next_frm, NULL);
+        if(prev_frm == NULL) {
+            return -1;
         }
 
-        frame_t* new_frm = memory_malloc_ext(ctx->heap, sizeof(frame_t), 0);
+        prev_frm->frame_address = tmp_frame->frame_address;
+        prev_frm->frame_count = prev_frm_count;
+        prev_frm->type = tmp_frame->type;
+        prev_frm->frame_attributes = tmp_frame->frame_attributes;
 
-        if(new_frm == NULL) {
-            lock_release(ctx->lock);
-            return -1;
-        }
+        tree->insert(tree, prev_frm, prev_frm, NULL);
 
-        new_frm->frame_address = f->frame_address;
-        new_frm->frame_count = f->frame_count;
-        new_frm->type = FRAME_TYPE_FREE;
-        new_frm->frame_attributes = tmp_frame->frame_attributes;
+        rem_frms -= prev_frm_count;
+    }
 
-        ctx->allocated_frame_count -= new_frm->frame_count;
-        ctx->free_frame_count += new_frm->frame_count;
+    if(rem_frms) {
+        frame_t* next_frm = memory_malloc_ext(ctx->heap, sizeof(frame_t), 0);
 
-        for(uint64_t i = 0; i < f->frame_count; i++) {
-            memory_paging_add_page(0x1000, f->frame_address + i * FRAME_SIZE, MEMORY_PAGING_PAGE_TYPE_4K);
-            memory_memclean((void*)(0x1000), FRAME_SIZE);
-            memory_paging_delete_page(0x1000, NULL);
+        if(next_frm == NULL) {
+            return -1;
         }
 
-        ctx->free_frames_by_address->insert(ctx->free_frames_by_address, new_frm, new_frm, NULL);
-        list_sortedlist_insert(ctx->free_frames_sorted_by_size, new_frm);
+        next_frm->frame_address = f->frame_address + f->frame_count * FRAME_SIZE;
+        next_frm->frame_count = rem_frms;
+        next_frm->type = tmp_frame->type;
+        next_frm->frame_attributes = tmp_frame->frame_attributes;
 
-        memory_free_ext(ctx->heap, (void*)tmp_frame);
+        tree->insert(tree, next_frm, next_frm, NULL);
     }
 
-    lock_release(ctx->lock);
+    frame_allocator_account(ctx, -(int64_t)f->frame_count);
+
+    frame_allocator_clean_frames(f->frame_address, f->frame_count);
+    frame_allocator_buddy_free_range(ctx, f->frame_address, f->frame_count);
 
+    memory_free_ext(ctx->heap, (void*)tmp_frame);
 
     return 0;
 }
 
-int8_t fa_release_acpi_reclaim_memory(frame_allocator_t* self) {
+int8_t fa_release_frame(frame_allocator_t* self, frame_t* f) {
     if(self == NULL) {
         return -1;
     }
 
     frame_allocator_context_t* ctx = self->context;
 
-    lock_acquire(ctx->lock);
-
-    iterator_t* iter;
-    list_t* frms;
+    if(frame_allocator_is_used(ctx, f->frame_address, f->frame_count)) {
+        frame_allocator_mark_used(ctx, f->frame_address, f->frame_count, false);
 
+        lock_acquire(ctx->lock);
 
-    frms = list_create_sortedlist_with_heap(ctx->heap, frame_allocator_cmp_by_size);
+        frame_allocator_clean_frames(f->frame_address, f->frame_count);
 
-    iter = ctx->reserved_frames_by_address->create_iterator(ctx->reserved_frames_by_address);
+        if(f->frame_count != 1) {
+            frame_allocator_buddy_free_range(ctx, f->frame_address, f->frame_count);
+        }
 
-    while(iter->end_of_iterator(iter) != 0) {
-        frame_t* f = (frame_t*)iter->get_item(iter);
+        lock_release(ctx->lock);
 
-        if((f->frame_attributes & FRAME_ATTRIBUTE_ACPI_RECLAIM_MEMORY) && !(f->frame_attributes & FRAME_ATTRIBUTE_RESERVED_PAGE_MAPPED)) {
-            list_sortedlist_insert(frms, f);
+        if(f->frame_count == 1) {
+            frame_allocator_cpu_cache_push(ctx, f->frame_address);
         }
 
-        iter = iter->next(iter);
+        frame_allocator_account(ctx, -(int64_t)f->frame_count);
+
+        return 0;
     }
 
-    iter->destroy(iter);
+    int8_t res = 0;
 
-    iter = list_iterator_create(frms);
+    lock_acquire(ctx->lock);
 
-    while(iter->end_of_iterator(iter) != 0) {
-        frame_t* f = (frame_t*)iter->get_item(iter);
+    const frame_t* tmp_frame = ctx->allocated_frames_by_address->find(ctx->allocated_frames_by_address, f);
 
-        ctx->reserved_frames_by_address->delete(ctx->reserved_frames_by_address, f, NULL);
+    if(tmp_frame) {
+        res = frame_allocator_release_tree_frame(ctx, ctx->allocated_frames_by_address, tmp_frame, f);
+    } else {
+        tmp_frame = ctx->reserved_frames_by_address->find(ctx->reserved_frames_by_address, f);
 
-        for(uint64_t i = 0; i < f->frame_count; i++) {
-            memory_paging_add_page(0x1000, f->frame_address + i * FRAME_SIZE, MEMORY_PAGING_PAGE_TYPE_4K);
-            memory_memclean((void*)(0x1000), FRAME_SIZE);
-            memory_paging_delete_page(0x1000, NULL);
+        if(tmp_frame) {
+            res = frame_allocator_release_tree_frame(ctx, ctx->reserved_frames_by_address, tmp_frame, f);
+        } else {
+            PRINTLOG(FRAMEALLOCATOR, LOG_WARNING, "frames 0x%llx with count 0x%llx are not allocated", f->frame_address, f->frame_count);
         }
-
-        f->frame_attributes &= ~FRAME_ATTRIBUTE_ACPI_RECLAIM_MEMORY;
-        f->type = FRAME_TYPE_FREE;
-
-        ctx->allocated_frame_count -= f->frame_count;
-        ctx->free_frame_count += f->frame_count;
-
-        list_sortedlist_insert(ctx->free_frames_sorted_by_size, f);
-        ctx->free_frames_by_address->insert(ctx->free_frames_by_address, f, f, NULL);
-
-        iter = iter->next(iter);
     }
 
-    iter->destroy(iter);
-
-    list_destroy(frms);
-
     lock_release(ctx->lock);
 
-    return 0;
+    return res;
 }
 
-int8_t fa_cleanup(frame_allocator_t* self) {
-    if(self == NULL) {
-        return -1;
-    }
-
-    frame_allocator_context_t* ctx = self->context;
-
-    lock_acquire(ctx->lock);
-
-    iterator_t* iter;
-    list_t* frms;
-
-
-    frms = list_create_sortedlist_with_heap(ctx->heap, frame_allocator_cmp_by_size);
+/**
+ * @brief moves frames of tree which have attribute to buddy
+ * @param[in] ctx allocator context
+ * @param[in] tree tree of frames
+ * @param[in] attribute frame attribute
+ * @param[in] skip_attribute frames with this attribute are skipped
+ */
+static void frame_allocator_release_tree_frames_with_attribute(frame_allocator_context_t* ctx, index_t* tree, uint64_t attribute, uint64_t skip_attribute) {
+    list_t* frms = list_create_sortedlist_with_heap(ctx->heap, frame_allocator_cmp_by_size);
 
-    iter = ctx->reserved_frames_by_address->create_iterator(ctx->reserved_frames_by_address);
+    iterator_t* iter = tree->create_iterator(tree);
 
     while(iter->end_of_iterator(iter) != 0) {
         frame_t* f = (frame_t*)iter->get_item(iter);
 
-        if(f->frame_attributes & FRAME_ATTRIBUTE_OLD_RESERVED) {
+        if((f->frame_attributes & attribute) && !(f->frame_attributes & skip_attribute)) {
             list_sortedlist_insert(frms, f);
         }
 
@@ -708,22 +1336,14 @@ int8_t fa_cleanup(frame_allocator_t* self) {
     while(iter->end_of_iterator(iter) != 0) {
         frame_t* f = (frame_t*)iter->get_item(iter);
 
-        ctx->reserved_frames_by_address->delete(ctx->reserved_frames_by_address, f, NULL);
-
-        for(uint64_t i = 0; i < f->frame_count; i++) {
-            memory_paging_add_page(0x1000, f->frame_address + i * FRAME_SIZE, MEMORY_PAGING_PAGE_TYPE_4K);
-            memory_memclean((void*)(0x1000), FRAME_SIZE);
-            memory_paging_delete_page(0x1000, NULL);
-        }
+        tree->delete(tree, f, NULL);
 
-        f->frame_attributes &= ~FRAME_ATTRIBUTE_OLD_RESERVED;
-        f->type = FRAME_TYPE_FREE;
+        frame_allocator_clean_frames(f->frame_address, f->frame_count);
+        frame_allocator_buddy_free_range(ctx, f->frame_address, f->frame_count);
 
-        ctx->allocated_frame_count -= f->frame_count;
-        ctx->free_frame_count += f->frame_count;
+        frame_allocator_account(ctx, -(int64_t)f->frame_count);
 
-        list_sortedlist_insert(ctx->free_frames_sorted_by_size, f);
-        ctx->free_frames_by_address->insert(ctx->free_frames_by_address, f, f, NULL);
+        memory_free_ext(ctx->heap, f);
 
         iter = iter->next(iter);
     }
@@ -731,52 +1351,36 @@ int8_t fa_cleanup(frame_allocator_t* self) {
     iter->destroy(iter);
 
     list_destroy(frms);
+}
 
-
-    frms = list_create_sortedlist_with_heap(ctx->heap, frame_allocator_cmp_by_size);
-
-    iter = ctx->allocated_frames_by_address->create_iterator(ctx->allocated_frames_by_address);
-
-    while(iter->end_of_iterator(iter) != 0) {
-        frame_t* f = (frame_t*)iter->get_item(iter);
-
-        if(f->frame_attributes & FRAME_ATTRIBUTE_OLD_RESERVED) {
-            list_sortedlist_insert(frms, f);
-        }
-
-        iter = iter->next(iter);
+int8_t fa_release_acpi_reclaim_memory(frame_allocator_t* self) {
+    if(self == NULL) {
+        return -1;
     }
 
-    iter->destroy(iter);
-
-    iter = list_iterator_create(frms);
-
-    while(iter->end_of_iterator(iter) != 0) {
-        frame_t* f = (frame_t*)iter->get_item(iter);
-
-        ctx->allocated_frames_by_address->delete(ctx->allocated_frames_by_address, f, NULL);
+    frame_allocator_context_t* ctx = self->context;
 
-        for(uint64_t i = 0; i < f->frame_count; i++) {
-            memory_paging_add_page(0x1000, f->frame_address + i * FRAME_SIZE, MEMORY_PAGING_PAGE_TYPE_4K);
-            memory_memclean((void*)(0x1000), FRAME_SIZE);
-            memory_paging_delete_page(0x1000, NULL);
-        }
+    lock_acquire(ctx->lock);
 
-        f->frame_attributes &= ~FRAME_ATTRIBUTE_OLD_RESERVED;
-        f->type = FRAME_TYPE_FREE;
+    frame_allocator_release_tree_frames_with_attribute(ctx, ctx->reserved_frames_by_address,
+                                                       FRAME_ATTRIBUTE_ACPI_RECLAIM_MEMORY, FRAME_ATTRIBUTE_RESERVED_PAGE_MAPPED);
 
-        ctx->allocated_frame_count -= f->frame_count;
-        ctx->free_frame_count += f->frame_count;
+    lock_release(ctx->lock);
 
-        list_sortedlist_insert(ctx->free_frames_sorted_by_size, f);
-        ctx->free_frames_by_address->insert(ctx->free_frames_by_address, f, f, NULL);
+    return 0;
+}
 
-        iter = iter->next(iter);
+int8_t fa_cleanup(frame_allocator_t* self) {
+    if(self == NULL) {
+        return -1;
     }
 
-    iter->destroy(iter);
+    frame_allocator_context_t* ctx = self->context;
 
-    list_destroy(frms);
+    lock_acquire(ctx->lock);
+
+    frame_allocator_release_tree_frames_with_attribute(ctx, ctx->reserved_frames_by_address, FRAME_ATTRIBUTE_OLD_RESERVED, 0);
+    frame_allocator_release_tree_frames_with_attribute(ctx, ctx->allocated_frames_by_address, FRAME_ATTRIBUTE_OLD_RESERVED, 0);
 
     lock_release(ctx->lock);
 
@@ -844,6 +1448,60 @@ static int8_t frame_allocator_destroy_key(memory_heap_t* heap, void* key) {
     return 0;
 }
 
+/**
+ * @brief allocates buddy bitmaps for memory which can be free, these are conventional and acpi reclaim memory
+ * @param[in] ctx allocator context
+ * @return 0 on success
+ */
+static int8_t frame_allocator_buddy_init(frame_allocator_context_t* ctx) {
+    uint64_t mmap_ent_cnt = SYSTEM_INFO->mmap_size / SYSTEM_INFO->mmap_descriptor_size;
+    uint64_t max_end = 0;
+
+    for(size_t i = 0; i < mmap_ent_cnt; i++) {
+        efi_memory_descriptor_t* mem_desc = (efi_memory_descriptor_t*)(SYSTEM_INFO->mmap_data + (i * SYSTEM_INFO->mmap_descriptor_size));
+        frame_type_t type = fa_get_fa_type(mem_desc->type);
+
+        if(type == FRAME_TYPE_FREE || type == FRAME_TYPE_ACPI_RECLAIM_MEMORY) {
+            max_end = MAX(max_end, mem_desc->physical_start + mem_desc->page_count * FRAME_SIZE);
+        }
+    }
+
+    ctx->page_count = max_end / FRAME_SIZE;
+
+    uint64_t word_count = 0;
+
+    for(uint64_t o = 0; o <= FRAME_ALLOCATOR_MAX_ORDER; o++) {
+        word_count += (frame_allocator_buddy_block_count(ctx, o) + 63) / 64 + 1;
+    }
+
+    word_count += (ctx->page_count + 63) / 64 + 1;
+
+    uint64_t* maps = memory_malloc_ext(ctx->heap, word_count * sizeof(uint64_t), 0);
+
+    if(maps == NULL) {
+        return -1;
+    }
+
+    for(uint64_t o = 0; o <= FRAME_ALLOCATOR_MAX_ORDER; o++) {
+        ctx->free_maps[o] = maps;
+        maps += (frame_allocator_buddy_block_count(ctx, o) + 63) / 64 + 1;
+    }
+
+    ctx->used_map = maps;
+
+    ctx->cpu_caches = memory_malloc_ext(ctx->heap, sizeof(frame_allocator_cpu_cache_t) * FRAME_ALLOCATOR_MAX_CPU_COUNT, 0);
+
+    if(ctx->cpu_caches == NULL) {
+        memory_free_ext(ctx->heap, ctx->free_maps[0]);
+
+        return -1;
+    }
+
+    PRINTLOG(FRAMEALLOCATOR, LOG_DEBUG, "buddy manages 0x%llx pages with bitmap size 0x%llx", ctx->page_count, word_count * sizeof(uint64_t));
+
+    return 0;
+}
+
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wanalyzer-malloc-leak"
 frame_allocator_t* frame_allocator_new_ext(memory_heap_t* heap) {
@@ -861,14 +1519,15 @@ frame_allocator_t* frame_allocator_new_ext(memory_heap_t* heap) {
     }
 
     ctx->heap = heap;
-    ctx->free_frames_sorted_by_size = list_create_sortedlist_with_heap(heap, frame_allocator_cmp_by_size);
-    list_set_equality_comparator(ctx->free_frames_sorted_by_size, frame_allocator_cmp_by_address);
 
-    ctx->acpi_frames = list_create_sortedlist_with_heap(heap, frame_allocator_cmp_by_address);
+    if(frame_allocator_buddy_init(ctx) != 0) {
+        memory_free_ext(heap, fa);
+        memory_free_ext(heap, ctx);
+
+        return NULL;
+    }
 
-    ctx->free_frames_by_address = bplustree_create_index_with_heap_and_unique(heap, 64, frame_allocator_cmp_by_address, true);
-    bplustree_set_key_cloner(ctx->free_frames_by_address, frame_allocator_clone_key);
-    bplustree_set_key_destroyer(ctx->free_frames_by_address, frame_allocator_destroy_key);
+    ctx->acpi_frames = list_create_sortedlist_with_heap(heap, frame_allocator_cmp_by_address);
 
     ctx->allocated_frames_by_address = bplustree_create_index_with_heap_and_unique(heap, 64, frame_allocator_cmp_by_address, true);
     bplustree_set_key_cloner(ctx->allocated_frames_by_address, frame_allocator_clone_key);
@@ -896,54 +1555,49 @@ frame_allocator_t* frame_allocator_new_ext(memory_heap_t* heap) {
         if(type == fa_get_fa_type(mem_desc->type) && (frame_start + frame_count * FRAME_SIZE) == mem_desc->physical_start && frame_attr == mem_desc->attribute) {
             frame_count += mem_desc->page_count;
         } else {
-
-
-            frame_t* f = memory_malloc_ext(heap, sizeof(frame_t), 0);
-
-            if(f == NULL) {
-                memory_free_ext(ctx->heap, fa);
-                memory_free_ext(ctx->heap, ctx);
-
-                return NULL;
-            }
-
-
-            f->frame_address = frame_start;
-            f->frame_count = frame_count;
-            f->type = type;
-            f->frame_attributes = mem_desc->attribute;
-
             if((frame_start + frame_count * FRAME_SIZE) <= (1 << 20)) {
                 type = FRAME_TYPE_RESERVED;
-                f->type = type;
             }
 
             ctx->total_frame_count += frame_count;
 
-            switch (type) {
-            case FRAME_TYPE_FREE:
-                ctx->free_frames_by_address->insert(ctx->free_frames_by_address, f, f, NULL);
-                list_sortedlist_insert(ctx->free_frames_sorted_by_size, f);
+            if(type == FRAME_TYPE_FREE) {
+                frame_allocator_buddy_free_range(ctx, frame_start, frame_count);
                 ctx->free_frame_count += frame_count;
-                break;
-            case FRAME_TYPE_USED:
-                ctx->allocated_frames_by_address->insert(ctx->allocated_frames_by_address, f, f, NULL);
-                ctx->allocated_frame_count += frame_count;
-                break;
-            case FRAME_TYPE_RESERVED:
-                ctx->reserved_frames_by_address->insert(ctx->reserved_frames_by_address, f, f, NULL);
-                ctx->allocated_frame_count += frame_count;
-                break;
-            case FRAME_TYPE_ACPI_RECLAIM_MEMORY:
-                f->frame_attributes |= FRAME_ATTRIBUTE_ACPI_RECLAIM_MEMORY;
-                ctx->reserved_frames_by_address->insert(ctx->reserved_frames_by_address, f, f, NULL);
-                ctx->allocated_frame_count += frame_count;
-                break;
-            case FRAME_TYPE_ACPI_CODE:
-            case FRAME_TYPE_ACPI_DATA:
-                f->frame_attributes |= FRAME_ATTRIBUTE_ACPI;
-                list_sortedlist_insert(ctx->acpi_frames, f);
+            } else {
+                frame_t* f = memory_malloc_ext(heap, sizeof(frame_t), 0);
+
+                if(f == NULL) {
+                    memory_free_ext(ctx->heap, fa);
+                    memory_free_ext(ctx->heap, ctx);
+
+                    return NULL;
+                }
+
+                f->frame_address = frame_start;
+                f->frame_count = frame_count;
+                f->type = type;
+                f->frame_attributes = mem_desc->attribute;
+
                 ctx->allocated_frame_count += frame_count;
+
+                switch (type) {
+                case FRAME_TYPE_USED:
+                    ctx->allocated_frames_by_address->insert(ctx->allocated_frames_by_address, f, f, NULL);
+                    break;
+                case FRAME_TYPE_ACPI_RECLAIM_MEMORY:
+                    f->frame_attributes |= FRAME_ATTRIBUTE_ACPI_RECLAIM_MEMORY;
+                    ctx->reserved_frames_by_address->insert(ctx->reserved_frames_by_address, f, f, NULL);
+                    break;
+                case FRAME_TYPE_ACPI_CODE:
+                case FRAME_TYPE_ACPI_DATA:
+                    f->frame_attributes |= FRAME_ATTRIBUTE_ACPI;
+                    list_sortedlist_insert(ctx->acpi_frames, f);
+                    break;
+                default:
+                    ctx->reserved_frames_by_address->insert(ctx->reserved_frames_by_address, f, f, NULL);
+                    break;
+                }
             }
 
 
@@ -965,6 +1619,9 @@ frame_allocator_t* frame_allocator_new_ext(memory_heap_t* heap) {
     fa->get_free_frame_count = fa_get_free_frame_count;
     fa->get_total_frame_count = fa_get_total_frame_count;
     fa->get_allocated_frame_count = fa_get_allocated_frame_count;
+    fa->set_numa_topology = fa_set_numa_topology;
+    fa->get_node_count = fa_get_node_count;
+    fa->get_node_free_frame_count = fa_get_node_free_frame_count;
 
     return fa;
 }
@@ -980,34 +1637,12 @@ void frame_allocator_print(frame_allocator_t* fa) {
 
     iterator_t* iter;
 
-    iter = ctx->free_frames_by_address->create_iterator(ctx->free_frames_by_address);
-
-    printf("free frames by address\n");
-
-    while(iter->end_of_iterator(iter) != 0) {
-        frame_t* f = (frame_t*)iter->get_item(iter);
-
-        printf("0x%016llx \t 0x%016llx \t 0x%016llx\n", f->frame_address, f->frame_count, f->frame_attributes);
-
-        iter = iter->next(iter);
-    }
-
-    iter->destroy(iter);
-
-    iter = list_iterator_create(ctx->free_frames_sorted_by_size);
-
-    printf("free frames by size\n");
-
-    while(iter->end_of_iterator(iter) != 0) {
-        frame_t* f = (frame_t*)iter->get_item(iter);
-
-        printf("0x%016llx \t 0x%016llx \t 0x%016llx\n", f->frame_address, f->frame_count, f->frame_attributes);
+    printf("free blocks by order\n");
 
-        iter = iter->next(iter);
+    for(uint64_t o = 0; o <= FRAME_ALLOCATOR_MAX_ORDER; o++) {
+        printf("order 0x%02llx \t 0x%016llx\n", o, ctx->free_block_counts[o]);
     }
 
-    iter->destroy(iter);
-
     iter = ctx->allocated_frames_by_address->create_iterator(ctx->allocated_frames_by_address);
 
     printf("used frames by address\n");
@@ -1077,4 +1712,3 @@ void frame_allocator_map_page_of_acpi_code_data_frames(frame_allocator_t* fa) {
 
     iter->destroy(iter);
 }
-
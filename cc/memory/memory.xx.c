@@ -20,6 +20,19 @@ typedef task_t * (*memory_current_task_getter_f)(void);
 void memory_set_current_task_getter(memory_current_task_getter_f getter);
 memory_current_task_getter_f memory_current_task_getter = NULL;
 
+typedef uint32_t (*memory_cpu_id_getter_f)(void);
+void memory_set_cpu_id_getter(memory_cpu_id_getter_f getter);
+memory_cpu_id_getter_f memory_cpu_id_getter = NULL;
+
+/*! sampled allocation callback, NULL when profiler is not running */
+static memory_profiler_record_f memory_profiler_record = NULL;
+/*! free callback of profiler */
+static memory_profiler_forget_f memory_profiler_forget = NULL;
+/*! bytes between samples */
+static uint64_t memory_profiler_sample_interval = 0;
+/*! bytes left until next sample */
+static int64_t memory_profiler_countdown = 0;
+
 
 static task_t* memory_get_current_task(void) {
     if(memory_current_task_getter) {
@@ -33,6 +46,104 @@ void memory_set_current_task_getter(memory_current_task_getter_f getter) {
     memory_current_task_getter = getter;
 }
 
+void memory_set_cpu_id_getter(memory_cpu_id_getter_f getter) {
+    memory_cpu_id_getter = getter;
+}
+
+void memory_set_profiler(uint64_t sample_interval, memory_profiler_record_f record, memory_profiler_forget_f forget) {
+    memory_profiler_record = NULL;
+    asm volatile ("" ::: "memory");
+
+    memory_profiler_forget = forget;
+    memory_profiler_sample_interval = sample_interval;
+    memory_profiler_countdown = sample_interval;
+
+    asm volatile ("" ::: "memory");
+    memory_profiler_record = sample_interval ? record : NULL;
+}
+
+/**
+ * @brief counts allocated bytes and records allocation if a sample point is crossed, it is not inlined
+ * so profiler can skip a fixed frame count to reach malloc caller
+ * @param[in] address allocated address
+ * @param[in] size allocation size
+ */
+static __attribute__((noinline)) void memory_profiler_account(const void* address, size_t size) {
+    memory_profiler_record_f record = memory_profiler_record;
+    uint64_t interval = memory_profiler_sample_interval;
+
+    if(!record || !interval) {
+        return;
+    }
+
+    int64_t countdown = __atomic_load_n(&memory_profiler_countdown, __ATOMIC_RELAXED);
+    int64_t left = 0;
+    uint64_t crossed = 0;
+
+    // allocation crossing sample points is recorded, its weight is byte count of crossed intervals
+    do {
+        left = countdown - (int64_t)size;
+        crossed = 0;
+
+        if(left <= 0) {
+            crossed = (uint64_t)(-left) / interval + 1;
+            left += (int64_t)(crossed * interval);
+        }
+    } while(!__atomic_compare_exchange_n(&memory_profiler_countdown, &countdown, left, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    if(crossed) {
+        record(address, size, crossed * interval);
+    }
+}
+
+boolean_t memory_get_cpu_id(uint64_t* cpu_id) {
+    if(memory_cpu_id_getter) {
+        *cpu_id = memory_cpu_id_getter();
+
+        return true;
+    }
+
+    return false;
+}
+
+static void* memory_heap_malloc(memory_heap_t* heap, size_t size, size_t align) {
+    void* res = NULL;
+
+    // per cpu caches are only valid after cpu id getter is set
+    if(heap->malloc_cached && memory_cpu_id_getter) {
+        res = heap->malloc_cached(heap, size, align);
+    }
+
+    if(!res) {
+        lock_acquire(heap->lock);
+        res = heap->malloc(heap, size, align);
+        lock_release(heap->lock);
+    }
+
+    // shrinkers run at pressure task, caller may hold locks of caches
+    if(!res) {
+        memory_pressure_notify(size);
+    }
+
+    return res;
+}
+
+static int8_t memory_heap_free(memory_heap_t* heap, void* address) {
+    int8_t res = -1;
+
+    if(heap->free_cached && memory_cpu_id_getter) {
+        res = heap->free_cached(heap, address);
+    }
+
+    if(res == -1) {
+        lock_acquire(heap->lock);
+        res = heap->free(heap, address);
+        lock_release(heap->lock);
+    }
+
+    return res;
+}
+
 memory_heap_t* memory_set_default_heap(memory_heap_t* heap) {
     memory_heap_t* res = memory_heap_default;
     memory_heap_default = heap;
@@ -75,21 +186,15 @@ void* memory_malloc_ext(memory_heap_t* heap, size_t size, size_t align){
     if(heap == NULL) {
         task_t* current_task = memory_get_current_task();
         if(current_task != NULL && current_task->heap != NULL) {
-            lock_acquire(current_task->heap->lock);
-            res = current_task->heap->malloc(current_task->heap, size, align);
-            lock_release(current_task->heap->lock);
+            res = memory_heap_malloc(current_task->heap, size, align);
         }
 
         if(!res) {
-            lock_acquire(memory_heap_default->lock);
-            res = memory_heap_default->malloc(memory_heap_default, size, align);
-            lock_release(memory_heap_default->lock);
+            res = memory_heap_malloc(memory_heap_default, size, align);
         }
 
     }else {
-        lock_acquire(heap->lock);
-        res = heap->malloc(heap, size, align);
-        lock_release(heap->lock);
+        res = memory_heap_malloc(heap, size, align);
     }
 
     if(res != NULL) {
@@ -99,87 +204,64 @@ void* memory_malloc_ext(memory_heap_t* heap, size_t size, size_t align){
         }
     }
 
+    if(res != NULL && memory_profiler_record) {
+        memory_profiler_account(res, size);
+    }
+
     return res;
 }
 
 int8_t memory_free_ext(memory_heap_t* heap, void* address){
     int8_t res = -1;
 
+    // sample should be dropped before address can be allocated again
+    if(memory_profiler_forget && address) {
+        memory_profiler_forget(address);
+    }
+
     if(heap == NULL) {
-        task_t* current_task = memory_get_current_task();
-        if(current_task != NULL && current_task->heap != NULL) {
-            lock_acquire(current_task->heap->lock);
-            res = current_task->heap->free(current_task->heap, address);
-            lock_release(current_task->heap->lock);
+        memory_heap_t* owner = memory_heap_find_owner(address);
+
+        if(owner != NULL) {
+            res = memory_heap_free(owner, address);
+
+            if(res == 0) {
+                return 0;
+            }
         }
 
-        if(res == -1) {
-            lock_acquire(memory_heap_default->lock);
+        task_t* current_task = memory_get_current_task();
+        if(current_task != NULL && current_task->heap != NULL && current_task->heap != owner) {
+            res = memory_heap_free(current_task->heap, address);
+        }
 
-            res = memory_heap_default->free(memory_heap_default, address);
-            lock_release(memory_heap_default->lock);
+        if(res == -1 && memory_heap_default != owner) {
+            res = memory_heap_free(memory_heap_default, address);
         }
 
     }else {
-        lock_acquire(heap->lock);
-        res = heap->free(heap, address);
-        lock_release(heap->lock);
+        res = memory_heap_free(heap, address);
     }
 
     return res;
 }
 
 void memory_get_heap_stat_ext(memory_heap_t* heap, memory_heap_stat_t* stat){
-    if(heap == NULL) {
-        task_t* current_task = memory_get_current_task();
-        if(current_task != NULL && current_task->heap != NULL) {
-            current_task->heap->stat(current_task->heap, stat);
+    heap = memory_get_heap(heap);
 
-            return;
-        }
+    heap->stat(heap, stat);
 
-        memory_heap_default->stat(memory_heap_default, stat);
-    } else {
-        heap->stat(heap, stat);
-    }
+    memory_cache_adjust_heap_stat(heap, stat);
+    memory_heap_owner_adjust_heap_stat(heap, stat);
 }
 
-#if 0
-int8_t memory_memset(void* address, uint8_t value, size_t size) {
-    if(address == NULL) {
-        return -1;
-    }
-
-    uint8_t* t_addr = (uint8_t*)address;
-
-    for(size_t i = 0; i < size; i++) {
-        t_addr[i] = value;
-    }
-
-    return 0;
-}
-#elif 0
-int8_t __attribute__((naked)) memory_memset(register void* address, register uint8_t value, register size_t size) {
-    // loop with rep stosq and rep stosb
-    // move sil to al and move it %rdi until %rcx is zero
-    asm volatile (
-        "test %2, %2\n"
-        "jz .Lexit%=\n"
-        "rep stosb\n"
-        ".Lexit%=:\n"
-        "xor %%rax, %%rax\n"
-        "ret\n"
-        :
-        : "a" (value), "c" (size), "D" (address)
-        : "memory"
-        );
-}
-#else
-int8_t memory_memset(void* address, uint8_t value, size_t size){
-    if(address == NULL) {
-        return -1;
-    }
-
+/**
+ * @brief sets memory with word stores, generic version for all cpus
+ * @param[in] address the address to be setted
+ * @param[in] value the value
+ * @param[in] size repeat count
+ */
+static void memory_memset_generic(void* address, uint8_t value, size_t size) {
     uint8_t* t_addr = (uint8_t*)address;
 
     size_t max_regsize = sizeof(size_t);
@@ -189,7 +271,8 @@ int8_t memory_memset(void* address, uint8_t value, size_t size){
             *t_addr = value;
             t_addr++;
         }
-        return 0;
+
+        return;
     }
 
     size_t start = (size_t)address;
@@ -232,143 +315,31 @@ int8_t memory_memset(void* address, uint8_t value, size_t size){
             t_addr++;
         }
     }
-
-    return 0;
 }
-#endif
-
-#if 1
-int8_t memory_memcopy(const void* source, void* destination, size_t size) {
-    if((!source && !destination) || !size) {
-        return 0;
-    }
-
-    if(source == NULL || destination == NULL) {
-        return -1;
-    }
 
+/**
+ * @brief copies memory byte by byte, generic version for all cpus
+ * @param[in] source source address
+ * @param[in] destination destination address
+ * @param[in] size byte count
+ */
+static void memory_memcopy_generic(const void* source, void* destination, size_t size) {
     uint8_t* s_addr = (uint8_t*)source;
     uint8_t* t_addr = (uint8_t*)destination;
 
     for(size_t i = 0; i < size; i++) {
         t_addr[i] = s_addr[i];
     }
-
-    return 0;
 }
-#else
-int8_t memory_memcopy(const void* source, void* destination, size_t size){
-    if((!source && !destination) || !size) {
-        return 0;
-    }
-
-    if(source == NULL || destination == NULL) {
-        return -1;
-    }
-
-    uint8_t* s_addr = (uint8_t*)source;
-    uint8_t* t_addr = (uint8_t*)destination;
-
-    size_t max_regsize = sizeof(size_t);
-
-    if(size <= (max_regsize * 2)) {
-        for(size_t i = 0; i < size; i++) {
-            *t_addr = *s_addr;
-            t_addr++;
-            s_addr++;
-        }
-        return 0;
-    }
-
-    size_t start = (size_t)source;
-
-    size_t rem = start % max_regsize;
-
-    if(rem != 0) {
-        rem = max_regsize - rem;
-
-        for(size_t i = 0; i < rem; i++) {
-            *t_addr = *s_addr;
-            t_addr++;
-            s_addr++;
-            size--;
-        }
-    }
-
-    size_t* st_addr = (size_t*)t_addr;
-    size_t* ss_addr = (size_t*)s_addr;
-
-    size_t rep = size / max_regsize;
-
-    for(size_t i = 0; i < rep; i++) {
-        *st_addr = *ss_addr;
-        st_addr++;
-        ss_addr++;
-    }
-
-    rem = size % max_regsize;
-
-    if(rem > 0) {
-        t_addr = (uint8_t*)st_addr;
-        s_addr = (uint8_t*)ss_addr;
-
-        for(size_t i = 0; i < rem; i++) {
-            *t_addr = *s_addr;
-            t_addr++;
-            s_addr++;
-        }
-    }
-
-    return 0;
-}
-#endif
-
-#if 0
-int8_t memory_memcompare(const void* mem1, const void* mem2, size_t size) {
-    if(!size && ((!mem1 && !mem2) || (mem1 && mem2))) {
-        return 0;
-    }
-
-    if(!mem1 && mem2) {
-        return -1;
-    }
-
-    if(mem1 && !mem2) {
-        return 1;
-    }
-
-    if(size && !mem1 && !mem2) {
-        return 0;
-    }
-
-    for(size_t i = 0; i < size; i++) {
-        if(((uint8_t*)mem1)[i] < ((uint8_t*)mem2)[i]) {
-            return -1;
-        } else if(((uint8_t*)mem1)[i] > ((uint8_t*)mem2)[i]) {
-            return 1;
-        }
-    }
-
-    return 0;
-}
-#else
-int8_t memory_memcompare(const void* mem1, const void* mem2, size_t size) {
-    if(!size && ((!mem1 && !mem2) || (mem1 && mem2))) {
-        return 0;
-    }
-
-    if(!mem1 && mem2) {
-        return -1;
-    }
-
-    if(mem1 && !mem2) {
-        return 1;
-    }
-
-    if(size && !mem1 && !mem2) {
-        return 0;
-    }
 
+/**
+ * @brief compares memory word by word, generic version for all cpus
+ * @param[in] mem1 first memory address
+ * @param[in] mem2 second memory address
+ * @param[in] size byte count
+ * @return <0 if mem1<mem2, 0 if mem1=mem2, >0 if mem1>mem2
+ */
+static int8_t memory_memcompare_generic(const void* mem1, const void* mem2, size_t size) {
     size_t q_size = size / sizeof(size_t);
     size_t rem = size % sizeof(size_t);
 
@@ -406,57 +377,22 @@ int8_t memory_memcompare(const void* mem1, const void* mem2, size_t size) {
     return 0;
 }
 
-#endif
-
-#if 0
-int8_t memory_memclean(void* address, size_t size) {
-    if(!address || !size) {
-        return 0;
-    }
-
-    uint8_t* t_addr = (uint8_t*)address;
-
-    for(size_t i = 0; i < size; i++) {
-        t_addr[i] = 0;
-    }
-
-    return 0;
-}
-#elif 0
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wanalyzer-use-of-uninitialized-value"
-int8_t memory_memclean(void* address, size_t size) {
-    return memory_memset(address, 0, size);
-}
-#pragma GCC diagnostic pop
-#elif 0
-int8_t __attribute__((naked)) memory_memclean(register void* address, register size_t size) {
-    // loop with rep stosq and rep stosb
-    // move sil to al and move it %rdi until %rcx is zero
-    asm volatile (
-        "test %1, %1\n"
-        "jz .Lexit%=\n"
-        "xor %%rax, %%rax\n"
-        "rep stosb\n"
-        ".Lexit%=:\n"
-        "ret\n"
-        :
-        : "c" (size), "D" (address)
-        : "memory"
-        );
-}
-#else
-int8_t memory_memclean(void* address, size_t size) {
-    if(!address || !size) {
-        return 0;
-    }
-
+/**
+ * @brief zeros memory with 16 byte stores, generic version for all cpus
+ * @param[in] address the address to be zeroed
+ * @param[in] size byte count
+ */
+static void memory_memclean_generic(void* address, size_t size) {
     uint64_t addr = (uint64_t)address;
     uint8_t* t_addr = (uint8_t*)address;
 
     if(addr % 16) {
+        size_t rem = 16 - (addr % 16);
+
+        if(rem > size) {
+            rem = size;
+        }
 
-        size_t rem = addr % 16;
         size -= rem;
 
         if(rem >= 8) {
@@ -523,10 +459,91 @@ int8_t memory_memclean(void* address, size_t size) {
             *t_addr++ = 0;
         }
     }
+}
+
+/*! active memory function implementations, cpu specific ones are selected at boot */
+static memory_functions_t memory_functions = {
+    .memset = memory_memset_generic,
+    .memclean = memory_memclean_generic,
+    .memcopy = memory_memcopy_generic,
+    .memcompare = memory_memcompare_generic,
+};
+
+void memory_set_functions(const memory_functions_t* functions) {
+    if(functions == NULL) {
+        return;
+    }
+
+    if(functions->memset) {
+        memory_functions.memset = functions->memset;
+    }
+
+    if(functions->memclean) {
+        memory_functions.memclean = functions->memclean;
+    }
+
+    if(functions->memcopy) {
+        memory_functions.memcopy = functions->memcopy;
+    }
+
+    if(functions->memcompare) {
+        memory_functions.memcompare = functions->memcompare;
+    }
+}
+
+int8_t memory_memset(void* address, uint8_t value, size_t size){
+    if(address == NULL) {
+        return -1;
+    }
+
+    memory_functions.memset(address, value, size);
+
+    return 0;
+}
+
+int8_t memory_memcopy(const void* source, void* destination, size_t size) {
+    if((!source && !destination) || !size) {
+        return 0;
+    }
+
+    if(source == NULL || destination == NULL) {
+        return -1;
+    }
+
+    memory_functions.memcopy(source, destination, size);
+
+    return 0;
+}
+
+int8_t memory_memcompare(const void* mem1, const void* mem2, size_t size) {
+    if(!size && ((!mem1 && !mem2) || (mem1 && mem2))) {
+        return 0;
+    }
+
+    if(!mem1 && mem2) {
+        return -1;
+    }
+
+    if(mem1 && !mem2) {
+        return 1;
+    }
+
+    if(size && !mem1 && !mem2) {
+        return 0;
+    }
+
+    return memory_functions.memcompare(mem1, mem2, size);
+}
+
+int8_t memory_memclean(void* address, size_t size) {
+    if(!address || !size) {
+        return 0;
+    }
+
+    memory_functions.memclean(address, size);
 
     return 0;
 }
-#endif
 
 
 typedef void (*memory_backtrace_f)(void);
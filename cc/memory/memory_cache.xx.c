@@ -0,0 +1,614 @@
+/**
+ * @file memory_cache.xx.c
+ * @brief slab caches for fixed size objects.
+ *
+ * This work is licensed under TURNSTONE OS Public License.
+ * Please read and understand latest version of Licence.
+ */
+
+#include <memory.h>
+#include <cpu.h>
+#include <cpu/sync.h>
+#include <logging.h>
+#include <utils.h>
+
+MODULE("turnstone.lib.memory");
+
+/*! default slab size, a slab is aligned to its size so object's slab is found by masking */
+#define MEMORY_CACHE_SLAB_SIZE            4096
+/*! slabs grow until they hold this many objects */
+#define MEMORY_CACHE_MIN_OBJECTS_PER_SLAB 8
+/*! largest slab size */
+#define MEMORY_CACHE_MAX_SLAB_SIZE        (64 << 10)
+/*! fully free slabs kept for later allocations, others are returned to heap */
+#define MEMORY_CACHE_MAX_EMPTY_SLABS      1
+/*! object count limit of a cpu's free list */
+#define MEMORY_CACHE_CPU_LIMIT            32
+/*! objects moved between a cpu's free list and slabs under one cache lock */
+#define MEMORY_CACHE_BATCH                (MEMORY_CACHE_CPU_LIMIT / 2)
+/*! per cpu slots, indexed by local apic id */
+#define MEMORY_CACHE_MAX_CPUS             256
+/*! slab header magic for validating freed objects */
+#define MEMORY_CACHE_SLAB_MAGIC           0x42414C534548434DULL
+
+typedef struct memory_cache_object_t {
+    struct memory_cache_object_t* next;
+} memory_cache_object_t;
+
+typedef struct memory_cache_slab_t {
+    uint64_t                    magic;
+    memory_cache_t*             cache;
+    struct memory_cache_slab_t* prev;
+    struct memory_cache_slab_t* next;
+    memory_cache_object_t*      free_list;
+    uint64_t                    free_count;
+} memory_cache_slab_t;
+
+typedef struct memory_cache_cpu_t {
+    memory_cache_object_t* free_list;
+    uint64_t               free_count;
+    uint64_t               alloc_count; ///< objects given from this free list
+    uint64_t               release_count; ///< objects put to this free list
+} memory_cache_cpu_t;
+
+struct memory_cache_t {
+    const char_t*        name;
+    memory_heap_t*       heap;
+    lock_t*              lock;
+    memory_cache_ctor_f  ctor;
+    uint64_t             object_size;
+    uint64_t             first_object_offset;
+    uint64_t             slab_size;
+    uint64_t             objects_per_slab;
+    memory_cache_slab_t* partial_slabs; ///< slabs with at least one free object
+    uint64_t             empty_slab_count;
+    uint64_t             slab_alloc_count; ///< slabs taken from heap, updated under lock
+    uint64_t             slab_free_count; ///< slabs returned to heap, updated under lock
+    uint64_t             alloc_count; ///< objects given without a cpu free list, updated under lock
+    uint64_t             free_count; ///< objects taken back without a cpu free list, updated under lock
+    uint64_t             metadata_malloc_count; ///< heap mallocs for cache itself and its lock
+    memory_cache_t*      next;
+    memory_cache_cpu_t   cpus[MEMORY_CACHE_MAX_CPUS];
+};
+
+/*! all caches for heap stats */
+memory_cache_t* memory_caches = NULL;
+/*! spin lock of cache list, caches are created before tasking so it is rarely contended */
+volatile uint64_t memory_caches_lock = 0;
+
+static inline void memory_cache_registry_lock(void) {
+    while(bit_locked_set(&memory_caches_lock, 0)) {
+        asm volatile ("pause" ::: "memory");
+    }
+}
+
+static inline void memory_cache_registry_unlock(void) {
+    asm volatile ("" ::: "memory");
+    memory_caches_lock = 0;
+}
+
+/**
+ * @brief disables interrupts, so a task can not move to another cpu while it uses a cpu free list
+ * @return true if interrupts were enabled
+ */
+static inline boolean_t memory_cache_disable_interrupts(void) {
+#if ___KERNELBUILD == 1
+    return cpu_cli();
+#else
+    return false;
+#endif
+}
+
+/**
+ * @brief enables interrupts if they were enabled before memory_cache_disable_interrupts
+ * @param[in] interrupts_enabled interrupt state
+ */
+static inline void memory_cache_restore_interrupts(boolean_t interrupts_enabled) {
+    if(interrupts_enabled) {
+        cpu_sti();
+    }
+}
+
+/**
+ * @brief returns current cpu's free list, interrupts should be disabled
+ * @param[in] cache cache
+ * @return cpu free list or NULL before cpu ids are known
+ */
+static inline memory_cache_cpu_t* memory_cache_get_cpu(memory_cache_t* cache) {
+    uint64_t cpu_id = 0;
+
+    if(!memory_get_cpu_id(&cpu_id) || cpu_id >= MEMORY_CACHE_MAX_CPUS) {
+        return NULL;
+    }
+
+    return &cache->cpus[cpu_id];
+}
+
+static void memory_cache_slab_link(memory_cache_t* cache, memory_cache_slab_t* slab) {
+    slab->prev = NULL;
+    slab->next = cache->partial_slabs;
+
+    if(cache->partial_slabs) {
+        cache->partial_slabs->prev = slab;
+    }
+
+    cache->partial_slabs = slab;
+}
+
+static void memory_cache_slab_unlink(memory_cache_t* cache, memory_cache_slab_t* slab) {
+    if(slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        cache->partial_slabs = slab->next;
+    }
+
+    if(slab->next) {
+        slab->next->prev = slab->prev;
+    }
+
+    slab->prev = NULL;
+    slab->next = NULL;
+}
+
+/**
+ * @brief takes a new slab from heap and links it as partial, cache lock should be held
+ * @param[in] cache cache
+ * @return slab or NULL
+ */
+static memory_cache_slab_t* memory_cache_slab_create(memory_cache_t* cache) {
+    memory_cache_slab_t* slab = memory_malloc_ext(cache->heap, cache->slab_size, cache->slab_size);
+
+    if(!slab) {
+        PRINTLOG(MEMORY, LOG_ERROR, "cannot allocate slab for cache %s", cache->name);
+
+        return NULL;
+    }
+
+    slab->magic = MEMORY_CACHE_SLAB_MAGIC;
+    slab->cache = cache;
+    slab->free_count = cache->objects_per_slab;
+
+    uint8_t* objects = (uint8_t*)slab + cache->first_object_offset;
+
+    // build free list backwards, so objects are given in address order
+    for(uint64_t i = cache->objects_per_slab; i > 0; i--) {
+        memory_cache_object_t* obj = (memory_cache_object_t*)(objects + (i - 1) * cache->object_size);
+        obj->next = slab->free_list;
+        slab->free_list = obj;
+    }
+
+    memory_cache_slab_link(cache, slab);
+
+    cache->slab_alloc_count++;
+    cache->empty_slab_count++;
+
+    return slab;
+}
+
+/**
+ * @brief takes objects from partial slabs, creates slabs when needed, cache lock should be held
+ * @param[in] cache cache
+ * @param[in] count requested object count
+ * @return chain of objects, may be shorter than count, NULL if no memory
+ */
+static memory_cache_object_t* memory_cache_take_objects(memory_cache_t* cache, uint64_t count) {
+    memory_cache_object_t* objects = NULL;
+
+    while(count--) {
+        memory_cache_slab_t* slab = cache->partial_slabs;
+
+        if(!slab) {
+            slab = memory_cache_slab_create(cache);
+
+            if(!slab) {
+                break;
+            }
+        }
+
+        if(slab->free_count == cache->objects_per_slab) {
+            cache->empty_slab_count--;
+        }
+
+        memory_cache_object_t* obj = slab->free_list;
+        slab->free_list = obj->next;
+        slab->free_count--;
+
+        if(!slab->free_count) {
+            memory_cache_slab_unlink(cache, slab);
+        }
+
+        obj->next = objects;
+        objects = obj;
+    }
+
+    return objects;
+}
+
+/**
+ * @brief puts chain of objects back to their slabs, returns surplus empty slabs to heap, cache lock should be held
+ * @param[in] cache cache
+ * @param[in] objects chain of objects
+ */
+static void memory_cache_release_objects(memory_cache_t* cache, memory_cache_object_t* objects) {
+    while(objects) {
+        memory_cache_object_t* obj = objects;
+        objects = obj->next;
+
+        memory_cache_slab_t* slab = (memory_cache_slab_t*)((uint64_t)obj & ~(cache->slab_size - 1));
+
+        obj->next = slab->free_list;
+        slab->free_list = obj;
+        slab->free_count++;
+
+        if(slab->free_count == 1) {
+            memory_cache_slab_link(cache, slab);
+        }
+
+        if(slab->free_count == cache->objects_per_slab) {
+            if(cache->empty_slab_count < MEMORY_CACHE_MAX_EMPTY_SLABS) {
+                cache->empty_slab_count++;
+            } else {
+                memory_cache_slab_unlink(cache, slab);
+                slab->magic = 0;
+                memory_free_ext(cache->heap, slab);
+                cache->slab_free_count++;
+            }
+        }
+    }
+}
+
+memory_cache_t* memory_cache_create(const char_t* name, size_t size, size_t align, memory_cache_ctor_f ctor) {
+    if(!size) {
+        return NULL;
+    }
+
+    if(align < sizeof(memory_cache_object_t)) {
+        align = sizeof(memory_cache_object_t);
+    }
+
+    if(align & (align - 1)) {
+        PRINTLOG(MEMORY, LOG_ERROR, "cache %s alignment 0x%llx is not power of 2", name, align);
+
+        return NULL;
+    }
+
+    uint64_t object_size = (size + align - 1) & ~(align - 1);
+    uint64_t first_object_offset = (sizeof(memory_cache_slab_t) + align - 1) & ~(align - 1);
+    uint64_t slab_size = MEMORY_CACHE_SLAB_SIZE;
+
+    while(slab_size < MEMORY_CACHE_MAX_SLAB_SIZE &&
+          (slab_size < first_object_offset || (slab_size - first_object_offset) / object_size < MEMORY_CACHE_MIN_OBJECTS_PER_SLAB)) {
+        slab_size <<= 1;
+    }
+
+    if(slab_size <= first_object_offset || (slab_size - first_object_offset) / object_size == 0) {
+        PRINTLOG(MEMORY, LOG_ERROR, "cache %s object size 0x%llx is too large for slabs", name, size);
+
+        return NULL;
+    }
+
+    memory_heap_t* heap = memory_get_default_heap();
+
+    memory_heap_stat_t stat_before = {0};
+    memory_heap_stat_t stat_after = {0};
+
+    heap->stat(heap, &stat_before);
+
+    memory_cache_t* cache = memory_malloc_ext(heap, sizeof(memory_cache_t), 0x0);
+
+    if(!cache) {
+        return NULL;
+    }
+
+    cache->lock = lock_create_with_heap(heap);
+
+    if(!cache->lock) {
+        memory_free_ext(heap, cache);
+
+        return NULL;
+    }
+
+    heap->stat(heap, &stat_after);
+
+    // caches live as long as kernel, their own mallocs are hidden with slabs. other cpus may malloc
+    // meanwhile but caches are created early at boot.
+    cache->metadata_malloc_count = stat_after.malloc_count - stat_before.malloc_count;
+
+    cache->name = name;
+    cache->heap = heap;
+    cache->ctor = ctor;
+    cache->object_size = object_size;
+    cache->first_object_offset = first_object_offset;
+    cache->slab_size = slab_size;
+    cache->objects_per_slab = (slab_size - first_object_offset) / object_size;
+
+    memory_cache_registry_lock();
+    cache->next = memory_caches;
+    memory_caches = cache;
+    memory_cache_registry_unlock();
+
+    PRINTLOG(MEMORY, LOG_DEBUG, "cache %s created object size 0x%llx slab size 0x%llx objects per slab 0x%llx",
+             name, object_size, slab_size, cache->objects_per_slab);
+
+    return cache;
+}
+
+int8_t memory_cache_destroy(memory_cache_t* cache) {
+    if(!cache) {
+        return -1;
+    }
+
+    lock_acquire(cache->lock);
+
+    uint64_t alloc_count = cache->alloc_count;
+    uint64_t free_count = cache->free_count;
+
+    for(uint64_t i = 0; i < MEMORY_CACHE_MAX_CPUS; i++) {
+        alloc_count += cache->cpus[i].alloc_count;
+        free_count += cache->cpus[i].release_count;
+    }
+
+    if(alloc_count != free_count) {
+        lock_release(cache->lock);
+
+        PRINTLOG(MEMORY, LOG_ERROR, "cache %s has 0x%llx live objects", cache->name, alloc_count - free_count);
+
+        return -1;
+    }
+
+    for(uint64_t i = 0; i < MEMORY_CACHE_MAX_CPUS; i++) {
+        memory_cache_release_objects(cache, cache->cpus[i].free_list);
+        cache->cpus[i].free_list = NULL;
+        cache->cpus[i].free_count = 0;
+    }
+
+    // all objects are free, so every remaining slab is empty and partial
+    while(cache->partial_slabs) {
+        memory_cache_slab_t* slab = cache->partial_slabs;
+        memory_cache_slab_unlink(cache, slab);
+        slab->magic = 0;
+        memory_free_ext(cache->heap, slab);
+    }
+
+    lock_release(cache->lock);
+
+    memory_cache_registry_lock();
+
+    memory_cache_t** prev = &memory_caches;
+
+    while(*prev && *prev != cache) {
+        prev = &(*prev)->next;
+    }
+
+    if(*prev) {
+        *prev = cache->next;
+    }
+
+    memory_cache_registry_unlock();
+
+    memory_heap_t* heap = cache->heap;
+
+    lock_destroy(cache->lock);
+
+    return memory_free_ext(heap, cache);
+}
+
+/**
+ * @brief takes a batch of objects from slabs, keeps one for caller and puts others to current cpu's free list
+ * @param[in] cache cache
+ * @return object for caller or NULL
+ */
+static memory_cache_object_t* memory_cache_refill(memory_cache_t* cache) {
+    uint64_t cpu_id = 0;
+
+    boolean_t interrupts_enabled = memory_cache_disable_interrupts();
+    boolean_t has_cpu_id = memory_get_cpu_id(&cpu_id) && cpu_id < MEMORY_CACHE_MAX_CPUS;
+    memory_cache_restore_interrupts(interrupts_enabled);
+
+    lock_acquire(cache->lock);
+
+    memory_cache_object_t* objects = memory_cache_take_objects(cache, has_cpu_id ? MEMORY_CACHE_BATCH : 1);
+
+    if(objects) {
+        cache->alloc_count++;
+    }
+
+    lock_release(cache->lock);
+
+    if(!objects) {
+        return NULL;
+    }
+
+    memory_cache_object_t* obj = objects;
+    objects = objects->next;
+
+    interrupts_enabled = memory_cache_disable_interrupts();
+
+    // cpu may be changed while lock is held, rest of batch goes to current one
+    memory_cache_cpu_t* cpu = memory_cache_get_cpu(cache);
+
+    while(cpu && objects && cpu->free_count < MEMORY_CACHE_CPU_LIMIT) {
+        memory_cache_object_t* next = objects->next;
+        objects->next = cpu->free_list;
+        cpu->free_list = objects;
+        cpu->free_count++;
+        objects = next;
+    }
+
+    memory_cache_restore_interrupts(interrupts_enabled);
+
+    if(objects) {
+        lock_acquire(cache->lock);
+        memory_cache_release_objects(cache, objects);
+        lock_release(cache->lock);
+    }
+
+    return obj;
+}
+
+void* memory_cache_alloc(memory_cache_t* cache) {
+    if(!cache) {
+        return NULL;
+    }
+
+    memory_cache_object_t* obj = NULL;
+
+    boolean_t interrupts_enabled = memory_cache_disable_interrupts();
+
+    memory_cache_cpu_t* cpu = memory_cache_get_cpu(cache);
+
+    if(cpu && cpu->free_list) {
+        obj = cpu->free_list;
+        cpu->free_list = obj->next;
+        cpu->free_count--;
+        cpu->alloc_count++;
+    }
+
+    memory_cache_restore_interrupts(interrupts_enabled);
+
+    if(!obj) {
+        obj = memory_cache_refill(cache);
+
+        if(!obj) {
+            return NULL;
+        }
+    }
+
+    memory_memclean(obj, cache->object_size);
+
+    if(cache->ctor) {
+        cache->ctor(obj);
+    }
+
+    return obj;
+}
+
+int8_t memory_cache_free(memory_cache_t* cache, void* object) {
+    if(!cache || !object) {
+        return -1;
+    }
+
+    memory_cache_slab_t* slab = (memory_cache_slab_t*)((uint64_t)object & ~(cache->slab_size - 1));
+    uint64_t offset = (uint64_t)object - (uint64_t)slab;
+
+    if(slab->magic != MEMORY_CACHE_SLAB_MAGIC || slab->cache != cache ||
+       offset < cache->first_object_offset || (offset - cache->first_object_offset) % cache->object_size) {
+        PRINTLOG(MEMORY, LOG_ERROR, "object %p does not belong to cache %s", object, cache->name);
+
+        return -1;
+    }
+
+    memory_cache_object_t* obj = object;
+    memory_cache_object_t* flush = NULL;
+    boolean_t cached = false;
+
+    boolean_t interrupts_enabled = memory_cache_disable_interrupts();
+
+    memory_cache_cpu_t* cpu = memory_cache_get_cpu(cache);
+
+    if(cpu) {
+        obj->next = cpu->free_list;
+        cpu->free_list = obj;
+        cpu->free_count++;
+        cpu->release_count++;
+        cached = true;
+
+        // a batch after the freed object goes back to slabs, freed object stays hot at head
+        if(cpu->free_count > MEMORY_CACHE_CPU_LIMIT) {
+            flush = obj->next;
+            memory_cache_object_t* last = flush;
+
+            for(uint64_t i = 1; i < MEMORY_CACHE_BATCH; i++) {
+                last = last->next;
+            }
+
+            obj->next = last->next;
+            cpu->free_count -= MEMORY_CACHE_BATCH;
+            last->next = NULL;
+        }
+    }
+
+    memory_cache_restore_interrupts(interrupts_enabled);
+
+    if(!cached) {
+        obj->next = NULL;
+        flush = obj;
+    }
+
+    if(flush) {
+        lock_acquire(cache->lock);
+
+        if(!cached) {
+            cache->free_count++;
+        }
+
+        memory_cache_release_objects(cache, flush);
+
+        lock_release(cache->lock);
+    }
+
+    return 0;
+}
+
+memory_cache_t* memory_cache_get_for_heap(memory_cache_t** cache_slot, memory_heap_t* heap,
+                                          const char_t* name, size_t size, size_t align, memory_cache_ctor_f ctor) {
+    memory_cache_t* cache = *cache_slot;
+
+    if(!cache) {
+        if(heap != memory_get_default_heap()) {
+            return NULL;
+        }
+
+        cache = memory_cache_create(name, size, align, ctor);
+
+        if(!cache) {
+            return NULL;
+        }
+
+        memory_cache_t* old_cache = NULL;
+
+        // another cpu may create same cache meanwhile, loser's cache is not used yet
+        if(!__atomic_compare_exchange_n(cache_slot, &old_cache, cache, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            memory_cache_destroy(cache);
+            cache = old_cache;
+        }
+    }
+
+    if(cache->heap != heap) {
+        return NULL;
+    }
+
+    return cache;
+}
+
+memory_heap_t* memory_cache_get_heap(memory_cache_t* cache) {
+    if(!cache) {
+        return NULL;
+    }
+
+    return cache->heap;
+}
+
+void memory_cache_adjust_heap_stat(memory_heap_t* heap, memory_heap_stat_t* stat) {
+    memory_cache_registry_lock();
+
+    for(memory_cache_t* cache = memory_caches; cache; cache = cache->next) {
+        if(cache->heap != heap) {
+            continue;
+        }
+
+        stat->malloc_count += cache->alloc_count;
+        stat->free_count += cache->free_count;
+
+        for(uint64_t i = 0; i < MEMORY_CACHE_MAX_CPUS; i++) {
+            stat->malloc_count += cache->cpus[i].alloc_count;
+            stat->free_count += cache->cpus[i].release_count;
+        }
+
+        // slabs and cache itself are not visible to callers, objects are counted instead
+        stat->malloc_count -= cache->slab_alloc_count + cache->metadata_malloc_count;
+        stat->free_count -= cache->slab_free_count;
+    }
+
+    memory_cache_registry_unlock();
+}
@@ -0,0 +1,291 @@
+/**
+ * @file memory_heap_arena.xx.c
+ * @brief arena heap implementation, bump allocates from chunks and frees everything at once.
+ *
+ * This work is licensed under TURNSTONE OS Public License.
+ * Please read and understand latest version of Licence.
+ */
+
+#include <memory.h>
+#include <cpu/sync.h>
+#include <logging.h>
+#include <utils.h>
+
+MODULE("turnstone.lib.memory");
+
+/*! default chunk size */
+#define MEMORY_HEAP_ARENA_DEFAULT_CHUNK_SIZE (64 << 10)
+/*! minimum alignment of returned addresses, same as other heaps */
+#define MEMORY_HEAP_ARENA_MIN_ALIGN          16
+/*! arena heap header */
+#define MEMORY_HEAP_ARENA_HEADER             0xaa55a4e4
+
+typedef struct memory_heap_arena_chunk_t {
+    struct memory_heap_arena_chunk_t* next; ///< next chunk, chunks are ordered from newest to oldest
+    uint64_t                          size; ///< usable size after header
+    uint64_t                          used; ///< bump offset
+    uint64_t                          reserved; ///< keeps data 16 byte aligned
+} memory_heap_arena_chunk_t;
+
+_Static_assert(sizeof(memory_heap_arena_chunk_t) % MEMORY_HEAP_ARENA_MIN_ALIGN == 0, "memory_heap_arena_chunk_t size is not aligned");
+
+typedef struct memory_heap_arena_metadata_t {
+    memory_heap_t*             parent; ///< heap of chunks
+    uint64_t                   chunk_size; ///< usable size of standard chunks
+    memory_heap_arena_chunk_t* chunks; ///< all chunks, first one is current
+    uint64_t                   chunk_count;
+    uint64_t                   total_size;
+    uint64_t                   used_size;
+    uint64_t                   malloc_count;
+    uint64_t                   free_count;
+} memory_heap_arena_metadata_t;
+
+void*  memory_heap_arena_malloc(memory_heap_t* heap, size_t size, size_t align);
+int8_t memory_heap_arena_free(memory_heap_t* heap, void* address);
+void   memory_heap_arena_stat(memory_heap_t* heap, memory_heap_stat_t* stat);
+
+/**
+ * @brief returns data start of chunk
+ * @param[in] chunk chunk
+ * @return data start
+ */
+static inline uint8_t* memory_heap_arena_chunk_data(memory_heap_arena_chunk_t* chunk) {
+    return (uint8_t*)chunk + sizeof(memory_heap_arena_chunk_t);
+}
+
+/**
+ * @brief allocates a zeroed chunk from parent heap and links it, heap lock should be held
+ * @param[in] metadata arena metadata
+ * @param[in] size usable size
+ * @param[in] as_current if false chunk is linked after current chunk, so large requests do not waste current chunk
+ * @return chunk or NULL
+ */
+static memory_heap_arena_chunk_t* memory_heap_arena_chunk_create(memory_heap_arena_metadata_t* metadata, uint64_t size, boolean_t as_current) {
+    memory_heap_arena_chunk_t* chunk = memory_malloc_ext(metadata->parent, sizeof(memory_heap_arena_chunk_t) + size, MEMORY_HEAP_ARENA_MIN_ALIGN);
+
+    if(!chunk) {
+        PRINTLOG(MEMORY, LOG_ERROR, "cannot allocate arena chunk with size 0x%llx", size);
+
+        return NULL;
+    }
+
+    chunk->size = size;
+
+    if(as_current || !metadata->chunks) {
+        chunk->next = metadata->chunks;
+        metadata->chunks = chunk;
+    } else {
+        chunk->next = metadata->chunks->next;
+        metadata->chunks->next = chunk;
+    }
+
+    metadata->chunk_count++;
+    metadata->total_size += size;
+
+    return chunk;
+}
+
+/**
+ * @brief tries to bump allocate from chunk
+ * @param[in] chunk chunk
+ * @param[in] size size
+ * @param[in] align alignment
+ * @return address or NULL if chunk does not have enough space
+ */
+static void* memory_heap_arena_chunk_alloc(memory_heap_arena_chunk_t* chunk, uint64_t size, uint64_t align) {
+    uint64_t data = (uint64_t)memory_heap_arena_chunk_data(chunk);
+    uint64_t start = (data + chunk->used + align - 1) & ~(align - 1);
+
+    if(start + size > data + chunk->size) {
+        return NULL;
+    }
+
+    chunk->used = start + size - data;
+
+    return (void*)start;
+}
+
+void* memory_heap_arena_malloc(memory_heap_t* heap, size_t size, size_t align) {
+    memory_heap_arena_metadata_t* metadata = heap->metadata;
+
+    if(align < MEMORY_HEAP_ARENA_MIN_ALIGN) {
+        align = MEMORY_HEAP_ARENA_MIN_ALIGN;
+    }
+
+    void* res = NULL;
+
+    if(metadata->chunks) {
+        res = memory_heap_arena_chunk_alloc(metadata->chunks, size, align);
+    }
+
+    if(!res) {
+        // requests larger than a quarter chunk get their own chunk, current chunk keeps serving small ones
+        boolean_t is_large = size + align > metadata->chunk_size / 4;
+        uint64_t chunk_size = is_large ? size + align : metadata->chunk_size;
+
+        memory_heap_arena_chunk_t* chunk = memory_heap_arena_chunk_create(metadata, chunk_size, !is_large);
+
+        if(!chunk) {
+            return NULL;
+        }
+
+        res = memory_heap_arena_chunk_alloc(chunk, size, align);
+    }
+
+    metadata->malloc_count++;
+    metadata->used_size += size;
+
+    return res;
+}
+
+int8_t memory_heap_arena_free(memory_heap_t* heap, void* address) {
+    memory_heap_arena_metadata_t* metadata = heap->metadata;
+
+    uint64_t addr = (uint64_t)address;
+
+    // memory is released with arena, only ownership is checked so frees of other heaps' addresses fall through
+    for(memory_heap_arena_chunk_t* chunk = metadata->chunks; chunk; chunk = chunk->next) {
+        uint64_t data = (uint64_t)memory_heap_arena_chunk_data(chunk);
+
+        if(addr >= data && addr < data + chunk->used) {
+            metadata->free_count++;
+
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+void memory_heap_arena_stat(memory_heap_t* heap, memory_heap_stat_t* stat) {
+    if(!heap || !stat) {
+        return;
+    }
+
+    memory_heap_arena_metadata_t* metadata = heap->metadata;
+
+    stat->malloc_count = metadata->malloc_count;
+    stat->free_count = metadata->free_count;
+    stat->total_size = metadata->total_size;
+    stat->free_size = metadata->total_size - metadata->used_size;
+    stat->fast_hit = metadata->malloc_count;
+    stat->header_count = metadata->chunk_count;
+}
+
+memory_heap_t* memory_create_heap_arena(memory_heap_t* parent, size_t chunk_size) {
+    parent = memory_get_heap(parent);
+
+    if(!chunk_size) {
+        chunk_size = MEMORY_HEAP_ARENA_DEFAULT_CHUNK_SIZE;
+    }
+
+    uint64_t lock_start = sizeof(memory_heap_t);
+
+    if(lock_start % 0x20) {
+        lock_start += 0x20 - (lock_start % 0x20);
+    }
+
+    uint64_t metadata_start = lock_start + SYNC_LOCK_SIZE;
+
+    if(metadata_start % 0x20) {
+        metadata_start += 0x20 - (metadata_start % 0x20);
+    }
+
+    uint8_t* heap_area = memory_malloc_ext(parent, metadata_start + sizeof(memory_heap_arena_metadata_t), 0x20);
+
+    if(!heap_area) {
+        return NULL;
+    }
+
+    memory_heap_t* heap = (memory_heap_t*)heap_area;
+    heap->header = MEMORY_HEAP_ARENA_HEADER;
+
+    memory_heap_t** lock_heap = (memory_heap_t**)(heap_area + lock_start);
+    *lock_heap = heap; // black magic first element of lock is heap
+    heap->lock = (lock_t*)lock_heap;
+
+    memory_heap_arena_metadata_t* metadata = (memory_heap_arena_metadata_t*)(heap_area + metadata_start);
+    metadata->parent = parent;
+    metadata->chunk_size = chunk_size;
+
+    heap->metadata = metadata;
+    heap->malloc = &memory_heap_arena_malloc;
+    heap->free = &memory_heap_arena_free;
+    heap->stat = &memory_heap_arena_stat;
+
+    if(!memory_heap_arena_chunk_create(metadata, chunk_size, true)) {
+        memory_free_ext(parent, heap_area);
+
+        return NULL;
+    }
+
+    PRINTLOG(MEMORY, LOG_DEBUG, "arena heap created with chunk size 0x%llx", chunk_size);
+
+    return heap;
+}
+
+int8_t memory_heap_arena_reset(memory_heap_t* heap) {
+    if(!heap || heap->header != MEMORY_HEAP_ARENA_HEADER) {
+        return -1;
+    }
+
+    memory_heap_arena_metadata_t* metadata = heap->metadata;
+
+    lock_acquire(heap->lock);
+
+    memory_heap_arena_chunk_t* keep = NULL;
+    memory_heap_arena_chunk_t* chunk = metadata->chunks;
+
+    // oldest standard chunk is kept, it is at the end of chunk list
+    while(chunk) {
+        memory_heap_arena_chunk_t* next = chunk->next;
+
+        if(!next && chunk->size == metadata->chunk_size) {
+            keep = chunk;
+        } else {
+            memory_free_ext(metadata->parent, chunk);
+        }
+
+        chunk = next;
+    }
+
+    metadata->chunks = keep;
+    metadata->chunk_count = 0;
+    metadata->total_size = 0;
+
+    if(keep) {
+        memory_memclean(memory_heap_arena_chunk_data(keep), keep->used);
+        keep->used = 0;
+        keep->next = NULL;
+        metadata->chunk_count = 1;
+        metadata->total_size = keep->size;
+    }
+
+    metadata->used_size = 0;
+    metadata->free_count = metadata->malloc_count;
+
+    lock_release(heap->lock);
+
+    return 0;
+}
+
+int8_t memory_destroy_heap_arena(memory_heap_t* heap) {
+    if(!heap || heap->header != MEMORY_HEAP_ARENA_HEADER) {
+        return -1;
+    }
+
+    memory_heap_arena_metadata_t* metadata = heap->metadata;
+    memory_heap_t* parent = metadata->parent;
+
+    memory_heap_arena_chunk_t* chunk = metadata->chunks;
+
+    while(chunk) {
+        memory_heap_arena_chunk_t* next = chunk->next;
+        memory_free_ext(parent, chunk);
+        chunk = next;
+    }
+
+    heap->header = 0;
+
+    return memory_free_ext(parent, heap);
+}
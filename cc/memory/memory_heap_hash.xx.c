@@ -30,7 +30,8 @@ typedef struct memory_heap_hash_block_t {
     uint32_t  size;
     uint32_t  next;
     boolean_t is_free;
-    uint8_t   reserved[3];
+    boolean_t is_cached;
+    uint8_t   reserved[2];
 }__attribute__((packed)) memory_heap_hash_block_t;
 
 _Static_assert(sizeof(memory_heap_hash_block_t) == 16, "memory_heap_hash_block_t size is not 16 bytes");
@@ -38,6 +39,43 @@ _Static_assert(sizeof(memory_heap_hash_block_t) == 16, "memory_heap_hash_block_t
 #define MEMORY_HEAP_HASH_FAST_CLASSES_COUNT 1025
 #define MEMORY_HEAP_HASH_MAX_POOLS            16
 
+/*! largest block size kept at per cpu magazines */
+#define MEMORY_HEAP_HASH_MAGAZINE_MAX_SIZE    512
+/*! magazine classes, a class holds blocks of fast class with same index */
+#define MEMORY_HEAP_HASH_MAGAZINE_CLASS_COUNT (MEMORY_HEAP_HASH_MAGAZINE_MAX_SIZE / 16)
+/*! block count of a full magazine */
+#define MEMORY_HEAP_HASH_MAGAZINE_SIZE        32
+/*! blocks moved between a magazine and pools under one heap lock */
+#define MEMORY_HEAP_HASH_MAGAZINE_BATCH       (MEMORY_HEAP_HASH_MAGAZINE_SIZE / 2)
+/*! per cpu slots, indexed by local apic id */
+#define MEMORY_HEAP_HASH_MAGAZINE_MAX_CPUS    256
+/*! memory pressure is notified when free size is below total size / divisor */
+#define MEMORY_HEAP_HASH_LOW_WATERMARK_DIVISOR  16
+/*! shrinkers are asked to free until free size reaches total size / divisor */
+#define MEMORY_HEAP_HASH_HIGH_WATERMARK_DIVISOR 8
+
+typedef struct memory_heap_hash_magazine_round_t {
+    void*                     address;
+    memory_heap_hash_block_t* block;
+} memory_heap_hash_magazine_round_t;
+
+typedef struct memory_heap_hash_magazine_t {
+    uint64_t                          count;
+    memory_heap_hash_magazine_round_t rounds[MEMORY_HEAP_HASH_MAGAZINE_SIZE];
+} memory_heap_hash_magazine_t;
+
+typedef struct memory_heap_hash_cpu_cache_t {
+    memory_heap_hash_magazine_t magazines[MEMORY_HEAP_HASH_MAGAZINE_CLASS_COUNT];
+    uint64_t                    malloc_count;
+    uint64_t                    free_count;
+} memory_heap_hash_cpu_cache_t;
+
+typedef struct memory_heap_hash_cpu_caches_t {
+    memory_heap_hash_cpu_cache_t* cpus[MEMORY_HEAP_HASH_MAGAZINE_MAX_CPUS];
+    uint64_t                      hidden_malloc_count; ///< pool mallocs on behalf of magazines, updated under heap lock
+    uint64_t                      hidden_free_count; ///< pool frees on behalf of magazines, updated under heap lock
+} memory_heap_hash_cpu_caches_t;
+
 typedef struct memory_heap_hash_fast_class_t {
     uint32_t head;
     uint32_t tail;
@@ -68,6 +106,7 @@ typedef struct memory_heap_hash_metadata_t {
     uint64_t free_size;
     uint64_t fast_hit;
     uint64_t header_count;
+    memory_heap_hash_cpu_caches_t* cpu_caches;
 }__attribute__((packed)) memory_heap_hash_metadata_t;
 
 static inline memory_heap_hash_pool_t* memory_heap_hash_pool_get(memory_heap_hash_metadata_t* metadata, uint16_t pool_id) {
@@ -475,6 +514,11 @@ void* memory_heap_hash_malloc_ext(memory_heap_t* heap, uint64_t size, uint64_t a
         metadata->malloc_count++;
         metadata->free_size -= size + 1;
 
+        // heap grows only from end, so watermark is checked here
+        if(metadata->free_size < metadata->total_size / MEMORY_HEAP_HASH_LOW_WATERMARK_DIVISOR) {
+            memory_pressure_notify(metadata->total_size / MEMORY_HEAP_HASH_HIGH_WATERMARK_DIVISOR - metadata->free_size);
+        }
+
         *flag = 0x55;
 
         PRINTLOG(HEAP_HASH, LOG_DEBUG, "malloced from end of heap. size 0x%llx alignment 0x%llx address 0x%llx", size, alignment, pool->pool_base + last_address);
@@ -541,7 +585,7 @@ int8_t memory_heap_hash_free(memory_heap_t* heap, void* ptr) {
         return -1;
     }
 
-    if(hash_block->is_free) {
+    if(hash_block->is_free || hash_block->is_cached) {
         PRINTLOG(HEAP_HASH, LOG_WARNING, "address %p is already freed. heap task 0x%llx", ptr, heap->task_id);
 
 #if ___KERNELBUILD == 1
@@ -617,9 +661,320 @@ void memory_heap_hash_stat(memory_heap_t* heap, memory_heap_stat_t* stat) {
     stat->free_size = metadata->free_size;
     stat->fast_hit = metadata->fast_hit;
     stat->header_count = metadata->header_count;
+
+    memory_heap_hash_cpu_caches_t* caches = metadata->cpu_caches;
+
+    if(!caches) {
+        return;
+    }
+
+    // blocks waiting at magazines are neither malloced nor freed for callers, they are only counted as used space
+    stat->malloc_count -= caches->hidden_malloc_count;
+    stat->free_count -= caches->hidden_free_count;
+
+    for(uint64_t i = 0; i < MEMORY_HEAP_HASH_MAGAZINE_MAX_CPUS; i++) {
+        memory_heap_hash_cpu_cache_t* cache = caches->cpus[i];
+
+        if(cache) {
+            stat->malloc_count += cache->malloc_count;
+            stat->free_count += cache->free_count;
+            stat->fast_hit += cache->malloc_count;
+        }
+    }
+}
+
+/**
+ * @brief disables interrupts, so a task can not move to another cpu while it uses a magazine
+ * @return true if interrupts were enabled
+ */
+static inline boolean_t memory_heap_hash_disable_interrupts(void) {
+#if ___KERNELBUILD == 1
+    return cpu_cli();
+#else
+    return false;
+#endif
 }
 
-memory_heap_t* memory_create_heap_hash(uint64_t start, uint64_t end) {
+/**
+ * @brief enables interrupts if they were enabled before memory_heap_hash_disable_interrupts
+ * @param[in] interrupts_enabled interrupt state
+ */
+static inline void memory_heap_hash_restore_interrupts(boolean_t interrupts_enabled) {
+    if(interrupts_enabled) {
+        cpu_sti();
+    }
+}
+
+/**
+ * @brief returns current cpu's magazine cache, interrupts should be disabled
+ * @param[in] caches per cpu caches of heap
+ * @return cpu cache or NULL if cpu has no cache yet
+ */
+static inline memory_heap_hash_cpu_cache_t* memory_heap_hash_get_cpu_cache(memory_heap_hash_cpu_caches_t* caches) {
+    uint64_t cpu_id = 0;
+
+    if(!memory_get_cpu_id(&cpu_id) || cpu_id >= MEMORY_HEAP_HASH_MAGAZINE_MAX_CPUS) {
+        return NULL;
+    }
+
+    return caches->cpus[cpu_id];
+}
+
+/**
+ * @brief returns magazine blocks to pools under heap lock
+ * @param[in] heap heap
+ * @param[in] rounds blocks
+ * @param[in] count block count
+ */
+static void memory_heap_hash_magazine_flush(memory_heap_t* heap, memory_heap_hash_magazine_round_t* rounds, uint64_t count) {
+    memory_heap_hash_metadata_t* metadata = heap->metadata;
+
+    lock_acquire(heap->lock);
+
+    for(uint64_t i = 0; i < count; i++) {
+        rounds[i].block->is_cached = false;
+
+        if(memory_heap_hash_free(heap, rounds[i].address) == 0) {
+            metadata->cpu_caches->hidden_free_count++;
+        }
+    }
+
+    lock_release(heap->lock);
+}
+
+/**
+ * @brief allocates a block for caller and a batch for current cpu's magazine under heap lock
+ * @param[in] heap heap
+ * @param[in] size requested size
+ * @param[in] magazine_class magazine class of size
+ * @return block for caller
+ */
+static void* memory_heap_hash_magazine_refill(memory_heap_t* heap, uint64_t size, uint64_t magazine_class) {
+    memory_heap_hash_metadata_t* metadata = heap->metadata;
+    memory_heap_hash_cpu_caches_t* caches = metadata->cpu_caches;
+    memory_heap_hash_magazine_round_t rounds[MEMORY_HEAP_HASH_MAGAZINE_BATCH];
+    uint64_t count = 0;
+    uint64_t cpu_id = 0;
+
+    boolean_t interrupts_enabled = memory_heap_hash_disable_interrupts();
+    boolean_t has_cpu_id = memory_get_cpu_id(&cpu_id) && cpu_id < MEMORY_HEAP_HASH_MAGAZINE_MAX_CPUS;
+    memory_heap_hash_restore_interrupts(interrupts_enabled);
+
+    if(!has_cpu_id) {
+        return NULL;
+    }
+
+    lock_acquire(heap->lock);
+
+    // cpu id may be stale after interrupts are enabled, creating another cpu's cache is harmless
+    if(!caches->cpus[cpu_id]) {
+        caches->cpus[cpu_id] = memory_heap_hash_malloc_ext(heap, sizeof(memory_heap_hash_cpu_cache_t), 16);
+
+        if(caches->cpus[cpu_id]) {
+            caches->hidden_malloc_count++;
+        }
+    }
+
+    void* res = memory_heap_hash_malloc_ext(heap, size, 16);
+
+    while(res && count < MEMORY_HEAP_HASH_MAGAZINE_BATCH) {
+        // largest request of class, so any request of class fits in the block
+        void* address = memory_heap_hash_malloc_ext(heap, magazine_class * 16 + 8, 16);
+
+        if(!address) {
+            break;
+        }
+
+        memory_heap_hash_pool_t* pool = memory_heap_hash_find_pool_by_address(metadata, (uint64_t)address);
+        memory_heap_hash_block_t* block = pool ? memory_heap_hash_pool_search_hash_block(metadata, pool, (uint64_t)address - pool->pool_base) : NULL;
+
+        // a split remainder at fast class may be smaller than the class size, it is not cached
+        if(!block || block->size != magazine_class * 16 + 15) {
+            memory_heap_hash_free(heap, address);
+
+            break;
+        }
+
+        caches->hidden_malloc_count++;
+        block->is_cached = true;
+        rounds[count].address = address;
+        rounds[count].block = block;
+        count++;
+    }
+
+    lock_release(heap->lock);
+
+    interrupts_enabled = memory_heap_hash_disable_interrupts();
+
+    memory_heap_hash_cpu_cache_t* cache = memory_heap_hash_get_cpu_cache(caches);
+
+    if(cache) {
+        memory_heap_hash_magazine_t* magazine = &cache->magazines[magazine_class];
+
+        while(count && magazine->count < MEMORY_HEAP_HASH_MAGAZINE_SIZE) {
+            magazine->rounds[magazine->count++] = rounds[--count];
+        }
+    }
+
+    memory_heap_hash_restore_interrupts(interrupts_enabled);
+
+    if(count) {
+        memory_heap_hash_magazine_flush(heap, rounds, count);
+    }
+
+    return res;
+}
+
+/**
+ * @brief serves small requests from current cpu's magazine without heap lock
+ * @param[in] heap heap
+ * @param[in] size requested size
+ * @param[in] alignment requested alignment, only unaligned requests are cached
+ * @return block or NULL if request should go to locked malloc
+ */
+static void* memory_heap_hash_malloc_cached(memory_heap_t* heap, uint64_t size, uint64_t alignment) {
+    uint64_t magazine_class = size / 16;
+
+    if(alignment || !size || magazine_class >= MEMORY_HEAP_HASH_MAGAZINE_CLASS_COUNT) {
+        return NULL;
+    }
+
+    memory_heap_hash_metadata_t* metadata = heap->metadata;
+
+    if(!metadata->cpu_caches) {
+        return NULL;
+    }
+
+    boolean_t interrupts_enabled = memory_heap_hash_disable_interrupts();
+
+    memory_heap_hash_cpu_cache_t* cache = memory_heap_hash_get_cpu_cache(metadata->cpu_caches);
+
+    if(cache && cache->magazines[magazine_class].count) {
+        memory_heap_hash_magazine_t* magazine = &cache->magazines[magazine_class];
+        memory_heap_hash_magazine_round_t round = magazine->rounds[--magazine->count];
+
+        round.block->is_cached = false;
+        cache->malloc_count++;
+
+        memory_heap_hash_restore_interrupts(interrupts_enabled);
+
+        return round.address;
+    }
+
+    memory_heap_hash_restore_interrupts(interrupts_enabled);
+
+    return memory_heap_hash_magazine_refill(heap, size, magazine_class);
+}
+
+/**
+ * @brief puts a small block to current cpu's magazine without heap lock, flushes half of a full magazine
+ * @param[in] heap heap
+ * @param[in] ptr block address
+ * @return 0 on success, -1 if address should go to locked free
+ */
+static int8_t memory_heap_hash_free_cached(memory_heap_t* heap, void* ptr) {
+    memory_heap_hash_metadata_t* metadata = heap->metadata;
+
+    if(!ptr || !metadata->cpu_caches) {
+        return -1;
+    }
+
+    memory_heap_hash_pool_t* pool = memory_heap_hash_find_pool_by_address(metadata, (uint64_t)ptr);
+
+    if(!pool) {
+        return -1;
+    }
+
+    // block belongs to caller, so its header is stable without heap lock
+    memory_heap_hash_block_t* block = memory_heap_hash_pool_search_hash_block(metadata, pool, (uint64_t)ptr - pool->pool_base);
+
+    if(!block || block->is_free || block->is_cached || (block->size % 16) != 15) {
+        return -1;
+    }
+
+    uint64_t magazine_class = block->size / 16;
+
+    if(magazine_class >= MEMORY_HEAP_HASH_MAGAZINE_CLASS_COUNT) {
+        return -1;
+    }
+
+    memory_memclean(ptr, block->size);
+
+    memory_heap_hash_magazine_round_t flush_rounds[MEMORY_HEAP_HASH_MAGAZINE_BATCH];
+    uint64_t flush_count = 0;
+
+    boolean_t interrupts_enabled = memory_heap_hash_disable_interrupts();
+
+    memory_heap_hash_cpu_cache_t* cache = memory_heap_hash_get_cpu_cache(metadata->cpu_caches);
+
+    if(!cache) {
+        memory_heap_hash_restore_interrupts(interrupts_enabled);
+
+        return -1;
+    }
+
+    memory_heap_hash_magazine_t* magazine = &cache->magazines[magazine_class];
+
+    if(magazine->count == MEMORY_HEAP_HASH_MAGAZINE_SIZE) {
+        // oldest blocks go back to pools, recently freed ones are still hot at cache
+        flush_count = MEMORY_HEAP_HASH_MAGAZINE_BATCH;
+
+        memory_memcopy(magazine->rounds, flush_rounds, sizeof(flush_rounds));
+        memory_memcopy(magazine->rounds + flush_count, magazine->rounds, (magazine->count - flush_count) * sizeof(memory_heap_hash_magazine_round_t));
+
+        magazine->count -= flush_count;
+    }
+
+    block->is_cached = true;
+    magazine->rounds[magazine->count].address = ptr;
+    magazine->rounds[magazine->count].block = block;
+    magazine->count++;
+    cache->free_count++;
+
+    memory_heap_hash_restore_interrupts(interrupts_enabled);
+
+    if(flush_count) {
+        memory_heap_hash_magazine_flush(heap, flush_rounds, flush_count);
+    }
+
+    return 0;
+}
+
+int8_t memory_heap_hash_enable_magazines(memory_heap_t* heap) {
+    if(!heap || heap->malloc != memory_heap_hash_malloc_ext) {
+        return -1;
+    }
+
+    memory_heap_hash_metadata_t* metadata = heap->metadata;
+
+    if(metadata->cpu_caches) {
+        return 0;
+    }
+
+    lock_acquire(heap->lock);
+
+    memory_heap_hash_cpu_caches_t* caches = memory_heap_hash_malloc_ext(heap, sizeof(memory_heap_hash_cpu_caches_t), 16);
+
+    if(caches) {
+        caches->hidden_malloc_count = 1;
+        metadata->cpu_caches = caches;
+    }
+
+    lock_release(heap->lock);
+
+    if(!caches) {
+        PRINTLOG(HEAP_HASH, LOG_ERROR, "cannot create per cpu magazines");
+
+        return -1;
+    }
+
+    heap->malloc_cached = memory_heap_hash_malloc_cached;
+    heap->free_cached = memory_heap_hash_free_cached;
+
+    return 0;
+}
+
+memory_heap_t* memory_create_heap_hash_ext(uint64_t start, uint64_t end, boolean_t zeroed) {
     size_t heap_start = 0, heap_end = 0;
 
     if(start == 0 || end == 0) {
@@ -636,7 +991,9 @@ memory_heap_t* memory_create_heap_hash(uint64_t start, uint64_t end) {
 
     uint64_t heap_size = heap_end - heap_start;
 
-    memory_memclean((void*)heap_start, heap_size);
+    if(!zeroed) {
+        memory_memclean((void*)heap_start, heap_size);
+    }
 
     memory_heap_t* heap = (memory_heap_t*)heap_start;
     heap->header = 0xaa55aa55;
@@ -0,0 +1,217 @@
+/**
+ * @file memory_heap_owner.xx.c
+ * @brief address range to heap ownership map implementation
+ *
+ * This work is licensed under TURNSTONE OS Public License.
+ * Please read and understand latest version of Licence.
+ */
+
+#include <memory.h>
+#include <logging.h>
+#include <utils.h>
+
+MODULE("turnstone.lib.memory");
+
+/*! bits of index at each level */
+#define MEMORY_HEAP_OWNER_LEVEL_BITS   12
+/*! entry count of a table */
+#define MEMORY_HEAP_OWNER_TABLE_SIZE   (1ULL << MEMORY_HEAP_OWNER_LEVEL_BITS)
+/*! level count, 3 levels with 4 KiB pages cover 48 bit address space */
+#define MEMORY_HEAP_OWNER_LEVEL_COUNT  3
+/*! page shift of map */
+#define MEMORY_HEAP_OWNER_PAGE_SHIFT   12
+/*! virtual address bits used for lookups */
+#define MEMORY_HEAP_OWNER_VA_MASK      ((1ULL << 48) - 1)
+/*! entry bit marking a heap instead of a next level table */
+#define MEMORY_HEAP_OWNER_ENTRY_HEAP   1ULL
+
+/*! root table, mid and leaf tables are allocated while ranges are registered */
+static uint64_t memory_heap_owner_root[MEMORY_HEAP_OWNER_TABLE_SIZE];
+/*! writers' spin lock, readers are lock free */
+static volatile uint64_t memory_heap_owner_lock = 0;
+/*! heap of mid and leaf tables */
+static memory_heap_t* memory_heap_owner_table_heap = NULL;
+/*! allocated table count, tables are never freed */
+static uint64_t memory_heap_owner_table_count = 0;
+
+/**
+ * @brief returns address span covered by one entry at level
+ * @param[in] level 0 is root
+ * @return span shift
+ */
+static uint64_t memory_heap_owner_span_shift(uint64_t level) {
+    return MEMORY_HEAP_OWNER_PAGE_SHIFT + MEMORY_HEAP_OWNER_LEVEL_BITS * (MEMORY_HEAP_OWNER_LEVEL_COUNT - 1 - level);
+}
+
+/**
+ * @brief returns index of address at level's table
+ * @param[in] va masked virtual address
+ * @param[in] level 0 is root
+ * @return index
+ */
+static uint64_t memory_heap_owner_index(uint64_t va, uint64_t level) {
+    return (va >> memory_heap_owner_span_shift(level)) & (MEMORY_HEAP_OWNER_TABLE_SIZE - 1);
+}
+
+memory_heap_t* memory_heap_find_owner(const void* address) {
+    uint64_t va = (uint64_t)address & MEMORY_HEAP_OWNER_VA_MASK;
+    uint64_t* table = memory_heap_owner_root;
+
+    for(uint64_t level = 0; level < MEMORY_HEAP_OWNER_LEVEL_COUNT; level++) {
+        uint64_t entry = __atomic_load_n(&table[memory_heap_owner_index(va, level)], __ATOMIC_ACQUIRE);
+
+        if(!entry) {
+            return NULL;
+        }
+
+        if(entry & MEMORY_HEAP_OWNER_ENTRY_HEAP) {
+            return (memory_heap_t*)(entry & ~MEMORY_HEAP_OWNER_ENTRY_HEAP);
+        }
+
+        table = (uint64_t*)entry;
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief returns next level table of entry, splits heap entries and allocates empty ones, writer lock should be held
+ * @param[in] entry entry at parent table
+ * @return next level table or NULL
+ */
+static uint64_t* memory_heap_owner_get_table(uint64_t* entry) {
+    uint64_t value = *entry;
+
+    if(value && !(value & MEMORY_HEAP_OWNER_ENTRY_HEAP)) {
+        return (uint64_t*)value;
+    }
+
+    uint64_t* table = memory_malloc_ext(memory_heap_owner_table_heap, sizeof(uint64_t) * MEMORY_HEAP_OWNER_TABLE_SIZE, 0x1000);
+
+    if(!table) {
+        return NULL;
+    }
+
+    // new table inherits old entry, so readers see same owner before and after table is published
+    for(uint64_t i = 0; i < MEMORY_HEAP_OWNER_TABLE_SIZE; i++) {
+        table[i] = value;
+    }
+
+    memory_heap_owner_table_count++;
+
+    __atomic_store_n(entry, (uint64_t)table, __ATOMIC_RELEASE);
+
+    return table;
+}
+
+/**
+ * @brief sets owner entries of range at table, writer lock should be held
+ * @param[in] table table of level
+ * @param[in] level 0 is root
+ * @param[in] start masked page aligned start
+ * @param[in] end masked page aligned end
+ * @param[in] value entry value, 0 clears owner
+ * @return 0 on success
+ */
+static int8_t memory_heap_owner_set(uint64_t* table, uint64_t level, uint64_t start, uint64_t end, uint64_t value) {
+    uint64_t span = 1ULL << memory_heap_owner_span_shift(level);
+
+    while(start < end) {
+        uint64_t span_start = start & ~(span - 1);
+        uint64_t span_end = span_start + span;
+        uint64_t part_end = MIN(end, span_end);
+        uint64_t* entry = &table[memory_heap_owner_index(start, level)];
+
+        if(*entry == value) {
+            start = part_end;
+
+            continue;
+        }
+
+        if((start == span_start && part_end == span_end) || level == MEMORY_HEAP_OWNER_LEVEL_COUNT - 1) {
+            __atomic_store_n(entry, value, __ATOMIC_RELEASE);
+        } else {
+            uint64_t* next = memory_heap_owner_get_table(entry);
+
+            if(!next) {
+                return -1;
+            }
+
+            if(memory_heap_owner_set(next, level + 1, start, part_end, value) != 0) {
+                return -1;
+            }
+        }
+
+        start = part_end;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief updates owner of range
+ * @param[in] start range start
+ * @param[in] end range end
+ * @param[in] value entry value
+ * @return 0 on success
+ */
+static int8_t memory_heap_owner_update(uint64_t start, uint64_t end, uint64_t value) {
+    if(start >= end) {
+        return -1;
+    }
+
+    uint64_t page_mask = (1ULL << MEMORY_HEAP_OWNER_PAGE_SHIFT) - 1;
+
+    start = (start & MEMORY_HEAP_OWNER_VA_MASK) & ~page_mask;
+    end = (((end - 1) & MEMORY_HEAP_OWNER_VA_MASK) | page_mask) + 1;
+
+    while(bit_locked_set(&memory_heap_owner_lock, 0)) {
+        asm volatile ("pause" ::: "memory");
+    }
+
+    if(!memory_heap_owner_table_heap) {
+        memory_heap_owner_table_heap = memory_get_default_heap();
+    }
+
+    int8_t res = memory_heap_owner_set(memory_heap_owner_root, 0, start, end, value);
+
+    asm volatile ("" ::: "memory");
+    memory_heap_owner_lock = 0;
+
+    return res;
+}
+
+int8_t memory_heap_register_range(memory_heap_t* heap, uint64_t start, uint64_t end) {
+    if(!heap) {
+        return -1;
+    }
+
+    if(memory_heap_owner_update(start, end, (uint64_t)heap | MEMORY_HEAP_OWNER_ENTRY_HEAP) != 0) {
+        PRINTLOG(MEMORY, LOG_ERROR, "cannot register heap 0x%p range 0x%llx-0x%llx", heap, start, end);
+
+        return -1;
+    }
+
+    PRINTLOG(MEMORY, LOG_DEBUG, "heap 0x%p owns range 0x%llx-0x%llx", heap, start, end);
+
+    return 0;
+}
+
+int8_t memory_heap_unregister_range(memory_heap_t* heap, uint64_t start, uint64_t end) {
+    if(!heap) {
+        return -1;
+    }
+
+    // clearing only splits partially covered entries, tables allocated for registration are already there
+    return memory_heap_owner_update(start, end, 0);
+}
+
+void memory_heap_owner_adjust_heap_stat(memory_heap_t* heap, memory_heap_stat_t* stat) {
+    if(!heap || !stat || heap != memory_heap_owner_table_heap) {
+        return;
+    }
+
+    uint64_t count = __atomic_load_n(&memory_heap_owner_table_count, __ATOMIC_ACQUIRE);
+
+    stat->malloc_count -= count;
+}
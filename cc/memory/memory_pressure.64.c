@@ -0,0 +1,74 @@
+/**
+ * @file memory_pressure.64.c
+ * @brief memory pressure task, it calls shrinkers when watermarks are crossed
+ *
+ * This work is licensed under TURNSTONE OS Public License.
+ * Please read and understand latest version of Licence.
+ */
+
+#include <memory.h>
+#include <cpu/task.h>
+#include <logging.h>
+
+MODULE("turnstone.kernel.memory");
+
+/*! memory pressure task id */
+static uint64_t memory_pressure_task_id = 0;
+
+/**
+ * @brief wakes memory pressure task, allocations before tasking of cpu do not wake it
+ */
+static void memory_pressure_wake(void) {
+    if(memory_pressure_task_id && task_get_current_task()) {
+        task_set_message_received(memory_pressure_task_id);
+    }
+}
+
+/**
+ * @brief memory pressure task main loop
+ * @return never returns
+ */
+static int32_t memory_pressure_main(void) {
+    while(true) {
+        uint64_t target = memory_pressure_take();
+
+        if(!target) {
+            // pressure may be notified between take and waiting, so it is checked again before yield
+            task_set_message_waiting();
+
+            target = memory_pressure_take();
+
+            if(!target) {
+                task_yield();
+
+                continue;
+            }
+
+            task_clear_message_waiting(memory_pressure_task_id);
+        }
+
+        uint64_t freed = memory_shrink(target);
+
+        PRINTLOG(MEMORY, LOG_DEBUG, "memory pressure target 0x%llx freed 0x%llx", target, freed);
+    }
+
+    return 0;
+}
+
+int8_t memory_pressure_init(void) {
+    memory_pressure_task_id = task_create_task(NULL, 1 << 20, 64 << 10, memory_pressure_main, 0, NULL, "memory pressure");
+
+    if(memory_pressure_task_id == -1ULL) {
+        memory_pressure_task_id = 0;
+
+        PRINTLOG(MEMORY, LOG_ERROR, "cannot create memory pressure task");
+
+        return -1;
+    }
+
+    memory_pressure_set_waker(memory_pressure_wake);
+
+    PRINTLOG(MEMORY, LOG_INFO, "memory pressure task 0x%llx started", memory_pressure_task_id);
+
+    return 0;
+}
@@ -0,0 +1,441 @@
+/**
+ * @file memory_profiler.64.c
+ * @brief sampling heap profiler, aggregates sampled allocations by call site
+ *
+ * memory_malloc_ext takes a sample after every sample interval bytes, so a sample stands for interval bytes
+ * and large allocations are always seen. sample keeps a short backtrace of its caller and live samples are
+ * kept until their addresses are freed, so both allocation rate and live bytes of a site are estimated.
+ *
+ * This work is licensed under TURNSTONE OS Public License.
+ * Please read and understand latest version of Licence.
+ */
+
+#include <memory.h>
+#include <backtrace.h>
+#include <buffer.h>
+#include <spool.h>
+#include <cpu.h>
+#include <time/timer.h>
+#include <logging.h>
+#include <utils.h>
+
+MODULE("turnstone.kernel.memory");
+
+/*! default byte interval between samples */
+#define MEMORY_PROFILER_DEFAULT_SAMPLE_INTERVAL (512ULL << 10)
+/*! recorded frame count of a sample */
+#define MEMORY_PROFILER_STACK_DEPTH             4
+/*! frames of profiler and memory_malloc_ext skipped at backtrace */
+#define MEMORY_PROFILER_SKIP_FRAMES             2
+/*! frame pointer chain is followed only while frames are closer than this */
+#define MEMORY_PROFILER_MAX_FRAME_SIZE          (64ULL << 10)
+/*! call site slot count, power of 2 */
+#define MEMORY_PROFILER_SITE_COUNT              1024
+/*! live sample slot count, power of 2 */
+#define MEMORY_PROFILER_SAMPLE_COUNT            8192
+/*! counter count of free filter, power of 2 */
+#define MEMORY_PROFILER_FILTER_COUNT            32768
+
+/**
+ * @struct memory_profiler_site_t
+ * @brief allocation statistics of a call site
+ */
+typedef struct memory_profiler_site_t {
+    uint64_t rips[MEMORY_PROFILER_STACK_DEPTH]; ///< backtrace of site, first one is caller of malloc
+    uint64_t sample_count; ///< sampled allocation count
+    uint64_t allocated_bytes; ///< estimated allocated bytes
+    uint64_t live_bytes; ///< estimated bytes not freed yet
+} memory_profiler_site_t; ///< short hand for struct
+
+/**
+ * @struct memory_profiler_sample_t
+ * @brief sampled allocation which is not freed yet
+ */
+typedef struct memory_profiler_sample_t {
+    uint64_t address; ///< allocated address, 0 for empty slot
+    uint64_t weight; ///< estimated bytes of sample
+    uint64_t site; ///< site index
+} memory_profiler_sample_t; ///< short hand for struct
+
+/*! call sites, open addressing by backtrace hash */
+static memory_profiler_site_t* memory_profiler_sites = NULL;
+/*! live samples, open addressing by address */
+static memory_profiler_sample_t* memory_profiler_samples = NULL;
+/*! live sample counts by address hash, frees of addresses without sample skip lock */
+static uint16_t* memory_profiler_filter = NULL;
+/*! live sample count */
+static uint64_t memory_profiler_live_count = 0;
+/*! samples dropped because tables are full */
+static uint64_t memory_profiler_dropped_count = 0;
+/*! tick count at start */
+static uint64_t memory_profiler_start_tick = 0;
+/*! tick count at stop, 0 while running */
+static uint64_t memory_profiler_stop_tick = 0;
+/*! sample interval of current run */
+static uint64_t memory_profiler_interval = 0;
+/*! table lock, it is taken with interrupts disabled because allocations may come from interrupts */
+static volatile uint64_t memory_profiler_lock = 0;
+
+/**
+ * @brief acquires table lock
+ * @return interrupt state before lock
+ */
+static boolean_t memory_profiler_lock_acquire(void) {
+    boolean_t interrupts_enabled = cpu_cli();
+
+    while(bit_locked_set(&memory_profiler_lock, 0)) {
+        asm volatile ("pause" ::: "memory");
+    }
+
+    return interrupts_enabled;
+}
+
+/**
+ * @brief releases table lock
+ * @param[in] interrupts_enabled interrupt state returned by acquire
+ */
+static void memory_profiler_lock_release(boolean_t interrupts_enabled) {
+    asm volatile ("" ::: "memory");
+    memory_profiler_lock = 0;
+
+    if(interrupts_enabled) {
+        cpu_sti();
+    }
+}
+
+/**
+ * @brief mixes a 64 bit value for table indexes
+ * @param[in] value value
+ * @return hash
+ */
+static inline uint64_t memory_profiler_hash(uint64_t value) {
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdULL;
+    value ^= value >> 33;
+
+    return value;
+}
+
+/**
+ * @brief gets filter counter index of address
+ * @param[in] address address
+ * @return counter index
+ */
+static inline uint64_t memory_profiler_filter_index(uint64_t address) {
+    return (memory_profiler_hash(address) >> 32) & (MEMORY_PROFILER_FILTER_COUNT - 1);
+}
+
+/**
+ * @brief collects return addresses of malloc caller by following frame pointers
+ * @param[out] rips return addresses, missing frames are 0
+ */
+static void memory_profiler_get_backtrace(uint64_t* rips) {
+    stackframe_t* frame = __builtin_frame_address(0);
+
+    for(uint64_t i = 0; frame && i < MEMORY_PROFILER_SKIP_FRAMES + MEMORY_PROFILER_STACK_DEPTH; i++) {
+        if(i >= MEMORY_PROFILER_SKIP_FRAMES) {
+            rips[i - MEMORY_PROFILER_SKIP_FRAMES] = frame->rip;
+        }
+
+        stackframe_t* previous = frame->previous;
+
+        // stack grows down, anything else is end of chain or a frame without frame pointer
+        if(previous <= frame || (uint64_t)previous - (uint64_t)frame > MEMORY_PROFILER_MAX_FRAME_SIZE) {
+            break;
+        }
+
+        frame = previous;
+    }
+}
+
+/**
+ * @brief finds or inserts site of backtrace, lock should be held
+ * @param[in] rips backtrace
+ * @return site index or -1 if table is full
+ */
+static int64_t memory_profiler_get_site(const uint64_t* rips) {
+    uint64_t hash = 0;
+
+    for(uint64_t i = 0; i < MEMORY_PROFILER_STACK_DEPTH; i++) {
+        hash = memory_profiler_hash(hash ^ rips[i]);
+    }
+
+    for(uint64_t probe = 0; probe < MEMORY_PROFILER_SITE_COUNT; probe++) {
+        uint64_t idx = (hash + probe) & (MEMORY_PROFILER_SITE_COUNT - 1);
+        memory_profiler_site_t* site = &memory_profiler_sites[idx];
+
+        if(!site->sample_count) {
+            memory_memcopy(rips, site->rips, sizeof(site->rips));
+
+            return idx;
+        }
+
+        if(memory_memcompare(rips, site->rips, sizeof(site->rips)) == 0) {
+            return idx;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * @brief records sampled allocation, called by memory_malloc_ext
+ * @param[in] address allocated address
+ * @param[in] size allocation size
+ * @param[in] weight estimated bytes of sample
+ */
+static void memory_profiler_record(const void* address, size_t size, uint64_t weight) {
+    UNUSED(size);
+
+    uint64_t rips[MEMORY_PROFILER_STACK_DEPTH] = {0};
+
+    memory_profiler_get_backtrace(rips);
+
+    boolean_t interrupts_enabled = memory_profiler_lock_acquire();
+
+    int64_t site_idx = memory_profiler_get_site(rips);
+
+    // sample table is kept under 3/4 load so probes stay short
+    if(site_idx == -1 || memory_profiler_live_count >= MEMORY_PROFILER_SAMPLE_COUNT / 4 * 3) {
+        memory_profiler_dropped_count++;
+        memory_profiler_lock_release(interrupts_enabled);
+
+        return;
+    }
+
+    memory_profiler_site_t* site = &memory_profiler_sites[site_idx];
+
+    site->sample_count++;
+    site->allocated_bytes += weight;
+    site->live_bytes += weight;
+
+    uint64_t idx = memory_profiler_hash((uint64_t)address) & (MEMORY_PROFILER_SAMPLE_COUNT - 1);
+
+    while(memory_profiler_samples[idx].address) {
+        idx = (idx + 1) & (MEMORY_PROFILER_SAMPLE_COUNT - 1);
+    }
+
+    memory_profiler_samples[idx].address = (uint64_t)address;
+    memory_profiler_samples[idx].weight = weight;
+    memory_profiler_samples[idx].site = site_idx;
+    memory_profiler_live_count++;
+
+    __atomic_add_fetch(&memory_profiler_filter[memory_profiler_filter_index((uint64_t)address)], 1, __ATOMIC_RELEASE);
+
+    memory_profiler_lock_release(interrupts_enabled);
+}
+
+/**
+ * @brief drops sample of freed address, called by memory_free_ext
+ * @param[in] address freed address
+ */
+static void memory_profiler_forget(const void* address) {
+    uint64_t filter_idx = memory_profiler_filter_index((uint64_t)address);
+
+    // most frees are not sampled and they should not wait the lock
+    if(!__atomic_load_n(&memory_profiler_filter[filter_idx], __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    boolean_t interrupts_enabled = memory_profiler_lock_acquire();
+
+    uint64_t idx = memory_profiler_hash((uint64_t)address) & (MEMORY_PROFILER_SAMPLE_COUNT - 1);
+
+    while(memory_profiler_samples[idx].address && memory_profiler_samples[idx].address != (uint64_t)address) {
+        idx = (idx + 1) & (MEMORY_PROFILER_SAMPLE_COUNT - 1);
+    }
+
+    if(!memory_profiler_samples[idx].address) {
+        memory_profiler_lock_release(interrupts_enabled);
+
+        return;
+    }
+
+    memory_profiler_sample_t* sample = &memory_profiler_samples[idx];
+
+    memory_profiler_sites[sample->site].live_bytes -= sample->weight;
+    memory_profiler_live_count--;
+
+    __atomic_sub_fetch(&memory_profiler_filter[filter_idx], 1, __ATOMIC_RELEASE);
+
+    // backward shift deletion keeps probe chains without tombstones
+    uint64_t hole = idx;
+    uint64_t next = (idx + 1) & (MEMORY_PROFILER_SAMPLE_COUNT - 1);
+
+    while(memory_profiler_samples[next].address) {
+        uint64_t home = memory_profiler_hash(memory_profiler_samples[next].address) & (MEMORY_PROFILER_SAMPLE_COUNT - 1);
+
+        // entry can fill hole if its home is not between hole and its slot
+        if(((next - home) & (MEMORY_PROFILER_SAMPLE_COUNT - 1)) >= ((next - hole) & (MEMORY_PROFILER_SAMPLE_COUNT - 1))) {
+            memory_profiler_samples[hole] = memory_profiler_samples[next];
+            hole = next;
+        }
+
+        next = (next + 1) & (MEMORY_PROFILER_SAMPLE_COUNT - 1);
+    }
+
+    memory_memclean(&memory_profiler_samples[hole], sizeof(memory_profiler_sample_t));
+
+    memory_profiler_lock_release(interrupts_enabled);
+}
+
+int8_t memory_profiler_start(uint64_t sample_interval) {
+    if(!sample_interval) {
+        sample_interval = MEMORY_PROFILER_DEFAULT_SAMPLE_INTERVAL;
+    }
+
+    memory_set_profiler(0, NULL, NULL);
+
+    // tables are allocated while hooks are disabled, they are kept for next runs
+    if(!memory_profiler_sites) {
+        memory_profiler_sites = memory_malloc(sizeof(memory_profiler_site_t) * MEMORY_PROFILER_SITE_COUNT);
+
+        if(!memory_profiler_sites) {
+            PRINTLOG(MEMORY, LOG_ERROR, "cannot allocate profiler sites");
+
+            return -1;
+        }
+    }
+
+    if(!memory_profiler_samples) {
+        memory_profiler_samples = memory_malloc(sizeof(memory_profiler_sample_t) * MEMORY_PROFILER_SAMPLE_COUNT);
+
+        if(!memory_profiler_samples) {
+            PRINTLOG(MEMORY, LOG_ERROR, "cannot allocate profiler samples");
+
+            return -1;
+        }
+    }
+
+    if(!memory_profiler_filter) {
+        memory_profiler_filter = memory_malloc(sizeof(uint16_t) * MEMORY_PROFILER_FILTER_COUNT);
+
+        if(!memory_profiler_filter) {
+            PRINTLOG(MEMORY, LOG_ERROR, "cannot allocate profiler filter");
+
+            return -1;
+        }
+    }
+
+    boolean_t interrupts_enabled = memory_profiler_lock_acquire();
+
+    memory_memclean(memory_profiler_sites, sizeof(memory_profiler_site_t) * MEMORY_PROFILER_SITE_COUNT);
+    memory_memclean(memory_profiler_samples, sizeof(memory_profiler_sample_t) * MEMORY_PROFILER_SAMPLE_COUNT);
+    memory_memclean(memory_profiler_filter, sizeof(uint16_t) * MEMORY_PROFILER_FILTER_COUNT);
+    memory_profiler_live_count = 0;
+    memory_profiler_dropped_count = 0;
+    memory_profiler_start_tick = time_timer_get_tick_count();
+    memory_profiler_stop_tick = 0;
+    memory_profiler_interval = sample_interval;
+
+    memory_profiler_lock_release(interrupts_enabled);
+
+    memory_set_profiler(sample_interval, memory_profiler_record, memory_profiler_forget);
+
+    PRINTLOG(MEMORY, LOG_INFO, "heap profiler started with sample interval 0x%llx", sample_interval);
+
+    return 0;
+}
+
+int8_t memory_profiler_stop(void) {
+    if(!memory_profiler_interval || memory_profiler_stop_tick) {
+        return -1;
+    }
+
+    // frees are still tracked after stop, so live bytes of dump stay correct
+    memory_set_profiler(0, NULL, memory_profiler_forget);
+
+    memory_profiler_stop_tick = time_timer_get_tick_count();
+
+    PRINTLOG(MEMORY, LOG_INFO, "heap profiler stopped");
+
+    return 0;
+}
+
+int8_t memory_profiler_dump(void) {
+    if(!memory_profiler_sites || !memory_profiler_interval) {
+        PRINTLOG(MEMORY, LOG_ERROR, "heap profiler is not started");
+
+        return -1;
+    }
+
+    // sites are copied under lock, report is built without it because it allocates
+    memory_profiler_site_t* sites = memory_malloc(sizeof(memory_profiler_site_t) * MEMORY_PROFILER_SITE_COUNT);
+
+    if(!sites) {
+        return -1;
+    }
+
+    boolean_t interrupts_enabled = memory_profiler_lock_acquire();
+
+    uint64_t site_count = 0;
+
+    for(uint64_t i = 0; i < MEMORY_PROFILER_SITE_COUNT; i++) {
+        if(memory_profiler_sites[i].sample_count) {
+            sites[site_count++] = memory_profiler_sites[i];
+        }
+    }
+
+    uint64_t dropped_count = memory_profiler_dropped_count;
+    uint64_t end_tick = memory_profiler_stop_tick ? memory_profiler_stop_tick : time_timer_get_tick_count();
+    uint64_t elapsed_ms = end_tick - memory_profiler_start_tick;
+
+    memory_profiler_lock_release(interrupts_enabled);
+
+    // sites with most live bytes come first
+    for(uint64_t i = 1; i < site_count; i++) {
+        memory_profiler_site_t site = sites[i];
+        uint64_t j = i;
+
+        while(j > 0 && sites[j - 1].live_bytes < site.live_bytes) {
+            sites[j] = sites[j - 1];
+            j--;
+        }
+
+        sites[j] = site;
+    }
+
+    if(!elapsed_ms) {
+        elapsed_ms = 1;
+    }
+
+    buffer_t* report = buffer_new();
+
+    if(!report) {
+        memory_free(sites);
+
+        return -1;
+    }
+
+    buffer_printf(report, "heap profile: interval 0x%llx elapsed %lli ms sites %lli dropped %lli\n",
+                  memory_profiler_interval, elapsed_ms, site_count, dropped_count);
+
+    for(uint64_t i = 0; i < site_count; i++) {
+        memory_profiler_site_t* site = &sites[i];
+
+        buffer_printf(report, "live 0x%llx allocated 0x%llx samples %lli rate 0x%llx B/s\n",
+                      site->live_bytes, site->allocated_bytes, site->sample_count,
+                      site->allocated_bytes * 1000 / elapsed_ms);
+
+        for(uint64_t j = 0; j < MEMORY_PROFILER_STACK_DEPTH && site->rips[j]; j++) {
+            const char_t* symbol_name = backtrace_get_symbol_name_by_rip(site->rips[j]);
+            const char_t* module_name = backtrace_get_module_name_by_rip(site->rips[j]);
+
+            buffer_printf(report, "\t0x%llx %s [%s]\n", site->rips[j],
+                          symbol_name ? symbol_name : "?", module_name ? module_name : "?");
+        }
+    }
+
+    memory_free(sites);
+
+    if(spool_add("heap profile", 1, report) != 0) {
+        PRINTLOG(MEMORY, LOG_ERROR, "cannot add heap profile to spool");
+        buffer_destroy(report);
+
+        return -1;
+    }
+
+    PRINTLOG(MEMORY, LOG_INFO, "heap profile with 0x%llx sites is added to spool", site_count);
+
+    return 0;
+}
@@ -0,0 +1,181 @@
+/**
+ * @file memory_shrinker.xx.c
+ * @brief shrinker registry and memory pressure notifications
+ *
+ * This work is licensed under TURNSTONE OS Public License.
+ * Please read and understand latest version of Licence.
+ */
+
+#include <memory.h>
+#include <logging.h>
+#include <utils.h>
+
+MODULE("turnstone.lib.memory");
+
+/*! maximum shrinker count, registry is static so it works while memory is low */
+#define MEMORY_SHRINKER_MAX_COUNT 64
+
+/**
+ * @struct memory_shrinker_t
+ * @brief registered shrinker
+ */
+typedef struct memory_shrinker_t {
+    const char_t*      name; ///< shrinker name for logs
+    memory_shrinker_f  shrinker; ///< callback
+    void*              context; ///< callback context
+} memory_shrinker_t; ///< short hand for struct
+
+/*! registered shrinkers, empty slots have NULL callback */
+static memory_shrinker_t memory_shrinkers[MEMORY_SHRINKER_MAX_COUNT];
+/*! registry spin lock, it is not held while callbacks run */
+static volatile uint64_t memory_shrinker_lock = 0;
+/*! slot of running callback, unregister waits it */
+static volatile int64_t memory_shrinker_running_slot = -1;
+/*! only one shrink runs at a time */
+static volatile uint64_t memory_shrinker_in_progress = 0;
+/*! pending pressure target in bytes */
+static uint64_t memory_pressure_pending = 0;
+/*! callback waking pressure handler */
+static memory_pressure_waker_f memory_pressure_waker = NULL;
+
+/**
+ * @brief acquires registry lock
+ */
+static void memory_shrinker_registry_lock(void) {
+    while(bit_locked_set(&memory_shrinker_lock, 0)) {
+        asm volatile ("pause" ::: "memory");
+    }
+}
+
+/**
+ * @brief releases registry lock
+ */
+static void memory_shrinker_registry_unlock(void) {
+    asm volatile ("" ::: "memory");
+    memory_shrinker_lock = 0;
+}
+
+int8_t memory_shrinker_register(const char_t* name, memory_shrinker_f shrinker, void* context) {
+    if(!shrinker) {
+        return -1;
+    }
+
+    memory_shrinker_registry_lock();
+
+    for(uint64_t i = 0; i < MEMORY_SHRINKER_MAX_COUNT; i++) {
+        if(!memory_shrinkers[i].shrinker) {
+            memory_shrinkers[i].name = name;
+            memory_shrinkers[i].context = context;
+            memory_shrinkers[i].shrinker = shrinker;
+
+            memory_shrinker_registry_unlock();
+
+            return 0;
+        }
+    }
+
+    memory_shrinker_registry_unlock();
+
+    PRINTLOG(MEMORY, LOG_WARNING, "shrinker registry is full, %s is not registered", name);
+
+    return -1;
+}
+
+int8_t memory_shrinker_unregister(memory_shrinker_f shrinker, void* context) {
+    memory_shrinker_registry_lock();
+
+    for(int64_t i = 0; i < MEMORY_SHRINKER_MAX_COUNT; i++) {
+        if(memory_shrinkers[i].shrinker == shrinker && memory_shrinkers[i].context == context) {
+            memory_shrinkers[i].shrinker = NULL;
+            memory_shrinkers[i].context = NULL;
+            memory_shrinkers[i].name = NULL;
+
+            // context may be destroyed after return, so running callback should finish
+            while(memory_shrinker_running_slot == i) {
+                memory_shrinker_registry_unlock();
+                asm volatile ("pause" ::: "memory");
+                memory_shrinker_registry_lock();
+            }
+
+            memory_shrinker_registry_unlock();
+
+            return 0;
+        }
+    }
+
+    memory_shrinker_registry_unlock();
+
+    return -1;
+}
+
+uint64_t memory_shrink(uint64_t target) {
+    if(!target || bit_locked_set(&memory_shrinker_in_progress, 0)) {
+        return 0;
+    }
+
+    uint64_t freed = 0;
+
+    for(int64_t i = 0; i < MEMORY_SHRINKER_MAX_COUNT && freed < target; i++) {
+        memory_shrinker_registry_lock();
+
+        memory_shrinker_t shrinker = memory_shrinkers[i];
+
+        if(shrinker.shrinker) {
+            memory_shrinker_running_slot = i;
+        }
+
+        memory_shrinker_registry_unlock();
+
+        if(!shrinker.shrinker) {
+            continue;
+        }
+
+        uint64_t res = shrinker.shrinker(shrinker.context, target - freed);
+
+        memory_shrinker_registry_lock();
+        memory_shrinker_running_slot = -1;
+        memory_shrinker_registry_unlock();
+
+        PRINTLOG(MEMORY, LOG_TRACE, "shrinker %s freed 0x%llx bytes", shrinker.name, res);
+
+        freed += res;
+    }
+
+    asm volatile ("" ::: "memory");
+    memory_shrinker_in_progress = 0;
+
+    return freed;
+}
+
+void memory_pressure_notify(uint64_t target) {
+    if(!target) {
+        return;
+    }
+
+    uint64_t pending = __atomic_load_n(&memory_pressure_pending, __ATOMIC_RELAXED);
+
+    while(pending < target) {
+        if(__atomic_compare_exchange_n(&memory_pressure_pending, &pending, target, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+
+    // handler is already woken if there was a pending target, allocations under pressure only raise target
+    if(pending) {
+        return;
+    }
+
+    memory_pressure_waker_f waker = memory_pressure_waker;
+
+    if(waker) {
+        waker();
+    }
+}
+
+uint64_t memory_pressure_take(void) {
+    return __atomic_exchange_n(&memory_pressure_pending, 0, __ATOMIC_ACQUIRE);
+}
+
+void memory_pressure_set_waker(memory_pressure_waker_f waker) {
+    memory_pressure_waker = waker;
+}
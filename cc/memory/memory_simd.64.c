@@ -0,0 +1,235 @@
+/**
+ * @file memory_simd.64.c
+ * @brief cpu specific memset, memcopy and memcompare implementations
+ *
+ * This work is licensed under TURNSTONE OS Public License.
+ * Please read and understand latest version of Licence.
+ */
+
+#include <types.h>
+#include <memory.h>
+#include <cpu.h>
+
+MODULE("turnstone.kernel.memory");
+
+/*! 16 byte aligned vector */
+typedef uint8_t memory_simd_v16_t __attribute__((vector_size(16)));
+/*! 16 byte unaligned vector for loads and stores at any address */
+typedef uint8_t memory_simd_v16u_t __attribute__((vector_size(16), aligned(1)));
+/*! char vector for pmovmskb */
+typedef char memory_simd_v16qi_t __attribute__((vector_size(16)));
+/*! quad word vector for non temporal stores */
+typedef long long memory_simd_v2di_t __attribute__((vector_size(16)));
+
+/*! copies and sets above this size bypass caches, they are framebuffer sized and would evict working set */
+#define MEMORY_SIMD_NON_TEMPORAL_THRESHOLD (1ULL << 20)
+/*! with erms rep movsb/stosb is faster than vector loops above this size */
+#define MEMORY_SIMD_ERMS_THRESHOLD         256
+/*! vector size */
+#define MEMORY_SIMD_VECTOR_SIZE            16
+
+/*! cpu has enhanced rep movsb/stosb */
+static boolean_t memory_simd_erms = false;
+/*! cpu has fast short rep movsb */
+static boolean_t memory_simd_fsrm = false;
+
+/**
+ * @brief stores vector to destination with aligned body loop, head and tail are unaligned stores
+ * @param[in] destination destination address
+ * @param[in] source source address, NULL for set
+ * @param[in] pattern set pattern if source is NULL
+ * @param[in] size byte count, at least vector size
+ * @param[in] non_temporal body stores bypass caches
+ */
+static void memory_simd_store(uint8_t* destination, const uint8_t* source, memory_simd_v16_t pattern, size_t size, boolean_t non_temporal) {
+    memory_simd_v16_t head = pattern;
+    memory_simd_v16_t tail = pattern;
+
+    if(source) {
+        head = *(const memory_simd_v16u_t*)source;
+        tail = *(const memory_simd_v16u_t*)(source + size - MEMORY_SIMD_VECTOR_SIZE);
+    }
+
+    size_t skip = MEMORY_SIMD_VECTOR_SIZE - ((uint64_t)destination % MEMORY_SIMD_VECTOR_SIZE);
+    uint8_t* dst = destination + skip;
+    const uint8_t* src = source ? source + skip : NULL;
+    size_t rem = size - skip;
+
+    if(non_temporal) {
+        while(rem >= MEMORY_SIMD_VECTOR_SIZE) {
+            memory_simd_v16_t data = src ? *(const memory_simd_v16u_t*)src : pattern;
+
+            __builtin_ia32_movntdq((memory_simd_v2di_t*)dst, (memory_simd_v2di_t)data);
+
+            dst += MEMORY_SIMD_VECTOR_SIZE;
+            src = src ? src + MEMORY_SIMD_VECTOR_SIZE : NULL;
+            rem -= MEMORY_SIMD_VECTOR_SIZE;
+        }
+
+        asm volatile ("sfence" ::: "memory");
+    } else if(src) {
+        while(rem >= 4 * MEMORY_SIMD_VECTOR_SIZE) {
+            memory_simd_v16_t d0 = *(const memory_simd_v16u_t*)(src + 0 * MEMORY_SIMD_VECTOR_SIZE);
+            memory_simd_v16_t d1 = *(const memory_simd_v16u_t*)(src + 1 * MEMORY_SIMD_VECTOR_SIZE);
+            memory_simd_v16_t d2 = *(const memory_simd_v16u_t*)(src + 2 * MEMORY_SIMD_VECTOR_SIZE);
+            memory_simd_v16_t d3 = *(const memory_simd_v16u_t*)(src + 3 * MEMORY_SIMD_VECTOR_SIZE);
+
+            *(memory_simd_v16_t*)(dst + 0 * MEMORY_SIMD_VECTOR_SIZE) = d0;
+            *(memory_simd_v16_t*)(dst + 1 * MEMORY_SIMD_VECTOR_SIZE) = d1;
+            *(memory_simd_v16_t*)(dst + 2 * MEMORY_SIMD_VECTOR_SIZE) = d2;
+            *(memory_simd_v16_t*)(dst + 3 * MEMORY_SIMD_VECTOR_SIZE) = d3;
+
+            dst += 4 * MEMORY_SIMD_VECTOR_SIZE;
+            src += 4 * MEMORY_SIMD_VECTOR_SIZE;
+            rem -= 4 * MEMORY_SIMD_VECTOR_SIZE;
+        }
+
+        while(rem >= MEMORY_SIMD_VECTOR_SIZE) {
+            *(memory_simd_v16_t*)dst = *(const memory_simd_v16u_t*)src;
+
+            dst += MEMORY_SIMD_VECTOR_SIZE;
+            src += MEMORY_SIMD_VECTOR_SIZE;
+            rem -= MEMORY_SIMD_VECTOR_SIZE;
+        }
+    } else {
+        while(rem >= MEMORY_SIMD_VECTOR_SIZE) {
+            *(memory_simd_v16_t*)dst = pattern;
+
+            dst += MEMORY_SIMD_VECTOR_SIZE;
+            rem -= MEMORY_SIMD_VECTOR_SIZE;
+        }
+    }
+
+    // head and tail overlap body, they cover unaligned parts
+    *(memory_simd_v16u_t*)destination = head;
+    *(memory_simd_v16u_t*)(destination + size - MEMORY_SIMD_VECTOR_SIZE) = tail;
+}
+
+/**
+ * @brief sets memory with rep stosb, sse2 or non temporal stores by size
+ * @param[in] address the address to be setted
+ * @param[in] value the value
+ * @param[in] size repeat count
+ */
+static void memory_simd_memset(void* address, uint8_t value, size_t size) {
+    uint8_t* dst = (uint8_t*)address;
+
+    if(size < MEMORY_SIMD_VECTOR_SIZE) {
+        for(size_t i = 0; i < size; i++) {
+            dst[i] = value;
+        }
+
+        return;
+    }
+
+    if(size < MEMORY_SIMD_NON_TEMPORAL_THRESHOLD && memory_simd_erms && size >= MEMORY_SIMD_ERMS_THRESHOLD) {
+        asm volatile ("rep stosb" : "+D" (dst), "+c" (size) : "a" (value) : "memory");
+
+        return;
+    }
+
+    memory_simd_v16_t pattern = (memory_simd_v16_t){} + value;
+
+    memory_simd_store(dst, NULL, pattern, size, size >= MEMORY_SIMD_NON_TEMPORAL_THRESHOLD);
+}
+
+/**
+ * @brief zeros memory with memset implementation
+ * @param[in] address the address to be zeroed
+ * @param[in] size byte count
+ */
+static void memory_simd_memclean(void* address, size_t size) {
+    memory_simd_memset(address, 0, size);
+}
+
+/**
+ * @brief copies memory with rep movsb, sse2 or non temporal stores by size
+ * @param[in] source source address
+ * @param[in] destination destination address
+ * @param[in] size byte count
+ */
+static void memory_simd_memcopy(const void* source, void* destination, size_t size) {
+    const uint8_t* src = (const uint8_t*)source;
+    uint8_t* dst = (uint8_t*)destination;
+
+    // overlapping copies keep forward byte copy semantics of generic version
+    if(size < MEMORY_SIMD_VECTOR_SIZE || (dst > src && dst < src + size) || (src > dst && src < dst + size)) {
+        for(size_t i = 0; i < size; i++) {
+            dst[i] = src[i];
+        }
+
+        return;
+    }
+
+    if(size < MEMORY_SIMD_NON_TEMPORAL_THRESHOLD && (memory_simd_fsrm || (memory_simd_erms && size >= MEMORY_SIMD_ERMS_THRESHOLD))) {
+        asm volatile ("rep movsb" : "+D" (dst), "+S" (src), "+c" (size) : : "memory");
+
+        return;
+    }
+
+    memory_simd_store(dst, src, (memory_simd_v16_t){}, size, size >= MEMORY_SIMD_NON_TEMPORAL_THRESHOLD);
+}
+
+/**
+ * @brief compares memory 16 bytes at a time with sse2
+ * @param[in] mem1 first memory address
+ * @param[in] mem2 second memory address
+ * @param[in] size byte count
+ * @return <0 if mem1<mem2, 0 if mem1=mem2, >0 if mem1>mem2
+ */
+static int8_t memory_simd_memcompare(const void* mem1, const void* mem2, size_t size) {
+    const uint8_t* m1 = (const uint8_t*)mem1;
+    const uint8_t* m2 = (const uint8_t*)mem2;
+    size_t i = 0;
+
+    for(; i + MEMORY_SIMD_VECTOR_SIZE <= size; i += MEMORY_SIMD_VECTOR_SIZE) {
+        memory_simd_v16_t d1 = *(const memory_simd_v16u_t*)(m1 + i);
+        memory_simd_v16_t d2 = *(const memory_simd_v16u_t*)(m2 + i);
+
+        uint32_t mask = __builtin_ia32_pmovmskb128((memory_simd_v16qi_t)(d1 == d2));
+
+        if(mask != 0xFFFF) {
+            size_t idx = i + __builtin_ctz(~mask);
+
+            return m1[idx] < m2[idx] ? -1 : 1;
+        }
+    }
+
+    for(; i < size; i++) {
+        if(m1[i] < m2[i]) {
+            return -1;
+        } else if(m1[i] > m2[i]) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int8_t memory_simd_init(void) {
+    cpu_cpuid_regs_t query = {0};
+    cpu_cpuid_regs_t answer = {0};
+
+    cpu_cpuid(query, &answer);
+
+    if(answer.eax >= 7) {
+        query.eax = 7;
+        query.ecx = 0;
+        cpu_cpuid(query, &answer);
+
+        memory_simd_erms = (answer.ebx >> 9) & 1;
+        memory_simd_fsrm = (answer.edx >> 4) & 1;
+    }
+
+    // sse2 is baseline at x86_64, avx is not used because task switch only saves fxsave state
+    memory_functions_t functions = {
+        .memset = memory_simd_memset,
+        .memclean = memory_simd_memclean,
+        .memcopy = memory_simd_memcopy,
+        .memcompare = memory_simd_memcompare,
+    };
+
+    memory_set_functions(&functions);
+
+    return 0;
+}
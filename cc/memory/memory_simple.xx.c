@@ -105,7 +105,7 @@ int8_t memory_simple_free(memory_heap_t* heap, void* address);
 
 void memory_simple_stat(memory_heap_t* heap, memory_heap_stat_t* stat);
 
-memory_heap_t* memory_create_heap_simple(size_t start, size_t end){
+memory_heap_t* memory_create_heap_simple_ext(size_t start, size_t end, boolean_t zeroed){
     size_t heap_start = 0, heap_end = 0;
 
     if(start == 0 || end == 0) {
@@ -120,8 +120,10 @@ memory_heap_t* memory_create_heap_simple(size_t start, size_t end){
 
     PRINTLOG(SIMPLEHEAP, LOG_DEBUG, "heap boundaries 0x%llx 0x%llx", heap_start, heap_end);
 
-    uint8_t* t_start = (uint8_t*)heap_start;
-    memory_memclean(t_start, heap_end - heap_start);
+    if(!zeroed) {
+        uint8_t* t_start = (uint8_t*)heap_start;
+        memory_memclean(t_start, heap_end - heap_start);
+    }
 
     memory_heap_t* heap = (memory_heap_t*)(heap_start);
 
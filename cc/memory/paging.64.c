@@ -118,8 +118,13 @@ memory_page_table_context_t* memory_paging_switch_table(const memory_page_table_
     __asm__ __volatile__ ("mov %%cr3, %0\n"
                           : "=r" (old_table));
 
+    // cr3 has pcid at low bits
+    old_table &= ~(FRAME_SIZE - 1);
+
     if(new_table != NULL) {
-        __asm__ __volatile__ ("mov %0, %%cr3\n" : : "r" (MEMORY_PAGING_GET_FA_FOR_RESERVED_VA(new_table->page_table)));
+        __asm__ __volatile__ ("mov %0, %%cr3\n" : : "r" (memory_paging_tlb_get_cr3(new_table)));
+
+        memory_paging_tlb_mark_active((memory_page_table_context_t*)new_table);
     }
 
     if(!memory_paging_page_tables) {
@@ -163,6 +168,97 @@ memory_page_table_context_t* memory_paging_switch_table(const memory_page_table_
     return old_table_context;
 }
 
+/**
+ * @brief splits a huge page entry into a table of smaller pages with same attributes
+ * @param[in] table_context page table context
+ * @param[in] entry 1G entry at p3 or 2M entry at p2
+ * @param[in] is_1g true if entry is at p3, its pages become 2M pages
+ * @param[in] virtual_address an address inside huge page for tlb invalidation
+ * @return 0 on success
+ */
+static int8_t memory_paging_split_huge_entry(memory_page_table_context_t* table_context, memory_page_entry_t* entry,
+                                             boolean_t is_1g, uint64_t virtual_address) {
+    uint64_t table_fa = memory_paging_get_internal_frame(table_context);
+
+    if(table_fa == 0) {
+        return -1;
+    }
+
+    memory_page_table_t* table = MEMORY_PAGING_GET_VA_FOR_RESERVED_FA((memory_page_table_t*)table_fa);
+    uint64_t step = is_1g ? (MEMORY_PAGING_PAGE_LENGTH_2M >> 12) : 1;
+
+    for(size_t i = 0; i < MEMORY_PAGING_INDEX_COUNT; i++) {
+        table->pages[i] = *entry;
+        table->pages[i].hugepage = is_1g ? 1 : 0; // bit 7 is pat at p1
+        table->pages[i].physical_address = entry->physical_address + i * step;
+    }
+
+    memory_page_entry_t new_entry = {0};
+
+    new_entry.present = 1;
+    new_entry.writable = 1;
+    new_entry.user_accessible = entry->user_accessible;
+    new_entry.physical_address = table_fa >> 12;
+
+    *entry = new_entry;
+
+    // translations are not changed, remote cpus drop huge entry with next flush
+    memory_paging_tlb_invalidate(table_context, virtual_address);
+
+    PRINTLOG(PAGING, LOG_TRACE, "huge page of va 0x%llx is splitted", virtual_address);
+
+    return 0;
+}
+
+/**
+ * @brief splits huge pages containing virtual address until it is mapped with pages of type or smaller
+ * @param[in] table_context page table context
+ * @param[in] virtual_address virtual address
+ * @param[in] type MEMORY_PAGING_PAGE_TYPE_4K or MEMORY_PAGING_PAGE_TYPE_2M
+ * @return 0 on success or if address is not mapped
+ */
+static int8_t memory_paging_split_page_ext(memory_page_table_context_t* table_context, uint64_t virtual_address, memory_paging_page_type_t type) {
+    memory_page_table_t* p4 = table_context->page_table;
+
+    size_t p4_idx = MEMORY_PT_GET_P4_INDEX(virtual_address);
+
+    if(p4->pages[p4_idx].present == 0) {
+        return 0;
+    }
+
+    memory_page_table_t* t_p3 = (memory_page_table_t*)((uint64_t)(p4->pages[p4_idx].physical_address << 12));
+    t_p3 = MEMORY_PAGING_GET_VA_FOR_RESERVED_FA(t_p3);
+
+    size_t p3_idx = MEMORY_PT_GET_P3_INDEX(virtual_address);
+
+    if(t_p3->pages[p3_idx].present == 0) {
+        return 0;
+    }
+
+    if(t_p3->pages[p3_idx].hugepage == 1 && memory_paging_split_huge_entry(table_context, &t_p3->pages[p3_idx], true, virtual_address) != 0) {
+        return -1;
+    }
+
+    if(type & MEMORY_PAGING_PAGE_TYPE_2M) {
+        return 0;
+    }
+
+    memory_page_table_t* t_p2 = (memory_page_table_t*)((uint64_t)(t_p3->pages[p3_idx].physical_address << 12));
+    t_p2 = MEMORY_PAGING_GET_VA_FOR_RESERVED_FA(t_p2);
+
+    size_t p2_idx = MEMORY_PT_GET_P2_INDEX(virtual_address);
+
+    if(t_p2->pages[p2_idx].present == 0) {
+        return 0;
+    }
+
+    if(t_p2->pages[p2_idx].hugepage == 1 && memory_paging_split_huge_entry(table_context, &t_p2->pages[p2_idx], false, virtual_address) != 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
 int8_t memory_paging_add_page_ext(memory_page_table_context_t* table_context,
                                   uint64_t virtual_address, uint64_t frame_address,
                                   memory_paging_page_type_t type) {
@@ -278,6 +374,11 @@ int8_t memory_paging_add_page_ext(memory_page_table_context_t* table_context,
             return 0;
         }
 
+        // smaller page inside a 1G page needs its own table
+        if(t_p3->pages[p3idx].hugepage == 1 && memory_paging_split_huge_entry(table_context, &t_p3->pages[p3idx], true, virtual_address) != 0) {
+            return -1;
+        }
+
         uint64_t tmp_pa = t_p3->pages[p3idx].physical_address;
         t_p2 = (memory_page_table_t*)(tmp_pa << 12);
         t_p2 = MEMORY_PAGING_GET_VA_FOR_RESERVED_FA(t_p2);
@@ -354,6 +455,10 @@ int8_t memory_paging_add_page_ext(memory_page_table_context_t* table_context,
             return 0;
         }
 
+        if(t_p2->pages[p2idx].hugepage == 1 && memory_paging_split_huge_entry(table_context, &t_p2->pages[p2idx], false, virtual_address) != 0) {
+            return -1;
+        }
+
         uint64_t tmp_pa = t_p2->pages[p2idx].physical_address;
         t_p1 = (memory_page_table_t*)(tmp_pa << 12);
         t_p1 = MEMORY_PAGING_GET_VA_FOR_RESERVED_FA(t_p1);
@@ -445,6 +550,10 @@ int8_t memory_paging_reserve_current_page_table_frames(void) {
 
     memory_memcopy(old_table_context, table_context, sizeof(memory_page_table_context_t));
 
+    // kernel table uses pcid 0, cpus mark it while joining tlb shootdowns
+    table_context->pcid = 0;
+    memory_memclean((void*)table_context->active_cpus, sizeof(table_context->active_cpus));
+
     uint64_t current_cr3 = 0;
 
     asm volatile ("mov %%cr3, %0" : "=r" (current_cr3));
@@ -507,6 +616,10 @@ memory_page_table_context_t* memory_paging_build_empty_table(uint64_t internal_f
 
     table_context->internal_frames_helper_frame = internal_frame_address;
 
+#if ___KERNELBUILD == 1
+    table_context->pcid = memory_paging_tlb_allocate_pcid();
+#endif
+
 
     uint64_t p4_fa = memory_paging_get_internal_frame(table_context);
     memory_page_table_t* p4 = (memory_page_table_t*)p4_fa;
@@ -634,7 +747,7 @@ int8_t memory_paging_clear_page_ext(memory_page_table_context_t* table_context,
                 t_p3->pages[p3_idx].accessed = 0;
             }
 
-            cpu_tlb_invalidate(t_p3);
+            memory_paging_tlb_invalidate(table_context, virtual_address);
 
         } else {
             t_p2 = (memory_page_table_t*)((uint64_t)(t_p3->pages[p3_idx].physical_address << 12));
@@ -660,7 +773,7 @@ int8_t memory_paging_clear_page_ext(memory_page_table_context_t* table_context,
                     t_p2->pages[p2_idx].accessed = 0;
                 }
 
-                cpu_tlb_invalidate(t_p2);
+                memory_paging_tlb_invalidate(table_context, virtual_address);
 
 
             } else {
@@ -685,13 +798,15 @@ int8_t memory_paging_clear_page_ext(memory_page_table_context_t* table_context,
                     t_p1->pages[p1_idx].accessed = 0;
                 }
 
-                cpu_tlb_invalidate(t_p1);
+                memory_paging_tlb_invalidate(table_context, virtual_address);
 
 
             }
         }
     }
 
+    memory_paging_tlb_flush();
+
     return 0;
 }
 
@@ -757,8 +872,7 @@ int8_t memory_paging_toggle_attributes_ext(memory_page_table_context_t* table_co
                 t_p3->pages[p3_idx].global = ~t_p3->pages[p3_idx].global;
             }
 
-            cpu_tlb_invalidate(t_p3);
-            cpu_tlb_invalidate((void*)virtual_address);
+            memory_paging_tlb_invalidate(table_context, virtual_address);
 
         } else {
             if(type & MEMORY_PAGING_PAGE_TYPE_USER_ACCESSIBLE) {
@@ -804,8 +918,7 @@ int8_t memory_paging_toggle_attributes_ext(memory_page_table_context_t* table_co
                     t_p2->pages[p2_idx].global = ~t_p2->pages[p2_idx].global;
                 }
 
-                cpu_tlb_invalidate(t_p2);
-                cpu_tlb_invalidate((void*)virtual_address);
+                memory_paging_tlb_invalidate(table_context, virtual_address);
 
 
             } else {
@@ -850,14 +963,15 @@ int8_t memory_paging_toggle_attributes_ext(memory_page_table_context_t* table_co
                     t_p1->pages[p1_idx].global = ~t_p1->pages[p1_idx].global;
                 }
 
-                cpu_tlb_invalidate(t_p1);
-                cpu_tlb_invalidate((void*)virtual_address);
+                memory_paging_tlb_invalidate(table_context, virtual_address);
 
 
             }
         }
     }
 
+    memory_paging_tlb_flush();
+
     return 0;
 }
 
@@ -899,7 +1013,7 @@ int8_t memory_paging_set_user_accessible_ext(memory_page_table_context_t* table_
         if(t_p3->pages[p3_idx].hugepage == 1) {
             t_p3->pages[p3_idx].user_accessible = 1;
 
-            cpu_tlb_invalidate(t_p3);
+            memory_paging_tlb_invalidate(table_context, virtual_address);
 
         } else {
             t_p3->pages[p3_idx].user_accessible = 1;
@@ -920,7 +1034,7 @@ int8_t memory_paging_set_user_accessible_ext(memory_page_table_context_t* table_
             if(t_p2->pages[p2_idx].hugepage == 1) {
                 t_p2->pages[p2_idx].user_accessible = 1;
 
-                cpu_tlb_invalidate(t_p2);
+                memory_paging_tlb_invalidate(table_context, virtual_address);
 
             } else {
                 t_p2->pages[p2_idx].user_accessible = 1;
@@ -941,19 +1055,38 @@ int8_t memory_paging_set_user_accessible_ext(memory_page_table_context_t* table_
                 t_p1->pages[p1_idx].user_accessible = 1;
 
 
-                cpu_tlb_invalidate(t_p1);
+                memory_paging_tlb_invalidate(table_context, virtual_address);
 
 
             }
         }
     }
 
+    memory_paging_tlb_flush();
+
     return 0;
 }
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wanalyzer-malloc-leak"
-int8_t memory_paging_delete_page_ext_with_heap(memory_page_table_context_t* table_context, uint64_t virtual_address, uint64_t* frame_address){
+/**
+ * @brief releases an emptied page table frame, other cpus may walk it until they are flushed
+ * @param[in] table page table
+ * @param[in] flush_type flush type
+ */
+static void memory_paging_release_table_frame(memory_page_table_t* table, memory_paging_tlb_flush_type_t flush_type) {
+    uint64_t fa = MEMORY_PAGING_GET_FA_FOR_RESERVED_VA((uint64_t)table);
+
+    if(flush_type == MEMORY_PAGING_TLB_FLUSH_TYPE_LOCAL) {
+        frame_t f = {fa, 1, 0, 0};
+        frame_get_allocator()->release_frame(frame_get_allocator(), &f);
+    } else {
+        memory_paging_tlb_release_frame_after_flush(fa);
+    }
+}
+
+int8_t memory_paging_delete_page_ext_with_flush(memory_page_table_context_t* table_context, uint64_t virtual_address, uint64_t* frame_address,
+                                                memory_paging_tlb_flush_type_t flush_type){
 
     if(table_context == NULL) {
         table_context = memory_paging_switch_table(NULL);
@@ -989,6 +1122,12 @@ int8_t memory_paging_delete_page_ext_with_heap(memory_page_table_context_t* tabl
     if(t_p3->pages[p3_idx].present == 0) {
         return -1;
     } else {
+        // deleting a page which is not at start of a huge page deletes only it, huge page is splitted
+        if(t_p3->pages[p3_idx].hugepage == 1 && (virtual_address % MEMORY_PAGING_PAGE_LENGTH_1G) &&
+           memory_paging_split_huge_entry(table_context, &t_p3->pages[p3_idx], true, virtual_address) != 0) {
+            return -1;
+        }
+
         if(t_p3->pages[p3_idx].hugepage == 1) {
             if(frame_address) {
                 *frame_address = t_p3->pages[p3_idx].physical_address << 12;
@@ -1009,6 +1148,11 @@ int8_t memory_paging_delete_page_ext_with_heap(memory_page_table_context_t* tabl
                 return -1;
             }
 
+            if(t_p2->pages[p2_idx].hugepage == 1 && (virtual_address % MEMORY_PAGING_PAGE_LENGTH_2M) &&
+               memory_paging_split_huge_entry(table_context, &t_p2->pages[p2_idx], false, virtual_address) != 0) {
+                return -1;
+            }
+
             if(t_p2->pages[p2_idx].hugepage == 1) {
                 if(frame_address) {
                     *frame_address = t_p2->pages[p2_idx].physical_address << 12;
@@ -1046,8 +1190,7 @@ int8_t memory_paging_delete_page_ext_with_heap(memory_page_table_context_t* tabl
                 if(p1_used == 0) {
                     memory_memclean(&t_p2->pages[p2_idx], sizeof(memory_page_entry_t));
 
-                    frame_t f = {MEMORY_PAGING_GET_FA_FOR_RESERVED_VA((uint64_t)t_p1), 1, 0, 0};
-                    frame_get_allocator()->release_frame(frame_get_allocator(), &f);
+                    memory_paging_release_table_frame(t_p1, flush_type);
                 }
 
             }
@@ -1063,8 +1206,7 @@ int8_t memory_paging_delete_page_ext_with_heap(memory_page_table_context_t* tabl
             if(p2_used == 0) {
                 memory_memclean(&t_p3->pages[p3_idx], sizeof(memory_page_entry_t));
 
-                frame_t f = {MEMORY_PAGING_GET_FA_FOR_RESERVED_VA((uint64_t)t_p2), 1, 0, 0};
-                frame_get_allocator()->release_frame(frame_get_allocator(), &f);
+                memory_paging_release_table_frame(t_p2, flush_type);
             }
         }
 
@@ -1079,11 +1221,21 @@ int8_t memory_paging_delete_page_ext_with_heap(memory_page_table_context_t* tabl
         if(p3_used == 0) {
             memory_memclean(&p4->pages[p4_idx], sizeof(memory_page_entry_t));
 
-            frame_t f = {MEMORY_PAGING_GET_FA_FOR_RESERVED_VA((uint64_t)t_p3), 1, 0, 0};
-            frame_get_allocator()->release_frame(frame_get_allocator(), &f);
+            memory_paging_release_table_frame(t_p3, flush_type);
         }
     }
 
+    // invlpg also drops paging structure caches of address, so one invalidation covers emptied tables
+    if(flush_type == MEMORY_PAGING_TLB_FLUSH_TYPE_LOCAL) {
+        cpu_tlb_invalidate((void*)virtual_address);
+    } else {
+        memory_paging_tlb_invalidate(table_context, virtual_address);
+    }
+
+    if(flush_type == MEMORY_PAGING_TLB_FLUSH_TYPE_SHOOTDOWN) {
+        memory_paging_tlb_flush();
+    }
+
     return 0;
 }
 #pragma GCC diagnostic pop
@@ -1177,7 +1329,15 @@ int8_t memory_paging_add_va_for_frame_ext(memory_page_table_context_t* table_con
     uint64_t frm_cnt = frm->frame_count;
 
     while(frm_cnt) {
-        if(frm_cnt >= 0x200 && (frm_addr % MEMORY_PAGING_PAGE_LENGTH_2M) == 0 && (va_start % MEMORY_PAGING_PAGE_LENGTH_2M) == 0) {
+        if(frm_cnt >= 0x40000 && (frm_addr % MEMORY_PAGING_PAGE_LENGTH_1G) == 0 && (va_start % MEMORY_PAGING_PAGE_LENGTH_1G) == 0) {
+            if(memory_paging_add_page_with_p4(table_context, va_start, frm_addr, type | MEMORY_PAGING_PAGE_TYPE_1G) != 0) {
+                return -1;
+            }
+
+            frm_cnt -= 0x40000;
+            frm_addr += MEMORY_PAGING_PAGE_LENGTH_1G;
+            va_start += MEMORY_PAGING_PAGE_LENGTH_1G;
+        } else if(frm_cnt >= 0x200 && (frm_addr % MEMORY_PAGING_PAGE_LENGTH_2M) == 0 && (va_start % MEMORY_PAGING_PAGE_LENGTH_2M) == 0) {
             if(memory_paging_add_page_with_p4(table_context, va_start, frm_addr, type | MEMORY_PAGING_PAGE_TYPE_2M) != 0) {
                 return -1;
             }
@@ -1204,28 +1364,42 @@ int8_t memory_paging_delete_va_for_frame_ext(memory_page_table_context_t* table_
         return -1;
     }
 
+    if(table_context == NULL) {
+        table_context = memory_paging_switch_table(NULL);
+    }
+
     uint64_t frm_addr = frm->frame_address;
     uint64_t frm_cnt = frm->frame_count;
 
     while(frm_cnt) {
-        if(frm_cnt >= 0x200 && (frm_addr % MEMORY_PAGING_PAGE_LENGTH_2M) == 0 && (va_start % MEMORY_PAGING_PAGE_LENGTH_2M) == 0) {
-            if(memory_paging_delete_page_ext(table_context, va_start, NULL) != 0) {
-                return -1;
-            }
+        uint64_t page_cnt = 1;
+        memory_paging_page_type_t page_type = MEMORY_PAGING_PAGE_TYPE_4K;
+
+        if(frm_cnt >= 0x40000 && (frm_addr % MEMORY_PAGING_PAGE_LENGTH_1G) == 0 && (va_start % MEMORY_PAGING_PAGE_LENGTH_1G) == 0) {
+            page_cnt = 0x40000;
+            page_type = MEMORY_PAGING_PAGE_TYPE_1G;
+        } else if(frm_cnt >= 0x200 && (frm_addr % MEMORY_PAGING_PAGE_LENGTH_2M) == 0 && (va_start % MEMORY_PAGING_PAGE_LENGTH_2M) == 0) {
+            page_cnt = 0x200;
+            page_type = MEMORY_PAGING_PAGE_TYPE_2M;
+        }
 
-            frm_cnt -= 0x200;
-            frm_addr += MEMORY_PAGING_PAGE_LENGTH_2M;
-            va_start += MEMORY_PAGING_PAGE_LENGTH_2M;
-        } else {
-            if(memory_paging_delete_page_ext(table_context, va_start, NULL) != 0) {
-                return -1;
-            }
+        // partial unmap of a larger page keeps rest of it mapped
+        if(page_type != MEMORY_PAGING_PAGE_TYPE_1G && memory_paging_split_page_ext(table_context, va_start, page_type) != 0) {
+            return -1;
+        }
 
-            frm_cnt--;
-            frm_addr += MEMORY_PAGING_PAGE_LENGTH_4K;
-            va_start += MEMORY_PAGING_PAGE_LENGTH_4K;
+        if(memory_paging_delete_page_batched(table_context, va_start, NULL) != 0) {
+            memory_paging_tlb_flush();
+
+            return -1;
         }
+
+        frm_cnt -= page_cnt;
+        frm_addr += page_cnt * MEMORY_PAGING_PAGE_LENGTH_4K;
+        va_start += page_cnt * MEMORY_PAGING_PAGE_LENGTH_4K;
     }
 
+    memory_paging_tlb_flush();
+
     return 0;
 }
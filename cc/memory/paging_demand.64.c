@@ -0,0 +1,406 @@
+/**
+ * @file paging_demand.64.c
+ * @brief demand paged virtual ranges, frames are allocated at first access
+ *
+ * This work is licensed under TURNSTONE OS Public License.
+ * Please read and understand latest version of Licence.
+ */
+
+#include <types.h>
+#include <memory.h>
+#include <memory/frame.h>
+#include <memory/paging.h>
+#include <cpu/sync.h>
+#include <logging.h>
+
+MODULE("turnstone.kernel.memory.paging");
+
+/*! start of demand paged area, it is below reserved frame area at 64 TiB */
+#define MEMORY_PAGING_DEMAND_VA_START (32ULL << 40)
+/*! end of demand paged area */
+#define MEMORY_PAGING_DEMAND_VA_END   (48ULL << 40)
+
+/**
+ * @struct memory_paging_demand_range_t
+ * @brief reserved demand paged range
+ */
+typedef struct memory_paging_demand_range_t {
+    struct memory_paging_demand_range_t* next; ///< next range ordered by address
+    memory_page_table_context_t*         table_context; ///< page table of range
+    uint64_t                             guard_start; ///< start of unmapped guard below range
+    uint64_t                             start; ///< range start
+    uint64_t                             end; ///< range end
+    memory_paging_page_type_t            type; ///< page type of populated pages
+    uint64_t*                            huge_map; ///< bitmap of 2M chunks from guard start which are mapped with huge pages, NULL if range has no whole chunk
+} memory_paging_demand_range_t; ///< short hand for struct
+
+/*! ranges ordered by address */
+static memory_paging_demand_range_t* memory_paging_demand_ranges = NULL;
+/*! lock of ranges and page population */
+static lock_t* memory_paging_demand_lock = NULL;
+/*! heap of range records */
+static memory_heap_t* memory_paging_demand_heap = NULL;
+
+/**
+ * @brief finds range containing address or its guard, lock should be held
+ * @param[in] virtual_address address
+ * @return range or NULL
+ */
+static memory_paging_demand_range_t* memory_paging_demand_find(uint64_t virtual_address) {
+    memory_paging_demand_range_t* range = memory_paging_demand_ranges;
+
+    while(range && range->guard_start <= virtual_address) {
+        if(virtual_address < range->end) {
+            return range;
+        }
+
+        range = range->next;
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief maps whole 2M chunk of address with a huge page if chunk is inside range and none of its pages is populated, lock should be held
+ * @param[in] range range of page
+ * @param[in] virtual_address page aligned address
+ * @return 0 on success, -1 if chunk should be populated with 4K pages
+ */
+static int8_t memory_paging_demand_map_huge_page(memory_paging_demand_range_t* range, uint64_t virtual_address) {
+    uint64_t huge_va = virtual_address & ~(MEMORY_PAGING_PAGE_LENGTH_2M - 1ULL);
+
+    if(range->huge_map == NULL || huge_va < range->start || huge_va + MEMORY_PAGING_PAGE_LENGTH_2M > range->end) {
+        return -1;
+    }
+
+    uint64_t frame_address = 0;
+
+    for(uint64_t va = huge_va; va < huge_va + MEMORY_PAGING_PAGE_LENGTH_2M; va += MEMORY_PAGING_PAGE_LENGTH_4K) {
+        if(memory_paging_get_physical_address_ext(range->table_context, va, &frame_address) == 0) {
+            return -1;
+        }
+    }
+
+    frame_t* frm = NULL;
+
+    // buddy blocks are aligned to their size, so 512 frames are a 2M aligned block. fragmented memory falls back to 4K pages
+    if(frame_get_allocator()->allocate_frame_by_count(frame_get_allocator(), MEMORY_PAGING_PAGE_LENGTH_2M / FRAME_SIZE,
+                                                      FRAME_ALLOCATION_TYPE_USED | FRAME_ALLOCATION_TYPE_BLOCK | FRAME_ALLOCATION_TYPE_OPPORTUNISTIC, &frm, NULL) != 0) {
+        return -1;
+    }
+
+    frame_address = frm->frame_address;
+    memory_free(frm);
+
+    if(memory_paging_add_page_ext(range->table_context, huge_va, frame_address, range->type | MEMORY_PAGING_PAGE_TYPE_2M) != 0) {
+        frame_t release_frm = {frame_address, MEMORY_PAGING_PAGE_LENGTH_2M / FRAME_SIZE, FRAME_TYPE_USED, 0};
+        frame_get_allocator()->release_frame(frame_get_allocator(), &release_frm);
+
+        return -1;
+    }
+
+    memory_memclean((void*)huge_va, MEMORY_PAGING_PAGE_LENGTH_2M);
+
+    uint64_t chunk = (huge_va - range->guard_start) / MEMORY_PAGING_PAGE_LENGTH_2M;
+    range->huge_map[chunk / 64] |= 1ULL << (chunk % 64);
+
+    return 0;
+}
+
+/**
+ * @brief allocates, maps and cleans frames for a page of range if it is not mapped, lock should be held
+ * @param[in] range range of page
+ * @param[in] virtual_address page aligned address
+ * @return 0 on success
+ *
+ * whole 2M chunks of range are mapped with huge pages when a 2M frame block is available.
+ */
+static int8_t memory_paging_demand_map_page(memory_paging_demand_range_t* range, uint64_t virtual_address) {
+    uint64_t frame_address = 0;
+
+    // another cpu may populate page while we are waiting lock
+    if(memory_paging_get_physical_address_ext(range->table_context, virtual_address, &frame_address) == 0) {
+        return 0;
+    }
+
+    if(memory_paging_demand_map_huge_page(range, virtual_address) == 0) {
+        return 0;
+    }
+
+    frame_t* frm = NULL;
+
+    if(frame_get_allocator()->allocate_frame_by_count(frame_get_allocator(), 1, FRAME_ALLOCATION_TYPE_USED | FRAME_ALLOCATION_TYPE_BLOCK, &frm, NULL) != 0) {
+        PRINTLOG(PAGING, LOG_ERROR, "cannot allocate frame for demand page 0x%llx", virtual_address);
+
+        return -1;
+    }
+
+    frame_address = frm->frame_address;
+    memory_free(frm);
+
+    if(memory_paging_add_page_ext(range->table_context, virtual_address, frame_address, range->type | MEMORY_PAGING_PAGE_TYPE_4K) != 0) {
+        PRINTLOG(PAGING, LOG_ERROR, "cannot map demand page 0x%llx to frame 0x%llx", virtual_address, frame_address);
+
+        frame_t release_frm = {frame_address, 1, FRAME_TYPE_USED, 0};
+        frame_get_allocator()->release_frame(frame_get_allocator(), &release_frm);
+
+        return -1;
+    }
+
+    memory_memclean((void*)virtual_address, MEMORY_PAGING_PAGE_LENGTH_4K);
+
+    return 0;
+}
+
+uint64_t memory_paging_demand_reserve_ext(memory_page_table_context_t* table_context, uint64_t size, uint64_t guard_size, memory_paging_page_type_t type) {
+    if(size == 0) {
+        return 0;
+    }
+
+    if(memory_paging_demand_lock == NULL) {
+        memory_paging_demand_heap = memory_get_default_heap();
+        memory_paging_demand_lock = lock_create_with_heap(memory_paging_demand_heap);
+
+        if(memory_paging_demand_lock == NULL) {
+            return 0;
+        }
+    }
+
+    if(table_context == NULL) {
+        table_context = memory_paging_get_table();
+    }
+
+    size = (size + MEMORY_PAGING_PAGE_LENGTH_4K - 1) & ~(MEMORY_PAGING_PAGE_LENGTH_4K - 1ULL);
+    guard_size = (guard_size + MEMORY_PAGING_PAGE_LENGTH_4K - 1) & ~(MEMORY_PAGING_PAGE_LENGTH_4K - 1ULL);
+
+    memory_paging_demand_range_t* new_range = memory_malloc_ext(memory_paging_demand_heap, sizeof(memory_paging_demand_range_t), 0);
+
+    if(new_range == NULL) {
+        return 0;
+    }
+
+    // range starts at a 2M boundary, chunk map covers guard and range
+    uint64_t chunk_count = (guard_size + size) / MEMORY_PAGING_PAGE_LENGTH_2M;
+    uint64_t* huge_map = NULL;
+
+    if(size >= MEMORY_PAGING_PAGE_LENGTH_2M && chunk_count) {
+        huge_map = memory_malloc_ext(memory_paging_demand_heap, sizeof(uint64_t) * ((chunk_count + 63) / 64), 0);
+
+        if(huge_map == NULL) {
+            memory_free_ext(memory_paging_demand_heap, new_range);
+
+            return 0;
+        }
+
+        memory_memclean(huge_map, sizeof(uint64_t) * ((chunk_count + 63) / 64));
+    }
+
+    lock_acquire(memory_paging_demand_lock);
+
+    // first fit, ranges start at 2M boundaries so they do not share last level tables
+    uint64_t candidate = MEMORY_PAGING_DEMAND_VA_START;
+    memory_paging_demand_range_t* prev = NULL;
+    memory_paging_demand_range_t* range = memory_paging_demand_ranges;
+
+    while(range) {
+        if(candidate + guard_size + size <= range->guard_start) {
+            break;
+        }
+
+        candidate = (range->end + MEMORY_PAGING_PAGE_LENGTH_2M - 1) & ~(MEMORY_PAGING_PAGE_LENGTH_2M - 1ULL);
+        prev = range;
+        range = range->next;
+    }
+
+    if(candidate + guard_size + size > MEMORY_PAGING_DEMAND_VA_END) {
+        lock_release(memory_paging_demand_lock);
+
+        if(huge_map) {
+            memory_free_ext(memory_paging_demand_heap, huge_map);
+        }
+
+        memory_free_ext(memory_paging_demand_heap, new_range);
+
+        PRINTLOG(PAGING, LOG_ERROR, "demand paged area is full for size 0x%llx", size);
+
+        return 0;
+    }
+
+    new_range->table_context = table_context;
+    new_range->guard_start = candidate;
+    new_range->start = candidate + guard_size;
+    new_range->end = new_range->start + size;
+    new_range->type = type;
+    new_range->huge_map = huge_map;
+    new_range->next = range;
+
+    if(prev) {
+        prev->next = new_range;
+    } else {
+        memory_paging_demand_ranges = new_range;
+    }
+
+    uint64_t va_start = new_range->start;
+
+    lock_release(memory_paging_demand_lock);
+
+    PRINTLOG(PAGING, LOG_TRACE, "demand range 0x%llx-0x%llx reserved with guard 0x%llx", va_start, va_start + size, guard_size);
+
+    return va_start;
+}
+
+int8_t memory_paging_demand_populate(uint64_t va_start, uint64_t size) {
+    if(memory_paging_demand_lock == NULL) {
+        return -1;
+    }
+
+    uint64_t va_end = va_start + size;
+
+    va_start &= ~(MEMORY_PAGING_PAGE_LENGTH_4K - 1ULL);
+
+    lock_acquire(memory_paging_demand_lock);
+
+    memory_paging_demand_range_t* range = memory_paging_demand_find(va_start);
+
+    if(range == NULL || va_start < range->start || va_end > range->end) {
+        lock_release(memory_paging_demand_lock);
+
+        return -1;
+    }
+
+    int8_t res = 0;
+
+    for(uint64_t va = va_start; va < va_end; va += MEMORY_PAGING_PAGE_LENGTH_4K) {
+        if(memory_paging_demand_map_page(range, va) != 0) {
+            res = -1;
+
+            break;
+        }
+    }
+
+    lock_release(memory_paging_demand_lock);
+
+    return res;
+}
+
+int8_t memory_paging_demand_release(uint64_t va_start) {
+    if(memory_paging_demand_lock == NULL) {
+        return -1;
+    }
+
+    lock_acquire(memory_paging_demand_lock);
+
+    memory_paging_demand_range_t* prev = NULL;
+    memory_paging_demand_range_t* range = memory_paging_demand_ranges;
+
+    while(range && range->start != va_start) {
+        prev = range;
+        range = range->next;
+    }
+
+    if(range == NULL) {
+        lock_release(memory_paging_demand_lock);
+
+        PRINTLOG(PAGING, LOG_ERROR, "demand range 0x%llx is not found", va_start);
+
+        return -1;
+    }
+
+    int8_t res = 0;
+
+    // range stays linked while its pages are unmapped, so its virtual range cannot be reserved again with stale pages.
+    // only populated pages have frames, released frames are cleaned by frame allocator
+    for(uint64_t va = range->start; va < range->end; va += MEMORY_PAGING_PAGE_LENGTH_4K) {
+        uint64_t frame_address = 0;
+
+        if(memory_paging_get_physical_address_ext(range->table_context, va, &frame_address) != 0) {
+            continue;
+        }
+
+        uint64_t frame_count = 1;
+
+        if(range->huge_map && (va % MEMORY_PAGING_PAGE_LENGTH_2M) == 0) {
+            uint64_t chunk = (va - range->guard_start) / MEMORY_PAGING_PAGE_LENGTH_2M;
+
+            if(range->huge_map[chunk / 64] & (1ULL << (chunk % 64))) {
+                frame_count = MEMORY_PAGING_PAGE_LENGTH_2M / FRAME_SIZE;
+            }
+        }
+
+        if(memory_paging_delete_page_batched(range->table_context, va, NULL) != 0) {
+            PRINTLOG(PAGING, LOG_ERROR, "cannot unmap demand page 0x%llx", va);
+
+            res = -1;
+
+            continue;
+        }
+
+        // other cpus may write frames until they are flushed
+        for(uint64_t i = 0; i < frame_count; i++) {
+            memory_paging_tlb_release_frame_after_flush(frame_address + i * FRAME_SIZE);
+        }
+
+        va += (frame_count - 1) * FRAME_SIZE;
+    }
+
+    memory_paging_tlb_flush();
+
+    if(prev) {
+        prev->next = range->next;
+    } else {
+        memory_paging_demand_ranges = range->next;
+    }
+
+    lock_release(memory_paging_demand_lock);
+
+    if(range->huge_map) {
+        memory_free_ext(memory_paging_demand_heap, range->huge_map);
+    }
+
+    memory_free_ext(memory_paging_demand_heap, range);
+
+    return res;
+}
+
+int8_t memory_paging_demand_populate_for_dma(uint64_t va_start, uint64_t size) {
+    if(va_start < MEMORY_PAGING_DEMAND_VA_START || va_start >= MEMORY_PAGING_DEMAND_VA_END) {
+        return 0;
+    }
+
+    return memory_paging_demand_populate(va_start, size);
+}
+
+int8_t memory_paging_demand_handle_fault(uint64_t virtual_address) {
+    if(memory_paging_demand_lock == NULL ||
+       virtual_address < MEMORY_PAGING_DEMAND_VA_START || virtual_address >= MEMORY_PAGING_DEMAND_VA_END) {
+        return -1;
+    }
+
+    virtual_address &= ~(MEMORY_PAGING_PAGE_LENGTH_4K - 1ULL);
+
+    lock_acquire(memory_paging_demand_lock);
+
+    memory_paging_demand_range_t* range = memory_paging_demand_find(virtual_address);
+
+    if(range == NULL) {
+        lock_release(memory_paging_demand_lock);
+
+        return -1;
+    }
+
+    if(virtual_address < range->start) {
+        uint64_t range_start = range->start;
+
+        lock_release(memory_paging_demand_lock);
+
+        PRINTLOG(PAGING, LOG_FATAL, "guard page 0x%llx of demand range 0x%llx is accessed", virtual_address, range_start);
+
+        return -1;
+    }
+
+    int8_t res = memory_paging_demand_map_page(range, virtual_address);
+
+    lock_release(memory_paging_demand_lock);
+
+    return res;
+}
@@ -0,0 +1,497 @@
+/**
+ * @file paging_tlb.64.c
+ * @brief batched tlb shootdowns and process context identifiers
+ *
+ * page table changes queue their addresses into current cpu's batch. a flush invalidates them at cpus which
+ * have loaded the table with one ipi per cpu and waits acknowledges, then page table frames freed by unmaps
+ * are released. with pcid, cr3 loads keep tlb entries and shootdowns also reach cpus which ran the table before.
+ *
+ * This work is licensed under TURNSTONE OS Public License.
+ * Please read and understand latest version of Licence.
+ */
+
+#include <types.h>
+#include <memory.h>
+#include <memory/frame.h>
+#include <memory/paging.h>
+#include <cpu.h>
+#include <cpu/crx.h>
+#include <cpu/interrupt.h>
+#include <cpu/task.h>
+#include <apic.h>
+#include <logging.h>
+#include <utils.h>
+
+MODULE("turnstone.kernel.memory.paging");
+
+/*! irq number of shootdown ipi, vector is irq + 32 */
+#define MEMORY_PAGING_TLB_IRQ              0xdd
+/*! address count of a batch, larger batches flush whole tlb */
+#define MEMORY_PAGING_TLB_BATCH_SIZE       32
+/*! page table frame count waiting a flush */
+#define MEMORY_PAGING_TLB_DEFERRED_SIZE    32
+/*! pcid count, pcid 0 is kernel table */
+#define MEMORY_PAGING_TLB_PCID_COUNT       4096
+/*! cr3 bit keeping tlb entries of pcid */
+#define MEMORY_PAGING_TLB_CR3_NOFLUSH      (1ULL << 63)
+
+/**
+ * @struct memory_paging_tlb_batch_t
+ * @brief pending invalidations of a cpu
+ */
+typedef struct memory_paging_tlb_batch_t {
+    memory_page_table_context_t* table_context; ///< table of queued addresses
+    uint64_t                     count; ///< queued address count
+    boolean_t                    full; ///< too many addresses, remote cpus flush whole tlb
+    boolean_t                    local_stale; ///< table is not loaded at current cpu, its pcid should be flushed
+    uint64_t                     addresses[MEMORY_PAGING_TLB_BATCH_SIZE]; ///< queued addresses
+    uint64_t                     deferred_count; ///< page table frame count waiting flush
+    uint64_t                     deferred_frames[MEMORY_PAGING_TLB_DEFERRED_SIZE]; ///< page table frames waiting flush
+    volatile boolean_t           flushing; ///< a task sends batch, flushes of cpu are serialized
+    volatile uint64_t            generation; ///< completed flush count
+} memory_paging_tlb_batch_t; ///< short hand for struct
+
+/**
+ * @struct memory_paging_tlb_request_t
+ * @brief shootdown request sent to remote cpus, it lives at sender's stack
+ */
+typedef struct memory_paging_tlb_request_t {
+    const memory_page_table_context_t* table_context; ///< table of addresses
+    uint64_t                           count; ///< address count
+    boolean_t                          full; ///< flush whole tlb
+    const uint64_t*                    addresses; ///< addresses
+    volatile uint64_t                  pending; ///< cpu count not acknowledged yet
+} memory_paging_tlb_request_t; ///< short hand for struct
+
+/*! cr3 bits or'ed at task switches, it keeps tlb entries when pcid is enabled */
+uint64_t memory_paging_tlb_cr3_noflush = 0;
+
+/*! per cpu batches indexed by local apic id */
+static memory_paging_tlb_batch_t* memory_paging_tlb_batches = NULL;
+/*! per cpu incoming requests */
+static memory_paging_tlb_request_t* volatile memory_paging_tlb_mailboxes[MEMORY_PAGING_TLB_MAX_CPU_COUNT];
+/*! cpus which can receive shootdowns */
+static volatile uint64_t memory_paging_tlb_online_cpus[MEMORY_PAGING_TLB_CPU_MASK_SIZE];
+/*! pcid is enabled */
+static boolean_t memory_paging_tlb_pcid_enabled = false;
+/*! next pcid to allocate */
+static uint64_t memory_paging_tlb_next_pcid = 1;
+
+/**
+ * @brief gets current cpu's batch
+ * @param[out] cpu_id current cpu id
+ * @return batch or NULL before tlb init
+ */
+static memory_paging_tlb_batch_t* memory_paging_tlb_get_batch(uint64_t* cpu_id) {
+    if(!memory_paging_tlb_batches || !memory_get_cpu_id(cpu_id) || *cpu_id >= MEMORY_PAGING_TLB_MAX_CPU_COUNT) {
+        return NULL;
+    }
+
+    return &memory_paging_tlb_batches[*cpu_id];
+}
+
+/**
+ * @brief records that current task waits next flush of batch, interrupts should be disabled
+ * @param[in] batch batch of current cpu
+ *
+ * a task queueing invalidations may be preempted before its flush. it is not migrated until its cpu completes
+ * the flush, otherwise flush at new cpu would release frames while old cpu's batch still has addresses.
+ */
+static void memory_paging_tlb_pin_current_task(const memory_paging_tlb_batch_t* batch) {
+    task_t* task = task_get_current_task();
+
+    // while a flush is in progress, new addresses wait the flush after it
+    if(task) {
+        task->tlb_generation = batch->generation + (batch->flushing ? 2 : 1);
+    }
+}
+
+/**
+ * @brief checks table is loaded at current cpu
+ * @param[in] table_context table
+ * @return true if cr3 points table
+ */
+static boolean_t memory_paging_tlb_is_active(const memory_page_table_context_t* table_context) {
+    uint64_t cr3 = cpu_read_cr3() & ~(FRAME_SIZE - 1);
+
+    return cr3 == MEMORY_PAGING_GET_FA_FOR_RESERVED_VA((uint64_t)table_context->page_table);
+}
+
+/**
+ * @brief flushes all tlb entries including global ones and all pcids by toggling cr4.pge
+ */
+static void memory_paging_tlb_flush_all_local(void) {
+    cpu_reg_cr4_t cr4 = cpu_read_cr4();
+    cpu_reg_cr4_t toggled = cr4;
+
+    toggled.fields.page_global_enable = !cr4.fields.page_global_enable;
+
+    cpu_write_cr4(toggled);
+    cpu_write_cr4(cr4);
+}
+
+/**
+ * @brief applies a request at current cpu
+ * @param[in] request request
+ */
+static void memory_paging_tlb_apply(const memory_paging_tlb_request_t* request) {
+    if(!memory_paging_tlb_is_active(request->table_context)) {
+        // without pcid entries of tables which are not loaded are already dropped by cr3 load
+        if(memory_paging_tlb_pcid_enabled) {
+            memory_paging_tlb_flush_all_local();
+        }
+
+        return;
+    }
+
+    if(request->full) {
+        memory_paging_tlb_flush_all_local();
+
+        return;
+    }
+
+    for(uint64_t i = 0; i < request->count; i++) {
+        cpu_tlb_invalidate((void*)request->addresses[i]);
+    }
+}
+
+/**
+ * @brief handles request at mailbox of current cpu if there is one
+ * @param[in] cpu_id current cpu id
+ */
+static void memory_paging_tlb_handle_mailbox(uint64_t cpu_id) {
+    memory_paging_tlb_request_t* request = __atomic_exchange_n(&memory_paging_tlb_mailboxes[cpu_id], NULL, __ATOMIC_ACQUIRE);
+
+    if(request) {
+        memory_paging_tlb_apply(request);
+
+        __atomic_sub_fetch(&request->pending, 1, __ATOMIC_RELEASE);
+    }
+}
+
+#if ___KERNELBUILD == 1
+/**
+ * @brief shootdown ipi handler
+ * @param[in] frame interrupt frame
+ * @return 0
+ */
+static int8_t memory_paging_tlb_isr(interrupt_frame_ext_t* frame) {
+    UNUSED(frame);
+
+    uint64_t cpu_id = 0;
+
+    if(memory_get_cpu_id(&cpu_id) && cpu_id < MEMORY_PAGING_TLB_MAX_CPU_COUNT) {
+        memory_paging_tlb_handle_mailbox(cpu_id);
+    }
+
+    apic_eoi();
+
+    return 0;
+}
+#endif
+
+/**
+ * @brief sends request to cpus which have loaded table and waits them
+ * @param[in] cpu_id current cpu id
+ * @param[in] request request
+ */
+static void memory_paging_tlb_send(uint64_t cpu_id, memory_paging_tlb_request_t* request) {
+    const memory_page_table_context_t* table_context = request->table_context;
+
+    for(uint64_t word = 0; word < MEMORY_PAGING_TLB_CPU_MASK_SIZE; word++) {
+        uint64_t targets = memory_paging_tlb_online_cpus[word] & table_context->active_cpus[word];
+
+        while(targets) {
+            uint64_t bit = __builtin_ctzll(targets);
+            uint64_t target = word * 64 + bit;
+
+            targets &= targets - 1;
+
+            if(target == cpu_id) {
+                continue;
+            }
+
+            __atomic_add_fetch(&request->pending, 1, __ATOMIC_RELAXED);
+
+            memory_paging_tlb_request_t* expected = NULL;
+
+            // another cpu may be shooting same target, our mailbox is served while waiting to avoid deadlocks
+            while(!__atomic_compare_exchange_n(&memory_paging_tlb_mailboxes[target], &expected, request, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+                expected = NULL;
+                memory_paging_tlb_handle_mailbox(cpu_id);
+                asm volatile ("pause" ::: "memory");
+            }
+
+#if ___KERNELBUILD == 1
+            apic_send_ipi(target, MEMORY_PAGING_TLB_IRQ + 32, false);
+#endif
+        }
+    }
+
+    while(__atomic_load_n(&request->pending, __ATOMIC_ACQUIRE)) {
+        memory_paging_tlb_handle_mailbox(cpu_id);
+        asm volatile ("pause" ::: "memory");
+    }
+}
+
+void memory_paging_tlb_invalidate(memory_page_table_context_t* table_context, uint64_t virtual_address) {
+    boolean_t active = memory_paging_tlb_is_active(table_context);
+
+    // current cpu is invalidated at once, only remote ones wait flush
+    if(active) {
+        cpu_tlb_invalidate((void*)virtual_address);
+    }
+
+    uint64_t cpu_id = 0;
+    boolean_t interrupts_enabled = cpu_cli();
+    memory_paging_tlb_batch_t* batch = memory_paging_tlb_get_batch(&cpu_id);
+
+    if(!batch) {
+        if(interrupts_enabled) {
+            cpu_sti();
+        }
+
+        return;
+    }
+
+    if(batch->table_context && batch->table_context != table_context) {
+        if(interrupts_enabled) {
+            cpu_sti();
+        }
+
+        memory_paging_tlb_flush();
+
+        interrupts_enabled = cpu_cli();
+        batch = memory_paging_tlb_get_batch(&cpu_id);
+    }
+
+    batch->table_context = table_context;
+    batch->local_stale |= !active && memory_paging_tlb_pcid_enabled;
+
+    memory_paging_tlb_pin_current_task(batch);
+
+    if(batch->count < MEMORY_PAGING_TLB_BATCH_SIZE) {
+        batch->addresses[batch->count++] = virtual_address;
+    } else {
+        batch->full = true;
+    }
+
+    if(interrupts_enabled) {
+        cpu_sti();
+    }
+}
+
+void memory_paging_tlb_release_frame_after_flush(uint64_t frame_address) {
+    uint64_t cpu_id = 0;
+    boolean_t interrupts_enabled = cpu_cli();
+    memory_paging_tlb_batch_t* batch = memory_paging_tlb_get_batch(&cpu_id);
+
+    while(batch && batch->deferred_count == MEMORY_PAGING_TLB_DEFERRED_SIZE) {
+        if(interrupts_enabled) {
+            cpu_sti();
+        }
+
+        memory_paging_tlb_flush();
+
+        interrupts_enabled = cpu_cli();
+        batch = memory_paging_tlb_get_batch(&cpu_id);
+    }
+
+    if(batch) {
+        batch->deferred_frames[batch->deferred_count++] = frame_address;
+
+        memory_paging_tlb_pin_current_task(batch);
+    }
+
+    if(interrupts_enabled) {
+        cpu_sti();
+    }
+
+    // before tlb init there is only boot cpu and its tlb is already invalidated
+    if(!batch) {
+        frame_t frm = {frame_address, 1, FRAME_TYPE_USED, 0};
+        frame_get_allocator()->release_frame(frame_get_allocator(), &frm);
+    }
+}
+
+void memory_paging_tlb_flush(void) {
+    uint64_t cpu_id = 0;
+    boolean_t interrupts_enabled = cpu_cli();
+    memory_paging_tlb_batch_t* batch = memory_paging_tlb_get_batch(&cpu_id);
+
+    // another task of cpu may have taken our invalidations, they are done only after its flush completes
+    while(batch && batch->flushing) {
+        if(interrupts_enabled) {
+            cpu_sti();
+        }
+
+        asm volatile ("pause" ::: "memory");
+
+        interrupts_enabled = cpu_cli();
+        batch = memory_paging_tlb_get_batch(&cpu_id);
+    }
+
+    if(!batch || (!batch->table_context && !batch->deferred_count)) {
+        if(interrupts_enabled) {
+            cpu_sti();
+        }
+
+        return;
+    }
+
+    // batch is copied so tasks of this cpu can queue new invalidations while we wait remote cpus
+    uint64_t addresses[MEMORY_PAGING_TLB_BATCH_SIZE];
+    uint64_t deferred_frames[MEMORY_PAGING_TLB_DEFERRED_SIZE];
+
+    memory_paging_tlb_request_t request = {0};
+
+    request.table_context = batch->table_context;
+    request.count = batch->count;
+    request.full = batch->full;
+    request.addresses = addresses;
+
+    memory_memcopy(batch->addresses, addresses, batch->count * sizeof(uint64_t));
+
+    uint64_t deferred_count = batch->deferred_count;
+
+    memory_memcopy(batch->deferred_frames, deferred_frames, deferred_count * sizeof(uint64_t));
+
+    boolean_t local_stale = batch->local_stale;
+
+    batch->table_context = NULL;
+    batch->count = 0;
+    batch->full = false;
+    batch->local_stale = false;
+    batch->deferred_count = 0;
+    // flushing task stays at cpu until batch is completed
+    memory_paging_tlb_pin_current_task(batch);
+
+    batch->flushing = true;
+
+    if(local_stale) {
+        memory_paging_tlb_flush_all_local();
+    }
+
+    if(interrupts_enabled) {
+        cpu_sti();
+    }
+
+    if(request.table_context) {
+        memory_paging_tlb_send(cpu_id, &request);
+    }
+
+    for(uint64_t i = 0; i < deferred_count; i++) {
+        frame_t frm = {deferred_frames[i], 1, FRAME_TYPE_USED, 0};
+
+        if(frame_get_allocator()->release_frame(frame_get_allocator(), &frm) != 0) {
+            PRINTLOG(PAGING, LOG_ERROR, "cannot release page table frame 0x%llx", deferred_frames[i]);
+        }
+    }
+
+    // batch is still the one of flushing cpu, task is not migrated while it is pending
+    __atomic_add_fetch(&batch->generation, 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&batch->flushing, false, __ATOMIC_RELEASE);
+}
+
+boolean_t memory_paging_tlb_is_pending(uint64_t cpu_id, uint64_t generation) {
+    if(!generation || !memory_paging_tlb_batches || cpu_id >= MEMORY_PAGING_TLB_MAX_CPU_COUNT) {
+        return false;
+    }
+
+    return __atomic_load_n(&memory_paging_tlb_batches[cpu_id].generation, __ATOMIC_ACQUIRE) < generation;
+}
+
+void memory_paging_tlb_mark_active(memory_page_table_context_t* table_context) {
+    uint64_t cpu_id = 0;
+
+    if(!table_context || !memory_get_cpu_id(&cpu_id) || cpu_id >= MEMORY_PAGING_TLB_MAX_CPU_COUNT) {
+        return;
+    }
+
+    uint64_t mask = 1ULL << (cpu_id % 64);
+
+    // bit is never cleared, cpu may keep entries of table with its pcid
+    if(!(table_context->active_cpus[cpu_id / 64] & mask)) {
+        __atomic_or_fetch(&table_context->active_cpus[cpu_id / 64], mask, __ATOMIC_RELEASE);
+    }
+}
+
+uint64_t memory_paging_tlb_allocate_pcid(void) {
+    uint64_t pcid = __atomic_fetch_add(&memory_paging_tlb_next_pcid, 1, __ATOMIC_RELAXED);
+
+    if(pcid < MEMORY_PAGING_TLB_PCID_COUNT) {
+        return pcid;
+    }
+
+    // tables share pcid 0 after exhaustion, so every cr3 load should flush it
+    if(memory_paging_tlb_cr3_noflush) {
+        memory_paging_tlb_cr3_noflush = 0;
+
+        PRINTLOG(PAGING, LOG_WARNING, "pcids are exhausted, task switches flush tlb");
+    }
+
+    return 0;
+}
+
+uint64_t memory_paging_tlb_get_cr3(const memory_page_table_context_t* table_context) {
+    uint64_t cr3 = MEMORY_PAGING_GET_FA_FOR_RESERVED_VA((uint64_t)table_context->page_table);
+
+    if(memory_paging_tlb_pcid_enabled) {
+        cr3 |= table_context->pcid;
+    }
+
+    return cr3 | memory_paging_tlb_cr3_noflush;
+}
+
+int8_t memory_paging_tlb_init(void) {
+    memory_paging_tlb_batches = memory_malloc(sizeof(memory_paging_tlb_batch_t) * MEMORY_PAGING_TLB_MAX_CPU_COUNT);
+
+    if(!memory_paging_tlb_batches) {
+        PRINTLOG(PAGING, LOG_ERROR, "cannot allocate tlb batches");
+
+        return -1;
+    }
+
+#if ___KERNELBUILD == 1
+    if(interrupt_irq_set_handler(MEMORY_PAGING_TLB_IRQ, &memory_paging_tlb_isr) != 0) {
+        PRINTLOG(PAGING, LOG_ERROR, "cannot set tlb shootdown handler");
+
+        return -1;
+    }
+#endif
+
+    cpu_cpuid_regs_t query = {.eax = 1};
+    cpu_cpuid_regs_t answer = {0};
+
+    cpu_cpuid(query, &answer);
+
+    // kernel table has pcid 0 so cr3 low bits are zero while enabling, aps take cr4 from boot cpu
+    if((answer.ecx >> 17) & 1) {
+        cpu_reg_cr4_t cr4 = cpu_read_cr4();
+        cr4.fields.process_context_identifier_enable = 1;
+        cpu_write_cr4(cr4);
+
+        memory_paging_tlb_pcid_enabled = true;
+        memory_paging_tlb_cr3_noflush = MEMORY_PAGING_TLB_CR3_NOFLUSH;
+    }
+
+    PRINTLOG(PAGING, LOG_INFO, "tlb shootdowns are initialized, pcid %s", memory_paging_tlb_pcid_enabled ? "enabled" : "disabled");
+
+    return memory_paging_tlb_ap_init();
+}
+
+int8_t memory_paging_tlb_ap_init(void) {
+    uint64_t cpu_id = 0;
+
+    if(!memory_get_cpu_id(&cpu_id) || cpu_id >= MEMORY_PAGING_TLB_MAX_CPU_COUNT) {
+        PRINTLOG(PAGING, LOG_ERROR, "cpu cannot join tlb shootdowns");
+
+        return -1;
+    }
+
+    memory_paging_tlb_mark_active(memory_paging_get_table());
+
+    __atomic_or_fetch(&memory_paging_tlb_online_cpus[cpu_id / 64], 1ULL << (cpu_id % 64), __ATOMIC_RELEASE);
+
+    return 0;
+}
@@ -165,7 +165,11 @@ int32_t network_dhcpv4_send_discover(uint64_t args_cnt, void** args) {
 
         PRINTLOG(NETWORK, LOG_TRACE, "dhcp packet sending...");
 
-        list_queue_push(ni->return_queue, res);
+        if(network_transmit_packet_push(ni->return_queue, res) != 0) {
+            PRINTLOG(NETWORK, LOG_ERROR, "cannot queue dhcp packet");
+            memory_free_ext(list_get_heap(ni->return_queue), packet_data);
+            memory_free_ext(list_get_heap(ni->return_queue), res);
+        }
     }
 
     return 0;
@@ -24,6 +24,7 @@
 #include <cpu.h>
 #include <cpu/crx.h>
 #include <cpu/smp.h>
+#include <cpu/workqueue.h>
 #include <utils.h>
 #include <device/kbd.h>
 #include <cpu/task.h>
@@ -116,6 +117,8 @@ __attribute__((noreturn)) void  ___kstart64(system_info_t* sysinfo) {
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wanalyzer-malloc-leak"
 int8_t kmain64(size_t entry_point) {
+    memory_simd_init();
+
     crc32_init_table();
 
     memory_heap_t* heap = memory_create_heap_hash(0, 0);
@@ -127,6 +130,19 @@ int8_t kmain64(size_t entry_point) {
 
     memory_set_default_heap(heap);
 
+    if(memory_heap_hash_enable_magazines(heap) != 0) {
+        PRINTLOG(KERNEL, LOG_WARNING, "cannot enable per cpu magazines of default heap");
+    }
+
+    program_header_t* kernel_header = (program_header_t*)SYSTEM_INFO->program_header_virtual_start;
+
+    if(memory_heap_register_range(heap, kernel_header->program_heap_virtual_address,
+                                  kernel_header->program_heap_virtual_address + kernel_header->program_heap_size) != 0) {
+        PRINTLOG(KERNEL, LOG_FATAL, "cannot register default heap range");
+
+        return -1;
+    }
+
     srand(SYSTEM_INFO->random_seed);
 
     if(spool_init(SYSTEM_INFO->spool_size, SYSTEM_INFO->spool_virtual_start) != 0) {
@@ -319,6 +335,10 @@ int8_t kmain64(size_t entry_point) {
         cpu_hlt();
     }
 
+    if(acpi_numa_setup(desc) != 0) {
+        PRINTLOG(KERNEL, LOG_ERROR, "numa setup failed, memory is at single node");
+    }
+
     if(pci_setup(NULL) != 0) {
         PRINTLOG(KERNEL, LOG_FATAL, "pci setup failed. Halting");
         cpu_hlt();
@@ -349,6 +369,11 @@ int8_t kmain64(size_t entry_point) {
         PRINTLOG(KERNEL, LOG_ERROR, "cannot init hypervisor.");
     }
 
+    if(time_timer_wheel_init() != 0) {
+        PRINTLOG(KERNEL, LOG_FATAL, "cannot init timer wheels. Halting...");
+        cpu_hlt();
+    }
+
     if(task_init_tasking_ext(heap) != 0) {
         PRINTLOG(KERNEL, LOG_FATAL, "cannot init tasking. Halting...");
         cpu_hlt();
@@ -356,11 +381,25 @@ int8_t kmain64(size_t entry_point) {
 
     PRINTLOG(KERNEL, LOG_INFO, "tasking initialized");
 
+    if(memory_pressure_init() != 0) {
+        PRINTLOG(KERNEL, LOG_ERROR, "cannot init memory pressure task.");
+    }
+
+    // aps copy cr4 of boot cpu, so pcid should be enabled before smp init
+    if(memory_paging_tlb_init() != 0) {
+        PRINTLOG(KERNEL, LOG_FATAL, "cannot init tlb shootdowns. Halting...");
+        cpu_hlt();
+    }
+
     if(smp_init() != 0) {
         PRINTLOG(KERNEL, LOG_FATAL, "cannot init smp. Halting...");
         cpu_hlt();
     }
 
+    if(workqueue_init() != 0) {
+        PRINTLOG(KERNEL, LOG_ERROR, "cannot init work queues, interrupt handlers do their work inline.");
+    }
+
     if(console_virtio_init() != 0) {
         PRINTLOG(KERNEL, LOG_FATAL, "cannot init virtio console. Halting...");
         cpu_hlt();
@@ -114,9 +114,36 @@ static int8_t network_send_packet_to_nic(network_transmit_packet_t* orginal_pack
 #pragma GCC diagnostic pop
 
 extern uint64_t network_vnet_tx_task_id;
+extern uint64_t network_e1000_tx_task_id;
+
+/**
+ * @brief wakes transmit tasks of nics, they sleep while their queues are empty
+ */
+static void network_wake_tx_tasks(void) {
+    if(network_vnet_tx_task_id) {
+        task_set_message_received(network_vnet_tx_task_id);
+    }
+
+    if(network_e1000_tx_task_id) {
+        task_set_message_received(network_e1000_tx_task_id);
+    }
+}
+
+int8_t network_transmit_packet_push(list_t* return_queue, network_transmit_packet_t* packet) {
+    if(list_queue_push(return_queue, packet) == -1ULL) {
+        return -1;
+    }
+
+    network_wake_tx_tasks();
+
+    return 0;
+}
 
 int8_t network_process_rx(void){
-    network_received_packets = list_create_queue_with_heap(NULL);
+    // nic drivers push received packets at their interrupt handlers
+    list_t* received_packets = list_create_queue_with_heap(NULL);
+    list_set_interrupt_safe(received_packets);
+    network_received_packets = received_packets;
 
     task_add_message_queue(network_received_packets);
 
@@ -159,8 +186,8 @@ int8_t network_process_rx(void){
                                     break;
                                 }
 
-                                if(notify_vnet_tx && network_vnet_tx_task_id) {
-                                    task_set_message_received(network_vnet_tx_task_id);
+                                if(notify_vnet_tx) {
+                                    network_wake_tx_tasks();
                                     notify_vnet_tx = false;
                                 }
                             }
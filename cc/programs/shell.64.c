@@ -69,6 +69,28 @@ static int8_t shell_handle_module_command(char_t* arguments) {
     return -1;
 }
 
+static int8_t shell_handle_heapprof_command(char_t* arguments) {
+    argument_parser_t parser = {arguments, 0};
+
+    char_t* command = argument_parser_advance(&parser);
+
+    if(strncmp("start", command, 5) == 0) {
+        char_t* interval_str = argument_parser_advance(&parser);
+        uint64_t interval = interval_str ? atoh(interval_str) : 0;
+
+        return memory_profiler_start(interval);
+    } else if(strncmp("stop", command, 4) == 0) {
+        return memory_profiler_stop();
+    } else if(strncmp("dump", command, 4) == 0) {
+        return memory_profiler_dump();
+    }
+
+    printf("Unknown command: %s\n", command);
+    printf("Usage: heapprof <start [interval]|stop|dump>\n");
+
+    return -1;
+}
+
 static int8_t shell_handle_tosdb_command(char_t* arguments) {
     argument_parser_t parser = {arguments, 0};
 
@@ -170,6 +192,7 @@ static int8_t shell_handle_vm_command(char_t* arguments) {
         }
 
         list_queue_push(vm_mq, msg);
+        task_set_message_received(vmid);
 
         while(!msg->message_data_completed) {
             task_yield();
@@ -249,8 +272,10 @@ int8_t  shell_process_command(buffer_t* command_buffer, buffer_t* argument_buffe
                "\trdtsc\t\t: read timestamp counter\n"
                "\ttosdb\t\t: tosdb commands\n"
                "\tkill\t\t: kills a process with pid\n"
+               "\tnice\t\t: sets priority of a process with pid, -20 highest 19 lowest\n"
                "\tmodule\t\t: module(library) utils\n"
                "\tlog\t\t: configures the log level\n"
+               "\theapprof\t: heap profiler, dump is written to spool\n"
                );
         res = 0;
     } else if(strcmp(command, "clear") == 0) {
@@ -295,6 +320,13 @@ int8_t  shell_process_command(buffer_t* command_buffer, buffer_t* argument_buffe
                frame_get_allocator()->get_free_frame_count(frame_get_allocator()),
                frame_get_allocator()->get_allocated_frame_count(frame_get_allocator()),
                frame_get_allocator()->get_total_frame_count(frame_get_allocator()));
+
+        uint64_t node_count = frame_get_allocator()->get_node_count(frame_get_allocator());
+
+        for(uint64_t i = 0; node_count > 1 && i < node_count; i++) {
+            printf("\tnode 0x%llx free frames: 0x%llx\n", i, frame_get_allocator()->get_node_free_frame_count(frame_get_allocator(), i));
+        }
+
         res = 0;
     } else if(strcmp(command, "wm") == 0) {
         res = windowmanager_init();
@@ -304,6 +336,8 @@ int8_t  shell_process_command(buffer_t* command_buffer, buffer_t* argument_buffe
         res = shell_handle_tosdb_command(arguments);
     } else if(strcmp(command, "module") == 0) {
         res = shell_handle_module_command(arguments);
+    } else if(strcmp(command, "heapprof") == 0) {
+        res = shell_handle_heapprof_command(arguments);
     } else if(strcmp(command, "rdtsc") == 0) {
         printf("rdtsc: 0x%llx\n", rdtsc());
         res = 0;
@@ -324,6 +358,27 @@ int8_t  shell_process_command(buffer_t* command_buffer, buffer_t* argument_buffe
             task_kill_task(pid, force);
             res = 0;
         }
+    } else if(strcmp(command, "nice") == 0) {
+        uint64_t pid = atoh(argument_parser_advance(&parser));
+        char_t* nice_str = argument_parser_advance(&parser);
+
+        if(pid == 0 || nice_str == NULL) {
+            printf("Usage: nice <pid> <value>\n");
+            res = -1;
+        } else {
+            int64_t nice = atoi(nice_str);
+
+            if(nice < TASK_NICE_MIN || nice > TASK_NICE_MAX) {
+                printf("nice value should be between %i and %i\n", TASK_NICE_MIN, TASK_NICE_MAX);
+                res = -1;
+            } else {
+                res = task_set_priority(pid, (int8_t)nice);
+
+                if(res != 0) {
+                    printf("cannot set priority of 0x%llx\n", pid);
+                }
+            }
+        }
     } else if(strcmp(command, "log") == 0) {
         char_t* log_module = argument_parser_advance(&parser);
         char_t* log_level = argument_parser_advance(&parser);
@@ -375,8 +430,13 @@ int32_t shell_main(int32_t argc, char* argv[]) {
 
     task_set_interruptible();
 
-    shell_buffer = buffer_new_with_capacity(NULL, 4100);
-    mouse_buffer = buffer_new_with_capacity(NULL, 4096);
+    // input devices append reports at their interrupt handlers, buffers are published after they are interrupt safe
+    buffer_t* kbd_input_buffer = buffer_new_with_capacity(NULL, 4100);
+    buffer_t* mouse_input_buffer = buffer_new_with_capacity(NULL, 4096);
+    buffer_set_interrupt_safe(kbd_input_buffer);
+    buffer_set_interrupt_safe(mouse_input_buffer);
+    shell_buffer = kbd_input_buffer;
+    mouse_buffer = mouse_input_buffer;
     buffer_t* command_buffer = buffer_new_with_capacity(NULL, 4096);
     buffer_t* argument_buffer = buffer_new_with_capacity(NULL, 4096);
     boolean_t first_space = false;
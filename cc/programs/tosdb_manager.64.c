@@ -674,6 +674,7 @@ int8_t tosdb_manager_close(void) {
     }
 
     list_queue_push(ipc_mq, &tosdb_manager_close_ipc);
+    task_set_message_received(tosdb_manager_task_id);
 
     return 0;
 }
@@ -712,6 +713,7 @@ int8_t tosdb_manager_ipc_send_and_wait(tosdb_manager_ipc_t* ipc) {
     }
 
     list_queue_push(ipc_mq, ipc);
+    task_set_message_received(tosdb_manager_task_id);
 
     while(!ipc->is_response_done) {
         task_set_message_waiting();
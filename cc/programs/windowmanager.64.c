@@ -59,8 +59,13 @@ static int8_t windowmanager_main(void) {
 
     task_set_interruptible();
 
-    shell_buffer = buffer_new_with_capacity(NULL, 4100);
-    mouse_buffer = buffer_new_with_capacity(NULL, 4096);
+    // input devices append reports at their interrupt handlers, buffers are published after they are interrupt safe
+    buffer_t* kbd_input_buffer = buffer_new_with_capacity(NULL, 4100);
+    buffer_t* mouse_input_buffer = buffer_new_with_capacity(NULL, 4096);
+    buffer_set_interrupt_safe(kbd_input_buffer);
+    buffer_set_interrupt_safe(mouse_input_buffer);
+    shell_buffer = kbd_input_buffer;
+    mouse_buffer = mouse_input_buffer;
 
     windowmanager_clear_screen(windowmanager_current_window);
     SCREEN_FLUSH(0, 0, 0, 0, screen_info.width, screen_info.height);
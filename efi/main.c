@@ -16,6 +16,7 @@
 #include <buffer.h>
 #include <data.h>
 #include <zpack.h>
+#include <lz4.h>
 #include <xxhash.h>
 #include <tosdb/tosdb.h>
 #include <memory/paging.h>
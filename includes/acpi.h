@@ -191,6 +191,66 @@ typedef union acpi_table_madt_entry_t {
     } local_apic_address_override;
 }__attribute__((packed)) acpi_table_madt_entry_t;
 
+typedef enum acpi_srat_entry_type_t {
+    ACPI_SRAT_ENTRY_TYPE_PROCESSOR_LOCAL_APIC_AFFINITY=0,
+    ACPI_SRAT_ENTRY_TYPE_MEMORY_AFFINITY=1,
+    ACPI_SRAT_ENTRY_TYPE_PROCESSOR_LOCAL_X2APIC_AFFINITY=2,
+} acpi_srat_entry_type_t;
+
+/*! srat entry flag for enabled processors and memory ranges */
+#define ACPI_SRAT_ENTRY_FLAG_ENABLED 1
+
+typedef union acpi_table_srat_entry_t {
+    struct srat_info_t {
+        uint8_t type;
+        uint8_t length;
+    } info;
+    struct processor_local_apic_affinity_t {
+        uint8_t  type;
+        uint8_t  length;
+        uint8_t  proximity_domain_low;
+        uint8_t  apic_id;
+        uint32_t flags;
+        uint8_t  local_sapic_eid;
+        uint8_t  proximity_domain_high[3];
+        uint32_t clock_domain;
+    } processor_local_apic_affinity;
+    struct memory_affinity_t {
+        uint8_t  type;
+        uint8_t  length;
+        uint32_t proximity_domain;
+        uint16_t reserved0;
+        uint64_t base_address;
+        uint64_t length_in_bytes;
+        uint32_t reserved1;
+        uint32_t flags;
+        uint64_t reserved2;
+    }__attribute__((packed)) memory_affinity;
+    struct processor_local_x2apic_affinity_t {
+        uint8_t  type;
+        uint8_t  length;
+        uint16_t reserved0;
+        uint32_t proximity_domain;
+        uint32_t x2apic_id;
+        uint32_t flags;
+        uint32_t clock_domain;
+        uint32_t reserved1;
+    } processor_local_x2apic_affinity;
+}__attribute__((packed)) acpi_table_srat_entry_t;
+
+typedef struct acpi_table_srat_t {
+    acpi_sdt_header_t header;
+    uint32_t          reserved0;
+    uint64_t          reserved1;
+    uint8_t           entries[];
+}__attribute__((packed)) acpi_table_srat_t;
+
+typedef struct acpi_table_slit_t {
+    acpi_sdt_header_t header;
+    uint64_t          locality_count;
+    uint8_t           distances[]; ///< locality_count x locality_count matrix
+}__attribute__((packed)) acpi_table_slit_t;
+
 typedef struct acpi_contex_t {
     acpi_xrsdp_descriptor_t* xrsdp_desc;
     acpi_table_fadt_t*       fadt;
@@ -211,6 +271,13 @@ list_t* acpi_get_apic_table_entries_with_heap(memory_heap_t* heap, acpi_sdt_head
 
 int8_t acpi_setup(acpi_xrsdp_descriptor_t* desc);
 
+/**
+ * @brief parses srat and slit, passes numa topology to frame allocator. without srat memory stays at single node.
+ * @param[in] desc xrsdp descriptor
+ * @return 0 if succeed.
+ */
+int8_t acpi_numa_setup(acpi_xrsdp_descriptor_t* desc);
+
 int8_t acpi_reset(void);
 int8_t acpi_poweroff(void);
 int8_t acpi_setup_events(void);
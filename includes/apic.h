@@ -126,6 +126,9 @@
 #define APIC_TIMER_PERIODIC         (1 << 17)
 #define APIC_TIMER_TSC_DEADLINE     (2 << 17)
 
+/*! msr of tsc deadline, timer fires when tsc reaches its value, zero disarms */
+#define APIC_MSR_TSC_DEADLINE       0x6E0
+
 
 #define APIC_IOAPIC_MAX_REDIRECTION_ENTRY(r)  (((r >> 16) & 0xFF) + 1)
 
@@ -177,4 +180,16 @@ uint64_t apic_get_ap_count(void);
 
 boolean_t apic_is_waiting_timer(void);
 
+/**
+ * @brief checks if local apic timer of current cpu is one shot, aps are tickless, bsp keeps periodic tick
+ * @return true if timer should be armed for each event
+ */
+boolean_t apic_timer_is_tickless(void);
+
+/**
+ * @brief arms one shot or tsc deadline timer of current cpu
+ * @param[in] ticks tick count until interrupt, zero stops timer
+ */
+void apic_timer_arm(uint64_t ticks);
+
 #endif
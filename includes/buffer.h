@@ -246,6 +246,13 @@ uint64_t buffer_read_ints(buffer_t* buffer, uint8_t bc);
 #define buffer_read_uint32(b) buffer_read_with_int_type(b, uint32)
 #define buffer_read_uint64(b) buffer_read_with_int_type(b, uint64)
 
+/**
+ * @brief makes buffer appendable at interrupt handlers, its lock disables interrupts and buffer does not grow at append
+ * @param[in] buffer buffer which is not used yet
+ * @return boolean_t true if success
+ */
+boolean_t buffer_set_interrupt_safe(buffer_t* buffer);
+
 /**
  * @brief sets readonly flag of buffer
  * @param[in] buffer buffer to set readonly
@@ -279,6 +286,15 @@ uint8_t* buffer_get_view_at_position(const buffer_t* buffer, uint64_t position,
 /*! macro to get view from buffer from current position @see buffer_get_view_at_position */
 #define buffer_get_view(b, l) buffer_get_view_at_position(b, buffer_get_position(b), l)
 
+/**
+ * @brief ensures buffer has room for length bytes at current position and returns a writable pointer to it.
+ * position and length are not changed, after writing caller should commit written bytes with buffer_seek.
+ * @param[in] buffer buffer to reserve space
+ * @param[in] length length of bytes to reserve
+ * @return uint8_t* pointer to writable area at current position, or null if buffer is readonly or resize failed
+ */
+uint8_t* buffer_reserve(buffer_t* buffer, uint64_t length);
+
 /*! default io buffer id for stdin */
 #define BUFFER_IO_INPUT 0
 /*! default io buffer id for stdout */
@@ -36,5 +36,6 @@ boolean_t cache_put(cache_t* cache, const void* key, const void* item, uint64_t
 #define cache_put_by_count(c, k, i) cache_put(c, k, i, 1)
 #define cache_put_item_as_key(c, i, s) cache_put(c, i, i, s)
 const void* cache_get(cache_t* cache, const void* key);
+uint64_t cache_shrink(cache_t* cache, uint64_t target);
 
 #endif
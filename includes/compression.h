@@ -17,6 +17,7 @@ typedef enum compression_type_t {
     COMPRESSION_TYPE_NONE = 0,
     COMPRESSION_TYPE_ZPACK,
     COMPRESSION_TYPE_DEFLATE,
+    COMPRESSION_TYPE_LZ4,
     COMPRESSION_MAX,
 } compression_type_t;
 
@@ -15,16 +15,17 @@
 #include <types.h>
 
 typedef struct cpu_state_t {
-    uint64_t  local_apic_id; ///< local apic id
-    task_t*   current_task; ///< current task
-    task_t*   idle_task; ///< idle task
-    boolean_t tasking_enabled; ///< tasking enabled
-    boolean_t task_switch_paramters_need_eoi; ///< task switch parameters need eoi
-    boolean_t task_switch_paramters_need_sti; ///< task switch parameters need sti
-    list_t*   task_queue; ///< task list
-    list_t*   task_sleep_queue; ///< task sleep list
-    list_t*   task_wait_queue; ///< task wait list
-    list_t*   task_cleanup_queue; ///< task cleanup list
+    uint64_t                   local_apic_id; ///< local apic id
+    task_t*                    current_task; ///< current task
+    task_t*                    idle_task; ///< idle task
+    boolean_t                  tasking_enabled; ///< tasking enabled
+    boolean_t                  task_switch_paramters_need_eoi; ///< task switch parameters need eoi
+    boolean_t                  task_switch_paramters_need_sti; ///< task switch parameters need sti
+    list_t*                    task_queue; ///< task list
+    struct task_ready_queue_t* task_ready_queue; ///< woken task list
+    list_t*                    task_cleanup_queue; ///< task cleanup list
+    task_t*                    previous_task; ///< switched out task, its on_cpu is cleared after stack switch
+    uint64_t                   last_balance_tick; ///< tick count of last load balancing check
 } cpu_state_t;
 
 #endif
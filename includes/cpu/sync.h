@@ -26,6 +26,14 @@ typedef struct lock_t lock_t;
  */
 lock_t* lock_create_with_heap_for_future(memory_heap_t* heap, boolean_t for_future, uint64_t task_id);
 
+/**
+ * @brief makes lock usable at interrupt handlers, holder disables interrupts and waiters spin without yielding
+ * @param[in] lock lock which is not held yet, future locks are not changed
+ *
+ * holder should not allocate or yield while it holds lock.
+ */
+void lock_set_interrupt_safe(lock_t* lock);
+
 /**
  * @brief destroys lock
  * @param[in] lock lock to destroy
@@ -112,4 +120,141 @@ int8_t semaphore_release_with_count(semaphore_t* semaphore, uint64_t count);
  */
 #define semaphore_release(s) semaphore_release_with_count(s, 1)
 
+/**
+ * @struct spinlock_t
+ * @brief fair ticket spin lock for short kernel critical sections, zero filled lock is unlocked
+ *
+ * holder runs with interrupts disabled, so it is never preempted and lock can be taken at interrupt handlers.
+ * waiters take tickets and get lock at order, they only read owner ticket while spinning.
+ */
+typedef struct spinlock_t {
+    volatile uint32_t next_ticket; ///< ticket of next acquirer
+    volatile uint32_t owner_ticket; ///< ticket which holds lock
+    boolean_t         interrupts_enabled; ///< interrupt flag of holder before acquiring
+} spinlock_t; ///< short hand for struct
+
+/**
+ * @brief acquires spin lock and disables interrupts
+ * @param[in] lock lock to acquire
+ */
+void spinlock_acquire(spinlock_t* lock);
+
+/**
+ * @brief releases spin lock and restores interrupts
+ * @param[in] lock lock to release
+ */
+void spinlock_release(spinlock_t* lock);
+
+/*! reader writer lock type */
+typedef struct rwlock_t rwlock_t;
+
+/**
+ * @brief creates reader writer lock for read mostly structures
+ * @param[in] heap heap for lock
+ * @return lock
+ */
+rwlock_t* rwlock_create_with_heap(memory_heap_t* heap);
+
+/**
+ * @brief macro for creating reader writer lock with default heap
+ */
+#define rwlock_create() rwlock_create_with_heap(NULL)
+
+/**
+ * @brief destroys reader writer lock
+ * @param[in] lock lock to destroy
+ * @return 0 if succeed
+ */
+int8_t rwlock_destroy(rwlock_t* lock);
+
+/**
+ * @brief acquires lock for reading, readers share lock and wait only a writer which holds it
+ * @param[in] lock lock to acquire
+ */
+void rwlock_read_acquire(rwlock_t* lock);
+
+/**
+ * @brief releases lock of a reader
+ * @param[in] lock lock to release
+ */
+void rwlock_read_release(rwlock_t* lock);
+
+/**
+ * @brief acquires lock for writing, writer holds it with interrupts disabled, it is not recursive and it should not allocate or yield
+ * @param[in] lock lock to acquire
+ */
+void rwlock_write_acquire(rwlock_t* lock);
+
+/**
+ * @brief releases lock of writer and restores interrupts
+ * @param[in] lock lock to release
+ */
+void rwlock_write_release(rwlock_t* lock);
+
+/*! wakes all waiters of a futex */
+#define FUTEX_WAKE_ALL ((uint64_t)-1)
+
+/**
+ * @brief blocks current task while value at address equals expected, task consumes no cpu until it is woken
+ * @param[in] address address to wait
+ * @param[in] expected value which task sleeps with
+ * @return 0 after wake, -1 if value is already different
+ *
+ * wake can be spurious, so caller checks its condition again.
+ * before tasking it spins until value changes.
+ */
+int8_t futex_wait(volatile uint32_t* address, uint32_t expected);
+
+/**
+ * @brief wakes tasks waiting at address, can be called from interrupt handlers
+ * @param[in] address address which tasks wait
+ * @param[in] count maximum task count to wake, @ref FUTEX_WAKE_ALL for all
+ * @return woken task count
+ */
+uint64_t futex_wake(volatile uint32_t* address, uint64_t count);
+
+/*! condition variable type */
+typedef struct condvar_t condvar_t;
+
+/**
+ * @brief creates condition variable
+ * @param[in] heap heap for condition variable
+ * @return condition variable
+ */
+condvar_t* condvar_create_with_heap(memory_heap_t* heap);
+
+/**
+ * @brief macro for creating condition variable with default heap
+ */
+#define condvar_create() condvar_create_with_heap(NULL)
+
+/**
+ * @brief destroys condition variable
+ * @param[in] condvar condition variable to destroy
+ * @return 0 if succeed
+ */
+int8_t condvar_destroy(condvar_t* condvar);
+
+/**
+ * @brief releases lock, sleeps until condition variable is signaled and acquires lock again
+ * @param[in] condvar condition variable to wait
+ * @param[in] lock lock which protects condition, it should be held
+ * @return 0 if succeed
+ */
+int8_t condvar_wait(condvar_t* condvar, lock_t* lock);
+
+/**
+ * @brief wakes one waiter of condition variable
+ * @param[in] condvar condition variable to signal
+ * @return 0 if succeed
+ */
+int8_t condvar_signal(condvar_t* condvar);
+
+/**
+ * @brief wakes all waiters of condition variable
+ * @param[in] condvar condition variable to broadcast
+ * @return 0 if succeed
+ */
+int8_t condvar_broadcast(condvar_t* condvar);
+
 #endif
@@ -16,9 +16,20 @@
 #include <list.h>
 #include <buffer.h>
 #include <utils.h>
+#include <time/timer.h>
 
 /*! maximum tick count of a task without yielding */
 #define TASK_MAX_TICK_COUNT 10
+/*! tick count between load balancing checks of a cpu */
+#define TASK_BALANCE_TICK_COUNT 100
+/*! minimum tick count of a task before it is preempted, time slices of low weight tasks are not shorter */
+#define TASK_MIN_GRANULARITY_TICK_COUNT 2
+/*! highest priority nice value */
+#define TASK_NICE_MIN -20
+/*! lowest priority nice value */
+#define TASK_NICE_MAX 19
+/*! weight of nice value 0, virtual runtime advances with real time at this weight */
+#define TASK_NICE_0_WEIGHT 1024
 
 #define TASK_IDLE_TASK_ID 1
 /*! kernel task id*/
@@ -110,6 +121,7 @@ typedef enum task_state_t {
 typedef enum task_attribute_t {
     TASK_ATTRIBUTE_NONE = 0x0, ///< no attribute
     TASK_ATTRIBUTE_INTERRUPTIBLE = 0x1, ///< task is interruptible
+    TASK_ATTRIBUTE_PINNED = 0x2, ///< task is never moved to another cpu
 } task_attribute_t; ///< short hand for enum
 
 typedef struct task_registers_t {
@@ -147,13 +159,23 @@ typedef struct task_t {
     uint64_t                     task_switch_count; ///< task switch count
     task_state_t                 state; ///< task state
     task_attribute_t             attributes; ///< task attributes
+    volatile boolean_t           on_cpu; ///< a cpu uses task's stack, cleared after the cpu loads another task
+    volatile boolean_t           parked; ///< task waits an event at no queue, waker moves it to ready queue
+    int8_t                       nice; ///< priority between @ref TASK_NICE_MIN and @ref TASK_NICE_MAX, lower is more cpu time
+    uint64_t                     vruntime; ///< run time scaled by weight of nice, run queues are ordered by it
+    uint64_t                     run_time; ///< consumed cpu time in rdtsc ticks
     void*                        entry_point; ///< entry point address
     uint64_t                     arguments_count; ///< argument count
     void**                       arguments; ///< argument list
     void*                        stack; ///< stack pointer
     uint64_t                     stack_size; ///< stack size of task
     list_t*                      message_queues; ///< task's listining queues.
-    uint64_t                     wake_tick; ///< tick value when task wakes up
+    time_timer_t                 sleep_timer; ///< wakes sleeping task
+    uint64_t                     tlb_generation; ///< tlb batch generation of task's invalidations, task is not migrated until it is flushed
+    volatile uint32_t*           futex_address; ///< address which task waits at, NULL if it is not at a futex queue
+    struct task_t*               futex_next; ///< next waiter at futex bucket
+    struct task_t*               futex_prev; ///< previous waiter at futex bucket
+    struct task_t*               ready_next; ///< next task at ready queue of cpu
     const char*                  task_name; ///< task name
     memory_page_table_context_t* page_table; ///< page table
     buffer_t*                    input_buffer; ///< input buffer
@@ -190,6 +212,32 @@ void task_switch_task(void);
  */
 void task_yield(void);
 
+/**
+ * @brief checks current task of cpu used its weighted time slice, idle task never expires, called from timer interrupt
+ * @return true if task should be preempted
+ */
+boolean_t task_is_time_slice_expired(void);
+
+/**
+ * @brief pulls a task from busiest cpu's run queue when current cpu is underloaded, called from timer interrupt
+ */
+void task_balance(void);
+
+/**
+ * @brief sets priority of task
+ * @param[in] task_id task id, 0 for current task
+ * @param[in] nice nice value between @ref TASK_NICE_MIN and @ref TASK_NICE_MAX
+ * @return 0 if succeed
+ */
+int8_t task_set_priority(uint64_t task_id, int8_t nice);
+
+/**
+ * @brief returns priority of task
+ * @param[in] task_id task id, 0 for current task
+ * @return nice value, 0 if task not found
+ */
+int8_t task_get_priority(uint64_t task_id);
+
 /**
  * @brief returns current task's id
  * @return task id
@@ -224,6 +272,19 @@ void task_set_interruptible(void);
  */
 void task_set_interrupt_received(uint64_t task_id);
 
+/**
+ * @brief sets task state and moves task to ready queue of its cpu if it is parked
+ * @param[in] task task to wake
+ * @param[in] state new state of task, it should not be a waiting state
+ */
+void task_wake_task(task_t* task, task_state_t state);
+
+/**
+ * @brief removes task from futex queue which it waits, ended tasks call it before they are freed
+ * @param[in] task task
+ */
+void futex_remove_task(task_t* task);
+
 
 void task_set_message_received(uint64_t tid);
 
@@ -236,8 +297,11 @@ void task_add_message_queue(list_t* queue);
 list_t* task_get_message_queue(uint64_t task_id, uint64_t queue_number);
 #define task_get_current_task_message_queue(queue_number) task_get_message_queue(task_get_id(), queue_number)
 
+/*! cpu id of task creation for least loaded cpu */
+#define TASK_CPU_ID_ANY ((uint64_t)-1)
+
 /**
- * @brief creates a task and apends it to wait queue
+ * @brief creates a task and apends it to run queue of a cpu
  * @param[in] heap creator heap
  * @param[in] heap_size task's heap size, heap allocated with frame allocator
  * @param[in] stack_size task's stack size, stack allocated with frame allocator
@@ -245,8 +309,22 @@ list_t* task_get_message_queue(uint64_t task_id, uint64_t queue_number);
  * @param[in] args_cnt argument count
  * @param[in] args argument list
  * @param[in] task_name task's name
+ * @param[in] cpu_id cpu which task is pinned to, @ref TASK_CPU_ID_ANY for least loaded cpu without pinning
+ * @return task id, -1 on error
+ */
+uint64_t task_create_task_ext(memory_heap_t* heap, uint64_t heap_size, uint64_t stack_size, void* entry_point, uint64_t args_cnt, void** args, const char_t* task_name, uint64_t cpu_id);
+
+/**
+ * @brief creates a task at least loaded cpu
+ * @param[in] h creator heap
+ * @param[in] hs task's heap size
+ * @param[in] ss task's stack size
+ * @param[in] ep task's entry point
+ * @param[in] ac argument count
+ * @param[in] a argument list
+ * @param[in] n task's name
  */
-uint64_t task_create_task(memory_heap_t* heap, uint64_t heap_size, uint64_t stack_size, void* entry_point, uint64_t args_cnt, void** args, const char_t* task_name);
+#define task_create_task(h, hs, ss, ep, ac, a, n) task_create_task_ext(h, hs, ss, ep, ac, a, n, TASK_CPU_ID_ANY)
 
 /**
  * @brief idle task checks if there is any task neeeds to run. it speeds up task running
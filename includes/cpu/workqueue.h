@@ -0,0 +1,54 @@
+/**
+ * @file workqueue.h
+ * @brief per cpu work queues for deferred work of interrupt handlers
+ *
+ * This work is licensed under TURNSTONE OS Public License.
+ * Please read and understand latest version of Licence.
+ */
+#ifndef ___CPU_WORKQUEUE_H
+/*! prevent duplicate header error macro */
+#define ___CPU_WORKQUEUE_H 0
+
+#include <types.h>
+
+/**
+ * @brief work callback, called at worker task of the cpu which work is scheduled from
+ * @param[in] data data of work
+ */
+typedef void (*workqueue_work_f)(void* data);
+
+/**
+ * @struct workqueue_work_t
+ * @brief deferred work item, owner embeds it so scheduling does not allocate
+ */
+typedef struct workqueue_work_t {
+    struct workqueue_work_t* next; ///< next work at queue
+    workqueue_work_f         callback; ///< callback of work
+    void*                    data; ///< data of callback
+    volatile boolean_t       pending; ///< work is at a queue and its callback is not started
+} workqueue_work_t; ///< short hand for struct
+
+/**
+ * @brief creates work queues and their worker tasks pinned to each cpu, should be called after smp init
+ * @return 0 if succeed, -1 if a worker cannot be created, then created workers are killed and queues are freed
+ */
+int8_t workqueue_init(void);
+
+/**
+ * @brief fills work item
+ * @param[out] work work item
+ * @param[in] callback callback of work
+ * @param[in] data data of callback
+ */
+void workqueue_work_init(workqueue_work_t* work, workqueue_work_f callback, void* data);
+
+/**
+ * @brief queues work at current cpu without locks, can be called from interrupt handlers
+ * @param[in] work work item
+ * @return 0 if work is queued or it is already pending, -1 if there is no worker so caller should do work itself
+ *
+ * a pending work is not queued again, so bursty interrupts are batched into one callback.
+ */
+int8_t workqueue_schedule(workqueue_work_t* work);
+
+#endif
@@ -14,7 +14,128 @@
 
 #include <compression.h>
 
+/*! level 0 emits stored blocks without compression */
+#define DEFLATE_LEVEL_STORE 0
+/*! fastest level with matching */
+#define DEFLATE_LEVEL_FAST 1
+/*! level used by deflate_deflate */
+#define DEFLATE_LEVEL_DEFAULT 6
+/*! slowest level with longest hash chains */
+#define DEFLATE_LEVEL_MAX 9
+
 int8_t deflate_deflate(buffer_t* in, buffer_t* out);
 int8_t deflate_inflate(buffer_t* in, buffer_t* out);
 
+/**
+ * @brief packs input with given level. levels trade speed for ratio like zlib: higher levels walk
+ * longer hash chains and from level 4 on matches are evaluated lazily.
+ * @param[in] in input buffer
+ * @param[in] out output buffer
+ * @param[in] level compression level between DEFLATE_LEVEL_STORE and DEFLATE_LEVEL_MAX
+ * @return 0 on success
+ */
+int8_t deflate_deflate_with_level(buffer_t* in, buffer_t* out, uint8_t level);
+
+/**
+ * @brief packs input as independent chunks on worker tasks across cpus, pigz style.
+ * each chunk is primed with 32 KiB before it and non final chunks end with a sync flush
+ * (empty stored block), so compressed chunks join into one valid stream. without tasking
+ * chunks are compressed one by one. deflate_deflate selects this mode for large inputs.
+ * @param[in] in input buffer
+ * @param[in] out output buffer
+ * @param[in] worker_count chunks compressed at the same time, 0 selects cpu count
+ * @param[in] level compression level
+ * @return 0 on success
+ */
+int8_t deflate_deflate_parallel(buffer_t* in, buffer_t* out, uint64_t worker_count, uint8_t level);
+
+/**
+ * @enum deflate_stream_status_t
+ * @brief result of a streaming deflate/inflate call
+ */
+typedef enum deflate_stream_status_t {
+    DEFLATE_STREAM_ERROR=-1, ///< stream is corrupted or out of memory, stream is unusable
+    DEFLATE_STREAM_OK=0, ///< all input is consumed, feed more input or finish
+    DEFLATE_STREAM_OUTPUT_FULL=1, ///< output window is full, drain it and call again with same input
+    DEFLATE_STREAM_END=2, ///< stream is complete and all output is written
+} deflate_stream_status_t;
+
+/**
+ * @struct deflate_stream_t
+ * @brief opaque streaming deflate/inflate context.
+ *
+ * a stream keeps a 32 KiB sliding history and a single block of state, so memory usage does not
+ * depend on total data size. input is consumed from buffer position, output is written to a caller
+ * provided window and written byte count is returned.
+ */
+typedef struct deflate_stream_t deflate_stream_t;
+
+/**
+ * @brief creates a streaming compressor
+ * @return stream context or NULL
+ */
+deflate_stream_t* deflate_deflate_stream_init(void);
+
+/**
+ * @brief creates a streaming compressor with given level
+ * @param[in] level compression level between DEFLATE_LEVEL_STORE and DEFLATE_LEVEL_MAX
+ * @return stream context or NULL
+ */
+deflate_stream_t* deflate_deflate_stream_init_with_level(uint8_t level);
+
+/**
+ * @brief compresses input buffer's remaining bytes
+ * @param[in] stream stream context
+ * @param[in] in input buffer, consumed bytes are skipped
+ * @param[out] out output window
+ * @param[in] out_len output window size
+ * @param[out] out_written bytes written to output window
+ * @return DEFLATE_STREAM_OK when input is consumed, DEFLATE_STREAM_OUTPUT_FULL when output window is full
+ */
+deflate_stream_status_t deflate_deflate_stream_feed(deflate_stream_t* stream, buffer_t* in, uint8_t* out, uint64_t out_len, uint64_t* out_written);
+
+/**
+ * @brief compresses pending input as last block and flushes it
+ * @param[in] stream stream context
+ * @param[out] out output window
+ * @param[in] out_len output window size
+ * @param[out] out_written bytes written to output window
+ * @return DEFLATE_STREAM_END when stream is complete, DEFLATE_STREAM_OUTPUT_FULL when it should be called again
+ */
+deflate_stream_status_t deflate_deflate_stream_finish(deflate_stream_t* stream, uint8_t* out, uint64_t out_len, uint64_t* out_written);
+
+/**
+ * @brief creates a streaming decompressor
+ * @return stream context or NULL
+ */
+deflate_stream_t* deflate_inflate_stream_init(void);
+
+/**
+ * @brief decompresses input buffer's remaining bytes, a few trailing bytes may be held until more input or finish
+ * @param[in] stream stream context
+ * @param[in] in input buffer, consumed bytes are skipped
+ * @param[out] out output window
+ * @param[in] out_len output window size
+ * @param[out] out_written bytes written to output window
+ * @return DEFLATE_STREAM_OK, DEFLATE_STREAM_OUTPUT_FULL, DEFLATE_STREAM_END or DEFLATE_STREAM_ERROR
+ */
+deflate_stream_status_t deflate_inflate_stream_feed(deflate_stream_t* stream, buffer_t* in, uint8_t* out, uint64_t out_len, uint64_t* out_written);
+
+/**
+ * @brief marks end of input, decodes held bytes and flushes output
+ * @param[in] stream stream context
+ * @param[out] out output window
+ * @param[in] out_len output window size
+ * @param[out] out_written bytes written to output window
+ * @return DEFLATE_STREAM_END when stream is complete, DEFLATE_STREAM_OUTPUT_FULL when it should be called again
+ */
+deflate_stream_status_t deflate_inflate_stream_finish(deflate_stream_t* stream, uint8_t* out, uint64_t out_len, uint64_t* out_written);
+
+/**
+ * @brief destroys a streaming context
+ * @param[in] stream stream context
+ * @return 0 on success
+ */
+int8_t deflate_stream_destroy(deflate_stream_t* stream);
+
 #endif
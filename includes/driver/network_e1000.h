@@ -13,6 +13,7 @@
 #include <pci.h>
 #include <network/network_protocols.h>
 #include <network/network_ethernet.h>
+#include <cpu/workqueue.h>
 
 // mmio register offsets at bar0
 #define NETWORK_E1000_REG_CTRL      0x0000
@@ -196,6 +197,8 @@ typedef struct {
 
     volatile network_e1000_tx_desc_t* tx_desc; // transmit descriptor buffer
     volatile uint16_t                 tx_tail;
+
+    workqueue_work_t rx_work; // rx poll deferred by interrupt handler
 }network_e1000_dev_t;
 
 int8_t network_e1000_init(const pci_dev_t* pci_netdev);
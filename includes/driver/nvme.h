@@ -17,6 +17,7 @@
 #include <future.h>
 #include <hashmap.h>
 #include <disk.h>
+#include <cpu/workqueue.h>
 
 /**
  * @brief initialize nvme devices
@@ -542,6 +543,7 @@ typedef struct nvme_disk_t {
     uint64_t                       max_prp_entries; ///< max prp entries
     int64_t                        active_command_count; ///< active command count
     boolean_t                      current_phase; ///< current phase
+    workqueue_work_t               completion_work; ///< io completions, interrupt defers them to work queue
 } nvme_disk_t; ///< shorthand for struct
 
 
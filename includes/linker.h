@@ -249,4 +249,5 @@ int8_t    linker_dump_program_to_array(linker_context_t* ctx, linker_program_dum
 void linker_build_modules_at_memory(void);
 void linker_print_modules_at_memory(void);
 void linker_print_module_info_at_memory(uint64_t module_id);
+const char_t* linker_get_module_name_at_memory(uint64_t module_id);
 #endif
@@ -106,6 +106,15 @@ list_t* list_create_with_type(memory_heap_t* heap, list_type_t type,
  */
 memory_heap_t* list_get_heap(list_t* list);
 
+/**
+ * @brief makes list usable at interrupt handlers, its operations disable interrupts and never yield
+ * @param[in]  list list which is not used yet
+ * @return 0 on success
+ *
+ * inserts, including sorted ones, and deletes do not allocate under lock, other operations should not be used at interrupt handlers.
+ */
+int8_t list_set_interrupt_safe(list_t* list);
+
 /**
  * @brief sets list's capacity
  * @param[in]  list       list to be modified
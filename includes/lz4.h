@@ -0,0 +1,35 @@
+/**
+ * @file lz4.h
+ * @brief lz4 block compression algorithm header
+ *
+ * lz4 trades compression ratio for speed: tokens are byte aligned, there is no entropy coding
+ * and decompression copies literals and matches with wide overlapping moves.
+ * packed stream starts with 64 bit little endian unpacked size followed by a single lz4 block.
+ *
+ * This work is licensed under TURNSTONE OS Public License.
+ * Please read and understand latest version of Licence.
+ */
+
+#ifndef ___LZ4_H
+/*! prevent duplicate header error macro */
+#define ___LZ4_H 0
+
+#include <compression.h>
+
+/**
+ * @brief packs data at input buffer to output buffer with lz4 algorithm
+ * @param[in] in input buffer
+ * @param[in] out output buffer
+ * @return 0 on success
+ */
+int8_t lz4_pack(buffer_t* in, buffer_t* out);
+
+/**
+ * @brief unpacks data at input buffer to output buffer with lz4 algorithm
+ * @param[in] in input buffer
+ * @param[in] out output buffer
+ * @return 0 on success
+ */
+int8_t lz4_unpack(buffer_t* in, buffer_t* out);
+
+#endif
@@ -39,23 +39,185 @@ typedef struct memory_heap_t {
     void (* stat)(struct memory_heap_t*, memory_heap_stat_t*); ///< return heap stats
     lock_t*  lock; ///< heap's lock
     uint64_t task_id; ///< task id of heap
+    void* (* malloc_cached)(struct memory_heap_t*, size_t, size_t); ///< optional per cpu cache malloc without heap lock, returns NULL when request should go to malloc
+    int8_t (* free_cached)(struct memory_heap_t*, void*); ///< optional per cpu cache free without heap lock, returns -1 when address should go to free
 } memory_heap_t; ///< short hand for struct
 
 /**
  * @brief creates simple heap
  * @param[in]  start start address of heap
  * @param[in]  end   end address of heap
+ * @param[in]  zeroed memory is already zero (such as demand paged memory) and it is not cleaned
  * @return       heap
  */
-memory_heap_t* memory_create_heap_simple(size_t start, size_t end);
+memory_heap_t* memory_create_heap_simple_ext(size_t start, size_t end, boolean_t zeroed);
+/*! creates simple heap after cleaning its memory */
+#define memory_create_heap_simple(s, e) memory_create_heap_simple_ext(s, e, false)
 
 /**
  * @brief creates hash backended heap
  * @param[in]  start start address of heap
  * @param[in]  end   end address of heap
+ * @param[in]  zeroed memory is already zero (such as demand paged memory) and it is not cleaned
  * @return       heap
  */
-memory_heap_t* memory_create_heap_hash(size_t start, size_t end);
+memory_heap_t* memory_create_heap_hash_ext(size_t start, size_t end, boolean_t zeroed);
+/*! creates hash heap after cleaning its memory */
+#define memory_create_heap_hash(s, e) memory_create_heap_hash_ext(s, e, false)
+
+/**
+ * @brief creates arena heap. arena bump allocates from chunks taken from parent heap, ignores frees
+ * and releases all memory at reset or destroy. it suits workloads building many small objects which
+ * die together, callers pass arena to memory_malloc_ext/list/hashmap creators like any other heap.
+ * @param[in] parent heap of chunks, NULL means current heap
+ * @param[in] chunk_size usable size of chunks, 0 means 64 KiB
+ * @return heap
+ */
+memory_heap_t* memory_create_heap_arena(memory_heap_t* parent, size_t chunk_size);
+
+/**
+ * @brief releases all allocations of arena, first chunk is kept for reuse
+ * @param[in] heap arena heap
+ * @return 0 on success
+ */
+int8_t memory_heap_arena_reset(memory_heap_t* heap);
+
+/**
+ * @brief destroys arena heap and returns its chunks to parent heap
+ * @param[in] heap arena heap
+ * @return 0 on success
+ */
+int8_t memory_destroy_heap_arena(memory_heap_t* heap);
+
+/**
+ * @brief puts per cpu magazines of recently freed small blocks in front of a hash heap.
+ * common small malloc/free pairs are served from current cpu's magazines without heap lock,
+ * magazines are refilled from and flushed to heap's pools in batches. magazines keep blocks of
+ * heap forever, so they should only be enabled for heaps living as long as kernel.
+ * @param[in] heap hash heap
+ * @return 0 on success
+ */
+int8_t memory_heap_hash_enable_magazines(memory_heap_t* heap);
+
+/**
+ * @brief returns current cpu's id for per cpu caches of heaps
+ * @param[out] cpu_id current cpu's id, only valid while interrupts are disabled
+ * @return true if cpu id is known, per cpu caches are not used before
+ */
+boolean_t memory_get_cpu_id(uint64_t* cpu_id);
+
+/**
+ * @struct memory_cache_t
+ * @brief slab cache of fixed size objects, opaque type.
+ *
+ * objects are carved from page sized slabs without per object headers. each cpu keeps a short free
+ * list, so common alloc/free pairs do not touch the cache lock. slabs are taken from the heap which is
+ * default while the cache is created, users should only use a cache for objects they would allocate at
+ * that heap.
+ */
+typedef struct memory_cache_t memory_cache_t;
+
+/**
+ * @brief object constructor of a cache
+ * @param[in] object zeroed object
+ */
+typedef void (*memory_cache_ctor_f)(void* object);
+
+/**
+ * @brief creates a slab cache at default heap
+ * @param[in] name cache name for logs, should live as long as cache
+ * @param[in] size object size
+ * @param[in] align object alignment, 0 means 8 byte
+ * @param[in] ctor optional constructor called for each allocated object after it is zeroed
+ * @return cache or NULL
+ */
+memory_cache_t* memory_cache_create(const char_t* name, size_t size, size_t align, memory_cache_ctor_f ctor);
+
+/**
+ * @brief destroys cache, all objects should be freed before
+ * @param[in] cache cache to destroy
+ * @return 0 on success, -1 if cache has live objects
+ */
+int8_t memory_cache_destroy(memory_cache_t* cache);
+
+/**
+ * @brief allocates a zeroed and constructed object from cache
+ * @param[in] cache cache
+ * @return object or NULL
+ */
+void* memory_cache_alloc(memory_cache_t* cache);
+
+/**
+ * @brief returns object to its cache
+ * @param[in] cache cache which object is allocated from
+ * @param[in] object object to free
+ * @return 0 on success, -1 if object does not belong to a cache
+ */
+int8_t memory_cache_free(memory_cache_t* cache, void* object);
+
+/**
+ * @brief returns cache at slot if objects of heap can be allocated from it. cache is created at first
+ * call with default heap. callers should fall back to heap mallocs when NULL is returned.
+ * @param[in,out] cache_slot lazily filled cache pointer of caller
+ * @param[in] heap heap which caller would allocate objects at
+ * @param[in] name cache name
+ * @param[in] size object size
+ * @param[in] align object alignment
+ * @param[in] ctor optional object constructor
+ * @return cache or NULL
+ */
+memory_cache_t* memory_cache_get_for_heap(memory_cache_t** cache_slot, memory_heap_t* heap,
+                                          const char_t* name, size_t size, size_t align, memory_cache_ctor_f ctor);
+
+/**
+ * @brief returns heap where cache takes its slabs from
+ * @param[in] cache cache
+ * @return heap of cache
+ */
+memory_heap_t* memory_cache_get_heap(memory_cache_t* cache);
+
+/**
+ * @brief replaces slab allocations of caches at heap with their object counts, so heap stats count
+ * cache objects as mallocs/frees and leak analysis still works
+ * @param[in] heap heap of stats
+ * @param[in,out] stat heap stats to adjust
+ */
+void memory_cache_adjust_heap_stat(memory_heap_t* heap, memory_heap_stat_t* stat);
+
+/**
+ * @brief registers address range of heap at global ownership map. memory_free_ext without heap finds
+ * owner of address with a lock free lookup and frees it at owner, so frees of other tasks' memory go
+ * to correct heap. ranges are page granular and should not overlap, heap should unregister its range
+ * before its memory is reused.
+ * @param[in] heap owner heap
+ * @param[in] start range start
+ * @param[in] end range end
+ * @return 0 on success
+ */
+int8_t memory_heap_register_range(memory_heap_t* heap, uint64_t start, uint64_t end);
+
+/**
+ * @brief removes address range of heap from ownership map
+ * @param[in] heap owner heap
+ * @param[in] start range start
+ * @param[in] end range end
+ * @return 0 on success
+ */
+int8_t memory_heap_unregister_range(memory_heap_t* heap, uint64_t start, uint64_t end);
+
+/**
+ * @brief finds heap owning address without locks
+ * @param[in] address address to look up
+ * @return owner heap or NULL if address is not at a registered range
+ */
+memory_heap_t* memory_heap_find_owner(const void* address);
+
+/**
+ * @brief hides tables of ownership map from heap stats like cache slabs
+ * @param[in] heap heap of stats
+ * @param[in,out] stat heap stats to adjust
+ */
+void memory_heap_owner_adjust_heap_stat(memory_heap_t* heap, memory_heap_stat_t* stat);
 
 /**
  * @brief sets default heap
@@ -92,7 +254,8 @@ void memory_get_heap_stat_ext(memory_heap_t* heap, memory_heap_stat_t* stat);
  * @param[in]  address address to free
  * @return  0 if successed.
  *
- * if heap is NULL, address will be freed at default heap
+ * if heap is NULL, address will be freed at its owner heap from ownership map, unregistered
+ * addresses are freed at current task's heap or default heap
  */
 __attribute__((no_reorder)) int8_t memory_free_ext(memory_heap_t* heap, void* address);
 /*! frees memory addr at default heap */
@@ -151,4 +314,125 @@ int8_t memory_memcopy(const void* source, void* destination, size_t size);
  */
 int8_t memory_memcompare(const void* mem1, const void* mem2, size_t size);
 
+/**
+ * @struct memory_functions_t
+ * @brief implementations behind memory_memset, memory_memclean, memory_memcopy and memory_memcompare.
+ * arguments are checked by callers, so implementations only do the work.
+ */
+typedef struct memory_functions_t {
+    void (*   memset)(void* address, uint8_t value, size_t size); ///< memset implementation
+    void (*   memclean)(void* address, size_t size); ///< memclean implementation
+    void (*   memcopy)(const void* source, void* destination, size_t size); ///< memcopy implementation
+    int8_t (* memcompare)(const void* mem1, const void* mem2, size_t size); ///< memcompare implementation
+} memory_functions_t; ///< short hand for struct
+
+/**
+ * @brief replaces generic memory function implementations, NULL members keep current ones
+ * @param[in] functions new implementations
+ */
+void memory_set_functions(const memory_functions_t* functions);
+
+/**
+ * @brief selects memory function implementations for boot cpu's features with cpuid
+ * @return 0 on success
+ */
+int8_t memory_simd_init(void);
+
+/**
+ * @brief shrinker callback, releases cached memory of its owner
+ * @param[in] context registered context
+ * @param[in] target requested byte count to be released
+ * @return released byte count
+ */
+typedef uint64_t (*memory_shrinker_f)(void* context, uint64_t target);
+
+/*! wakes memory pressure handler after a notification */
+typedef void (*memory_pressure_waker_f)(void);
+
+/**
+ * @brief registers a shrinker, it is called under memory pressure
+ * @param[in] name shrinker name for logs
+ * @param[in] shrinker callback
+ * @param[in] context callback context
+ * @return 0 on success
+ */
+int8_t memory_shrinker_register(const char_t* name, memory_shrinker_f shrinker, void* context);
+
+/**
+ * @brief unregisters a shrinker, waits if it is running
+ * @param[in] shrinker callback
+ * @param[in] context callback context
+ * @return 0 on success
+ */
+int8_t memory_shrinker_unregister(memory_shrinker_f shrinker, void* context);
+
+/**
+ * @brief calls shrinkers until target bytes are released, concurrent calls return immediately
+ * @param[in] target requested byte count
+ * @return released byte count
+ */
+uint64_t memory_shrink(uint64_t target);
+
+/**
+ * @brief records memory pressure and wakes handler, shrinkers are not called at caller's context
+ * @param[in] target requested byte count, pending target is maximum of notifications
+ */
+void memory_pressure_notify(uint64_t target);
+
+/**
+ * @brief takes and clears pending pressure target
+ * @return pending byte count, 0 if there is no pressure
+ */
+uint64_t memory_pressure_take(void);
+
+/**
+ * @brief sets memory pressure handler waker
+ * @param[in] waker waker callback
+ */
+void memory_pressure_set_waker(memory_pressure_waker_f waker);
+
+/**
+ * @brief starts memory pressure task which calls shrinkers when notified
+ * @return 0 on success
+ */
+int8_t memory_pressure_init(void);
+
+/**
+ * @brief records a sampled allocation
+ * @param[in] address allocated address
+ * @param[in] size allocation size
+ * @param[in] weight estimated byte count represented by sample
+ */
+typedef void (*memory_profiler_record_f)(const void* address, size_t size, uint64_t weight);
+
+/*! called before an address is freed, so profiler can drop its sample */
+typedef void (*memory_profiler_forget_f)(const void* address);
+
+/**
+ * @brief sets allocation sampling hooks, a sample is taken after every sample interval bytes allocated
+ * @param[in] sample_interval byte interval between samples
+ * @param[in] record sample callback, NULL disables sampling
+ * @param[in] forget free callback
+ */
+void memory_set_profiler(uint64_t sample_interval, memory_profiler_record_f record, memory_profiler_forget_f forget);
+
+/**
+ * @brief starts sampling heap profiler, samples of previous run are dropped
+ * @param[in] sample_interval byte interval between samples, 0 selects default
+ * @return 0 on success
+ */
+int8_t memory_profiler_start(uint64_t sample_interval);
+
+/**
+ * @brief stops sampling, collected samples are kept for dump
+ * @return 0 on success
+ */
+int8_t memory_profiler_stop(void);
+
+/**
+ * @brief writes allocation sites with their live bytes and allocation rates to spool
+ * @return 0 on success
+ */
+int8_t memory_profiler_dump(void);
+
 #endif
@@ -16,6 +16,15 @@
 /*! frame size (4K) */
 #define FRAME_SIZE 4096
 
+/*! max numa node count known by frame allocator */
+#define FRAME_NUMA_MAX_NODE_COUNT  8
+/*! max memory range count of numa nodes */
+#define FRAME_NUMA_MAX_RANGE_COUNT 32
+/*! max local apic id which can be mapped to a numa node */
+#define FRAME_NUMA_MAX_CPU_COUNT   256
+/*! node value of cpus without proximity information */
+#define FRAME_NUMA_NODE_UNKNOWN    0xFF
+
 /*! frame attribure for reserved frames before relinked start */
 #define FRAME_ATTRIBUTE_OLD_RESERVED           0x0000000100000000
 /*! frame attribure for acpi reclaim memory */
@@ -46,6 +55,7 @@ typedef enum frame_allocation_type_t {
     FRAME_ALLOCATION_TYPE_RELAX = 1 << 1, ///< frames reserved non blockly
     FRAME_ALLOCATION_TYPE_BLOCK = 1 << 2, ///< frames should be continuous
     FRAME_ALLOCATION_TYPE_UNDER_4G = 1 << 3, ///< frames should be under 4G
+    FRAME_ALLOCATION_TYPE_OPPORTUNISTIC = 1 << 4, ///< caller has a fallback, failure is not logged and does not notify memory pressure
     FRAME_ALLOCATION_TYPE_USED = 1 << 7, ///< frames for using
     FRAME_ALLOCATION_TYPE_RESERVED = 1 << 8, ///< frames for reserved area
     FRAME_ALLOCATION_TYPE_OLD_RESERVED = 1 << 15, ///<frames for old reserved area (reserved areas before relinking)
@@ -62,6 +72,28 @@ typedef struct frame_t {
     uint64_t     frame_attributes; ///< frame attributes
 } frame_t; ///< short hand for struct frame_s
 
+/**
+ * @struct frame_numa_range_t
+ * @brief physical memory range of a numa node
+ */
+typedef struct frame_numa_range_t {
+    uint64_t frame_address; ///< range start address (physical)
+    uint64_t frame_count; ///< range frame count
+    uint64_t node; ///< node index of range
+} frame_numa_range_t; ///< short hand for struct frame_numa_range_t
+
+/**
+ * @struct frame_numa_topology_t
+ * @brief numa topology, node indexes are dense and start from 0
+ */
+typedef struct frame_numa_topology_t {
+    uint64_t           node_count; ///< node count
+    uint64_t           range_count; ///< memory range count
+    frame_numa_range_t ranges[FRAME_NUMA_MAX_RANGE_COUNT]; ///< memory ranges of nodes
+    uint8_t            cpu_nodes[FRAME_NUMA_MAX_CPU_COUNT]; ///< nodes of cpus by local apic id, @ref FRAME_NUMA_NODE_UNKNOWN if not known
+    uint8_t            distances[FRAME_NUMA_MAX_NODE_COUNT][FRAME_NUMA_MAX_NODE_COUNT]; ///< relative distances between nodes, 10 is local
+} frame_numa_topology_t; ///< short hand for struct frame_numa_topology_t
+
 /*! opaque struct for frame_allocator_t */
 struct frame_allocator_t;
 
@@ -144,6 +176,29 @@ typedef uint64_t (* fa_get_allocated_frame_count_f)(struct frame_allocator_t* se
  */
 typedef uint64_t (* fa_get_free_frame_count_f)(struct frame_allocator_t* self);
 
+/**
+ * @brief sets numa topology, frame allocations prefer the node of calling cpu and fall back to other nodes by distance
+ * @param[in] self frame allocator
+ * @param[in] topology numa topology, it is copied
+ * @return 0 if succeed.
+ */
+typedef int8_t (* fa_set_numa_topology_f)(struct frame_allocator_t* self, const frame_numa_topology_t* topology);
+
+/**
+ * @brief returns numa node count, it is 1 without numa topology
+ * @param[in] self frame allocator
+ * @return node count
+ */
+typedef uint64_t (* fa_get_node_count_f)(struct frame_allocator_t* self);
+
+/**
+ * @brief returns free frame count of numa node, frames at per cpu caches are not counted
+ * @param[in] self frame allocator
+ * @param[in] node node index
+ * @return free frame count of node
+ */
+typedef uint64_t (* fa_get_node_free_frame_count_f)(struct frame_allocator_t* self, uint64_t node);
+
 /**
  * @struct frame_allocator_t
  * @brief frame allocator class
@@ -160,6 +215,9 @@ typedef struct frame_allocator_t {
     fa_get_total_frame_count_f          get_total_frame_count; ///< returns total frame count
     fa_get_allocated_frame_count_f      get_allocated_frame_count; ///< returns used frame count
     fa_get_free_frame_count_f           get_free_frame_count; ///< returns free frame count
+    fa_set_numa_topology_f              set_numa_topology; ///< sets numa topology
+    fa_get_node_count_f                 get_node_count; ///< returns numa node count
+    fa_get_node_free_frame_count_f      get_node_free_frame_count; ///< returns free frame count of numa node
 } frame_allocator_t; ///< short hand for struct frame_allocator_t
 
 /**
@@ -70,6 +70,11 @@ typedef enum memory_paging_internal_frame_init_state_t {
     MEMORY_PAGING_INTERNAL_FRAME_INIT_STATE_INITIALIZED = 2,
 } memory_paging_internal_frame_init_state_t;
 
+/*! maximum cpu count joining tlb shootdowns, it is indexed by local apic id */
+#define MEMORY_PAGING_TLB_MAX_CPU_COUNT 256
+/*! 64 bit word count of cpu masks */
+#define MEMORY_PAGING_TLB_CPU_MASK_SIZE (MEMORY_PAGING_TLB_MAX_CPU_COUNT / 64)
+
 typedef struct memory_page_table_context_t {
     memory_page_table_t *                     page_table; ///< page table
     memory_paging_internal_frame_init_state_t internal_frame_init_state; ///< internal frame init state
@@ -79,6 +84,8 @@ typedef struct memory_page_table_context_t {
     uint64_t                                  internal_frames_2_start; ///< internal frames type 2
     uint64_t                                  internal_frames_2_count; ///< internal frames type 2 count
     uint64_t                                  internal_frames_helper_frame; ///< internal frames helper frame
+    uint64_t                                  pcid; ///< process context identifier of table, 0 for kernel table
+    volatile uint64_t                         active_cpus[MEMORY_PAGING_TLB_CPU_MASK_SIZE]; ///< cpus which have loaded table, shootdowns are sent them
 } memory_page_table_context_t; ///< short hand for struct
 
 
@@ -142,9 +149,92 @@ int8_t memory_paging_add_page_ext(memory_page_table_context_t* p4,
 /*! add va and fa to defeault p4 table*/
 #define memory_paging_add_page(va, fa, t)  memory_paging_add_page_ext(NULL, va, fa, t)
 
-int8_t memory_paging_delete_page_ext_with_heap(memory_page_table_context_t* p4, uint64_t virtual_address, uint64_t* frame_address);
+/**
+ * @enum memory_paging_tlb_flush_type_t
+ * @brief how tlb entries of deleted pages are invalidated
+ */
+typedef enum memory_paging_tlb_flush_type_t {
+    MEMORY_PAGING_TLB_FLUSH_TYPE_SHOOTDOWN, ///< invalidate at all cpus and wait them before return
+    MEMORY_PAGING_TLB_FLUSH_TYPE_BATCHED, ///< queue invalidation, caller calls \ref memory_paging_tlb_flush
+    MEMORY_PAGING_TLB_FLUSH_TYPE_LOCAL, ///< invalidate only at current cpu, for temporary mappings of a cpu
+} memory_paging_tlb_flush_type_t; ///< short hand for enum
+
+/**
+ * @brief deletes page of virtual address
+ * @param[in] p4 page table, NULL means current table
+ * @param[in] virtual_address virtual address of page
+ * @param[out] frame_address frame address of page if not NULL
+ * @param[in] flush_type how tlb entries are invalidated
+ * @return 0 on success
+ */
+int8_t memory_paging_delete_page_ext_with_flush(memory_page_table_context_t* p4, uint64_t virtual_address, uint64_t* frame_address, memory_paging_tlb_flush_type_t flush_type);
+/*! deletes page and shoots down its tlb entries */
+#define memory_paging_delete_page_ext_with_heap(p4, va, faptr) memory_paging_delete_page_ext_with_flush(p4, va, faptr, MEMORY_PAGING_TLB_FLUSH_TYPE_SHOOTDOWN)
 #define memory_paging_delete_page_ext(p4, va, faptr) memory_paging_delete_page_ext_with_heap(p4, va, faptr)
 #define memory_paging_delete_page(va, faptr) memory_paging_delete_page_ext_with_heap(NULL, va, faptr)
+/*! deletes page and queues its invalidation to current cpu's batch */
+#define memory_paging_delete_page_batched(p4, va, faptr) memory_paging_delete_page_ext_with_flush(p4, va, faptr, MEMORY_PAGING_TLB_FLUSH_TYPE_BATCHED)
+/*! deletes page which is only mapped at current cpu */
+#define memory_paging_delete_page_local(va, faptr) memory_paging_delete_page_ext_with_flush(NULL, va, faptr, MEMORY_PAGING_TLB_FLUSH_TYPE_LOCAL)
+
+/**
+ * @brief invalidates address at current cpu and queues it for remote cpus
+ * @param[in] table_context table of address
+ * @param[in] virtual_address address
+ */
+void memory_paging_tlb_invalidate(memory_page_table_context_t* table_context, uint64_t virtual_address);
+
+/**
+ * @brief releases a page table frame after queued invalidations are flushed, cpus may still walk it before
+ * @param[in] frame_address frame address
+ */
+void memory_paging_tlb_release_frame_after_flush(uint64_t frame_address);
+
+/**
+ * @brief sends queued invalidations of current cpu with one ipi per cpu which has loaded the table
+ *
+ * it also waits a flush of current cpu which is already in progress, so queued invalidations of caller are done at return.
+ */
+void memory_paging_tlb_flush(void);
+
+/**
+ * @brief checks a flush generation of a cpu's batch is not completed
+ * @param[in] cpu_id cpu of batch
+ * @param[in] generation generation recorded when invalidations are queued, 0 for none
+ * @return true if queued invalidations are not flushed yet, so their task should not leave the cpu
+ */
+boolean_t memory_paging_tlb_is_pending(uint64_t cpu_id, uint64_t generation);
+
+/**
+ * @brief marks table is loaded at current cpu
+ * @param[in] table_context table
+ */
+void memory_paging_tlb_mark_active(memory_page_table_context_t* table_context);
+
+/**
+ * @brief allocates a process context identifier for a new table
+ * @return pcid, 0 when pcids are exhausted
+ */
+uint64_t memory_paging_tlb_allocate_pcid(void);
+
+/**
+ * @brief builds cr3 value of table with its pcid
+ * @param[in] table_context table
+ * @return cr3 value
+ */
+uint64_t memory_paging_tlb_get_cr3(const memory_page_table_context_t* table_context);
+
+/**
+ * @brief initializes tlb shootdowns and enables pcid if cpu supports it, should be called before aps start
+ * @return 0 on success
+ */
+int8_t memory_paging_tlb_init(void);
+
+/**
+ * @brief joins current cpu to tlb shootdowns
+ * @return 0 on success
+ */
+int8_t memory_paging_tlb_ap_init(void);
 
 memory_page_table_t* memory_paging_clone_pagetable_ext(memory_page_table_context_t* table_context);
 #define memory_paging_clone_pagetable() memory_paging_clone_pagetable_ext(NULL)
@@ -199,8 +289,55 @@ int8_t memory_paging_add_va_for_frame_ext(memory_page_table_context_t* table_con
 #define memory_paging_add_va_for_frame(vas, f, t) memory_paging_add_va_for_frame_ext(NULL, vas, f, t)
 
 int8_t memory_paging_delete_va_for_frame_ext(memory_page_table_context_t* table_context, uint64_t va_start, frame_t* frm);
-#define memory_paging_delete_va_for_frame(vas, f) memory_paging_add_va_for_frame_ext(NULL, vas, f)
+#define memory_paging_delete_va_for_frame(vas, f) memory_paging_delete_va_for_frame_ext(NULL, vas, f)
 
 memory_page_table_context_t* memory_paging_build_empty_table(uint64_t internal_frame_address);
 int8_t                       memory_paging_reserve_current_page_table_frames(void);
+
+/**
+ * @brief reserves a virtual range at demand paged area without frames. frames are allocated and
+ * mapped by page fault handler at first access of each page, so reserving large ranges is cheap.
+ * range should be accessed while its page table is active.
+ * @param[in] table_context page table of range, NULL means current table
+ * @param[in] size range size, rounded up to page size
+ * @param[in] guard_size unmapped guard size below range, faults inside guard are not handled
+ * @param[in] type page type of populated pages
+ * @return range start or 0 on failure
+ */
+uint64_t memory_paging_demand_reserve_ext(memory_page_table_context_t* table_context, uint64_t size, uint64_t guard_size, memory_paging_page_type_t type);
+/*! reserves demand paged range at current page table */
+#define memory_paging_demand_reserve(s, g, t) memory_paging_demand_reserve_ext(NULL, s, g, t)
+
+/**
+ * @brief allocates and maps frames of a part of demand paged range immediately, for memory which cannot
+ * fault such as stacks
+ * @param[in] va_start start address inside range
+ * @param[in] size size of part
+ * @return 0 on success
+ */
+int8_t memory_paging_demand_populate(uint64_t va_start, uint64_t size);
+
+/**
+ * @brief populates pages of a dma buffer if it is inside a demand paged range, other buffers are already mapped
+ * @param[in] va_start buffer start
+ * @param[in] size buffer size
+ * @return 0 on success
+ *
+ * populated pages are not physically contiguous, drivers translate each page while building their descriptors.
+ */
+int8_t memory_paging_demand_populate_for_dma(uint64_t va_start, uint64_t size);
+
+/**
+ * @brief unmaps populated pages of demand paged range, releases their frames and virtual range
+ * @param[in] va_start range start returned by reserve
+ * @return 0 on success
+ */
+int8_t memory_paging_demand_release(uint64_t va_start);
+
+/**
+ * @brief populates page of address if it is inside a demand paged range, called by page fault handler
+ * @param[in] virtual_address faulting address
+ * @return 0 if page is populated, -1 if fault is not a demand fault
+ */
+int8_t memory_paging_demand_handle_fault(uint64_t virtual_address);
 #endif
@@ -40,6 +40,14 @@ extern list_t* network_received_packets;
 
 int8_t network_transmit_packet_destroyer(memory_heap_t* heap, void* data);
 
+/**
+ * @brief queues packet to transmit queue of a nic and wakes transmit tasks
+ * @param[in] return_queue transmit queue of nic
+ * @param[in] packet packet to send, queue owns it if succeed
+ * @return 0 if succeed
+ */
+int8_t network_transmit_packet_push(list_t* return_queue, network_transmit_packet_t* packet);
+
 int8_t network_init(void);
 
 #endif
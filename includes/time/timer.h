@@ -32,4 +32,64 @@ void time_timer_spinsleep(uint64_t usecs);
 
 void time_timer_sleep(uint64_t secs);
 
+/**
+ * @brief timer callback, called at timer interrupt of the cpu which timer is added from, so it should be short
+ * @param[in] data data given at adding timer
+ */
+typedef void (*time_timer_callback_f)(void* data);
+
+/*! timer wheel of a cpu */
+typedef struct time_timer_wheel_t time_timer_wheel_t;
+
+/**
+ * @struct time_timer_t
+ * @brief a timer at a timer wheel, memory is owned by caller and should live until timer fires or is cancelled
+ */
+typedef struct time_timer_t {
+    struct time_timer_t*        next; ///< next timer at same slot
+    struct time_timer_t*        prev; ///< previous timer at same slot
+    struct time_timer_t**       slot; ///< slot head which timer is linked to
+    time_timer_wheel_t* volatile wheel; ///< wheel of pending timer, NULL if timer is not pending
+    uint64_t                    deadline; ///< tick count when callback is called
+    time_timer_callback_f       callback; ///< callback
+    void*                       data; ///< callback data
+    volatile uint64_t           running_cpu; ///< one more than id of cpu which runs callback, 0 if callback is not running
+} time_timer_t; ///< short hand for struct
+
+/**
+ * @brief creates timer wheels of cpus
+ * @return 0 on success
+ */
+int8_t time_timer_wheel_init(void);
+
+/**
+ * @brief adds timer to current cpu's wheel in O(1), a pending timer is moved to new deadline
+ * @param[in] timer timer
+ * @param[in] deadline tick count when callback is called, past deadlines fire at next tick
+ * @param[in] callback callback
+ * @param[in] data callback data
+ * @return 0 on success, -1 if wheels are not created
+ */
+int8_t time_timer_add(time_timer_t* timer, uint64_t deadline, time_timer_callback_f callback, void* data);
+
+/**
+ * @brief removes pending timer from its wheel in O(1), waits callback if timer is firing at another cpu
+ * @param[in] timer timer
+ * @return 0 if timer is removed, -1 if it is not pending
+ *
+ * after return timer memory can be freed, except when it is called from timer's own callback.
+ */
+int8_t time_timer_cancel(time_timer_t* timer);
+
+/**
+ * @brief fires expired timers of current cpu's wheel, called by timer interrupt
+ */
+void time_timer_wheel_run(void);
+
+/**
+ * @brief arms one shot timer of a tickless cpu for next wheel event, stops it if there is none
+ * @param[in] max_ticks upper limit of tick count until interrupt such as time slice end, zero for no limit
+ */
+void time_timer_wheel_program(uint64_t max_ticks);
+
 #endif
@@ -12,6 +12,13 @@
 
 #include <compression.h>
 
+/*! fastest level */
+#define ZPACK_LEVEL_MIN 1
+/*! level used by zpack_pack */
+#define ZPACK_LEVEL_DEFAULT 6
+/*! slowest level with longest hash chains */
+#define ZPACK_LEVEL_MAX 9
+
 /**
  * @brief packs data at input buffer to output buffer with z77 algorithm
  * @param[in] in input buffer
@@ -20,6 +27,16 @@
  */
 int8_t zpack_pack(buffer_t* in, buffer_t* out);
 
+/**
+ * @brief packs data at input buffer to output buffer with z77 algorithm and given level.
+ * higher levels walk longer hash chains and from level 4 on matches are evaluated lazily.
+ * @param[in] in input buffer
+ * @param[in] out output buffer
+ * @param[in] level compression level between ZPACK_LEVEL_MIN and ZPACK_LEVEL_MAX
+ * @return 0 on success
+ */
+int8_t zpack_pack_with_level(buffer_t* in, buffer_t* out, uint8_t level);
+
 /**
  * @brief unpacks data at input buffer to output buffer with z77 algorithm
  * @param[in] in input buffer
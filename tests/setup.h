@@ -200,6 +200,7 @@ typedef void            * frame_t;
 typedef int8_t          memory_paging_page_type_t;
 typedef void            * memory_page_table_t;
 typedef struct future_t future_t;
+typedef struct rwlock_t rwlock_t;
 
 int8_t    memory_paging_add_va_for_frame_ext(memory_page_table_t* p4, uint64_t va_start, frame_t* frm, memory_paging_page_type_t type);
 void      dump_ram(char_t* fname);
@@ -208,8 +209,15 @@ lock_t*   lock_create_with_heap(memory_heap_t* heap);
 int8_t    lock_destroy(lock_t* lock);
 void      lock_acquire(lock_t* lock);
 void      lock_release(lock_t* lock);
+void      lock_set_interrupt_safe(lock_t* lock);
 lock_t*   lock_create_with_heap_for_future(memory_heap_t* heap, boolean_t for_future);
 future_t* future_create_with_heap_and_data(memory_heap_t* heap, lock_t* lock, void* data);
+rwlock_t* rwlock_create_with_heap(memory_heap_t* heap);
+int8_t    rwlock_destroy(rwlock_t* lock);
+void      rwlock_read_acquire(rwlock_t* lock);
+void      rwlock_read_release(rwlock_t* lock);
+void      rwlock_write_acquire(rwlock_t* lock);
+void      rwlock_write_release(rwlock_t* lock);
 void*     future_get_data_and_destroy(future_t* fut);
 
 int8_t memory_paging_add_va_for_frame_ext(memory_page_table_t* p4, uint64_t va_start, frame_t* frm, memory_paging_page_type_t type){
@@ -248,6 +256,36 @@ void lock_release(lock_t* lock){
     UNUSED(lock);
 }
 
+void lock_set_interrupt_safe(lock_t* lock){
+    UNUSED(lock);
+}
+
+rwlock_t* rwlock_create_with_heap(memory_heap_t* heap){
+    UNUSED(heap);
+    return (void*)0xdeadbeaf;
+}
+
+int8_t rwlock_destroy(rwlock_t* lock){
+    UNUSED(lock);
+    return 0;
+}
+
+void rwlock_read_acquire(rwlock_t* lock){
+    UNUSED(lock);
+}
+
+void rwlock_read_release(rwlock_t* lock){
+    UNUSED(lock);
+}
+
+void rwlock_write_acquire(rwlock_t* lock){
+    UNUSED(lock);
+}
+
+void rwlock_write_release(rwlock_t* lock){
+    UNUSED(lock);
+}
+
 future_t* future_create_with_heap_and_data(memory_heap_t* heap, lock_t* lock, void* data) {
     UNUSED(heap);
     UNUSED(lock);
@@ -12,6 +12,15 @@
 
 int32_t   main(uint32_t argc, char_t** argv);
 boolean_t test_item_key_destroyer(const void* key, const void* item);
+uint64_t  test_shrinker(void* context, uint64_t target);
+
+uint64_t test_shrinker_calls = 0;
+
+uint64_t test_shrinker(void* context, uint64_t target) {
+    (*(uint64_t*)context)++;
+
+    return target;
+}
 
 boolean_t test_item_key_destroyer(const void* key, const void* item) {
     UNUSED(key);
@@ -83,8 +92,52 @@ int32_t main(uint32_t argc, char_t** argv) {
         return -1;
     }
 
+    // cache is registered as shrinker, lru tail is evicted first
+    if(memory_shrink(1) == 0) {
+        print_error("cache is not shrinked");
+        cache_destroy(cache);
+
+        return -1;
+    }
+
+    if(strcmp("kayısı", cache_get(cache, (void*)5)) != 0) {
+        print_error("mru key 5 is evicted");
+        cache_destroy(cache);
+
+        return -1;
+    }
+
     cache_destroy(cache);
 
+    if(memory_shrinker_register("test", test_shrinker, &test_shrinker_calls) != 0) {
+        print_error("cannot register shrinker");
+
+        return -1;
+    }
+
+    memory_pressure_notify(100);
+    memory_pressure_notify(50);
+
+    uint64_t target = memory_pressure_take();
+
+    if(target != 100 || memory_pressure_take() != 0) {
+        print_error("pressure target 0x%llx is wrong", target);
+
+        return -1;
+    }
+
+    if(memory_shrink(target) != target || test_shrinker_calls != 1) {
+        print_error("shrinker is not called");
+
+        return -1;
+    }
+
+    if(memory_shrinker_unregister(test_shrinker, &test_shrinker_calls) != 0 || memory_shrink(target) != 0 || test_shrinker_calls != 1) {
+        print_error("shrinker is not unregistered");
+
+        return -1;
+    }
+
     print_success("TESTS PASSED");
 
     return 0;
@@ -0,0 +1,428 @@
+/*
+ * This work is licensed under TURNSTONE OS Public License.
+ * Please read and understand latest version of Licence.
+ */
+
+#define RAMSIZE 0x4000000
+#include "setup.h"
+#include <compression.h>
+#include <deflate.h>
+#include <zpack.h>
+#include <lz4.h>
+#include <buffer.h>
+#include <utils.h>
+#include <random.h>
+#include <quicksort.h>
+
+int32_t main(uint32_t argc, char_t** argv);
+int8_t  test_compression_roundtrip(compression_type_t type, uint8_t* data, uint64_t data_len);
+int8_t  test_compression_deflate_stream(uint8_t* data, uint64_t data_len);
+int8_t  test_compression_deflate_parallel(uint8_t* data, uint64_t data_len);
+int8_t  test_compression_levels(uint8_t* data, uint64_t data_len);
+int8_t  test_compression_lz4_bad_length(uint8_t* data, uint64_t data_len);
+
+int8_t test_compression_roundtrip(compression_type_t type, uint8_t* data, uint64_t data_len) {
+    const compression_t* compression = compression_get(type);
+
+    if(!compression) {
+        print_error("compression type %i not found", type);
+
+        return -1;
+    }
+
+    buffer_t* in = buffer_encapsulate(data, data_len);
+    buffer_t* packed = buffer_new_with_capacity(NULL, data_len + 64);
+    buffer_t* unpacked = buffer_new_with_capacity(NULL, data_len + 64);
+
+    int8_t res = -1;
+
+    if(compression->pack(in, packed) != 0) {
+        print_error("compression type %i pack failed", type);
+
+        goto exit;
+    }
+
+    buffer_seek(packed, 0, BUFFER_SEEK_DIRECTION_START);
+
+    if(compression->unpack(packed, unpacked) != 0) {
+        print_error("compression type %i unpack failed", type);
+
+        goto exit;
+    }
+
+    if(buffer_get_length(unpacked) != data_len) {
+        print_error("compression type %i length mismatch 0x%llx 0x%llx", type, buffer_get_length(unpacked), data_len);
+
+        goto exit;
+    }
+
+    if(data_len && memory_memcompare(buffer_get_view_at_position(unpacked, 0, data_len), data, data_len) != 0) {
+        print_error("compression type %i data mismatch", type);
+
+        goto exit;
+    }
+
+    printf("compression type %i in 0x%llx packed 0x%llx\n", type, data_len, buffer_get_length(packed));
+
+    res = 0;
+
+exit:
+    buffer_destroy(in);
+    buffer_destroy(packed);
+    buffer_destroy(unpacked);
+
+    return res;
+}
+
+int8_t test_compression_deflate_stream(uint8_t* data, uint64_t data_len) {
+    uint8_t window[4096];
+    uint64_t written = 0;
+    int8_t res = -1;
+    deflate_stream_status_t status = DEFLATE_STREAM_OK;
+
+    buffer_t* packed = buffer_new_with_capacity(NULL, data_len + 64);
+    buffer_t* unpacked = buffer_new_with_capacity(NULL, data_len + 64);
+    buffer_t* oneshot = buffer_new_with_capacity(NULL, data_len + 64);
+
+    deflate_stream_t* ds = deflate_deflate_stream_init();
+    deflate_stream_t* is = deflate_inflate_stream_init();
+
+    if(!ds || !is) {
+        print_error("cannot create deflate streams");
+
+        goto exit;
+    }
+
+    // odd chunk sizes and small windows force suspends in the middle of blocks and symbols
+    for(uint64_t pos = 0; pos < data_len; pos += 1000) {
+        buffer_t* chunk = buffer_encapsulate(data + pos, MIN(1000ULL, data_len - pos));
+
+        do {
+            status = deflate_deflate_stream_feed(ds, chunk, window, sizeof(window), &written);
+            buffer_append_bytes(packed, window, written);
+        } while(status == DEFLATE_STREAM_OUTPUT_FULL);
+
+        buffer_destroy(chunk);
+
+        if(status != DEFLATE_STREAM_OK) {
+            print_error("deflate stream feed failed");
+
+            goto exit;
+        }
+    }
+
+    do {
+        status = deflate_deflate_stream_finish(ds, window, sizeof(window), &written);
+        buffer_append_bytes(packed, window, written);
+    } while(status == DEFLATE_STREAM_OUTPUT_FULL);
+
+    if(status != DEFLATE_STREAM_END) {
+        print_error("deflate stream finish failed");
+
+        goto exit;
+    }
+
+    uint64_t packed_len = buffer_get_length(packed);
+    uint8_t* packed_data = buffer_get_view_at_position(packed, 0, packed_len);
+
+    status = DEFLATE_STREAM_OK;
+
+    for(uint64_t pos = 0; pos < packed_len && status != DEFLATE_STREAM_END; pos += 333) {
+        buffer_t* chunk = buffer_encapsulate(packed_data + pos, MIN(333ULL, packed_len - pos));
+
+        do {
+            status = deflate_inflate_stream_feed(is, chunk, window, 100, &written);
+            buffer_append_bytes(unpacked, window, written);
+        } while(status == DEFLATE_STREAM_OUTPUT_FULL);
+
+        buffer_destroy(chunk);
+
+        if(status == DEFLATE_STREAM_ERROR) {
+            print_error("inflate stream feed failed");
+
+            goto exit;
+        }
+    }
+
+    do {
+        status = deflate_inflate_stream_finish(is, window, 100, &written);
+        buffer_append_bytes(unpacked, window, written);
+    } while(status == DEFLATE_STREAM_OUTPUT_FULL);
+
+    if(status != DEFLATE_STREAM_END) {
+        print_error("inflate stream finish failed");
+
+        goto exit;
+    }
+
+    buffer_seek(packed, 0, BUFFER_SEEK_DIRECTION_START);
+
+    if(deflate_inflate(packed, oneshot) != 0) {
+        print_error("one shot inflate of stream failed");
+
+        goto exit;
+    }
+
+    if(buffer_get_length(unpacked) != data_len || buffer_get_length(oneshot) != data_len) {
+        print_error("deflate stream length mismatch 0x%llx 0x%llx 0x%llx", buffer_get_length(unpacked), buffer_get_length(oneshot), data_len);
+
+        goto exit;
+    }
+
+    if(data_len && (memory_memcompare(buffer_get_view_at_position(unpacked, 0, data_len), data, data_len) != 0 ||
+                    memory_memcompare(buffer_get_view_at_position(oneshot, 0, data_len), data, data_len) != 0)) {
+        print_error("deflate stream data mismatch");
+
+        goto exit;
+    }
+
+    printf("deflate stream in 0x%llx packed 0x%llx\n", data_len, packed_len);
+
+    res = 0;
+
+exit:
+    deflate_stream_destroy(ds);
+    deflate_stream_destroy(is);
+    buffer_destroy(packed);
+    buffer_destroy(unpacked);
+    buffer_destroy(oneshot);
+
+    return res;
+}
+
+int8_t test_compression_deflate_parallel(uint8_t* data, uint64_t data_len) {
+    buffer_t* in = buffer_encapsulate(data, data_len);
+    buffer_t* packed = buffer_new_with_capacity(NULL, data_len + 64);
+    buffer_t* unpacked = buffer_new_with_capacity(NULL, data_len + 64);
+
+    int8_t res = -1;
+
+    if(deflate_deflate_parallel(in, packed, 4, DEFLATE_LEVEL_DEFAULT) != 0) {
+        print_error("parallel deflate failed");
+
+        goto exit;
+    }
+
+    buffer_seek(packed, 0, BUFFER_SEEK_DIRECTION_START);
+
+    if(deflate_inflate(packed, unpacked) != 0) {
+        print_error("inflate of parallel deflate failed");
+
+        goto exit;
+    }
+
+    if(buffer_get_length(unpacked) != data_len ||
+       memory_memcompare(buffer_get_view_at_position(unpacked, 0, data_len), data, data_len) != 0) {
+        print_error("parallel deflate data mismatch");
+
+        goto exit;
+    }
+
+    printf("deflate parallel in 0x%llx packed 0x%llx\n", data_len, buffer_get_length(packed));
+
+    res = 0;
+
+exit:
+    buffer_destroy(in);
+    buffer_destroy(packed);
+    buffer_destroy(unpacked);
+
+    return res;
+}
+
+int8_t test_compression_levels(uint8_t* data, uint64_t data_len) {
+    int8_t res = 0;
+
+    for(uint8_t level = DEFLATE_LEVEL_STORE; level <= DEFLATE_LEVEL_MAX + ZPACK_LEVEL_MAX && res == 0; level++) {
+        boolean_t is_zpack = level > DEFLATE_LEVEL_MAX;
+        uint8_t algo_level = is_zpack ? level - DEFLATE_LEVEL_MAX : level;
+
+        buffer_t* in = buffer_encapsulate(data, data_len);
+        buffer_t* packed = buffer_new_with_capacity(NULL, data_len + 64);
+        buffer_t* unpacked = buffer_new_with_capacity(NULL, data_len + 64);
+
+        res = -1;
+
+        if((is_zpack ? zpack_pack_with_level(in, packed, algo_level) : deflate_deflate_with_level(in, packed, algo_level)) != 0) {
+            print_error("%s level %i pack failed", is_zpack ? "zpack" : "deflate", algo_level);
+
+            goto next;
+        }
+
+        buffer_seek(packed, 0, BUFFER_SEEK_DIRECTION_START);
+
+        if((is_zpack ? zpack_unpack(packed, unpacked) : deflate_inflate(packed, unpacked)) != 0) {
+            print_error("%s level %i unpack failed", is_zpack ? "zpack" : "deflate", algo_level);
+
+            goto next;
+        }
+
+        if(buffer_get_length(unpacked) != data_len ||
+           memory_memcompare(buffer_get_view_at_position(unpacked, 0, data_len), data, data_len) != 0) {
+            print_error("%s level %i data mismatch", is_zpack ? "zpack" : "deflate", algo_level);
+
+            goto next;
+        }
+
+        printf("%s level %i in 0x%llx packed 0x%llx\n", is_zpack ? "zpack" : "deflate", algo_level, data_len, buffer_get_length(packed));
+
+        res = 0;
+
+next:
+        buffer_destroy(in);
+        buffer_destroy(packed);
+        buffer_destroy(unpacked);
+    }
+
+    return res;
+}
+
+int8_t test_compression_lz4_bad_length(uint8_t* data, uint64_t data_len) {
+    buffer_t* in = buffer_encapsulate(data, data_len);
+    buffer_t* packed = buffer_new_with_capacity(NULL, data_len + 64);
+    buffer_t* unpacked = buffer_new_with_capacity(NULL, data_len + 64);
+
+    int8_t res = -1;
+
+    if(lz4_pack(in, packed) != 0) {
+        print_error("lz4 pack failed");
+
+        goto exit;
+    }
+
+    uint64_t packed_len = buffer_get_length(packed);
+    uint8_t* header = buffer_get_view_at_position(packed, 0, packed_len);
+
+    // lengths which overflow reserve or cannot be produced by input
+    const uint64_t bad_lengths[] = {-1ULL, -8ULL, packed_len * 256};
+
+    for(uint64_t i = 0; i < ARRAY_SIZE(bad_lengths); i++) {
+        memory_memcopy(&bad_lengths[i], header, sizeof(uint64_t));
+
+        buffer_seek(packed, 0, BUFFER_SEEK_DIRECTION_START);
+
+        if(lz4_unpack(packed, unpacked) == 0) {
+            print_error("lz4 unpack accepted output length 0x%llx", bad_lengths[i]);
+
+            goto exit;
+        }
+    }
+
+    res = 0;
+
+exit:
+    buffer_destroy(in);
+    buffer_destroy(packed);
+    buffer_destroy(unpacked);
+
+    return res;
+}
+
+int32_t main(uint32_t argc, char_t** argv) {
+    UNUSED(argc);
+    UNUSED(argv);
+
+    const char_t* words[] = {"turnstone ", "os ", "tosdb ", "compression ", "deflate ", "lz4 ", "zpack ", "\n"};
+
+    uint64_t text_len = 200000;
+    uint8_t* text = memory_malloc(text_len);
+    uint64_t text_pos = 0;
+
+    while(text_pos < text_len) {
+        const char_t* word = words[rand() % ARRAY_SIZE(words)];
+
+        while(*word && text_pos < text_len) {
+            text[text_pos++] = *word++;
+        }
+    }
+
+    uint64_t random_len = 70000;
+    uint8_t* random_data = memory_malloc(random_len);
+
+    for(uint64_t i = 0; i < random_len; i++) {
+        random_data[i] = rand();
+    }
+
+    uint64_t runs_len = 100000;
+    uint8_t* runs = memory_malloc(runs_len);
+
+    for(uint64_t i = 0; i < runs_len; i++) {
+        runs[i] = (i / 1000) % 3;
+    }
+
+    int8_t res = 0;
+
+    for(compression_type_t type = COMPRESSION_TYPE_NONE; type < COMPRESSION_MAX; type++) {
+        if(type == COMPRESSION_TYPE_LZ4) {
+            for(uint64_t len = 0; len < 40 && res == 0; len++) {
+                res = test_compression_roundtrip(type, text, len);
+            }
+        }
+
+        if(res == 0) {
+            res = test_compression_roundtrip(type, text, text_len);
+        }
+
+        if(res == 0) {
+            res = test_compression_roundtrip(type, random_data, random_len);
+        }
+
+        if(res == 0) {
+            res = test_compression_roundtrip(type, runs, runs_len);
+        }
+
+        if(res != 0) {
+            break;
+        }
+    }
+
+    if(res == 0) {
+        res = test_compression_deflate_stream(text, 0);
+    }
+
+    if(res == 0) {
+        res = test_compression_deflate_stream(text, text_len);
+    }
+
+    if(res == 0) {
+        res = test_compression_deflate_stream(random_data, random_len);
+    }
+
+    if(res == 0) {
+        res = test_compression_deflate_stream(runs, runs_len);
+    }
+
+    if(res == 0) {
+        res = test_compression_levels(text, text_len);
+    }
+
+    if(res == 0) {
+        res = test_compression_lz4_bad_length(text, 4096);
+    }
+
+    if(res == 0) {
+        // chunks of several block sizes are needed for more than one parallel job
+        uint64_t mixed_len = text_len + random_len + runs_len;
+        uint8_t* mixed = memory_malloc(mixed_len);
+
+        memory_memcopy(text, mixed, text_len);
+        memory_memcopy(random_data, mixed + text_len, random_len);
+        memory_memcopy(runs, mixed + text_len + random_len, runs_len);
+
+        res = test_compression_deflate_parallel(mixed, mixed_len);
+
+        memory_free(mixed);
+    }
+
+    memory_free(text);
+    memory_free(random_data);
+    memory_free(runs);
+
+    if(res == 0) {
+        print_success("TESTS PASSED");
+    } else {
+        print_error("TESTS FAILED");
+    }
+
+    return res;
+}
@@ -18,6 +18,7 @@
 #include <math.h>
 #include <compression.h>
 #include <zpack.h>
+#include <lz4.h>
 #include <deflate.h>
 #include <binarysearch.h>
 #include <tokenizer.h>
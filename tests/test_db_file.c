@@ -27,6 +27,7 @@
 #include <compression.h>
 #include <deflate.h>
 #include <zpack.h>
+#include <lz4.h>
 #include <binarysearch.h>
 #include <tokenizer.h>
 #include <set.h>
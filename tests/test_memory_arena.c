@@ -0,0 +1,169 @@
+/*
+ * This work is licensed under TURNSTONE OS Public License.
+ * Please read and understand latest version of Licence.
+ */
+
+#define RAMSIZE 0x1000000
+#include "setup.h"
+#include <list.h>
+#include <hashmap.h>
+
+int32_t main(uint32_t argc, char_t** argv);
+
+int32_t main(uint32_t argc, char_t** argv) {
+    UNUSED(argc);
+    UNUSED(argv);
+
+    int8_t res = -1;
+
+    memory_heap_stat_t stat;
+    memory_get_heap_stat(&stat);
+
+    uint64_t malloc_count = stat.malloc_count;
+    uint64_t free_count = stat.free_count;
+
+    memory_heap_t* arena = memory_create_heap_arena(NULL, 4096);
+
+    if(!arena) {
+        print_error("cannot create arena");
+
+        return -1;
+    }
+
+    uint8_t* prev = NULL;
+
+    for(uint64_t i = 0; i < 1000; i++) {
+        uint8_t* data = memory_malloc_ext(arena, 24, 0);
+
+        if(!data || ((uint64_t)data % 16)) {
+            print_error("bad arena malloc %p", data);
+
+            goto exit;
+        }
+
+        for(uint64_t j = 0; j < 24; j++) {
+            if(data[j]) {
+                print_error("arena malloc is not zeroed");
+
+                goto exit;
+            }
+        }
+
+        memory_memset(data, 0xAA, 24);
+
+        if(prev && prev == data) {
+            print_error("arena reuses address");
+
+            goto exit;
+        }
+
+        prev = data;
+    }
+
+    uint8_t* aligned = memory_malloc_ext(arena, 100, 0x200);
+    uint8_t* large = memory_malloc_ext(arena, 3 * 4096, 0);
+    uint8_t* after_large = memory_malloc_ext(arena, 24, 0);
+
+    if(!aligned || ((uint64_t)aligned % 0x200) || !large || !after_large) {
+        print_error("aligned or large arena malloc failed");
+
+        goto exit;
+    }
+
+    memory_memset(large, 0xBB, 3 * 4096);
+
+    // large request has own chunk, so next small one continues at current chunk
+    if(after_large < aligned || after_large >= aligned + 4096) {
+        print_error("current chunk is not kept after large malloc");
+
+        goto exit;
+    }
+
+    uint8_t* foreign = memory_malloc(24);
+    uint64_t foreign_address = (uint64_t)foreign;
+
+    if(memory_free_ext(arena, large) != 0 || memory_free_ext(arena, (void*)foreign_address) == 0) {
+        memory_free(foreign);
+        print_error("arena free ownership check failed");
+
+        goto exit;
+    }
+
+    memory_free(foreign);
+
+    // containers accept arena like any heap and are not destroyed one by one
+    list_t* list = list_create_list_with_heap(arena);
+    hashmap_t* hm = hashmap_integer_with_heap(arena, 16);
+
+    if(!list || !hm) {
+        print_error("cannot create containers at arena");
+
+        goto exit;
+    }
+
+    for(uint64_t i = 0; i < 100; i++) {
+        list_list_insert(list, (void*)i);
+        hashmap_put(hm, (void*)i, (void*)(i + 1));
+    }
+
+    if(list_size(list) != 100 || hashmap_get(hm, (void*)42) != (void*)43) {
+        print_error("containers at arena failed");
+
+        goto exit;
+    }
+
+    memory_get_heap_stat_ext(arena, &stat);
+
+    if(stat.malloc_count == 0 || stat.total_size < stat.free_size) {
+        print_error("arena stats are wrong");
+
+        goto exit;
+    }
+
+    if(memory_heap_arena_reset(arena) != 0) {
+        print_error("cannot reset arena");
+
+        goto exit;
+    }
+
+    memory_get_heap_stat_ext(arena, &stat);
+
+    if(stat.malloc_count != stat.free_count || stat.header_count != 1 || stat.total_size != stat.free_size) {
+        print_error("arena is not empty after reset");
+
+        goto exit;
+    }
+
+    uint8_t* reused = memory_malloc_ext(arena, 24, 0);
+
+    if(!reused || reused[0] || reused[23]) {
+        print_error("arena is not reused after reset");
+
+        goto exit;
+    }
+
+    res = 0;
+
+exit:
+    if(memory_destroy_heap_arena(arena) != 0) {
+        print_error("cannot destroy arena");
+
+        res = -1;
+    }
+
+    memory_get_heap_stat(&stat);
+
+    if(res == 0 && (stat.malloc_count - malloc_count != stat.free_count - free_count)) {
+        print_error("arena leaks at parent heap");
+
+        res = -1;
+    }
+
+    if(res == 0) {
+        print_success("TESTS PASSED");
+    } else {
+        print_error("TESTS FAILED");
+    }
+
+    return res;
+}
@@ -0,0 +1,196 @@
+/*
+ * This work is licensed under TURNSTONE OS Public License.
+ * Please read and understand latest version of Licence.
+ */
+
+#define RAMSIZE 0x1000000
+#include "setup.h"
+#include <list.h>
+
+typedef uint32_t (*memory_cache_cpu_id_getter_f)(void);
+void memory_set_cpu_id_getter(memory_cache_cpu_id_getter_f getter);
+
+typedef struct test_memory_cache_object_t {
+    uint64_t id;
+    uint64_t magic;
+    uint8_t  payload[40];
+} test_memory_cache_object_t;
+
+uint32_t test_memory_cache_get_cpu_id(void);
+void     test_memory_cache_ctor(void* object);
+int8_t   test_memory_cache_alloc_free(memory_cache_t* cache, uint64_t count);
+int32_t  main(uint32_t argc, char_t** argv);
+
+uint32_t test_memory_cache_get_cpu_id(void) {
+    return 0;
+}
+
+void test_memory_cache_ctor(void* object) {
+    ((test_memory_cache_object_t*)object)->magic = 0x1234;
+}
+
+int8_t test_memory_cache_alloc_free(memory_cache_t* cache, uint64_t count) {
+    test_memory_cache_object_t** objects = memory_malloc(sizeof(test_memory_cache_object_t*) * count);
+
+    if(!objects) {
+        return -1;
+    }
+
+    int8_t res = -1;
+
+    for(uint64_t i = 0; i < count; i++) {
+        objects[i] = memory_cache_alloc(cache);
+
+        if(!objects[i]) {
+            print_error("cannot alloc object %lli", i);
+
+            goto exit;
+        }
+
+        if(((uint64_t)objects[i]) % 16) {
+            print_error("object %lli is not aligned %p", i, objects[i]);
+
+            goto exit;
+        }
+
+        if(objects[i]->id != 0 || objects[i]->magic != 0x1234) {
+            print_error("object %lli is not cleaned or constructed", i);
+
+            goto exit;
+        }
+
+        objects[i]->id = i + 1;
+        memory_memset(objects[i]->payload, 0xAA, sizeof(objects[i]->payload));
+    }
+
+    for(uint64_t i = 0; i < count; i++) {
+        if(objects[i]->id != i + 1) {
+            print_error("object %lli is overwritten", i);
+
+            goto exit;
+        }
+    }
+
+    res = 0;
+
+exit:
+    for(uint64_t i = 0; i < count; i++) {
+        if(objects[i] && memory_cache_free(cache, objects[i]) != 0) {
+            print_error("cannot free object %lli", i);
+
+            res = -1;
+        }
+    }
+
+    memory_free(objects);
+
+    return res;
+}
+
+int32_t main(uint32_t argc, char_t** argv) {
+    UNUSED(argc);
+    UNUSED(argv);
+
+    int8_t res = -1;
+
+    // log buffer is created by first error log, create it before counting
+    buffer_get_io_buffer(0);
+
+    memory_heap_stat_t stat;
+    memory_get_heap_stat(&stat);
+
+    uint64_t malloc_count = stat.malloc_count;
+    uint64_t free_count = stat.free_count;
+
+    memory_cache_t* cache = memory_cache_create("test objects", sizeof(test_memory_cache_object_t), 16, test_memory_cache_ctor);
+
+    if(!cache) {
+        print_error("cannot create cache");
+
+        return -1;
+    }
+
+    // without cpu ids every call goes to slabs, enough objects for several slabs
+    if(test_memory_cache_alloc_free(cache, 1000) != 0) {
+        goto exit;
+    }
+
+    // with cpu ids objects move through cpu free lists in batches
+    memory_set_cpu_id_getter(test_memory_cache_get_cpu_id);
+
+    if(test_memory_cache_alloc_free(cache, 1000) != 0) {
+        goto exit;
+    }
+
+    void* obj = memory_cache_alloc(cache);
+
+    memory_get_heap_stat(&stat);
+
+    if(stat.malloc_count - malloc_count != stat.free_count - free_count + 1) {
+        print_error("stats does not count live object");
+
+        goto exit;
+    }
+
+    if(memory_cache_destroy(cache) == 0) {
+        print_error("cache with live object is destroyed");
+
+        goto exit;
+    }
+
+    void* heap_obj = memory_malloc(sizeof(test_memory_cache_object_t));
+
+    if(memory_cache_free(cache, heap_obj) == 0 || memory_cache_free(cache, (uint8_t*)obj + 8) == 0) {
+        print_error("foreign object is accepted");
+
+        goto exit;
+    }
+
+    memory_free(heap_obj);
+    memory_cache_free(cache, obj);
+
+    // list items at default heap come from list item cache
+    list_t* list = list_create_list();
+
+    for(uint64_t i = 0; i < 100; i++) {
+        list_queue_push(list, (void*)(i + 1));
+    }
+
+    for(uint64_t i = 0; i < 100; i++) {
+        if(list_get_data_at_position(list, i) != (void*)(i + 1)) {
+            print_error("list data mismatch at %lli", i);
+
+            goto exit;
+        }
+    }
+
+    list_destroy(list);
+
+    res = 0;
+
+exit:
+    memory_set_cpu_id_getter(NULL);
+
+    if(memory_cache_destroy(cache) != 0) {
+        print_error("cannot destroy cache");
+
+        res = -1;
+    }
+
+    memory_get_heap_stat(&stat);
+
+    // list item cache lives on, but its slabs and metadata are hidden
+    if(res == 0 && (stat.malloc_count - malloc_count != stat.free_count - free_count)) {
+        print_error("stats mismatch mc 0x%llx fc 0x%llx", stat.malloc_count - malloc_count, stat.free_count - free_count);
+
+        res = -1;
+    }
+
+    if(res == 0) {
+        print_success("TESTS PASSED");
+    } else {
+        print_error("TESTS FAILED");
+    }
+
+    return res;
+}
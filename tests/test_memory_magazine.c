@@ -0,0 +1,147 @@
+/*
+ * This work is licensed under TURNSTONE OS Public License.
+ * Please read and understand latest version of Licence.
+ */
+
+#define RAMSIZE 0x1000000
+#include "setup.h"
+
+typedef uint32_t (*memory_cpu_id_getter_f)(void);
+void memory_set_cpu_id_getter(memory_cpu_id_getter_f getter);
+
+uint32_t test_memory_magazine_cpu_id = 0;
+
+uint32_t test_memory_magazine_get_cpu_id(void);
+int32_t  main(uint32_t argc, char_t** argv);
+
+uint32_t test_memory_magazine_get_cpu_id(void) {
+    return test_memory_magazine_cpu_id;
+}
+
+int32_t main(uint32_t argc, char_t** argv) {
+    UNUSED(argc);
+    UNUSED(argv);
+
+    int32_t res = -1;
+
+    if(memory_heap_hash_enable_magazines(memory_get_default_heap()) != 0) {
+        print_error("cannot enable magazines");
+
+        return -1;
+    }
+
+    memory_set_cpu_id_getter(test_memory_magazine_get_cpu_id);
+
+    uint8_t* items[100] = {0};
+
+    // first malloc refills magazine, later ones are served from it
+    for(uint64_t i = 0; i < ARRAY_SIZE(items); i++) {
+        items[i] = memory_malloc(40);
+
+        if(!items[i]) {
+            print_error("cannot malloc item %lli", i);
+
+            goto exit;
+        }
+
+        memory_memset(items[i], 0xAA, 40);
+    }
+
+    uint64_t last = (uint64_t)items[ARRAY_SIZE(items) - 1];
+
+    // frees fill magazine and flush half of it to pools when it is full
+    for(uint64_t i = 0; i < ARRAY_SIZE(items); i++) {
+        if(memory_free(items[i]) != 0) {
+            print_error("cannot free item %lli", i);
+
+            goto exit;
+        }
+
+        items[i] = NULL;
+    }
+
+    if(memory_free((void*)last) == 0) {
+        print_error("double free of cached block is not detected");
+
+        goto exit;
+    }
+
+    // double free warning creates log buffer, so counting starts here
+    memory_heap_stat_t stat;
+    memory_get_heap_stat(&stat);
+
+    uint64_t malloc_count = stat.malloc_count;
+    uint64_t free_count = stat.free_count;
+
+    uint8_t* again = memory_malloc(40);
+
+    if((uint64_t)again != last) {
+        print_error("last freed block is not reused %p 0x%llx", again, last);
+
+        goto exit;
+    }
+
+    for(uint64_t i = 0; i < 40; i++) {
+        if(again[i]) {
+            print_error("reused block is not cleaned");
+
+            goto exit;
+        }
+    }
+
+    // block freed at another cpu goes to that cpu's magazine, first malloc creates its cache
+    test_memory_magazine_cpu_id = 1;
+
+    uint8_t* warm = memory_malloc(40);
+    uint64_t again_address = (uint64_t)again;
+
+    memory_free(again);
+
+    uint8_t* other = memory_malloc(40);
+
+    memory_free(warm);
+
+    test_memory_magazine_cpu_id = 0;
+
+    if((uint64_t)other != again_address) {
+        print_error("block is not reused at other cpu");
+
+        goto exit;
+    }
+
+    memory_free(other);
+
+    // aligned and large requests bypass magazines
+    uint8_t* aligned = memory_malloc_aligned(40, 0x100);
+    uint8_t* large = memory_malloc(4096);
+
+    if(!aligned || ((uint64_t)aligned % 0x100) || !large) {
+        print_error("bypassing requests failed");
+
+        goto exit;
+    }
+
+    memory_free(aligned);
+    memory_free(large);
+
+    memory_get_heap_stat(&stat);
+
+    if(stat.malloc_count - malloc_count != 5 || stat.free_count - free_count != 5) {
+        print_error("stats mismatch mc 0x%llx fc 0x%llx", stat.malloc_count - malloc_count, stat.free_count - free_count);
+
+        goto exit;
+    }
+
+    res = 0;
+
+exit:
+    memory_set_cpu_id_getter(NULL);
+
+    if(res == 0) {
+        print_success("TESTS PASSED");
+    } else {
+        print_error("TESTS FAILED");
+    }
+
+    return res;
+}
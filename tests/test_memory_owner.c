@@ -0,0 +1,133 @@
+/*
+ * This work is licensed under TURNSTONE OS Public License.
+ * Please read and understand latest version of Licence.
+ */
+
+#define RAMSIZE 0x1000000
+#include "setup.h"
+
+#define TEST_MEMORY_OWNER_HEAP_SIZE (256 << 10)
+
+int32_t main(uint32_t argc, char_t** argv);
+
+int32_t main(uint32_t argc, char_t** argv) {
+    UNUSED(argc);
+    UNUSED(argv);
+
+    int8_t res = -1;
+
+    // log buffer is created by first error log, create it before counting
+    buffer_get_io_buffer(0);
+
+    memory_heap_stat_t stat;
+    memory_get_heap_stat(&stat);
+
+    uint64_t malloc_count = stat.malloc_count;
+    uint64_t free_count = stat.free_count;
+
+    uint64_t area_a = (uint64_t)memory_malloc_aligned(TEST_MEMORY_OWNER_HEAP_SIZE, 0x1000);
+    uint64_t area_b = (uint64_t)memory_malloc_aligned(TEST_MEMORY_OWNER_HEAP_SIZE, 0x1000);
+
+    if(!area_a || !area_b) {
+        print_error("cannot allocate heap areas");
+
+        return -1;
+    }
+
+    memory_heap_t* heap_a = memory_create_heap_simple(area_a, area_a + TEST_MEMORY_OWNER_HEAP_SIZE);
+    memory_heap_t* heap_b = memory_create_heap_simple(area_b, area_b + TEST_MEMORY_OWNER_HEAP_SIZE);
+
+    if(!heap_a || !heap_b) {
+        print_error("cannot create heaps");
+
+        goto exit;
+    }
+
+    if(memory_heap_find_owner((void*)area_a) != NULL) {
+        print_error("unregistered range has owner");
+
+        goto exit;
+    }
+
+    if(memory_heap_register_range(heap_a, area_a, area_a + TEST_MEMORY_OWNER_HEAP_SIZE) != 0 ||
+       memory_heap_register_range(heap_b, area_b, area_b + TEST_MEMORY_OWNER_HEAP_SIZE) != 0) {
+        print_error("cannot register heap ranges");
+
+        goto exit;
+    }
+
+    if(memory_heap_find_owner((void*)area_a) != heap_a ||
+       memory_heap_find_owner((void*)(area_a + TEST_MEMORY_OWNER_HEAP_SIZE - 1)) != heap_a ||
+       memory_heap_find_owner((void*)area_b) != heap_b ||
+       memory_heap_find_owner((void*)(area_b + TEST_MEMORY_OWNER_HEAP_SIZE)) == heap_b) {
+        print_error("owner lookup failed");
+
+        goto exit;
+    }
+
+    uint64_t data_a = (uint64_t)memory_malloc_ext(heap_a, 100, 0);
+    uint64_t data_b = (uint64_t)memory_malloc_ext(heap_b, 100, 0);
+
+    if(!data_a || !data_b) {
+        print_error("cannot malloc at heaps");
+
+        goto exit;
+    }
+
+    // frees without heap go to owners instead of default heap
+    if(memory_free((void*)data_a) != 0 || memory_free((void*)data_b) != 0) {
+        print_error("cannot free at owner heaps");
+
+        goto exit;
+    }
+
+    memory_get_heap_stat_ext(heap_a, &stat);
+
+    if(stat.malloc_count != stat.free_count) {
+        print_error("heap a free count mismatch");
+
+        goto exit;
+    }
+
+    memory_get_heap_stat_ext(heap_b, &stat);
+
+    if(stat.malloc_count != stat.free_count) {
+        print_error("heap b free count mismatch");
+
+        goto exit;
+    }
+
+    if(memory_heap_unregister_range(heap_a, area_a, area_a + TEST_MEMORY_OWNER_HEAP_SIZE) != 0 ||
+       memory_heap_find_owner((void*)area_a) != NULL ||
+       memory_heap_find_owner((void*)area_b) != heap_b) {
+        print_error("unregister failed");
+
+        goto exit;
+    }
+
+    res = 0;
+
+exit:
+    memory_heap_unregister_range(heap_a, area_a, area_a + TEST_MEMORY_OWNER_HEAP_SIZE);
+    memory_heap_unregister_range(heap_b, area_b, area_b + TEST_MEMORY_OWNER_HEAP_SIZE);
+
+    memory_free((void*)area_a);
+    memory_free((void*)area_b);
+
+    memory_get_heap_stat(&stat);
+
+    // ownership map tables live on, but they are hidden
+    if(res == 0 && (stat.malloc_count - malloc_count != stat.free_count - free_count)) {
+        print_error("stats mismatch mc 0x%llx fc 0x%llx", stat.malloc_count - malloc_count, stat.free_count - free_count);
+
+        res = -1;
+    }
+
+    if(res == 0) {
+        print_success("TESTS PASSED");
+    } else {
+        print_error("TESTS FAILED");
+    }
+
+    return res;
+}
@@ -0,0 +1,110 @@
+/*
+ * This work is licensed under TURNSTONE OS Public License.
+ * Please read and understand latest version of Licence.
+ */
+
+#define RAMSIZE 0x1000000
+#include "setup.h"
+
+#define TEST_MEMORY_PROFILER_INTERVAL   1024
+#define TEST_MEMORY_PROFILER_ALLOC_SIZE 64
+#define TEST_MEMORY_PROFILER_ALLOC_COUNT 100
+
+int32_t main(uint32_t argc, char_t** argv);
+
+static uint64_t test_memory_profiler_record_count = 0;
+static uint64_t test_memory_profiler_record_weight = 0;
+static uint64_t test_memory_profiler_forget_count = 0;
+static const void* test_memory_profiler_last_address = NULL;
+
+static void test_memory_profiler_record(const void* address, size_t size, uint64_t weight) {
+    UNUSED(size);
+
+    test_memory_profiler_record_count++;
+    test_memory_profiler_record_weight += weight;
+    test_memory_profiler_last_address = address;
+}
+
+static void test_memory_profiler_forget(const void* address) {
+    if(address == test_memory_profiler_last_address) {
+        test_memory_profiler_forget_count++;
+    }
+}
+
+int32_t main(uint32_t argc, char_t** argv) {
+    UNUSED(argc);
+    UNUSED(argv);
+
+    int8_t res = -1;
+
+    void* data[TEST_MEMORY_PROFILER_ALLOC_COUNT] = {0};
+
+    memory_set_profiler(TEST_MEMORY_PROFILER_INTERVAL, test_memory_profiler_record, test_memory_profiler_forget);
+
+    for(uint64_t i = 0; i < TEST_MEMORY_PROFILER_ALLOC_COUNT; i++) {
+        data[i] = memory_malloc(TEST_MEMORY_PROFILER_ALLOC_SIZE);
+    }
+
+    // every interval bytes one sample is taken and it stands for interval bytes
+    uint64_t total = TEST_MEMORY_PROFILER_ALLOC_SIZE * TEST_MEMORY_PROFILER_ALLOC_COUNT;
+
+    if(test_memory_profiler_record_count != total / TEST_MEMORY_PROFILER_INTERVAL) {
+        print_error("sample count mismatch");
+
+        goto exit;
+    }
+
+    if(test_memory_profiler_record_weight != test_memory_profiler_record_count * TEST_MEMORY_PROFILER_INTERVAL) {
+        print_error("sample weight mismatch");
+
+        goto exit;
+    }
+
+    // an allocation larger than interval is always sampled with weight of crossed intervals
+    void* large = memory_malloc(TEST_MEMORY_PROFILER_INTERVAL * 3);
+
+    if(test_memory_profiler_last_address != large ||
+       test_memory_profiler_record_weight < (test_memory_profiler_record_count - 1 + 3) * TEST_MEMORY_PROFILER_INTERVAL) {
+        print_error("large allocation is not sampled");
+
+        goto exit;
+    }
+
+    memory_free(large);
+
+    if(test_memory_profiler_forget_count != 1) {
+        print_error("free of sampled address is not reported");
+
+        goto exit;
+    }
+
+    uint64_t record_count = test_memory_profiler_record_count;
+
+    memory_set_profiler(0, NULL, NULL);
+
+    large = memory_malloc(TEST_MEMORY_PROFILER_INTERVAL * 3);
+    memory_free(large);
+
+    if(test_memory_profiler_record_count != record_count || test_memory_profiler_forget_count != 1) {
+        print_error("disabled profiler is called");
+
+        goto exit;
+    }
+
+    res = 0;
+
+exit:
+    memory_set_profiler(0, NULL, NULL);
+
+    for(uint64_t i = 0; i < TEST_MEMORY_PROFILER_ALLOC_COUNT; i++) {
+        memory_free(data[i]);
+    }
+
+    if(res == 0) {
+        print_success("TESTS PASSED");
+    } else {
+        print_error("TESTS FAILED");
+    }
+
+    return res;
+}
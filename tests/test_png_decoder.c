@@ -10,6 +10,7 @@
 #include <crc.h>
 #include <compression.h>
 #include <zpack.h>
+#include <lz4.h>
 #include <deflate.h>
 #include <quicksort.h>
 #include <graphics/png.h>
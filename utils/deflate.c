@@ -12,6 +12,7 @@
 #include <compression.h>
 #include <deflate.h>
 #include <zpack.h>
+#include <lz4.h>
 #include <buffer.h>
 #include <utils.h>
 #include <strings.h>
@@ -24,7 +25,7 @@ int32_t main(int32_t argc, char_t** argv) {
     argv++;
 
     if (argc < 3) {
-        printf("Usage: deflate <c|d> <input file> <output file>\n");
+        printf("Usage: deflate <c|d> <input file> <output file> [level]\n");
         return 1;
     }
 
@@ -32,6 +33,7 @@ int32_t main(int32_t argc, char_t** argv) {
 
     char_t* input = argv[1];
     char_t* output = argv[2];
+    uint8_t level = argc > 3 ? atoi(argv[3]) : DEFLATE_LEVEL_DEFAULT;
 
     FILE* in = fopen(input, "rb");
 
@@ -61,7 +63,7 @@ int32_t main(int32_t argc, char_t** argv) {
     const compression_t* compression = compression_get(COMPRESSION_TYPE_DEFLATE);
 
     if(compress) {
-        ret = compression->pack(in_buf, out_buf);
+        ret = deflate_deflate_with_level(in_buf, out_buf, level);
     } else {
         ret = compression->unpack(in_buf, out_buf);
     }
@@ -27,6 +27,7 @@
 #include <binarysearch.h>
 #include <bplustree.h>
 #include <zpack.h>
+#include <lz4.h>
 #include <math.h>
 #include <deflate.h>
 #include <quicksort.h>